@@ -0,0 +1,341 @@
+// Times each DSP stage of the capture path once per frame (20 ms, or --frame-ms) and reports
+// the latency distribution against the real-time budget. Single-threaded: frames/s is per core.
+// The aec stage is followed by an echo check at every frame size, which fails the run when the
+// canceller's ERLE drops below kMinErleDb.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aec.h"
+#include "audio_format.h"
+#include "crosstalk.h"
+#include "drift.h"
+#include "dsp_kernels.h"
+#include "flac_encoder.h"
+#include "levels.h"
+#include "log_mel.h"
+#include "opus_codec.h"
+#include "protocol.h"
+#include "resampler.h"
+#include "spsc_ring.h"
+#include "vad.h"
+
+namespace {
+using engine::kSampleRate;
+
+constexpr double kTwoPi = 6.283185307179586476925286766559;
+constexpr int kOutRate = 16000;  // the ASR rate the backend asks for
+constexpr int kEchoTailMs = 200;
+constexpr size_t kWarmupFrames = 50;
+constexpr size_t kDefaultFrames = 3000;  // timed frames per stage; one minute at 20 ms
+constexpr size_t kSignalFrames = 500;    // frames of source material, cycled
+// Echo check: far-end speech through a sparse room response, cancelled at every frame size.
+constexpr int kEchoCheckSeconds = 30;
+constexpr int kEchoDelayMs = 30;
+constexpr int kEchoDecayMs = 40;
+constexpr int kEchoSpreadMs = 150;
+constexpr size_t kEchoTaps = 400;
+constexpr double kMinErleDb = 10.0;
+
+// Speech-like test material: a gliding voiced harmonic series, syllable-rate amplitude
+// modulation and a noise floor, so the VAD, Rice coder and AEC see realistic statistics.
+std::vector<int16_t> make_signal(size_t samples, int rate, uint32_t seed, double pitch_hz) {
+    std::vector<int16_t> out(samples);
+    uint32_t lcg = seed;
+    double phase = 0.0;
+    for (size_t i = 0; i < samples; ++i) {
+        double t = static_cast<double>(i) / rate;
+        double f0 = pitch_hz * (1.0 + 0.1 * std::sin(kTwoPi * 0.5 * t));
+        phase += kTwoPi * f0 / rate;
+        double voiced = 0.0;
+        for (int h = 1; h <= 8; ++h) {
+            voiced += std::sin(phase * h) / h;
+        }
+        double envelope = 0.5 + 0.5 * std::sin(kTwoPi * 4.0 * t);
+        lcg = lcg * 1664525u + 1013904223u;
+        double noise = (static_cast<double>(lcg >> 8) / 16777216.0 - 0.5) * 0.02;
+        out[i] = static_cast<int16_t>(std::clamp((voiced * envelope * 0.3 + noise) * 32767.0, -32768.0, 32767.0));
+    }
+    return out;
+}
+
+// Unvoiced far-end talk for the echo check: noise through a formant-like resonance under a
+// syllable-rate envelope, broadband enough to exercise every AEC bin.
+std::vector<int16_t> make_far_talk(size_t samples, int rate, uint32_t seed) {
+    std::vector<int16_t> out(samples);
+    uint32_t lcg = seed;
+    double y1 = 0.0;
+    double y2 = 0.0;
+    for (size_t i = 0; i < samples; ++i) {
+        lcg = lcg * 1664525u + 1013904223u;
+        const double noise = static_cast<double>(lcg >> 8) / 16777216.0 - 0.5;
+        const double y = noise + 1.6 * y1 - 0.8 * y2;
+        y2 = y1;
+        y1 = y;
+        const double t = static_cast<double>(i) / rate;
+        const double envelope = std::max(0.2, std::sin(kTwoPi * 1.7 * t));
+        out[i] = static_cast<int16_t>(std::clamp(y * envelope * 2000.0, -32768.0, 32767.0));
+    }
+    return out;
+}
+
+struct Stage {
+    std::string name;
+    // Runs the stage on frame index i of the cycled source material.
+    std::function<void(size_t i)> run;
+};
+
+struct Result {
+    double p50 = 0;
+    double p99 = 0;
+    double max = 0;
+    double mean = 0;
+};
+
+Result measure(const Stage &stage, size_t frames) {
+    for (size_t i = 0; i < kWarmupFrames; ++i) {
+        stage.run(i);
+    }
+    std::vector<double> ns(frames);
+    for (size_t i = 0; i < frames; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        stage.run(kWarmupFrames + i);
+        auto stop = std::chrono::steady_clock::now();
+        ns[i] = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+    }
+    Result r;
+    for (double v : ns) {
+        r.mean += v;
+    }
+    r.mean /= static_cast<double>(frames);
+    std::sort(ns.begin(), ns.end());
+    r.p50 = ns[frames / 2];
+    r.p99 = ns[std::min(frames - 1, frames * 99 / 100)];
+    r.max = ns.back();
+    return r;
+}
+
+// The mic signal for far: far through a room response starting kEchoDelayMs in, with taps
+// decaying over the following kEchoSpreadMs, plus a noise floor.
+std::vector<int16_t> make_echo(const std::vector<int16_t> &far, uint32_t seed) {
+    std::vector<size_t> delays(kEchoTaps);
+    std::vector<double> gains(kEchoTaps);
+    uint32_t lcg = seed;
+    auto uniform = [&lcg] {
+        lcg = lcg * 1664525u + 1013904223u;
+        return static_cast<double>(lcg >> 8) / 16777216.0;
+    };
+    const double delay = kSampleRate * kEchoDelayMs / 1000.0;
+    for (size_t t = 0; t < kEchoTaps; ++t) {
+        const double after = uniform() * kSampleRate * kEchoSpreadMs / 1000.0;
+        delays[t] = static_cast<size_t>(delay + after);
+        gains[t] = (uniform() - 0.5) * 0.6 * std::exp(-after / (kSampleRate * kEchoDecayMs / 1000.0));
+    }
+    std::vector<int16_t> mic(far.size());
+    for (size_t i = 0; i < far.size(); ++i) {
+        double echo = (uniform() - 0.5) * 20.0;
+        for (size_t t = 0; t < kEchoTaps; ++t) {
+            if (delays[t] <= i) {
+                echo += gains[t] * far[i - delays[t]];
+            }
+        }
+        mic[i] = static_cast<int16_t>(std::clamp(echo, -32768.0, 32767.0));
+    }
+    return mic;
+}
+
+// Echo return loss enhancement over the last third of the material, once the canceller has
+// converged, with frames of ms.
+double measure_erle(const std::vector<int16_t> &far, const std::vector<int16_t> &mic, int ms) {
+    const size_t frame_samples = static_cast<size_t>(kSampleRate * ms / 1000);
+    engine::EchoCanceller canceller(kSampleRate, frame_samples, kEchoTailMs);
+    std::vector<int16_t> out(frame_samples);
+    double mic_power = 0.0;
+    double out_power = 0.0;
+    for (size_t at = 0; at + frame_samples <= far.size(); at += frame_samples) {
+        canceller.process(mic.data() + at, far.data() + at, out.data(), frame_samples);
+        if (at < far.size() * 2 / 3) {
+            continue;
+        }
+        for (size_t i = 0; i < frame_samples; ++i) {
+            mic_power += static_cast<double>(mic[at + i]) * mic[at + i];
+            out_power += static_cast<double>(out[i]) * out[i];
+        }
+    }
+    return 10.0 * std::log10((mic_power + 1.0) / (out_power + 1.0));
+}
+
+void print_usage() {
+    std::printf("Usage: audio_engine_bench [--frames N] [--stage NAME] [--simd LEVEL] [--frame-ms MS]\n"
+                "  --frames N    timed frames per stage (default %zu)\n"
+                "  --stage NAME  run only stages whose name contains NAME\n"
+                "  --simd LEVEL  scalar, sse2, avx2 or avx512 kernels (default: widest supported)\n"
+                "  --frame-ms MS frame duration: 5, 10, 20 (default) or 40\n",
+                kDefaultFrames);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    size_t frames = kDefaultFrames;
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--stage" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--simd" && i + 1 < argc) {
+            std::string level = argv[++i];
+            bool known = false;
+            for (engine::SimdLevel l : {engine::SimdLevel::Scalar, engine::SimdLevel::Sse2, engine::SimdLevel::Avx2,
+                                        engine::SimdLevel::Avx512}) {
+                if (level == engine::simd_level_name(l)) {
+                    engine::set_simd_level(l);
+                    known = true;
+                }
+            }
+            if (!known) {
+                print_usage();
+                return 1;
+            }
+        } else if (arg == "--frame-ms" && i + 1 < argc) {
+            const int ms = std::stoi(argv[++i]);
+            if (!engine::is_supported_frame_ms(ms)) {
+                print_usage();
+                return 1;
+            }
+            engine::set_frame_ms(ms);
+        } else {
+            print_usage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    const size_t frame_samples = static_cast<size_t>(engine::capture_frame_samples());
+    const double frame_budget_ns = engine::frame_ms() * 1e6;
+    const size_t out_samples = static_cast<size_t>(engine::frame_samples_for_rate(kOutRate));
+    const std::vector<int16_t> mic = make_signal(kSignalFrames * frame_samples, kSampleRate, 1, 140.0);
+    const std::vector<int16_t> loop = make_signal(kSignalFrames * frame_samples, kSampleRate, 2, 210.0);
+    const std::vector<int16_t> mic_out = make_signal(kSignalFrames * out_samples, kOutRate, 1, 140.0);
+    auto mic_frame = [&](size_t i) { return mic.data() + (i % kSignalFrames) * frame_samples; };
+    auto loop_frame = [&](size_t i) { return loop.data() + (i % kSignalFrames) * frame_samples; };
+    auto out_frame = [&](size_t i) { return mic_out.data() + (i % kSignalFrames) * out_samples; };
+
+    // A stereo float32 mix-format stream, as WASAPI shared mode delivers it.
+    std::vector<float> device(kSignalFrames * frame_samples * 2);
+    for (size_t i = 0; i < kSignalFrames * frame_samples; ++i) {
+        device[2 * i] = mic[i] / 32768.0f;
+        device[2 * i + 1] = loop[i] / 32768.0f;
+    }
+    auto device_frame = [&](size_t i) { return device.data() + (i % kSignalFrames) * frame_samples * 2; };
+
+    std::vector<int16_t> scratch(frame_samples * 2, 0);
+    std::vector<float> floats(frame_samples, 0.0f);
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> packet;
+    volatile float sink = 0.0f;
+
+    engine::Resampler resampler(kSampleRate, kOutRate);
+    engine::VoiceActivityDetector vad(kOutRate);
+    engine::EchoCanceller canceller(kSampleRate, frame_samples, kEchoTailMs);
+    engine::DriftCorrector drift;
+    uint64_t drift_qpc = 0;
+    engine::FlacEncoder flac(kSampleRate, frame_samples);
+    engine::FrameRing ring(64, frame_samples);
+    engine::FrameMeta meta;
+    engine::CrosstalkAnalyzer crosstalk;
+    engine::FrameMeta joint_meta;
+    joint_meta.flags = engine::kFrameFlagSpeech;
+    engine::LogMelExtractor log_mel;
+    std::vector<float> mel(engine::LogMelExtractor::max_frames(out_samples) * engine::LogMelExtractor::kMels);
+
+    std::vector<Stage> stages = {
+        {"downmix f32x2 48k", [&](size_t i) {
+             engine::downmix_to_int16(device_frame(i), frame_samples, 2, scratch.data());
+         }},
+        {"s16->f32 48k", [&](size_t i) { engine::int16_to_float(mic_frame(i), floats.data(), frame_samples); }},
+        {"f32->s16 48k", [&](size_t i) {
+             engine::float_to_int16(device_frame(i), scratch.data(), frame_samples);
+         }},
+        {"gain 48k", [&](size_t i) {
+             std::copy(mic_frame(i), mic_frame(i) + frame_samples, scratch.begin());
+             engine::apply_gain(scratch.data(), frame_samples, 1.5f);
+         }},
+        {"mix 48k", [&](size_t i) { engine::mix_int16(mic_frame(i), loop_frame(i), scratch.data(), frame_samples); }},
+        {"levels 48k", [&](size_t i) { sink = engine::measure_levels(mic_frame(i), frame_samples).peak; }},
+        {"resample 48k->16k", [&](size_t i) { resampler.process(mic_frame(i), frame_samples, scratch.data()); }},
+        {"vad 16k", [&](size_t i) { sink = vad.process(out_frame(i), out_samples) ? 1.0f : 0.0f; }},
+        {"log-mel 16k", [&](size_t i) { sink = log_mel.process(out_frame(i), out_samples, mel.data()) ? mel[0] : 0; }},
+        {"aec 48k", [&](size_t i) {
+             canceller.process(mic_frame(i), loop_frame(i), scratch.data(), frame_samples);
+         }},
+        {"crosstalk 48k", [&](size_t i) {
+             joint_meta.qpc_100ns = 10000000ULL * i * frame_samples / kSampleRate;
+             crosstalk.push_loop(loop_frame(i), joint_meta);
+             sink = crosstalk.analyze(mic_frame(i), joint_meta).coherence;
+         }},
+        {"drift 48k", [&](size_t i) {
+             drift.process(mic_frame(i), frame_samples, drift_qpc);
+             drift_qpc += 10000000ULL * frame_samples / kSampleRate;
+         }},
+        {"flac 48k", [&](size_t i) {
+             bytes.clear();
+             flac.encode(mic_frame(i), bytes);
+         }},
+        {"ring push+pop 48k", [&](size_t i) {
+             meta.sequence = i;
+             ring.push(mic_frame(i), meta);
+             ring.pop(scratch.data(), meta);
+         }},
+    };
+    std::unique_ptr<engine::OpusFrameEncoder> opus;
+    if (engine::opus_available()) {
+        opus = std::make_unique<engine::OpusFrameEncoder>(kOutRate, 1, engine::kDefaultOpusBitrate);
+        packet.resize(engine::kMaxOpusPacketBytes);
+        stages.push_back({"opus 16k", [&](size_t i) {
+                              opus->encode(out_frame(i), static_cast<int>(out_samples), packet.data(),
+                                           static_cast<int>(packet.size()));
+                          }});
+    } else {
+        std::printf("opus: built without libopus, skipped\n");
+    }
+
+    std::printf("%zu frames of %d ms per stage; budget %.0f ns per frame; kernels %s\n\n", frames, engine::frame_ms(),
+                frame_budget_ns, engine::simd_level_name(engine::simd_level()));
+    std::printf("%-20s %10s %10s %10s %12s %8s\n", "stage", "p50 ns", "p99 ns", "max ns", "frames/s", "budget");
+    for (const Stage &stage : stages) {
+        if (!filter.empty() && stage.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        Result r = measure(stage, frames);
+        std::printf("%-20s %10.0f %10.0f %10.0f %12.0f %7.3f%%\n", stage.name.c_str(), r.p50, r.p99, r.max,
+                    r.mean > 0 ? 1e9 / r.mean : 0.0, 100.0 * r.mean / frame_budget_ns);
+    }
+
+    // The AEC adapts per block, and the block follows the frame, so check that it still cancels
+    // at every frame size, not only that it fits the budget.
+    int failed = 0;
+    if (filter.empty() || std::string("aec").find(filter) != std::string::npos) {
+        const size_t samples = static_cast<size_t>(kSampleRate) * kEchoCheckSeconds;
+        const std::vector<int16_t> far = make_far_talk(samples, kSampleRate, 3);
+        const std::vector<int16_t> echo = make_echo(far, 4);
+        std::printf("\naec echo check: %d ms delay, %d ms tail, ERLE over the last %d s\n", kEchoDelayMs,
+                    kEchoTailMs, kEchoCheckSeconds / 3);
+        for (int ms : {5, 10, 20, 40}) {
+            const double erle = measure_erle(far, echo, ms);
+            const size_t block = engine::EchoCanceller::block_size_for(static_cast<size_t>(kSampleRate * ms / 1000));
+            std::printf("  %2d ms frames block=%-4zu ERLE %5.1f dB%s\n", ms, block, erle,
+                        erle < kMinErleDb ? "  below minimum" : "");
+            failed += erle < kMinErleDb ? 1 : 0;
+        }
+    }
+    return failed > 0 ? 1 : 0;
+}
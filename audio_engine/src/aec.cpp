@@ -0,0 +1,260 @@
+#include "aec.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "dsp_kernels.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define ENGINE_AEC_SSE 1
+#endif
+
+namespace engine {
+namespace {
+
+constexpr size_t kMaxBlock = 256;
+constexpr size_t kMinBlock = 16;
+// Fixed step until the filter has seen enough reference energy to trust its leak estimate.
+constexpr float kWarmupStep = 0.25f;
+constexpr float kMaxStep = 0.5f;
+// The warm-up and the leak and ERLE smoothing are given per 64-sample block (the block of a
+// 20 ms frame) and scaled to the actual block, so they span the same time at any --frame-ms.
+constexpr size_t kReferenceBlock = 64;
+constexpr float kWarmupBlocks = 50.0f;
+// Per partition; partitions shrink with the block, so this already follows time.
+constexpr float kPowerSmoothing = 0.35f;
+constexpr float kLeakSmoothing = 0.05f;
+constexpr float kErleSmoothing = 0.02f;
+// Regularisation, in squared int16-normalised units per bin.
+constexpr float kPowerFloor = 1e-6f;
+// Blocks whose reference is this quiet (mean square) carry no echo worth adapting to.
+constexpr float kActiveRefPower = 1e-7f;
+constexpr float kDivergenceRatio = 4.0f;
+
+// acc += a * b over split complex arrays.
+void multiply_accumulate(float *acc_re, float *acc_im, const float *a_re, const float *a_im, const float *b_re,
+                         const float *b_im, size_t n) {
+    size_t i = 0;
+#if defined(ENGINE_AEC_SSE)
+    for (; i + 4 <= n; i += 4) {
+        __m128 ar = _mm_loadu_ps(a_re + i);
+        __m128 ai = _mm_loadu_ps(a_im + i);
+        __m128 br = _mm_loadu_ps(b_re + i);
+        __m128 bi = _mm_loadu_ps(b_im + i);
+        __m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+        __m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+        _mm_storeu_ps(acc_re + i, _mm_add_ps(_mm_loadu_ps(acc_re + i), re));
+        _mm_storeu_ps(acc_im + i, _mm_add_ps(_mm_loadu_ps(acc_im + i), im));
+    }
+#endif
+    for (; i < n; ++i) {
+        acc_re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+        acc_im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+    }
+}
+
+// acc += conj(a) * b over split complex arrays.
+void conj_multiply_accumulate(float *acc_re, float *acc_im, const float *a_re, const float *a_im, const float *b_re,
+                              const float *b_im, size_t n) {
+    size_t i = 0;
+#if defined(ENGINE_AEC_SSE)
+    for (; i + 4 <= n; i += 4) {
+        __m128 ar = _mm_loadu_ps(a_re + i);
+        __m128 ai = _mm_loadu_ps(a_im + i);
+        __m128 br = _mm_loadu_ps(b_re + i);
+        __m128 bi = _mm_loadu_ps(b_im + i);
+        __m128 re = _mm_add_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+        __m128 im = _mm_sub_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+        _mm_storeu_ps(acc_re + i, _mm_add_ps(_mm_loadu_ps(acc_re + i), re));
+        _mm_storeu_ps(acc_im + i, _mm_add_ps(_mm_loadu_ps(acc_im + i), im));
+    }
+#endif
+    for (; i < n; ++i) {
+        acc_re[i] += a_re[i] * b_re[i] + a_im[i] * b_im[i];
+        acc_im[i] += a_re[i] * b_im[i] - a_im[i] * b_re[i];
+    }
+}
+
+// A smoothing rate given per kReferenceBlock samples, for blocks of block samples instead.
+float rate_for_block(float rate, size_t block) {
+    return 1.0f - std::pow(1.0f - rate, static_cast<float>(block) / kReferenceBlock);
+}
+
+}  // namespace
+
+size_t EchoCanceller::block_size_for(size_t frame_samples) {
+    size_t block = kMaxBlock;
+    while (block >= kMinBlock && frame_samples % block != 0) {
+        block /= 2;
+    }
+    return block >= kMinBlock ? block : 0;
+}
+
+EchoCanceller::EchoCanceller(int sample_rate, size_t frame_samples, int tail_ms)
+    : block_(block_size_for(frame_samples)),
+      bins_(block_ + 1),
+      partitions_(std::max<size_t>(1, (static_cast<size_t>(sample_rate) * tail_ms / 1000 + block_ - 1) / block_)),
+      fft_(2 * block_),
+      warmup_blocks_(kWarmupBlocks * kReferenceBlock / static_cast<float>(block_)),
+      leak_smoothing_(rate_for_block(kLeakSmoothing, block_)),
+      erle_smoothing_(rate_for_block(kErleSmoothing, block_)) {
+    x_re_.resize(partitions_ * bins_);
+    x_im_.resize(partitions_ * bins_);
+    w_re_.resize(partitions_ * bins_);
+    w_im_.resize(partitions_ * bins_);
+    ref_window_.resize(2 * block_);
+    power_.resize(bins_);
+    y_re_.resize(bins_);
+    y_im_.resize(bins_);
+    e_re_.resize(bins_);
+    e_im_.resize(bins_);
+    time_.resize(2 * block_);
+    mic_f_.resize(block_);
+    ref_f_.resize(block_);
+    out_f_.resize(block_);
+    reset();
+}
+
+void EchoCanceller::reset() {
+    std::fill(x_re_.begin(), x_re_.end(), 0.0f);
+    std::fill(x_im_.begin(), x_im_.end(), 0.0f);
+    std::fill(w_re_.begin(), w_re_.end(), 0.0f);
+    std::fill(w_im_.begin(), w_im_.end(), 0.0f);
+    std::fill(ref_window_.begin(), ref_window_.end(), 0.0f);
+    std::fill(power_.begin(), power_.end(), 0.0f);
+    x_head_ = 0;
+    constrain_next_ = 0;
+    leak_ = 0.0f;
+    pey_ = 0.0f;
+    pyy_ = 1.0f;
+    adapted_ = 0.0f;
+    echo_power_ = 0.0f;
+    residual_power_ = 0.0f;
+}
+
+float EchoCanceller::erle_db() const {
+    return 10.0f * std::log10((echo_power_ + 1e-10f) / (residual_power_ + 1e-10f));
+}
+
+void EchoCanceller::process(const int16_t *mic, const int16_t *ref, int16_t *out, size_t count) {
+    for (size_t offset = 0; offset + block_ <= count; offset += block_) {
+        int16_to_float(mic + offset, mic_f_.data(), block_);
+        int16_to_float(ref + offset, ref_f_.data(), block_);
+        process_block(mic_f_.data(), ref_f_.data(), out_f_.data());
+        float_to_int16(out_f_.data(), out + offset, block_);
+    }
+}
+
+void EchoCanceller::process_block(const float *mic, const float *ref, float *out) {
+    const size_t n = bins_;
+
+    // Overlap-save: transform the previous and current reference block together.
+    std::copy(ref_window_.begin() + block_, ref_window_.end(), ref_window_.begin());
+    std::copy(ref, ref + block_, ref_window_.begin() + block_);
+    x_head_ = (x_head_ + partitions_ - 1) % partitions_;
+    float *x_re = x_re_.data() + x_head_ * n;
+    float *x_im = x_im_.data() + x_head_ * n;
+    fft_.forward(ref_window_.data(), x_re, x_im);
+
+    float ref_power = 0.0f;
+    for (size_t i = 0; i < block_; ++i) {
+        ref_power += ref[i] * ref[i];
+    }
+    ref_power /= static_cast<float>(block_);
+
+    const float smoothing = kPowerSmoothing / static_cast<float>(partitions_);
+    for (size_t k = 0; k < n; ++k) {
+        float p = x_re[k] * x_re[k] + x_im[k] * x_im[k];
+        power_[k] = (1.0f - smoothing) * power_[k] + smoothing * p;
+    }
+
+    // Echo estimate: sum over partitions of weights times the matching past reference spectrum.
+    std::fill(y_re_.begin(), y_re_.end(), 0.0f);
+    std::fill(y_im_.begin(), y_im_.end(), 0.0f);
+    for (size_t p = 0; p < partitions_; ++p) {
+        size_t slot = (x_head_ + p) % partitions_;
+        multiply_accumulate(y_re_.data(), y_im_.data(), w_re_.data() + p * n, w_im_.data() + p * n,
+                            x_re_.data() + slot * n, x_im_.data() + slot * n, n);
+    }
+    fft_.inverse(y_re_.data(), y_im_.data(), time_.data());
+
+    float mic_power = 0.0f;
+    float err_power = 0.0f;
+    for (size_t i = 0; i < block_; ++i) {
+        out[i] = mic[i] - time_[block_ + i];
+        mic_power += mic[i] * mic[i];
+        err_power += out[i] * out[i];
+    }
+
+    std::fill(time_.begin(), time_.begin() + block_, 0.0f);
+    std::copy(out, out + block_, time_.begin() + block_);
+    fft_.forward(time_.data(), e_re_.data(), e_im_.data());
+
+    if (ref_power < kActiveRefPower) {
+        return;
+    }
+    echo_power_ += erle_smoothing_ * (mic_power - echo_power_);
+    residual_power_ += erle_smoothing_ * (err_power - residual_power_);
+    // A filter that keeps adding energy has diverged; pass the mic through and start over.
+    if (!(residual_power_ <= kDivergenceRatio * echo_power_ + kPowerFloor)) {
+        std::copy(mic, mic + block_, out);
+        reset();
+        return;
+    }
+
+    // Leak estimate: how strongly the error power spectrum still follows the echo estimate.
+    // Near-end speech is uncorrelated with the echo, so it does not inflate this.
+    float mean_e = 0.0f;
+    float mean_y = 0.0f;
+    for (size_t k = 0; k < n; ++k) {
+        mean_e += e_re_[k] * e_re_[k] + e_im_[k] * e_im_[k];
+        mean_y += y_re_[k] * y_re_[k] + y_im_[k] * y_im_[k];
+    }
+    mean_e /= static_cast<float>(n);
+    mean_y /= static_cast<float>(n);
+    float sey = 0.0f;
+    float syy = 0.0f;
+    for (size_t k = 0; k < n; ++k) {
+        float de = e_re_[k] * e_re_[k] + e_im_[k] * e_im_[k] - mean_e;
+        float dy = y_re_[k] * y_re_[k] + y_im_[k] * y_im_[k] - mean_y;
+        sey += de * dy;
+        syy += dy * dy;
+    }
+    pey_ += leak_smoothing_ * (sey - pey_);
+    pyy_ += leak_smoothing_ * (syy - pyy_);
+    leak_ = std::clamp(pey_ / (pyy_ + 1e-20f), 0.0f, 1.0f);
+    adapted_ += 1.0f;
+
+    // Per-bin step: the estimated residual echo share of the error, normalised by reference power.
+    for (size_t k = 0; k < n; ++k) {
+        float step = kWarmupStep;
+        if (adapted_ > warmup_blocks_) {
+            float e2 = e_re_[k] * e_re_[k] + e_im_[k] * e_im_[k];
+            float y2 = y_re_[k] * y_re_[k] + y_im_[k] * y_im_[k];
+            step = std::min(kMaxStep, leak_ * y2 / (e2 + kPowerFloor));
+        }
+        float scale = step / (static_cast<float>(partitions_) * power_[k] + kPowerFloor);
+        e_re_[k] *= scale;
+        e_im_[k] *= scale;
+    }
+    for (size_t p = 0; p < partitions_; ++p) {
+        size_t slot = (x_head_ + p) % partitions_;
+        conj_multiply_accumulate(w_re_.data() + p * n, w_im_.data() + p * n, x_re_.data() + slot * n,
+                                 x_im_.data() + slot * n, e_re_.data(), e_im_.data(), n);
+    }
+
+    constrain(constrain_next_);
+    constrain_next_ = (constrain_next_ + 1) % partitions_;
+}
+
+// Zeroes the second half of one partition's impulse response so overlap-save stays linear.
+void EchoCanceller::constrain(size_t partition) {
+    float *w_re = w_re_.data() + partition * bins_;
+    float *w_im = w_im_.data() + partition * bins_;
+    fft_.inverse(w_re, w_im, time_.data());
+    std::fill(time_.begin() + block_, time_.end(), 0.0f);
+    fft_.forward(time_.data(), w_re, w_im);
+}
+
+}  // namespace engine
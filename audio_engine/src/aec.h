@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "fft.h"
+
+namespace engine {
+
+// Acoustic echo canceller: removes the loopback (far-end) signal from the mic stream.
+//
+// The echo path is modelled by a partitioned-block frequency-domain adaptive filter (the MDF
+// structure): the tail is split into partitions of block_size() samples, each filtered with a
+// 2 * block_size() overlap-save FFT, so cost grows linearly with tail length. Weights adapt by
+// per-bin normalised LMS. The step size follows an estimate of how much of the residual is
+// still echo, which slows adaptation by itself during double talk instead of diverging on the
+// near-end voice. One partition per block gets the gradient constraint, round robin.
+class EchoCanceller {
+public:
+    // frame_samples must be a multiple of block_size_for(frame_samples) (see below).
+    EchoCanceller(int sample_rate, size_t frame_samples, int tail_ms);
+
+    // Largest power-of-two block (at most 256) that divides a frame, or 0 when that is below
+    // 16 samples and the rate is unsuitable.
+    static size_t block_size_for(size_t frame_samples);
+
+    size_t block_size() const { return block_; }
+    size_t partitions() const { return partitions_; }
+
+    // Cancels ref out of mic. All three hold count samples, a multiple of block_size();
+    // out may alias mic.
+    void process(const int16_t *mic, const int16_t *ref, int16_t *out, size_t count);
+    void reset();
+
+    // Smoothed echo return loss enhancement, in dB.
+    float erle_db() const;
+
+private:
+    void process_block(const float *mic, const float *ref, float *out);
+    void constrain(size_t partition);
+
+    size_t block_;
+    size_t bins_;
+    size_t partitions_;
+    RealFft fft_;
+    // Blocks of fixed step, and the leak and ERLE smoothing rates, for this block size.
+    float warmup_blocks_;
+    float leak_smoothing_;
+    float erle_smoothing_;
+
+    // Reference spectra, newest at x_head_, and filter weights; partition p at p * bins_.
+    std::vector<float> x_re_, x_im_;
+    std::vector<float> w_re_, w_im_;
+    size_t x_head_ = 0;
+    size_t constrain_next_ = 0;
+
+    std::vector<float> ref_window_;  // previous and current reference block
+    std::vector<float> power_;       // smoothed reference power per bin
+    std::vector<float> y_re_, y_im_, e_re_, e_im_;
+    std::vector<float> time_;
+    std::vector<float> mic_f_, ref_f_, out_f_;
+
+    float leak_ = 0.0f;
+    float pey_ = 0.0f;
+    float pyy_ = 1.0f;
+    float adapted_ = 0.0f;
+    float echo_power_ = 0.0f;
+    float residual_power_ = 0.0f;
+};
+
+}  // namespace engine
@@ -0,0 +1,323 @@
+#include "asr.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "audio_format.h"
+#include "dsp_kernels.h"
+#include "log.h"
+#include "protocol.h"
+#include "segmenter.h"
+#include "wasapi_capture.h"
+
+#ifdef ENGINE_HAVE_WHISPER
+#include <whisper.h>
+#endif
+
+namespace engine {
+namespace {
+
+constexpr int kAsrFirstPartialMs = 400;
+constexpr int kAsrPartialStepMs = 500;
+// whisper_full() returns no segments for under a second of audio, so early partials and
+// short finals are padded with trailing silence.
+constexpr int kAsrMinDecodeMs = 1050;
+
+constexpr size_t samples_for_ms(int ms) {
+    return static_cast<size_t>(kAsrSampleRate) * static_cast<size_t>(ms) / 1000;
+}
+
+uint64_t elapsed_us(uint64_t since_100ns, uint64_t now_100ns) {
+    return now_100ns > since_100ns ? (now_100ns - since_100ns) / 10 : 0;
+}
+
+}  // namespace
+
+AsrPool::AsrPool(std::string model_path, std::string language, int workers, EventLog &events)
+    : model_path_(std::move(model_path)), language_(std::move(language)), workers_(workers), events_(events) {}
+
+AsrPool::~AsrPool() {
+    stop();
+}
+
+void AsrPool::submit(AsrJob job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ || threads_.empty()) {
+            return;
+        }
+        auto same_stream = [&job](const AsrJob &queued) { return queued.stream == job.stream; };
+        auto waiting = std::find_if(partials_.begin(), partials_.end(), same_stream);
+        if (job.final) {
+            progress_of(job.stream).finalized = job.utterance;
+            if (waiting != partials_.end()) {
+                partials_.erase(waiting);
+                ++skipped_partials_;
+            }
+            finals_.push_back(std::move(job));
+        } else if (waiting != partials_.end()) {
+            *waiting = std::move(job);
+            ++skipped_partials_;
+        } else {
+            partials_.push_back(std::move(job));
+        }
+    }
+    ready_.notify_one();
+}
+
+uint64_t AsrPool::skipped_partials() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return skipped_partials_;
+}
+
+bool AsrPool::take(AsrJob &job) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait(lock, [this] { return stopping_ || !finals_.empty() || !partials_.empty(); });
+    if (stopping_) {
+        return false;
+    }
+    if (!finals_.empty()) {
+        job = std::move(finals_.front());
+        finals_.pop_front();
+    } else {
+        job = std::move(partials_.front());
+        partials_.erase(partials_.begin());
+    }
+    return true;
+}
+
+AsrPool::Progress &AsrPool::progress_of(const std::string &stream) {
+    for (Progress &progress : progress_) {
+        if (progress.stream == stream) {
+            return progress;
+        }
+    }
+    progress_.push_back(Progress{stream});
+    return progress_.back();
+}
+
+void AsrPool::publish(const AsrJob &job, const std::string &text, uint64_t decode_us) {
+    const uint64_t now = qpc_now_100ns();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Progress &progress = progress_of(job.stream);
+        // A partial that finished after its utterance's final was queued is out of date.
+        if (!job.final && job.utterance <= progress.finalized) {
+            return;
+        }
+        if (!text.empty() && job.utterance > progress.first_word) {
+            progress.first_word = job.utterance;
+            if (job.metrics) {
+                job.metrics->asr_first_word_us.record(elapsed_us(job.onset_qpc_100ns, now));
+            }
+        }
+    }
+    if (job.metrics) {
+        job.metrics->asr_decode_us.record(decode_us);
+        if (job.final) {
+            job.metrics->asr_final_us.record(elapsed_us(job.end_qpc_100ns, now));
+        }
+    }
+    if (text.empty() && !job.final) {
+        return;
+    }
+    events_.publish("transcript", "\"stream\":" + json_string(job.stream) +
+                                      ",\"utterance\":" + std::to_string(job.utterance) +
+                                      ",\"final\":" + (job.final ? "true" : "false") +
+                                      ",\"start_qpc_100ns\":" + std::to_string(job.start_qpc_100ns) +
+                                      ",\"end_qpc_100ns\":" + std::to_string(job.end_qpc_100ns) +
+                                      ",\"decode_ms\":" + std::to_string(decode_us / 1000) +
+                                      ",\"text\":" + json_string(text));
+}
+
+#ifdef ENGINE_HAVE_WHISPER
+
+bool asr_available() {
+    return true;
+}
+
+bool AsrPool::start() {
+    // whisper.cpp logs every model tensor by default; the engine log keeps errors only.
+    whisper_log_set(
+        [](enum ggml_log_level level, const char *text, void *) {
+            if (level == GGML_LOG_LEVEL_ERROR) {
+                log_error(std::string("whisper: ") + text);
+            }
+        },
+        nullptr);
+    context_ = whisper_init_from_file_with_params_no_state(model_path_.c_str(), whisper_context_default_params());
+    if (!context_) {
+        log_error("asr model load failed: " + model_path_);
+        return false;
+    }
+    if (whisper_lang_id(language_.c_str()) < 0) {
+        log_error("asr language not supported by whisper: " + language_);
+        whisper_free(context_);
+        context_ = nullptr;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = false;
+    for (int i = 0; i < workers_; ++i) {
+        threads_.emplace_back([this] { run(); });
+    }
+    return true;
+}
+
+void AsrPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        finals_.clear();
+        partials_.clear();
+    }
+    ready_.notify_all();
+    for (std::thread &thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+    if (context_) {
+        whisper_free(context_);
+        context_ = nullptr;
+    }
+}
+
+void AsrPool::run() {
+    whisper_state *state = whisper_init_state(context_);
+    if (!state) {
+        log_error("asr worker state allocation failed");
+        return;
+    }
+    // Workers share the cores; ggml threads within one decode beyond that only contend.
+    const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    params.n_threads = std::max(1, cores / workers_);
+    params.language = language_.c_str();
+    params.no_context = true;
+    params.no_timestamps = true;
+    params.single_segment = true;
+    params.print_progress = false;
+    params.print_realtime = false;
+    params.print_special = false;
+    params.print_timestamps = false;
+    params.suppress_blank = true;
+
+    AsrJob job;
+    while (take(job)) {
+        job.samples.resize(std::max(job.samples.size(), samples_for_ms(kAsrMinDecodeMs)), 0.0f);
+        const auto started = std::chrono::steady_clock::now();
+        std::string text;
+        const int count = static_cast<int>(job.samples.size());
+        if (whisper_full_with_state(context_, state, params, job.samples.data(), count) == 0) {
+            const int segments = whisper_full_n_segments_from_state(state);
+            for (int i = 0; i < segments; ++i) {
+                text += whisper_full_get_segment_text_from_state(state, i);
+            }
+        } else {
+            log_error(job.stream + " asr decode failed for utterance " + std::to_string(job.utterance));
+        }
+        const size_t begin = text.find_first_not_of(' ');
+        text = begin == std::string::npos ? std::string() : text.substr(begin);
+        const auto decode = std::chrono::steady_clock::now() - started;
+        const uint64_t decode_us =
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(decode).count());
+        publish(job, text, decode_us);
+    }
+    whisper_free_state(state);
+}
+
+#else
+
+bool asr_available() {
+    return false;
+}
+
+bool AsrPool::start() {
+    log_error("engine built without whisper.cpp; --asr is unavailable");
+    return false;
+}
+
+void AsrPool::stop() {}
+
+void AsrPool::run() {}
+
+#endif
+
+AsrFeed::AsrFeed(AsrPool &pool, std::string stream, StreamMetrics *metrics)
+    : pool_(pool), stream_(std::move(stream)), metrics_(metrics) {}
+
+void AsrFeed::push(const int16_t *samples, const FrameMeta &meta) {
+    const int frame_samples = static_cast<int>(meta.samples ? meta.samples : capture_frame_samples());
+    const int rate = rate_for_frame_samples(frame_samples);
+    if (!resampler_ || resampler_->in_rate() != rate) {
+        resampler_ = std::make_unique<Resampler>(rate, kAsrSampleRate);
+        resampled_.resize(resampler_->max_output(capture_frame_samples()));
+        converted_.resize(resampled_.size());
+    }
+    const int16_t *pcm = samples;
+    size_t count = static_cast<size_t>(frame_samples);
+    if (!resampler_->passthrough()) {
+        count = resampler_->process(samples, count, resampled_.data());
+        pcm = resampled_.data();
+    }
+    int16_to_float(pcm, converted_.data(), count);
+    const float *audio = converted_.data();
+
+    // A gap may have taken the end frame with it; what is left of that utterance is dropped.
+    const uint64_t utterance = meta.utterance;
+    if (open_ && ((meta.flags & kFrameFlagDiscontinuity) || utterance != utterance_)) {
+        flush();
+    }
+    if (!open_ && utterance != 0 && utterance != utterance_) {
+        open_ = true;
+        utterance_ = utterance;
+        audio_.assign(lookback_.begin(), lookback_.end());
+        lookback_.clear();
+        onset_qpc_100ns_ = meta.qpc_100ns;
+        // 625 x 100 ns per 16 kHz sample.
+        start_qpc_100ns_ = meta.qpc_100ns - static_cast<uint64_t>(audio_.size()) * 625;
+        next_partial_ = audio_.size() + samples_for_ms(kAsrFirstPartialMs);
+    }
+    if (!open_) {
+        lookback_.insert(lookback_.end(), audio, audio + count);
+        const size_t keep = samples_for_ms(static_cast<int>(utterance_lookback_frames()) * frame_ms());
+        while (lookback_.size() > keep) {
+            lookback_.pop_front();
+        }
+        return;
+    }
+
+    audio_.insert(audio_.end(), audio, audio + count);
+    end_qpc_100ns_ = meta.qpc_100ns + static_cast<uint64_t>(count) * 625;
+    if (meta.flags & kFrameFlagUtteranceEnd) {
+        flush();
+    } else if (audio_.size() >= next_partial_) {
+        submit(false);
+        next_partial_ = audio_.size() + samples_for_ms(kAsrPartialStepMs);
+    }
+}
+
+void AsrFeed::flush() {
+    if (!open_) {
+        return;
+    }
+    submit(true);
+    open_ = false;
+    audio_.clear();
+}
+
+void AsrFeed::submit(bool final) {
+    AsrJob job;
+    job.stream = stream_;
+    job.utterance = utterance_;
+    job.final = final;
+    job.start_qpc_100ns = start_qpc_100ns_;
+    job.onset_qpc_100ns = onset_qpc_100ns_;
+    job.end_qpc_100ns = end_qpc_100ns_;
+    job.samples = audio_;
+    job.metrics = metrics_;
+    pool_.submit(std::move(job));
+}
+
+}  // namespace engine
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "events.h"
+#include "metrics.h"
+#include "resampler.h"
+#include "spsc_ring.h"
+
+struct whisper_context;
+
+namespace engine {
+
+// False when the engine was built without whisper.cpp (see CMakeLists.txt).
+bool asr_available();
+
+constexpr int kAsrSampleRate = 16000;
+
+// One decode: an utterance's audio so far (partial) or all of it (final).
+struct AsrJob {
+    std::string stream;
+    // 1, 2, ... per stream.
+    uint64_t utterance = 0;
+    bool final = false;
+    // Capture times (100 ns QPC) of the first sample, of the frame where the VAD opened and
+    // of the end of the last sample.
+    uint64_t start_qpc_100ns = 0;
+    uint64_t onset_qpc_100ns = 0;
+    uint64_t end_qpc_100ns = 0;
+    // 16 kHz mono, full scale 1.0.
+    std::vector<float> samples;
+    // The stream's ASR latency histograms; may be null.
+    StreamMetrics *metrics = nullptr;
+};
+
+// Whisper transcription on a pool of worker threads. The model is loaded once and shared;
+// each worker decodes with its own state, so utterances from both streams run in parallel.
+//
+// Finals are decoded in arrival order ahead of any partial, and each stream has at most one
+// partial waiting: a newer one covers more audio and replaces it, so a busy pool skips
+// partials rather than falling behind. Results go out as "transcript" events.
+class AsrPool {
+public:
+    AsrPool(std::string model_path, std::string language, int workers, EventLog &events);
+    ~AsrPool();
+
+    AsrPool(const AsrPool &) = delete;
+    AsrPool &operator=(const AsrPool &) = delete;
+
+    // Loads the model and starts the workers; logs and returns false when the model cannot
+    // be loaded.
+    bool start();
+    // Finishes the jobs in progress, discards the queue and joins the workers.
+    void stop();
+
+    void submit(AsrJob job);
+
+    int workers() const { return workers_; }
+    uint64_t skipped_partials() const;
+
+private:
+    // Per stream: the newest utterance with a final queued, and the newest whose first word
+    // has been timed.
+    struct Progress {
+        std::string stream;
+        uint64_t finalized = 0;
+        uint64_t first_word = 0;
+    };
+
+    void run();
+    // Blocks for the next job; false once stop() was called.
+    bool take(AsrJob &job);
+    void publish(const AsrJob &job, const std::string &text, uint64_t decode_us);
+    Progress &progress_of(const std::string &stream);
+
+    const std::string model_path_;
+    const std::string language_;
+    const int workers_;
+    EventLog &events_;
+    whisper_context *context_ = nullptr;
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stopping_ = false;
+    std::deque<AsrJob> finals_;
+    std::vector<AsrJob> partials_;
+    std::vector<Progress> progress_;
+    uint64_t skipped_partials_ = 0;
+    std::vector<std::thread> threads_;
+};
+
+// Turns one stream's segmented frames (see segmenter.h) into AsrJobs carrying the
+// segmenter's utterance ids. An utterance opens on its first frame, with the lookback audio
+// before it, and closes with a final on its end frame or a gap in the stream. While it is
+// open a partial goes out once kAsrFirstPartialMs of speech is in and then every
+// kAsrPartialStepMs, which is what sets the time to first word.
+class AsrFeed {
+public:
+    AsrFeed(AsrPool &pool, std::string stream, StreamMetrics *metrics);
+
+    // One frame at the stream's output rate; meta.utterance and the utterance flags come
+    // from the capture thread's segmenter.
+    void push(const int16_t *samples, const FrameMeta &meta);
+    // Ends the open utterance, if any, with a final.
+    void flush();
+
+private:
+    void submit(bool final);
+
+    AsrPool &pool_;
+    const std::string stream_;
+    StreamMetrics *metrics_;
+    std::unique_ptr<Resampler> resampler_;
+    std::vector<int16_t> resampled_;
+    std::vector<float> converted_;
+
+    // Audio ahead of the next utterance, at most the segmenter's lookback of it.
+    std::deque<float> lookback_;
+    bool open_ = false;
+    uint64_t utterance_ = 0;
+    std::vector<float> audio_;
+    uint64_t start_qpc_100ns_ = 0;
+    uint64_t onset_qpc_100ns_ = 0;
+    uint64_t end_qpc_100ns_ = 0;
+    size_t next_partial_ = 0;
+};
+
+}  // namespace engine
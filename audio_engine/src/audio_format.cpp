@@ -0,0 +1,24 @@
+#include "audio_format.h"
+
+namespace engine {
+namespace {
+
+int g_frame_ms = kDefaultFrameMs;
+
+}  // namespace
+
+bool is_supported_frame_ms(int ms) {
+    return ms == 5 || ms == 10 || ms == 20 || ms == 40;
+}
+
+void set_frame_ms(int ms) {
+    if (is_supported_frame_ms(ms)) {
+        g_frame_ms = ms;
+    }
+}
+
+int frame_ms() {
+    return g_frame_ms;
+}
+
+}  // namespace engine
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace engine {
+
+// Capture runs at 48 kHz mono int16 in frames of frame_ms(): 20 ms unless --frame-ms picks 5,
+// 10 or 40 ms. Streams may leave the engine at a lower --out-rate; frames keep their duration,
+// so their sample count scales with the rate.
+constexpr int kSampleRate = 48000;
+constexpr int kDefaultFrameMs = 20;
+constexpr int kMaxFrameMs = 40;
+// The longest frame, for buffers that must hold any of them.
+constexpr int kMaxFrameSamples = kSampleRate * kMaxFrameMs / 1000;
+
+bool is_supported_frame_ms(int ms);
+// Selects the frame duration for the whole engine. Call before starting the threads that
+// frame audio; everything framed afterwards follows it.
+void set_frame_ms(int ms);
+int frame_ms();
+
+// Capture-rate samples and bytes per frame.
+inline int capture_frame_samples() {
+    return kSampleRate * frame_ms() / 1000;
+}
+
+inline int capture_frame_bytes() {
+    return capture_frame_samples() * static_cast<int>(sizeof(int16_t));
+}
+
+inline uint64_t frame_100ns() {
+    return static_cast<uint64_t>(frame_ms()) * 10000;
+}
+
+// Frames covering ms, at least one.
+inline size_t frames_for_ms(int ms) {
+    const int frame = frame_ms();
+    return ms > frame ? static_cast<size_t>((ms + frame - 1) / frame) : 1;
+}
+
+inline int frame_samples_for_rate(int rate) {
+    return rate * frame_ms() / 1000;
+}
+
+inline int rate_for_frame_samples(int samples) {
+    return samples * 1000 / frame_ms();
+}
+
+}  // namespace engine
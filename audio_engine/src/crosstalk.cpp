@@ -0,0 +1,281 @@
+#include "crosstalk.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "audio_format.h"
+#include "protocol.h"
+
+namespace engine {
+namespace {
+
+constexpr double kTwoPi = 6.283185307179586476925286766559;
+
+constexpr size_t kMaxDelaySamples = static_cast<size_t>(kSampleRate) * kMaxEchoDelayMs / 1000;
+
+// The coherence spectra span one frame, at least this many samples.
+constexpr size_t kMinSpectrumFft = 256;
+constexpr float kBandLowHz = 300.0f;
+constexpr float kBandHighHz = 3400.0f;
+// Smoothing of the coherence spectra per 20 ms frame: about 100 ms.
+constexpr float kSpectrumSmoothing = 0.8f;
+
+// Loop audio kept for mic frames that arrive late.
+constexpr size_t kHistorySamples = static_cast<size_t>(kSampleRate) / 2;
+// A loop frame further than this from where the previous one ended starts a new timeline.
+constexpr uint64_t kRealign100ns = 20000;  // 2 ms
+// Below this RMS (full scale 32768) a frame carries nothing to correlate.
+constexpr double kMinRms = 30.0;
+
+constexpr float kEchoCoherence = 0.6f;
+constexpr float kEchoCorrelation = 0.7f;
+
+constexpr int kOverlapOpenMs = 60;    // of both talking
+constexpr int kOverlapCloseMs = 200;  // without
+
+uint64_t samples_to_100ns(size_t samples) {
+    return static_cast<uint64_t>(samples) * 10000000ULL / kSampleRate;
+}
+
+int64_t duration_to_samples(int64_t duration_100ns) {
+    return duration_100ns * kSampleRate / 10000000LL;
+}
+
+size_t round_up_pow2(size_t value) {
+    size_t out = 1;
+    while (out < value) {
+        out <<= 1;
+    }
+    return out;
+}
+
+size_t band_bin(float hz, size_t fft_size) {
+    return static_cast<size_t>(std::lround(hz * static_cast<float>(fft_size) / kSampleRate));
+}
+
+}  // namespace
+
+CrosstalkAnalyzer::CrosstalkAnalyzer()
+    : frame_samples_(static_cast<size_t>(capture_frame_samples())),
+      window_samples_(frame_samples_ + kMaxDelaySamples),
+      // Linear (not circular) correlation of a frame against the window.
+      correlation_fft_(round_up_pow2(window_samples_ + frame_samples_ - 1)),
+      mic_time_(correlation_fft_.size(), 0.0f),
+      loop_time_(correlation_fft_.size(), 0.0f),
+      product_(correlation_fft_.size(), 0.0f),
+      mic_re_(correlation_fft_.bins()),
+      mic_im_(correlation_fft_.bins()),
+      loop_re_(correlation_fft_.bins()),
+      loop_im_(correlation_fft_.bins()),
+      loop_energy_(window_samples_ + 1, 0.0),
+      spectrum_fft_(round_up_pow2(std::max(frame_samples_, kMinSpectrumFft))),
+      window_(frame_samples_),
+      frame_(spectrum_fft_.size(), 0.0f),
+      a_re_(spectrum_fft_.bins()),
+      a_im_(spectrum_fft_.bins()),
+      b_re_(spectrum_fft_.bins()),
+      b_im_(spectrum_fft_.bins()),
+      smoothing_(std::pow(kSpectrumSmoothing, static_cast<float>(frame_ms()) / kDefaultFrameMs)) {
+    for (size_t i = 0; i < frame_samples_; ++i) {
+        window_[i] = static_cast<float>(0.5 - 0.5 * std::cos(kTwoPi * static_cast<double>(i) / frame_samples_));
+    }
+    const size_t band = band_bin(kBandHighHz, spectrum_fft_.size()) - band_bin(kBandLowHz, spectrum_fft_.size()) + 1;
+    paa_.assign(band, 0.0f);
+    pbb_.assign(band, 0.0f);
+    pab_re_.assign(band, 0.0f);
+    pab_im_.assign(band, 0.0f);
+    history_.reserve(kHistorySamples + frame_samples_);
+}
+
+void CrosstalkAnalyzer::reset() {
+    history_.clear();
+    spans_.clear();
+    std::fill(paa_.begin(), paa_.end(), 0.0f);
+    std::fill(pbb_.begin(), pbb_.end(), 0.0f);
+    std::fill(pab_re_.begin(), pab_re_.end(), 0.0f);
+    std::fill(pab_im_.begin(), pab_im_.end(), 0.0f);
+}
+
+void CrosstalkAnalyzer::push_loop(const int16_t *samples, const FrameMeta &meta) {
+    const uint64_t expected = history_qpc_ + samples_to_100ns(history_.size());
+    const uint64_t skew = meta.qpc_100ns > expected ? meta.qpc_100ns - expected : expected - meta.qpc_100ns;
+    if (history_.empty() || skew > kRealign100ns) {
+        history_.clear();
+        history_qpc_ = meta.qpc_100ns;
+    }
+    history_.insert(history_.end(), samples, samples + frame_samples_);
+    if (history_.size() > kHistorySamples) {
+        const size_t drop = history_.size() - kHistorySamples;
+        history_.erase(history_.begin(), history_.begin() + static_cast<std::ptrdiff_t>(drop));
+        history_qpc_ += samples_to_100ns(drop);
+    }
+    spans_.push_back(LoopSpan{meta.qpc_100ns, meta.qpc_100ns + samples_to_100ns(frame_samples_),
+                              (meta.flags & kFrameFlagSpeech) != 0});
+    auto stale = [this](const LoopSpan &span) { return span.end_100ns <= history_qpc_; };
+    spans_.erase(std::remove_if(spans_.begin(), spans_.end(), stale), spans_.end());
+}
+
+bool CrosstalkAnalyzer::covers(uint64_t qpc_100ns) const {
+    return !history_.empty() &&
+           history_qpc_ + samples_to_100ns(history_.size()) >= qpc_100ns + samples_to_100ns(frame_samples_);
+}
+
+void CrosstalkAnalyzer::extract(uint64_t qpc_100ns, size_t count, float *out) const {
+    std::fill(out, out + count, 0.0f);
+    if (history_.empty()) {
+        return;
+    }
+    // Offset of out[0] into history_, negative when it starts before the history.
+    const int64_t offset = duration_to_samples(static_cast<int64_t>(qpc_100ns) - static_cast<int64_t>(history_qpc_));
+    for (size_t i = 0; i < count; ++i) {
+        const int64_t at = offset + static_cast<int64_t>(i);
+        if (at >= 0 && at < static_cast<int64_t>(history_.size())) {
+            out[i] = history_[static_cast<size_t>(at)];
+        }
+    }
+}
+
+bool CrosstalkAnalyzer::loop_speech(uint64_t start_100ns, uint64_t end_100ns) const {
+    for (const LoopSpan &span : spans_) {
+        if (span.speech && span.start_100ns < end_100ns && span.end_100ns > start_100ns) {
+            return true;
+        }
+    }
+    return false;
+}
+
+float CrosstalkAnalyzer::coherence(const float *mic, const float *loop) {
+    for (size_t i = 0; i < frame_samples_; ++i) {
+        frame_[i] = mic[i] * window_[i];
+    }
+    spectrum_fft_.forward(frame_.data(), a_re_.data(), a_im_.data());
+    for (size_t i = 0; i < frame_samples_; ++i) {
+        frame_[i] = loop[i] * window_[i];
+    }
+    spectrum_fft_.forward(frame_.data(), b_re_.data(), b_im_.data());
+
+    const size_t first = band_bin(kBandLowHz, spectrum_fft_.size());
+    const float keep = smoothing_;
+    const float take = 1.0f - smoothing_;
+    double sum = 0.0;
+    for (size_t i = 0; i < paa_.size(); ++i) {
+        const size_t k = first + i;
+        paa_[i] = keep * paa_[i] + take * (a_re_[k] * a_re_[k] + a_im_[k] * a_im_[k]);
+        pbb_[i] = keep * pbb_[i] + take * (b_re_[k] * b_re_[k] + b_im_[k] * b_im_[k]);
+        // a * conj(b)
+        pab_re_[i] = keep * pab_re_[i] + take * (a_re_[k] * b_re_[k] + a_im_[k] * b_im_[k]);
+        pab_im_[i] = keep * pab_im_[i] + take * (a_im_[k] * b_re_[k] - a_re_[k] * b_im_[k]);
+        const double cross = static_cast<double>(pab_re_[i]) * pab_re_[i] +
+                             static_cast<double>(pab_im_[i]) * pab_im_[i];
+        const double power = static_cast<double>(paa_[i]) * pbb_[i];
+        sum += power > 0.0 ? std::min(1.0, cross / power) : 0.0;
+    }
+    return static_cast<float>(sum / static_cast<double>(paa_.size()));
+}
+
+CrosstalkFrame CrosstalkAnalyzer::analyze(const int16_t *mic, const FrameMeta &meta) {
+    CrosstalkFrame out;
+    out.qpc_100ns = meta.qpc_100ns;
+    out.mic_speech = (meta.flags & kFrameFlagSpeech) != 0;
+    const uint64_t end_100ns = meta.qpc_100ns + samples_to_100ns(frame_samples_);
+    out.loop_speech = loop_speech(meta.qpc_100ns, end_100ns);
+
+    // Loop window: kMaxDelaySamples before the frame, then the frame's own interval.
+    const uint64_t lead_100ns = samples_to_100ns(kMaxDelaySamples);
+    const uint64_t window_100ns = meta.qpc_100ns > lead_100ns ? meta.qpc_100ns - lead_100ns : 0;
+    std::fill(loop_time_.begin(), loop_time_.end(), 0.0f);
+    extract(window_100ns, window_samples_, loop_time_.data());
+    std::fill(mic_time_.begin(), mic_time_.end(), 0.0f);
+    double mic_energy = 0.0;
+    for (size_t i = 0; i < frame_samples_; ++i) {
+        mic_time_[i] = mic[i];
+        mic_energy += static_cast<double>(mic[i]) * mic[i];
+    }
+    for (size_t i = 0; i < window_samples_; ++i) {
+        loop_energy_[i + 1] = loop_energy_[i] + static_cast<double>(loop_time_[i]) * loop_time_[i];
+    }
+    const double min_energy = kMinRms * kMinRms * static_cast<double>(frame_samples_);
+
+    // c[k] = sum_n mic[n] * loop[n + k]: the inverse FFT of conj(MIC) * LOOP. Lag k lines the
+    // frame up with loop audio kMaxDelaySamples - k samples before it.
+    size_t best = kMaxDelaySamples;
+    if (mic_energy >= min_energy && loop_energy_[window_samples_] >= min_energy) {
+        correlation_fft_.forward(mic_time_.data(), mic_re_.data(), mic_im_.data());
+        correlation_fft_.forward(loop_time_.data(), loop_re_.data(), loop_im_.data());
+        for (size_t k = 0; k < mic_re_.size(); ++k) {
+            const float re = mic_re_[k] * loop_re_[k] + mic_im_[k] * loop_im_[k];
+            const float im = mic_re_[k] * loop_im_[k] - mic_im_[k] * loop_re_[k];
+            mic_re_[k] = re;
+            mic_im_[k] = im;
+        }
+        correlation_fft_.inverse(mic_re_.data(), mic_im_.data(), product_.data());
+        for (size_t k = 0; k <= kMaxDelaySamples; ++k) {
+            const double energy = loop_energy_[k + frame_samples_] - loop_energy_[k];
+            if (energy < min_energy) {
+                continue;
+            }
+            const float rho = static_cast<float>(std::fabs(product_[k]) / std::sqrt(mic_energy * energy));
+            if (rho > out.correlation) {
+                out.correlation = std::min(rho, 1.0f);
+                best = k;
+            }
+        }
+    }
+    out.delay_ms = static_cast<float>(kMaxDelaySamples - best) * 1000.0f / kSampleRate;
+
+    out.coherence = coherence(mic_time_.data(), loop_time_.data() + best);
+    out.echo = out.mic_speech && out.loop_speech &&
+               (out.coherence >= kEchoCoherence || out.correlation >= kEchoCorrelation);
+    out.overlap = out.mic_speech && out.loop_speech && !out.echo;
+    return out;
+}
+
+OverlapTracker::Change OverlapTracker::update(const CrosstalkFrame &frame) {
+    const uint64_t frame_end_100ns = frame.qpc_100ns + frame_100ns();
+    if (frame.overlap) {
+        if (run_ == 0 && !open_) {
+            pending_ = Overlap{};
+            pending_.start_qpc_100ns = frame.qpc_100ns;
+        }
+        ++run_;
+        quiet_ = 0;
+        last_overlap_end_100ns_ = frame_end_100ns;
+    } else {
+        run_ = 0;
+        ++quiet_;
+    }
+
+    Overlap &target = open_ ? current_ : pending_;
+    if (frame.overlap) {
+        ++target.frames;
+        target.max_correlation = std::max(target.max_correlation, frame.correlation);
+        target.coherence_sum += frame.coherence;
+    } else if (open_ && frame.echo) {
+        ++current_.echo_frames;
+    }
+
+    if (!open_ && run_ >= frames_for_ms(kOverlapOpenMs)) {
+        open_ = true;
+        current_ = pending_;
+        current_.id = next_id_++;
+        return Change::Started;
+    }
+    if (open_ && quiet_ >= frames_for_ms(kOverlapCloseMs)) {
+        open_ = false;
+        current_.end_qpc_100ns = last_overlap_end_100ns_;
+        return Change::Ended;
+    }
+    return Change::None;
+}
+
+bool OverlapTracker::finish() {
+    run_ = 0;
+    if (!open_) {
+        return false;
+    }
+    open_ = false;
+    current_.end_qpc_100ns = last_overlap_end_100ns_;
+    return true;
+}
+
+}  // namespace engine
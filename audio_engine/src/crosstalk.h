@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "fft.h"
+#include "spsc_ring.h"
+
+namespace engine {
+
+// Longest loop-to-mic delay the correlation searches: render buffering plus the acoustic path
+// when Speaker B plays through speakers.
+constexpr int kMaxEchoDelayMs = 40;
+
+// Joint statistics of one mic frame and the loop audio captured over the same interval.
+struct CrosstalkFrame {
+    uint64_t qpc_100ns = 0;
+    bool mic_speech = false;
+    bool loop_speech = false;
+    // Peak normalised cross-correlation of the mic frame with the loop over delays
+    // 0..kMaxEchoDelayMs, and the delay of that peak.
+    float correlation = 0.0f;
+    float delay_ms = 0.0f;
+    // Magnitude-squared coherence at that delay over 300 Hz - 3.4 kHz, smoothed over about
+    // 100 ms; near 1 when the mic hears the loop, near 0 for independent talkers.
+    float coherence = 0.0f;
+    // The mic's speech is the loop's playback picked up again, not a second talker.
+    bool echo = false;
+    // Both speakers are talking.
+    bool overlap = false;
+};
+
+// Compares the mic and loop streams of one engine in a single pass. Both are drift corrected
+// onto the shared QPC timeline, so the loop audio for a mic frame is found by timestamp;
+// loop frames are kept for a little while, and a mic frame is analysed once the loop has
+// covered it (or without it, when the loop has stalled).
+//
+// Frames are 48 kHz capture frames of capture_frame_samples(), fixed when the analyzer is
+// built; kFrameFlagSpeech carries each stream's VAD decision.
+class CrosstalkAnalyzer {
+public:
+    CrosstalkAnalyzer();
+
+    void push_loop(const int16_t *samples, const FrameMeta &meta);
+    // The loop audio pushed so far reaches the end of the mic frame starting at qpc_100ns.
+    bool covers(uint64_t qpc_100ns) const;
+    CrosstalkFrame analyze(const int16_t *mic, const FrameMeta &meta);
+    void reset();
+
+private:
+    struct LoopSpan {
+        uint64_t start_100ns;
+        uint64_t end_100ns;
+        bool speech;
+    };
+
+    // Writes count loop samples from qpc_100ns on; silence where the loop has none.
+    void extract(uint64_t qpc_100ns, size_t count, float *out) const;
+    bool loop_speech(uint64_t start_100ns, uint64_t end_100ns) const;
+    float coherence(const float *mic, const float *loop);
+
+    size_t frame_samples_;
+    // Loop audio from kMaxEchoDelayMs before a mic frame to its end.
+    size_t window_samples_;
+    std::vector<int16_t> history_;
+    // Capture time of history_[0].
+    uint64_t history_qpc_ = 0;
+    std::vector<LoopSpan> spans_;
+
+    RealFft correlation_fft_;
+    std::vector<float> mic_time_, loop_time_, product_;
+    std::vector<float> mic_re_, mic_im_, loop_re_, loop_im_;
+    std::vector<double> loop_energy_;
+
+    RealFft spectrum_fft_;
+    std::vector<float> window_;
+    std::vector<float> frame_;
+    std::vector<float> a_re_, a_im_, b_re_, b_im_;
+    // Smoothed auto- and cross-spectra over the coherence band.
+    std::vector<float> paa_, pbb_, pab_re_, pab_im_;
+    float smoothing_;
+};
+
+// Turns per-frame overlap decisions into overlap periods: one opens after 60 ms of overlapping
+// frames and closes after 200 ms without, so a single misjudged frame neither starts nor ends
+// one.
+class OverlapTracker {
+public:
+    struct Overlap {
+        // 1, 2, ... per engine.
+        uint64_t id = 0;
+        uint64_t start_qpc_100ns = 0;
+        // Just after the last overlapping frame; set once the overlap has ended.
+        uint64_t end_qpc_100ns = 0;
+        size_t frames = 0;
+        // Frames inside the overlap where the mic was judged to hear the loop.
+        size_t echo_frames = 0;
+        float max_correlation = 0.0f;
+        double coherence_sum = 0.0;
+
+        uint64_t duration_ms() const { return (end_qpc_100ns - start_qpc_100ns) / 10000; }
+        float mean_coherence() const { return frames ? static_cast<float>(coherence_sum / frames) : 0.0f; }
+    };
+
+    enum class Change { None, Started, Ended };
+
+    Change update(const CrosstalkFrame &frame);
+    // Ends an open overlap at the last frame seen, e.g. at shutdown.
+    bool finish();
+
+    bool open() const { return open_; }
+    // The open overlap, or the one that ended last.
+    const Overlap &current() const { return current_; }
+
+private:
+    bool open_ = false;
+    // Consecutive frames with and without overlap.
+    size_t run_ = 0;
+    size_t quiet_ = 0;
+    uint64_t last_overlap_end_100ns_ = 0;
+    uint64_t next_id_ = 1;
+    // The run that may open the next overlap.
+    Overlap pending_;
+    Overlap current_;
+};
+
+}  // namespace engine
@@ -0,0 +1,174 @@
+#include "drift.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "audio_format.h"
+
+namespace engine {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr double kTicksPerSecond = 10000000.0;
+constexpr double kSamplesPerTick = kSampleRate / kTicksPerSecond;
+
+// Interpolation kernel: kTaps-point Kaiser-windowed sinc sampled at kPhases fractional offsets.
+constexpr int kTaps = 16;
+constexpr int kPhases = 128;
+constexpr double kCutoff = 0.9;
+constexpr double kKaiserBeta = 6.0;
+
+// Loop gains per packet update, for a critically damped loop settling in about 10 s.
+// Timestamp jitter of a sample or so moves the ratio by a few ppm at most.
+constexpr double kProportionalGain = 4e-6;
+constexpr double kIntegralGain = 2e-9;
+// A ten times wider loop for the first packets pulls in the device offset within seconds.
+constexpr uint64_t kAcquirePackets = 1000;
+constexpr double kAcquireScale = 10.0;
+constexpr double kMaxDrift = 1e-3;
+// Phase errors beyond this (in samples, 10 ms) are re-anchored rather than slewed out.
+constexpr double kResyncSamples = kSampleRate / 100.0;
+
+double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    double half = x * 0.5;
+    for (int k = 1; k < 64; ++k) {
+        term *= (half / k) * (half / k);
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+inline int16_t to_int16(float value) {
+    float scaled = std::lrintf(value);
+    return static_cast<int16_t>(std::min(32767.0f, std::max(-32768.0f, scaled)));
+}
+
+}  // namespace
+
+DriftCorrector::DriftCorrector() : table_(static_cast<size_t>(kPhases + 1) * kTaps) {
+    // Row p interpolates at fractional offset p / kPhases past the sample at tap kTaps/2 - 1.
+    const double window_norm = bessel_i0(kKaiserBeta);
+    for (int p = 0; p <= kPhases; ++p) {
+        double frac = static_cast<double>(p) / kPhases;
+        float *row = table_.data() + static_cast<size_t>(p) * kTaps;
+        double sum = 0.0;
+        for (int j = 0; j < kTaps; ++j) {
+            double d = static_cast<double>(j - (kTaps / 2 - 1)) - frac;
+            double x = kPi * kCutoff * d;
+            double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+            double r = d / (kTaps / 2);
+            double window = std::fabs(r) < 1.0 ? bessel_i0(kKaiserBeta * std::sqrt(1.0 - r * r)) / window_norm : 0.0;
+            row[j] = static_cast<float>(sinc * window);
+            sum += row[j];
+        }
+        for (int j = 0; j < kTaps; ++j) {
+            row[j] = static_cast<float>(row[j] / sum);
+        }
+    }
+    history_.reserve(4 * kMaxFrameSamples);
+    output_.reserve(4 * kMaxFrameSamples);
+}
+
+void DriftCorrector::reset() {
+    history_.clear();
+    history_start_ = 0;
+    in_count_ = 0;
+    started_ = false;
+    position_ = 0.0;
+    origin_qpc_ = 0;
+    out_count_ = 0;
+    integrator_ = 0.0;
+    ratio_ = 1.0;
+    updates_ = 0;
+    output_.clear();
+    resynced_ = false;
+}
+
+uint64_t DriftCorrector::time_of(uint64_t out_index) const {
+    return origin_qpc_ + out_index * 10000000ULL / kSampleRate;
+}
+
+float DriftCorrector::sample_at(double position) const {
+    double base = std::floor(position);
+    double phase = (position - base) * kPhases;
+    int p0 = std::min(kPhases - 1, static_cast<int>(phase));
+    float t = static_cast<float>(phase - p0);
+    const float *row0 = table_.data() + static_cast<size_t>(p0) * kTaps;
+    const float *row1 = row0 + kTaps;
+
+    // Taps before the first buffered sample (stream start) read as silence.
+    int64_t first = static_cast<int64_t>(base) - (kTaps / 2 - 1) - static_cast<int64_t>(history_start_);
+    float acc = 0.0f;
+    for (int j = 0; j < kTaps; ++j) {
+        int64_t index = first + j;
+        if (index < 0) {
+            continue;
+        }
+        float h = row0[j] + t * (row1[j] - row0[j]);
+        acc += h * history_[static_cast<size_t>(index)];
+    }
+    return acc;
+}
+
+size_t DriftCorrector::process(const int16_t *samples, size_t count, uint64_t qpc_100ns) {
+    output_.clear();
+    resynced_ = false;
+    const uint64_t packet_start = in_count_;
+    if (!started_) {
+        started_ = true;
+        origin_qpc_ = qpc_100ns;
+        out_count_ = 0;
+        position_ = static_cast<double>(packet_start);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        history_.push_back(static_cast<float>(samples[i]));
+    }
+    in_count_ += count;
+
+    // Where the next output sample should read from, according to this packet's timestamp.
+    double out_time = static_cast<double>(time_of(out_count_));
+    double target = static_cast<double>(packet_start) + (out_time - static_cast<double>(qpc_100ns)) * kSamplesPerTick;
+    double error = target - position_;
+    if (error < -kResyncSamples) {
+        // Input arrived later than its sample count implies (a capture gap): move the
+        // output timeline forward to meet it.
+        double offset = (position_ - static_cast<double>(packet_start)) / kSamplesPerTick;
+        origin_qpc_ = static_cast<uint64_t>(static_cast<double>(qpc_100ns) + offset);
+        out_count_ = 0;
+        resynced_ = true;
+    } else if (error > kResyncSamples) {
+        // The output fell behind the input: skip ahead rather than slew for seconds.
+        position_ = target;
+        resynced_ = true;
+    } else {
+        double scale = updates_ < kAcquirePackets ? kAcquireScale : 1.0;
+        ++updates_;
+        integrator_ = std::clamp(integrator_ + scale * scale * kIntegralGain * error, -kMaxDrift, kMaxDrift);
+        ratio_ = std::clamp(1.0 + integrator_ + scale * kProportionalGain * error, 1.0 - kMaxDrift, 1.0 + kMaxDrift);
+    }
+
+    output_qpc_ = time_of(out_count_);
+    const double limit = static_cast<double>(in_count_) - kTaps / 2;
+    while (position_ < limit) {
+        output_.push_back(to_int16(sample_at(position_)));
+        position_ += ratio_;
+        ++out_count_;
+    }
+
+    // Keep only the history the next output sample's taps can reach.
+    int64_t first_tap = static_cast<int64_t>(std::floor(position_)) - (kTaps / 2 - 1);
+    if (first_tap > static_cast<int64_t>(history_start_)) {
+        size_t drop = static_cast<size_t>(
+            std::min<uint64_t>(static_cast<uint64_t>(first_tap) - history_start_, history_.size()));
+        history_.erase(history_.begin(), history_.begin() + static_cast<std::ptrdiff_t>(drop));
+        history_start_ += drop;
+    }
+    return output_.size();
+}
+
+}  // namespace engine
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace engine {
+
+// Locks one capture stream to the QPC timeline shared by every stream in the engine.
+//
+// Each endpoint runs on its own hardware clock, so over an hour a mic and a render device
+// can drift hundreds of milliseconds apart. Every WASAPI packet carries the QPC time of its
+// first sample; a second-order phase-locked loop compares that against the time of the next
+// output sample and steers the resampling ratio, so output sample k always lands at
+// origin + k / kSampleRate on the QPC clock. Output timestamps are therefore exact and
+// strictly increasing. A gap in the input moves the origin forward; an input burst that
+// runs far ahead is skipped; both are reported through resynced().
+class DriftCorrector {
+public:
+    DriftCorrector();
+
+    // Consumes one packet captured at qpc_100ns and returns the number of corrected samples
+    // now in output(), the first of which is at output_qpc().
+    size_t process(const int16_t *samples, size_t count, uint64_t qpc_100ns);
+    void reset();
+
+    const int16_t *output() const { return output_.data(); }
+    uint64_t output_qpc() const { return output_qpc_; }
+    // The last process() call re-anchored instead of slewing.
+    bool resynced() const { return resynced_; }
+    // Device clock relative to QPC, in parts per million.
+    double drift_ppm() const { return (ratio_ - 1.0) * 1e6; }
+
+private:
+    float sample_at(double position) const;
+    uint64_t time_of(uint64_t out_index) const;
+
+    std::vector<float> table_;
+    std::vector<float> history_;
+    uint64_t history_start_ = 0;  // input index of history_[0]
+    uint64_t in_count_ = 0;
+
+    bool started_ = false;
+    double position_ = 0.0;  // input index of the next output sample
+    uint64_t origin_qpc_ = 0;
+    uint64_t out_count_ = 0;  // output samples since origin_qpc_
+    double integrator_ = 0.0;
+    double ratio_ = 1.0;
+    uint64_t updates_ = 0;
+
+    std::vector<int16_t> output_;
+    uint64_t output_qpc_ = 0;
+    bool resynced_ = false;
+};
+
+}  // namespace engine
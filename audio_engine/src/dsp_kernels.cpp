@@ -0,0 +1,555 @@
+#include "dsp_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ENGINE_DSP_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC emits any intrinsic regardless of /arch; dispatch keeps them off CPUs without them.
+#define ENGINE_TARGET(isa)
+#else
+#include <cpuid.h>
+#define ENGINE_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace engine {
+namespace {
+
+constexpr float kScale = 32768.0f;
+constexpr float kMax = 32767.0f;
+constexpr float kMin = -32768.0f;
+constexpr int kFullScale = 32767;
+
+struct Kernels {
+    void (*float_to_int16)(const float *, int16_t *, size_t, float);
+    void (*int16_to_float)(const int16_t *, float *, size_t, float);
+    void (*apply_gain)(int16_t *, size_t, float);
+    void (*mix_int16)(const int16_t *, const int16_t *, int16_t *, size_t);
+    void (*downmix_stereo)(const float *, size_t, int16_t *);
+    void (*accumulate_levels)(const int16_t *, size_t, LevelSums &);
+};
+
+// Scalar kernels: the reference behaviour, and the tail of every vector loop.
+namespace scalar {
+
+inline int16_t saturate(float scaled) {
+    return static_cast<int16_t>(std::lrintf(std::min(kMax, std::max(kMin, scaled))));
+}
+
+void float_to_int16(const float *in, int16_t *out, size_t count, float gain) {
+    const float scale = gain * kScale;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = saturate(in[i] * scale);
+    }
+}
+
+void int16_to_float(const int16_t *in, float *out, size_t count, float gain) {
+    const float scale = gain / kScale;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = static_cast<float>(in[i]) * scale;
+    }
+}
+
+void apply_gain(int16_t *samples, size_t count, float gain) {
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = saturate(static_cast<float>(samples[i]) * gain);
+    }
+}
+
+void mix_int16(const int16_t *a, const int16_t *b, int16_t *out, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = static_cast<int16_t>(std::min(32767, std::max(-32768, a[i] + b[i])));
+    }
+}
+
+void downmix_stereo(const float *in, size_t frames, int16_t *out) {
+    const float scale = 0.5f * kScale;
+    for (size_t i = 0; i < frames; ++i) {
+        out[i] = saturate((in[2 * i] + in[2 * i + 1]) * scale);
+    }
+}
+
+void accumulate_levels(const int16_t *samples, size_t count, LevelSums &sums) {
+    for (size_t i = 0; i < count; ++i) {
+        const int magnitude = std::min(std::abs(static_cast<int>(samples[i])), kFullScale);
+        sums.sum_squares += static_cast<uint64_t>(static_cast<int64_t>(samples[i]) * samples[i]);
+        sums.peak = std::max(sums.peak, magnitude);
+        sums.clipped += magnitude >= kFullScale ? 1u : 0u;
+    }
+}
+
+}  // namespace scalar
+
+#if defined(ENGINE_DSP_X86)
+
+// The level kernels square with madd: a lane pair sums to at most 2^31, which only fits when
+// read as unsigned, so the products are widened to 64-bit before accumulating. Magnitudes come
+// from a saturating 0 - x so that -32768 maps to 32767 and is counted as clipped.
+
+// Conversions clamp in float first: out-of-range cvtps yields INT_MIN, which would wrap a
+// loud positive sample to full-scale negative. cvtps rounds to nearest under the default
+// MXCSR, matching lrintf.
+namespace sse2 {
+
+ENGINE_TARGET("sse2") inline __m128i to_int32(__m128 scaled) {
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(scaled, _mm_set1_ps(kMin)), _mm_set1_ps(kMax)));
+}
+
+ENGINE_TARGET("sse2") inline void store8(int16_t *out, __m128 lo, __m128 hi) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packs_epi32(to_int32(lo), to_int32(hi)));
+}
+
+ENGINE_TARGET("sse2") inline void load8(const int16_t *in, __m128 &lo, __m128 &hi) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    // Sign-extend by placing each sample in the top half of a 32-bit lane and shifting down.
+    lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+    hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+}
+
+ENGINE_TARGET("sse2") void float_to_int16(const float *in, int16_t *out, size_t count, float gain) {
+    const __m128 scale = _mm_set1_ps(gain * kScale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        store8(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), scale), _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale));
+    }
+    scalar::float_to_int16(in + i, out + i, count - i, gain);
+}
+
+ENGINE_TARGET("sse2") void int16_to_float(const int16_t *in, float *out, size_t count, float gain) {
+    const __m128 scale = _mm_set1_ps(gain / kScale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 lo;
+        __m128 hi;
+        load8(in + i, lo, hi);
+        _mm_storeu_ps(out + i, _mm_mul_ps(lo, scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(hi, scale));
+    }
+    scalar::int16_to_float(in + i, out + i, count - i, gain);
+}
+
+ENGINE_TARGET("sse2") void apply_gain(int16_t *samples, size_t count, float gain) {
+    const __m128 scale = _mm_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 lo;
+        __m128 hi;
+        load8(samples + i, lo, hi);
+        store8(samples + i, _mm_mul_ps(lo, scale), _mm_mul_ps(hi, scale));
+    }
+    scalar::apply_gain(samples + i, count - i, gain);
+}
+
+ENGINE_TARGET("sse2") void mix_int16(const int16_t *a, const int16_t *b, int16_t *out, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_adds_epi16(x, y));
+    }
+    scalar::mix_int16(a + i, b + i, out + i, count - i);
+}
+
+ENGINE_TARGET("sse2") void downmix_stereo(const float *in, size_t frames, int16_t *out) {
+    const __m128 scale = _mm_set1_ps(0.5f * kScale);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128 mono[2];
+        for (int half = 0; half < 2; ++half) {
+            const float *p = in + 2 * (i + 4 * half);
+            __m128 a = _mm_loadu_ps(p);
+            __m128 b = _mm_loadu_ps(p + 4);
+            __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            mono[half] = _mm_mul_ps(_mm_add_ps(left, right), scale);
+        }
+        store8(out + i, mono[0], mono[1]);
+    }
+    scalar::downmix_stereo(in + 2 * i, frames - i, out + i);
+}
+
+ENGINE_TARGET("sse2") void accumulate_levels(const int16_t *samples, size_t count, LevelSums &sums) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i full = _mm_set1_epi16(kFullScale);
+    __m128i sum = zero;
+    __m128i peak = zero;
+    __m128i clipped = zero;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + i));
+        __m128i squares = _mm_madd_epi16(x, x);
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(squares, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(squares, zero));
+        __m128i magnitude = _mm_max_epi16(x, _mm_subs_epi16(zero, x));
+        peak = _mm_max_epi16(peak, magnitude);
+        clipped = _mm_sub_epi32(clipped, _mm_madd_epi16(_mm_cmpeq_epi16(magnitude, full), ones));
+    }
+
+    alignas(16) uint64_t lanes_sum[2];
+    alignas(16) int16_t lanes_peak[8];
+    alignas(16) uint32_t lanes_clipped[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes_sum), sum);
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes_peak), peak);
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes_clipped), clipped);
+    for (uint64_t s : lanes_sum) {
+        sums.sum_squares += s;
+    }
+    for (int16_t p : lanes_peak) {
+        sums.peak = std::max(sums.peak, static_cast<int>(p));
+    }
+    for (uint32_t c : lanes_clipped) {
+        sums.clipped += c;
+    }
+    scalar::accumulate_levels(samples + i, count - i, sums);
+}
+
+}  // namespace sse2
+
+namespace avx2 {
+
+ENGINE_TARGET("avx2") inline __m256i to_int32(__m256 scaled) {
+    return _mm256_cvtps_epi32(
+        _mm256_min_ps(_mm256_max_ps(scaled, _mm256_set1_ps(kMin)), _mm256_set1_ps(kMax)));
+}
+
+ENGINE_TARGET("avx2") inline void store16(int16_t *out, __m256 lo, __m256 hi) {
+    // packs works per 128-bit lane; the permute restores sample order.
+    __m256i packed = _mm256_packs_epi32(to_int32(lo), to_int32(hi));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permute4x64_epi64(packed, 0xD8));
+}
+
+ENGINE_TARGET("avx2") inline void load16(const int16_t *in, __m256 &lo, __m256 &hi) {
+    lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in))));
+    hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 8))));
+}
+
+ENGINE_TARGET("avx2") void float_to_int16(const float *in, int16_t *out, size_t count, float gain) {
+    const __m256 scale = _mm256_set1_ps(gain * kScale);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        store16(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), scale),
+                _mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale));
+    }
+    scalar::float_to_int16(in + i, out + i, count - i, gain);
+}
+
+ENGINE_TARGET("avx2") void int16_to_float(const int16_t *in, float *out, size_t count, float gain) {
+    const __m256 scale = _mm256_set1_ps(gain / kScale);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 lo;
+        __m256 hi;
+        load16(in + i, lo, hi);
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(lo, scale));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(hi, scale));
+    }
+    scalar::int16_to_float(in + i, out + i, count - i, gain);
+}
+
+ENGINE_TARGET("avx2") void apply_gain(int16_t *samples, size_t count, float gain) {
+    const __m256 scale = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 lo;
+        __m256 hi;
+        load16(samples + i, lo, hi);
+        store16(samples + i, _mm256_mul_ps(lo, scale), _mm256_mul_ps(hi, scale));
+    }
+    scalar::apply_gain(samples + i, count - i, gain);
+}
+
+ENGINE_TARGET("avx2") void mix_int16(const int16_t *a, const int16_t *b, int16_t *out, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_adds_epi16(x, y));
+    }
+    scalar::mix_int16(a + i, b + i, out + i, count - i);
+}
+
+ENGINE_TARGET("avx2") void downmix_stereo(const float *in, size_t frames, int16_t *out) {
+    const __m256 scale = _mm256_set1_ps(0.5f * kScale);
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m256 mono[2];
+        for (int half = 0; half < 2; ++half) {
+            const float *p = in + 2 * (i + 8 * half);
+            __m256 a = _mm256_loadu_ps(p);
+            __m256 b = _mm256_loadu_ps(p + 8);
+            // Per lane: L0 L1 L4 L5 | L2 L3 L6 L7; the 64-bit permute puts them in order.
+            __m256 left = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m256 right = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            __m256 sum = _mm256_add_ps(left, right);
+            sum = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sum), 0xD8));
+            mono[half] = _mm256_mul_ps(sum, scale);
+        }
+        store16(out + i, mono[0], mono[1]);
+    }
+    scalar::downmix_stereo(in + 2 * i, frames - i, out + i);
+}
+
+ENGINE_TARGET("avx2") void accumulate_levels(const int16_t *samples, size_t count, LevelSums &sums) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i full = _mm256_set1_epi16(kFullScale);
+    __m256i sum = zero;
+    __m256i peak = zero;
+    __m256i clipped = zero;
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(samples + i));
+        __m256i squares = _mm256_madd_epi16(x, x);
+        sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(squares, zero));
+        sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(squares, zero));
+        __m256i magnitude = _mm256_max_epi16(x, _mm256_subs_epi16(zero, x));
+        peak = _mm256_max_epi16(peak, magnitude);
+        clipped = _mm256_sub_epi32(clipped, _mm256_madd_epi16(_mm256_cmpeq_epi16(magnitude, full), ones));
+    }
+
+    alignas(32) uint64_t lanes_sum[4];
+    alignas(32) int16_t lanes_peak[16];
+    alignas(32) uint32_t lanes_clipped[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes_sum), sum);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes_peak), peak);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes_clipped), clipped);
+    for (uint64_t s : lanes_sum) {
+        sums.sum_squares += s;
+    }
+    for (int16_t p : lanes_peak) {
+        sums.peak = std::max(sums.peak, static_cast<int>(p));
+    }
+    for (uint32_t c : lanes_clipped) {
+        sums.clipped += c;
+    }
+    scalar::accumulate_levels(samples + i, count - i, sums);
+}
+
+}  // namespace avx2
+
+namespace avx512 {
+
+ENGINE_TARGET("avx512f") inline void store16(int16_t *out, __m512 scaled) {
+    __m512i x = _mm512_cvtps_epi32(
+        _mm512_min_ps(_mm512_max_ps(scaled, _mm512_set1_ps(kMin)), _mm512_set1_ps(kMax)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm512_cvtepi32_epi16(x));
+}
+
+ENGINE_TARGET("avx512f") inline __m512 load16(const int16_t *in) {
+    return _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in))));
+}
+
+ENGINE_TARGET("avx512f") void float_to_int16(const float *in, int16_t *out, size_t count, float gain) {
+    const __m512 scale = _mm512_set1_ps(gain * kScale);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        store16(out + i, _mm512_mul_ps(_mm512_loadu_ps(in + i), scale));
+    }
+    scalar::float_to_int16(in + i, out + i, count - i, gain);
+}
+
+ENGINE_TARGET("avx512f") void int16_to_float(const int16_t *in, float *out, size_t count, float gain) {
+    const __m512 scale = _mm512_set1_ps(gain / kScale);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(load16(in + i), scale));
+    }
+    scalar::int16_to_float(in + i, out + i, count - i, gain);
+}
+
+ENGINE_TARGET("avx512f") void apply_gain(int16_t *samples, size_t count, float gain) {
+    const __m512 scale = _mm512_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        store16(samples + i, _mm512_mul_ps(load16(samples + i), scale));
+    }
+    scalar::apply_gain(samples + i, count - i, gain);
+}
+
+ENGINE_TARGET("avx512bw") void mix_int16(const int16_t *a, const int16_t *b, int16_t *out, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m512i x = _mm512_loadu_si512(a + i);
+        __m512i y = _mm512_loadu_si512(b + i);
+        _mm512_storeu_si512(out + i, _mm512_adds_epi16(x, y));
+    }
+    scalar::mix_int16(a + i, b + i, out + i, count - i);
+}
+
+ENGINE_TARGET("avx512f") void downmix_stereo(const float *in, size_t frames, int16_t *out) {
+    const __m512 scale = _mm512_set1_ps(0.5f * kScale);
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m512 a = _mm512_loadu_ps(in + 2 * i);
+        __m512 b = _mm512_loadu_ps(in + 2 * i + 16);
+        __m512 sum = _mm512_add_ps(_mm512_permutex2var_ps(a, even, b), _mm512_permutex2var_ps(a, odd, b));
+        store16(out + i, _mm512_mul_ps(sum, scale));
+    }
+    scalar::downmix_stereo(in + 2 * i, frames - i, out + i);
+}
+
+}  // namespace avx512
+
+void cpuid(int leaf, int subleaf, unsigned regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int out[4];
+    __cpuidex(out, leaf, subleaf);
+    for (int i = 0; i < 4; ++i) {
+        regs[i] = static_cast<unsigned>(out[i]);
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// XCR0: which register states the OS saves on a context switch.
+uint64_t xgetbv0() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    unsigned lo = 0;
+    unsigned hi = 0;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+}
+
+SimdLevel detect() {
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    const unsigned max_leaf = regs[0];
+    cpuid(1, 0, regs);
+    if (!(regs[3] & (1u << 26))) {
+        return SimdLevel::Scalar;
+    }
+    const bool osxsave = (regs[2] & (1u << 27)) != 0;
+    if (!osxsave || max_leaf < 7) {
+        return SimdLevel::Sse2;
+    }
+    const uint64_t xcr0 = xgetbv0();
+    cpuid(7, 0, regs);
+    const bool avx2 = (regs[1] & (1u << 5)) && (xcr0 & 0x6) == 0x6;
+    const bool avx512 = (regs[1] & (1u << 16)) && (regs[1] & (1u << 30)) && (xcr0 & 0xE6) == 0xE6;
+    if (avx2 && avx512) {
+        return SimdLevel::Avx512;
+    }
+    return avx2 ? SimdLevel::Avx2 : SimdLevel::Sse2;
+}
+
+#else
+
+SimdLevel detect() {
+    return SimdLevel::Scalar;
+}
+
+#endif
+
+Kernels kernels_for(SimdLevel level) {
+    switch (level) {
+#if defined(ENGINE_DSP_X86)
+    // The level meter gains nothing from 512-bit lanes on a frame; AVX-512 CPUs run the AVX2 one.
+    case SimdLevel::Avx512:
+        return {avx512::float_to_int16, avx512::int16_to_float, avx512::apply_gain, avx512::mix_int16,
+                avx512::downmix_stereo, avx2::accumulate_levels};
+    case SimdLevel::Avx2:
+        return {avx2::float_to_int16, avx2::int16_to_float, avx2::apply_gain, avx2::mix_int16,
+                avx2::downmix_stereo, avx2::accumulate_levels};
+    case SimdLevel::Sse2:
+        return {sse2::float_to_int16, sse2::int16_to_float, sse2::apply_gain, sse2::mix_int16,
+                sse2::downmix_stereo, sse2::accumulate_levels};
+#endif
+    default:
+        return {scalar::float_to_int16, scalar::int16_to_float, scalar::apply_gain, scalar::mix_int16,
+                scalar::downmix_stereo, scalar::accumulate_levels};
+    }
+}
+
+struct Dispatch {
+    SimdLevel detected = detect();
+    SimdLevel level = detected;
+    Kernels kernels = kernels_for(level);
+};
+
+Dispatch &dispatch() {
+    static Dispatch instance;
+    return instance;
+}
+
+}  // namespace
+
+SimdLevel simd_level() {
+    return dispatch().level;
+}
+
+SimdLevel detected_simd_level() {
+    return dispatch().detected;
+}
+
+const char *simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Sse2:
+        return "sse2";
+    case SimdLevel::Avx2:
+        return "avx2";
+    case SimdLevel::Avx512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+void set_simd_level(SimdLevel level) {
+    Dispatch &d = dispatch();
+    d.level = std::min(level, d.detected);
+    d.kernels = kernels_for(d.level);
+}
+
+void float_to_int16(const float *in, int16_t *out, size_t count, float gain) {
+    dispatch().kernels.float_to_int16(in, out, count, gain);
+}
+
+void int16_to_float(const int16_t *in, float *out, size_t count, float gain) {
+    dispatch().kernels.int16_to_float(in, out, count, gain);
+}
+
+void apply_gain(int16_t *samples, size_t count, float gain) {
+    dispatch().kernels.apply_gain(samples, count, gain);
+}
+
+void mix_int16(const int16_t *a, const int16_t *b, int16_t *out, size_t count) {
+    dispatch().kernels.mix_int16(a, b, out, count);
+}
+
+void accumulate_levels(const int16_t *samples, size_t count, LevelSums &sums) {
+    dispatch().kernels.accumulate_levels(samples, count, sums);
+}
+
+void downmix_to_int16(const float *interleaved, size_t frames, int channels, int16_t *out) {
+    if (channels == 1) {
+        float_to_int16(interleaved, out, frames);
+        return;
+    }
+    if (channels == 2) {
+        dispatch().kernels.downmix_stereo(interleaved, frames, out);
+        return;
+    }
+    const float scale = kScale / static_cast<float>(channels);
+    for (size_t i = 0; i < frames; ++i) {
+        const float *frame = interleaved + i * static_cast<size_t>(channels);
+        float sum = 0.0f;
+        for (int ch = 0; ch < channels; ++ch) {
+            sum += frame[ch];
+        }
+        out[i] = scalar::saturate(sum * scale);
+    }
+}
+
+}  // namespace engine
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace engine {
+
+// Per-sample conversion and mixing kernels for the capture path. Each has scalar, SSE2, AVX2
+// and AVX-512 variants; the widest one the CPU and OS support is picked by CPUID on first use,
+// so one binary runs everywhere and still uses the wide units where they exist.
+//
+// int16 <-> float uses the same scale as the rest of the engine: full scale is 32768, float
+// to int16 rounds to nearest and saturates (NaN becomes -32768).
+
+enum class SimdLevel {
+    Scalar,
+    Sse2,
+    Avx2,
+    // AVX-512 F and BW.
+    Avx512,
+};
+
+// The level the kernels currently dispatch to.
+SimdLevel simd_level();
+// The widest level this CPU supports.
+SimdLevel detected_simd_level();
+const char *simd_level_name(SimdLevel level);
+// Selects a narrower level, e.g. for the bench; anything above detected_simd_level() is
+// clamped to it. Call before starting the threads that use the kernels.
+void set_simd_level(SimdLevel level);
+
+// out[i] = saturate(in[i] * gain * 32768)
+void float_to_int16(const float *in, int16_t *out, size_t count, float gain = 1.0f);
+// out[i] = in[i] * gain / 32768
+void int16_to_float(const int16_t *in, float *out, size_t count, float gain = 1.0f);
+// samples[i] = saturate(samples[i] * gain), in place.
+void apply_gain(int16_t *samples, size_t count, float gain);
+// out[i] = saturate(a[i] + b[i]); out may alias a or b.
+void mix_int16(const int16_t *a, const int16_t *b, int16_t *out, size_t count);
+// Averages the channels of interleaved float frames into mono int16; 1 and 2 channels take
+// the vector paths.
+void downmix_to_int16(const float *interleaved, size_t frames, int channels, int16_t *out);
+
+// Running level statistics over int16 samples (see levels.h).
+struct LevelSums {
+    uint64_t sum_squares = 0;
+    // Largest |sample|, saturated at 32767, so -32768 counts as full scale.
+    int peak = 0;
+    // Samples at full scale.
+    uint32_t clipped = 0;
+};
+// Adds count samples to sums. AVX-512 CPUs run the AVX2 variant.
+void accumulate_levels(const int16_t *samples, size_t count, LevelSums &sums);
+
+}  // namespace engine
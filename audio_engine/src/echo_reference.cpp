@@ -0,0 +1,95 @@
+#include "echo_reference.h"
+
+#include <algorithm>
+
+#include "audio_format.h"
+
+namespace engine {
+namespace {
+
+// Chunks whose timestamp is further than this from where the previous one ended start a new
+// timeline (a loop device glitch or restart) instead of being appended.
+constexpr uint64_t kRealign100ns = 20000;  // 2 ms
+// Loop reference held ahead of the mic: WASAPI packets plus the canceller's one-frame hold.
+constexpr int kMaxPendingMs = 80;
+
+uint64_t samples_to_100ns(size_t samples) {
+    return static_cast<uint64_t>(samples) * 10000000ULL / kSampleRate;
+}
+
+size_t duration_to_samples(uint64_t duration_100ns) {
+    return static_cast<size_t>(duration_100ns * kSampleRate / 10000000ULL);
+}
+
+}  // namespace
+
+EchoTap::EchoTap(FrameRing &ring) : ring_(ring), chunk_(ring.frame_samples(), 0) {}
+
+void EchoTap::write(const int16_t *samples, size_t count, uint64_t qpc_100ns) {
+    while (count > 0) {
+        if (fill_ == 0) {
+            meta_.qpc_100ns = qpc_100ns;
+        }
+        size_t n = std::min(count, chunk_.size() - fill_);
+        std::copy(samples, samples + n, chunk_.begin() + fill_);
+        fill_ += n;
+        samples += n;
+        count -= n;
+        qpc_100ns += samples_to_100ns(n);
+        if (fill_ == chunk_.size()) {
+            fill_ = 0;
+            ring_.push(chunk_.data(), meta_);
+            ++meta_.sequence;
+        }
+    }
+}
+
+EchoReference::EchoReference(FrameRing &ring)
+    : ring_(ring),
+      chunk_(ring.frame_samples(), 0),
+      max_pending_(frames_for_ms(kMaxPendingMs) * static_cast<size_t>(capture_frame_samples())) {
+    pending_.reserve(max_pending_ + chunk_.size());
+}
+
+void EchoReference::drain() {
+    FrameMeta meta;
+    while (ring_.pop(chunk_.data(), meta)) {
+        uint64_t expected = pending_qpc_ + samples_to_100ns(pending_.size());
+        uint64_t skew = meta.qpc_100ns > expected ? meta.qpc_100ns - expected : expected - meta.qpc_100ns;
+        if (pending_.empty() || skew > kRealign100ns) {
+            pending_.clear();
+            pending_qpc_ = meta.qpc_100ns;
+        }
+        pending_.insert(pending_.end(), chunk_.begin(), chunk_.end());
+        if (pending_.size() > max_pending_) {
+            discard_front(pending_.size() - max_pending_);
+        }
+    }
+}
+
+void EchoReference::discard_front(size_t count) {
+    count = std::min(count, pending_.size());
+    pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(count));
+    pending_qpc_ += samples_to_100ns(count);
+}
+
+void EchoReference::fill(uint64_t qpc_100ns, int16_t *out, size_t count) {
+    drain();
+
+    if (!pending_.empty() && pending_qpc_ < qpc_100ns) {
+        discard_front(duration_to_samples(qpc_100ns - pending_qpc_));
+    }
+
+    // Reference that starts after the frame (or is missing) leaves leading silence.
+    size_t lead = count;
+    if (!pending_.empty()) {
+        lead = pending_qpc_ > qpc_100ns ? std::min(count, duration_to_samples(pending_qpc_ - qpc_100ns)) : 0;
+    }
+    std::fill(out, out + lead, static_cast<int16_t>(0));
+    size_t available = lead < count ? std::min(count - lead, pending_.size()) : 0;
+    std::copy(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(available), out + lead);
+    std::fill(out + lead + available, out + count, static_cast<int16_t>(0));
+    discard_front(available);
+}
+
+}  // namespace engine
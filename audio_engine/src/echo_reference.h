@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "spsc_ring.h"
+
+namespace engine {
+
+// Loopback side of --aec: slices the 48 kHz loop capture into short chunks for the mic thread.
+// Chunks are pushed as packets arrive rather than per frame, so the reference for a
+// mic frame is available soon after the mic frame itself.
+class EchoTap {
+public:
+    explicit EchoTap(FrameRing &ring);
+
+    void write(const int16_t *samples, size_t count, uint64_t qpc_100ns);
+    void reset() { fill_ = 0; }
+
+private:
+    FrameRing &ring_;
+    std::vector<int16_t> chunk_;
+    FrameMeta meta_;
+    size_t fill_ = 0;
+};
+
+// Mic side of --aec: hands out loop samples lined up with mic frames by capture timestamp.
+// Both streams carry the same QPC clock, so the reference for a mic frame is the loop audio
+// captured at the same instant; the echo canceller models the render and acoustic delay.
+class EchoReference {
+public:
+    explicit EchoReference(FrameRing &ring);
+
+    // Writes count reference samples starting at qpc_100ns; silence where the loop has none.
+    void fill(uint64_t qpc_100ns, int16_t *out, size_t count);
+
+private:
+    void drain();
+    void discard_front(size_t count);
+
+    FrameRing &ring_;
+    std::vector<int16_t> chunk_;
+    std::vector<int16_t> pending_;
+    // Reference kept ahead of the mic: a few frames.
+    size_t max_pending_;
+    // Capture time of pending_[0].
+    uint64_t pending_qpc_ = 0;
+};
+
+}  // namespace engine
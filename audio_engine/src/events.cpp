@@ -0,0 +1,58 @@
+#include "events.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace engine {
+
+EventLog::EventLog(size_t capacity) : capacity_(capacity) {}
+
+uint64_t EventLog::publish(const std::string &type, const std::string &fields) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint64_t id = first_id_ + events_.size();
+    std::string event = "{\"id\":" + std::to_string(id) + ",\"type\":" + json_string(type);
+    if (!fields.empty()) {
+        event += ',';
+        event += fields;
+    }
+    events_.push_back(event + "}");
+    if (events_.size() > capacity_) {
+        events_.pop_front();
+        ++first_id_;
+    }
+    return id;
+}
+
+uint64_t EventLog::since(uint64_t id, std::vector<std::string> &out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint64_t last = first_id_ + events_.size() - 1;
+    for (uint64_t next = std::max(id + 1, first_id_); next <= last; ++next) {
+        out.push_back(events_[static_cast<size_t>(next - first_id_)]);
+    }
+    return std::max(id, last);
+}
+
+uint64_t EventLog::last_id() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return first_id_ + events_.size() - 1;
+}
+
+std::string json_string(const std::string &value) {
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            // Control characters would break the one-event-per-line framing.
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+}  // namespace engine
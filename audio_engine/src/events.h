@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace engine {
+
+// Bounded log of engine events (transcripts and the like) for control clients that
+// subscribe. Each event is one JSON object line with an "id" that increases by one, so a
+// subscriber that fell more than capacity events behind sees the jump.
+class EventLog {
+public:
+    explicit EventLog(size_t capacity);
+
+    // Adds {"id":N,"type":"<type>",<fields>} and returns N. fields is the body of a JSON
+    // object without braces, or empty.
+    uint64_t publish(const std::string &type, const std::string &fields);
+
+    // Appends the events after id to out, oldest first, and returns the id of the newest one
+    // (id itself when there is nothing new).
+    uint64_t since(uint64_t id, std::vector<std::string> &out) const;
+    uint64_t last_id() const;
+
+private:
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::deque<std::string> events_;
+    // Id of events_.front(); ids start at 1 so 0 means "before the first event".
+    uint64_t first_id_ = 1;
+};
+
+// A JSON string literal for value, quotes included.
+std::string json_string(const std::string &value);
+
+}  // namespace engine
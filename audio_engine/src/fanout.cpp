@@ -0,0 +1,109 @@
+#include "fanout.h"
+
+#include <algorithm>
+
+namespace engine {
+
+Subscriber::Subscriber(size_t capacity, DropPolicy policy, std::function<void()> notify)
+    : policy_(policy), notify_(std::move(notify)), slots_(std::max<size_t>(capacity, 1)) {}
+
+void Subscriber::offer(const FrameRef &frame) {
+    FrameRef released;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count_ == slots_.size()) {
+            ++drops_;
+            if (policy_ == DropPolicy::Newest) {
+                return;
+            }
+            // The dropped reference is released after unlocking; it may free the frame.
+            released = std::move(slots_[first_]);
+            first_ = (first_ + 1) % slots_.size();
+            --count_;
+        }
+        slots_[(first_ + count_) % slots_.size()] = frame;
+        ++count_;
+    }
+    if (notify_) {
+        notify_();
+    }
+}
+
+bool Subscriber::pop(FrameRef &out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0) {
+        return false;
+    }
+    out = std::move(slots_[first_]);
+    first_ = (first_ + 1) % slots_.size();
+    --count_;
+    return true;
+}
+
+void Subscriber::poke() {
+    if (notify_) {
+        notify_();
+    }
+}
+
+uint64_t Subscriber::drops() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return drops_;
+}
+
+size_t Subscriber::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+}
+
+std::shared_ptr<Subscriber> FanOut::subscribe(size_t capacity, DropPolicy policy, std::function<void()> notify) {
+    auto subscriber = std::make_shared<Subscriber>(capacity, policy, std::move(notify));
+    std::lock_guard<std::mutex> lock(mutex_);
+    subscribers_.push_back(subscriber);
+    return subscriber;
+}
+
+void FanOut::unsubscribe(const std::shared_ptr<Subscriber> &subscriber) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find(subscribers_.begin(), subscribers_.end(), subscriber);
+    if (it != subscribers_.end()) {
+        retired_drops_ += subscriber->drops();
+        subscribers_.erase(it);
+    }
+}
+
+void FanOut::publish(const FrameRef &frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &subscriber : subscribers_) {
+        subscriber->offer(frame);
+    }
+}
+
+void FanOut::poke_all() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &subscriber : subscribers_) {
+        subscriber->poke();
+    }
+}
+
+size_t FanOut::subscribers() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return subscribers_.size();
+}
+
+uint64_t FanOut::drops() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t total = retired_drops_;
+    for (const auto &subscriber : subscribers_) {
+        total += subscriber->drops();
+    }
+    return total;
+}
+
+bool FanOut::any_full() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::any_of(subscribers_.begin(), subscribers_.end(),
+                       [](const std::shared_ptr<Subscriber> &s) { return s->queued() >= s->capacity(); });
+}
+
+}  // namespace engine
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "frame_pool.h"
+
+namespace engine {
+
+// What a full subscriber queue does with the next frame.
+enum class DropPolicy {
+    // Discard the oldest queued frame: the subscriber stays live (ASR, meters).
+    Oldest,
+    // Discard the incoming frame: the subscriber keeps a contiguous backlog (recorders).
+    Newest,
+};
+
+// Bounded per-subscriber queue of frame references. The publisher only ever holds the lock
+// for an O(1) push, so a subscriber stuck in send() cannot slow the publisher down.
+class Subscriber {
+public:
+    // notify runs on the publishing thread after each offer(), outside the queue lock.
+    Subscriber(size_t capacity, DropPolicy policy, std::function<void()> notify);
+
+    Subscriber(const Subscriber &) = delete;
+    Subscriber &operator=(const Subscriber &) = delete;
+
+    // Publisher side; never blocks on the subscriber.
+    void offer(const FrameRef &frame);
+
+    // Subscriber side. Returns false when the queue is empty.
+    bool pop(FrameRef &out);
+    // Runs notify without a frame, so the subscriber can act on time alone.
+    void poke();
+
+    uint64_t drops() const;
+    size_t queued() const;
+    size_t capacity() const { return slots_.size(); }
+
+private:
+    const DropPolicy policy_;
+    std::function<void()> notify_;
+    mutable std::mutex mutex_;
+    std::vector<FrameRef> slots_;
+    size_t first_ = 0;
+    size_t count_ = 0;
+    uint64_t drops_ = 0;
+};
+
+// Hands every published frame to all current subscribers without copying the samples.
+class FanOut {
+public:
+    std::shared_ptr<Subscriber> subscribe(size_t capacity, DropPolicy policy, std::function<void()> notify);
+    // Once this returns no further notify call for the subscriber is running or will follow.
+    void unsubscribe(const std::shared_ptr<Subscriber> &subscriber);
+
+    void publish(const FrameRef &frame);
+    size_t subscribers() const;
+    // Frames dropped by full queues, including those of subscribers that have since left.
+    uint64_t drops() const;
+    // True when some subscriber's queue is full, i.e. the next publish would drop.
+    bool any_full() const;
+    // Pokes every subscriber; the publisher calls it while idle, so batching senders can flush.
+    void poke_all();
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<Subscriber>> subscribers_;
+    uint64_t retired_drops_ = 0;
+};
+
+}  // namespace engine
@@ -0,0 +1,371 @@
+#include "fft.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define ENGINE_FFT_SSE 1
+#endif
+
+namespace engine {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Lane types for the MixedRadixFft passes: one point, or four adjacent points in SSE.
+struct ScalarLane {
+    using T = float;
+    static constexpr size_t kWidth = 1;
+    static T load(const float *p) { return *p; }
+    static void store(float *p, T v) { *p = v; }
+    static T set(float v) { return v; }
+};
+
+#if defined(ENGINE_FFT_SSE)
+struct Vec4 {
+    __m128 v;
+};
+inline Vec4 operator+(Vec4 a, Vec4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline Vec4 operator-(Vec4 a, Vec4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline Vec4 operator*(Vec4 a, Vec4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+
+struct SseLane {
+    using T = Vec4;
+    static constexpr size_t kWidth = 4;
+    static T load(const float *p) { return {_mm_loadu_ps(p)}; }
+    static void store(float *p, T v) { _mm_storeu_ps(p, v.v); }
+    static T set(float v) { return {_mm_set1_ps(v)}; }
+};
+#endif
+
+// In-place DFT of radix points (2 to 5), forward direction.
+template <typename L>
+void butterfly(size_t radix, typename L::T *re, typename L::T *im) {
+    using T = typename L::T;
+    switch (radix) {
+    case 2: {
+        T r = re[0] - re[1];
+        T i = im[0] - im[1];
+        re[0] = re[0] + re[1];
+        im[0] = im[0] + im[1];
+        re[1] = r;
+        im[1] = i;
+        break;
+    }
+    case 3: {
+        const T half = L::set(0.5f);
+        const T sin60 = L::set(0.866025403784438647f);
+        T sr = re[1] + re[2];
+        T si = im[1] + im[2];
+        // (a1 - a2) * -i sin(2 pi / 3)
+        T dr = sin60 * (im[1] - im[2]);
+        T di = sin60 * (re[2] - re[1]);
+        T mr = re[0] - half * sr;
+        T mi = im[0] - half * si;
+        re[0] = re[0] + sr;
+        im[0] = im[0] + si;
+        re[1] = mr + dr;
+        im[1] = mi + di;
+        re[2] = mr - dr;
+        im[2] = mi - di;
+        break;
+    }
+    case 4: {
+        T t0r = re[0] + re[2];
+        T t0i = im[0] + im[2];
+        T t1r = re[0] - re[2];
+        T t1i = im[0] - im[2];
+        T t2r = re[1] + re[3];
+        T t2i = im[1] + im[3];
+        // (a1 - a3) * -i
+        T t3r = im[1] - im[3];
+        T t3i = re[3] - re[1];
+        re[0] = t0r + t2r;
+        im[0] = t0i + t2i;
+        re[1] = t1r + t3r;
+        im[1] = t1i + t3i;
+        re[2] = t0r - t2r;
+        im[2] = t0i - t2i;
+        re[3] = t1r - t3r;
+        im[3] = t1i - t3i;
+        break;
+    }
+    case 5: {
+        const T c1 = L::set(0.309016994374947424f);   // cos(2 pi / 5)
+        const T c2 = L::set(-0.809016994374947424f);  // cos(4 pi / 5)
+        const T s1 = L::set(0.951056516295153572f);   // sin(2 pi / 5)
+        const T s2 = L::set(0.587785252292473129f);   // sin(4 pi / 5)
+        T t1r = re[1] + re[4];
+        T t1i = im[1] + im[4];
+        T t2r = re[2] + re[3];
+        T t2i = im[2] + im[3];
+        T d1r = re[1] - re[4];
+        T d1i = im[1] - im[4];
+        T d2r = re[2] - re[3];
+        T d2i = im[2] - im[3];
+        T m1r = re[0] + c1 * t1r + c2 * t2r;
+        T m1i = im[0] + c1 * t1i + c2 * t2i;
+        T m2r = re[0] + c2 * t1r + c1 * t2r;
+        T m2i = im[0] + c2 * t1i + c1 * t2i;
+        T n1r = s1 * d1r + s2 * d2r;
+        T n1i = s1 * d1i + s2 * d2i;
+        T n2r = s2 * d1r - s1 * d2r;
+        T n2i = s2 * d1i - s1 * d2i;
+        re[0] = re[0] + t1r + t2r;
+        im[0] = im[0] + t1i + t2i;
+        // y1 = m1 - i n1, y4 = m1 + i n1, y2 = m2 - i n2, y3 = m2 + i n2.
+        re[1] = m1r + n1i;
+        im[1] = m1i - n1r;
+        re[4] = m1r - n1i;
+        im[4] = m1i + n1r;
+        re[2] = m2r + n2i;
+        im[2] = m2i - n2r;
+        re[3] = m2r - n2i;
+        im[3] = m2i + n2r;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// One Stockham pass over the points q in [q_begin, q_end) of every stride group: butterfly
+// inputs are span * stride apart, and output u of butterfly p is scaled by twiddle p, u.
+template <typename L>
+void stockham_pass(size_t radix, size_t span, size_t stride, const float *tw_re, const float *tw_im,
+                   const float *x_re, const float *x_im, float *y_re, float *y_im, size_t q_begin, size_t q_end) {
+    using T = typename L::T;
+    T re[5];
+    T im[5];
+    for (size_t p = 0; p < span; ++p) {
+        const float *w_re = tw_re + p * (radix - 1);
+        const float *w_im = tw_im + p * (radix - 1);
+        for (size_t q = q_begin; q + L::kWidth <= q_end; q += L::kWidth) {
+            for (size_t t = 0; t < radix; ++t) {
+                const size_t at = q + stride * (p + t * span);
+                re[t] = L::load(x_re + at);
+                im[t] = L::load(x_im + at);
+            }
+            butterfly<L>(radix, re, im);
+            const size_t out = q + stride * radix * p;
+            L::store(y_re + out, re[0]);
+            L::store(y_im + out, im[0]);
+            for (size_t u = 1; u < radix; ++u) {
+                const T wr = L::set(w_re[u - 1]);
+                const T wi = L::set(w_im[u - 1]);
+                L::store(y_re + out + stride * u, re[u] * wr - im[u] * wi);
+                L::store(y_im + out + stride * u, re[u] * wi + im[u] * wr);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+RealFft::RealFft(size_t size) : size_(size), half_(size / 2) {
+    size_t bits = 0;
+    while ((static_cast<size_t>(1) << bits) < half_) {
+        ++bits;
+    }
+    bit_reverse_.resize(half_);
+    for (size_t i = 0; i < half_; ++i) {
+        size_t r = 0;
+        for (size_t b = 0; b < bits; ++b) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bit_reverse_[i] = static_cast<uint32_t>(r);
+    }
+
+    twiddle_re_.reserve(half_);
+    twiddle_im_.reserve(half_);
+    for (size_t span = 2; span <= half_; span *= 2) {
+        for (size_t j = 0; j < span / 2; ++j) {
+            double angle = -2.0 * kPi * static_cast<double>(j) / static_cast<double>(span);
+            twiddle_re_.push_back(static_cast<float>(std::cos(angle)));
+            twiddle_im_.push_back(static_cast<float>(std::sin(angle)));
+        }
+    }
+
+    split_re_.resize(half_ + 1);
+    split_im_.resize(half_ + 1);
+    for (size_t k = 0; k <= half_; ++k) {
+        double angle = -2.0 * kPi * static_cast<double>(k) / static_cast<double>(size_);
+        split_re_[k] = static_cast<float>(std::cos(angle));
+        split_im_[k] = static_cast<float>(std::sin(angle));
+    }
+
+    work_re_.assign(half_, 0.0f);
+    work_im_.assign(half_, 0.0f);
+}
+
+void RealFft::transform() {
+    float *re = work_re_.data();
+    float *im = work_im_.data();
+    for (size_t span = 2; span <= half_; span *= 2) {
+        const size_t half_span = span / 2;
+        const float *w_re = twiddle_re_.data() + half_span - 1;
+        const float *w_im = twiddle_im_.data() + half_span - 1;
+        for (size_t start = 0; start < half_; start += span) {
+            float *a_re = re + start;
+            float *a_im = im + start;
+            float *b_re = a_re + half_span;
+            float *b_im = a_im + half_span;
+            size_t j = 0;
+#if defined(ENGINE_FFT_SSE)
+            for (; j + 4 <= half_span; j += 4) {
+                __m128 wr = _mm_loadu_ps(w_re + j);
+                __m128 wi = _mm_loadu_ps(w_im + j);
+                __m128 br = _mm_loadu_ps(b_re + j);
+                __m128 bi = _mm_loadu_ps(b_im + j);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(wr, br), _mm_mul_ps(wi, bi));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(wr, bi), _mm_mul_ps(wi, br));
+                __m128 ar = _mm_loadu_ps(a_re + j);
+                __m128 ai = _mm_loadu_ps(a_im + j);
+                _mm_storeu_ps(b_re + j, _mm_sub_ps(ar, tr));
+                _mm_storeu_ps(b_im + j, _mm_sub_ps(ai, ti));
+                _mm_storeu_ps(a_re + j, _mm_add_ps(ar, tr));
+                _mm_storeu_ps(a_im + j, _mm_add_ps(ai, ti));
+            }
+#endif
+            for (; j < half_span; ++j) {
+                float tr = w_re[j] * b_re[j] - w_im[j] * b_im[j];
+                float ti = w_re[j] * b_im[j] + w_im[j] * b_re[j];
+                b_re[j] = a_re[j] - tr;
+                b_im[j] = a_im[j] - ti;
+                a_re[j] += tr;
+                a_im[j] += ti;
+            }
+        }
+    }
+}
+
+void RealFft::forward(const float *in, float *re, float *im) {
+    // Even samples become the real part and odd samples the imaginary part of a half-size signal.
+    for (size_t n = 0; n < half_; ++n) {
+        size_t r = bit_reverse_[n];
+        work_re_[r] = in[2 * n];
+        work_im_[r] = in[2 * n + 1];
+    }
+    transform();
+
+    for (size_t k = 0; k <= half_; ++k) {
+        size_t a = k % half_;
+        size_t b = (half_ - k) % half_;
+        float zr = work_re_[a];
+        float zi = work_im_[a];
+        float cr = work_re_[b];
+        float ci = -work_im_[b];
+        // Even part (z + conj z') / 2 and odd part (z - conj z') / 2i.
+        float even_re = 0.5f * (zr + cr);
+        float even_im = 0.5f * (zi + ci);
+        float odd_re = 0.5f * (zi - ci);
+        float odd_im = -0.5f * (zr - cr);
+        re[k] = even_re + split_re_[k] * odd_re - split_im_[k] * odd_im;
+        im[k] = even_im + split_re_[k] * odd_im + split_im_[k] * odd_re;
+    }
+}
+
+void RealFft::inverse(const float *re, const float *im, float *out) {
+    // Rebuild the half-size spectrum, conjugated so the forward transform computes the inverse.
+    for (size_t k = 0; k < half_; ++k) {
+        size_t m = half_ - k;
+        float xr = re[k];
+        float xi = im[k];
+        float yr = re[m];
+        float yi = -im[m];
+        float even_re = 0.5f * (xr + yr);
+        float even_im = 0.5f * (xi + yi);
+        float diff_re = 0.5f * (xr - yr);
+        float diff_im = 0.5f * (xi - yi);
+        // odd = diff * exp(+2 pi i k / size)
+        float odd_re = diff_re * split_re_[k] + diff_im * split_im_[k];
+        float odd_im = diff_im * split_re_[k] - diff_re * split_im_[k];
+        // z = even + i * odd, conjugated.
+        size_t r = bit_reverse_[k];
+        work_re_[r] = even_re - odd_im;
+        work_im_[r] = -(even_im + odd_re);
+    }
+    transform();
+
+    const float scale = 1.0f / static_cast<float>(half_);
+    for (size_t n = 0; n < half_; ++n) {
+        out[2 * n] = work_re_[n] * scale;
+        out[2 * n + 1] = -work_im_[n] * scale;
+    }
+}
+
+bool MixedRadixFft::supported(size_t size) {
+    if (size == 0) {
+        return false;
+    }
+    for (size_t radix : {2, 3, 5}) {
+        while (size % radix == 0) {
+            size /= radix;
+        }
+    }
+    return size == 1;
+}
+
+MixedRadixFft::MixedRadixFft(size_t size) : size_(size) {
+    // Radix-4 passes first: they are the cheapest per point, and the small early strides
+    // leave the wide ones for the rest.
+    size_t rest = size;
+    std::vector<size_t> radices;
+    while (rest % 4 == 0) {
+        radices.push_back(4);
+        rest /= 4;
+    }
+    for (size_t radix : {2, 3, 5}) {
+        while (rest > 1 && rest % radix == 0) {
+            radices.push_back(radix);
+            rest /= radix;
+        }
+    }
+
+    size_t length = size;
+    size_t stride = 1;
+    for (size_t radix : radices) {
+        const size_t span = length / radix;
+        passes_.push_back(Pass{radix, span, stride, twiddle_re_.size()});
+        for (size_t p = 0; p < span; ++p) {
+            for (size_t u = 1; u < radix; ++u) {
+                double angle = -2.0 * kPi * static_cast<double>(p * u) / static_cast<double>(length);
+                twiddle_re_.push_back(static_cast<float>(std::cos(angle)));
+                twiddle_im_.push_back(static_cast<float>(std::sin(angle)));
+            }
+        }
+        length = span;
+        stride *= radix;
+    }
+
+    work_re_.assign(size_, 0.0f);
+    work_im_.assign(size_, 0.0f);
+}
+
+void MixedRadixFft::forward(float *re, float *im) {
+    float *x_re = re;
+    float *x_im = im;
+    float *y_re = work_re_.data();
+    float *y_im = work_im_.data();
+    for (const Pass &pass : passes_) {
+        const float *w_re = twiddle_re_.data() + pass.twiddle;
+        const float *w_im = twiddle_im_.data() + pass.twiddle;
+        size_t q = 0;
+#if defined(ENGINE_FFT_SSE)
+        q = pass.stride - pass.stride % SseLane::kWidth;
+        stockham_pass<SseLane>(pass.radix, pass.span, pass.stride, w_re, w_im, x_re, x_im, y_re, y_im, 0, q);
+#endif
+        stockham_pass<ScalarLane>(pass.radix, pass.span, pass.stride, w_re, w_im, x_re, x_im, y_re, y_im, q,
+                                  pass.stride);
+        std::swap(x_re, y_re);
+        std::swap(x_im, y_im);
+    }
+    if (x_re != re) {
+        std::copy(x_re, x_re + size_, re);
+        std::copy(x_im, x_im + size_, im);
+    }
+}
+
+}  // namespace engine
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace engine {
+
+// Real-input FFT of a power-of-two size, built on a half-size radix-2 complex transform.
+//
+// Spectra are split into separate real and imaginary arrays of bins() values so the
+// per-bin arithmetic in callers, and the butterflies here, vectorize four bins at a time.
+class RealFft {
+public:
+    explicit RealFft(size_t size);
+
+    size_t size() const { return size_; }
+    size_t bins() const { return size_ / 2 + 1; }
+
+    // in holds size() samples; re and im receive bins() values.
+    void forward(const float *in, float *re, float *im);
+    // Inverse of forward(), including the 1/size scaling.
+    void inverse(const float *re, const float *im, float *out);
+
+private:
+    // In-place forward complex FFT of size_ / 2 points on work_re_ / work_im_, whose input
+    // has already been written in bit-reversed order.
+    void transform();
+
+    size_t size_;
+    size_t half_;
+    std::vector<uint32_t> bit_reverse_;
+    // Butterfly twiddles for every stage, concatenated: stage with span s starts at s/2 - 1.
+    std::vector<float> twiddle_re_;
+    std::vector<float> twiddle_im_;
+    // exp(-2 pi i k / size) for splitting the half-size transform into the real spectrum.
+    std::vector<float> split_re_;
+    std::vector<float> split_im_;
+    std::vector<float> work_re_;
+    std::vector<float> work_im_;
+};
+
+// Complex FFT of any size whose prime factors are 2, 3 and 5, such as the 400-point windows
+// of Whisper-style features that RealFft cannot take.
+//
+// A Stockham autosort transform: each radix-4/2/3/5 pass reads one buffer and writes the
+// other in order, so there is no bit reversal, and once a pass's stride reaches four points
+// its butterflies run on four of them at a time.
+class MixedRadixFft {
+public:
+    explicit MixedRadixFft(size_t size);
+
+    static bool supported(size_t size);
+    size_t size() const { return size_; }
+
+    // In-place forward transform of size() points held as split real/imaginary arrays.
+    void forward(float *re, float *im);
+
+private:
+    struct Pass {
+        size_t radix;
+        // Butterflies per stride group, and points between the inputs of one butterfly group.
+        size_t span;
+        size_t stride;
+        // First of this pass's span * (radix - 1) twiddles.
+        size_t twiddle;
+    };
+
+    size_t size_;
+    std::vector<Pass> passes_;
+    std::vector<float> twiddle_re_;
+    std::vector<float> twiddle_im_;
+    std::vector<float> work_re_;
+    std::vector<float> work_im_;
+};
+
+}  // namespace engine
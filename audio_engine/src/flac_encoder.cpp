@@ -0,0 +1,279 @@
+#include "flac_encoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace engine {
+namespace {
+
+constexpr int kBitsPerSample = 16;
+constexpr int kMaxFixedOrder = 4;
+constexpr int kMaxPartitionOrder = 6;
+constexpr int kMaxRiceParam = 14;  // 15 is the escape code
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t> &out) : out_(out) {}
+
+    void put(uint32_t value, int bits) {
+        for (int i = bits - 1; i >= 0; --i) {
+            put_bit((value >> i) & 1u);
+        }
+    }
+
+    void put_signed(int32_t value, int bits) { put(static_cast<uint32_t>(value) & ((1u << bits) - 1u), bits); }
+
+    // q zero bits followed by a one.
+    void put_unary(uint32_t q) {
+        for (uint32_t i = 0; i < q; ++i) {
+            put_bit(0);
+        }
+        put_bit(1);
+    }
+
+    void put_rice(int32_t value, int param) {
+        uint32_t folded = static_cast<uint32_t>(value) << 1 ^ static_cast<uint32_t>(value >> 31);
+        put_unary(folded >> param);
+        if (param > 0) {
+            put(folded & ((1u << param) - 1u), param);
+        }
+    }
+
+    void align() {
+        while (fill_ != 0) {
+            put_bit(0);
+        }
+    }
+
+private:
+    void put_bit(uint32_t bit) {
+        acc_ = static_cast<uint8_t>(acc_ << 1 | bit);
+        if (++fill_ == 8) {
+            out_.push_back(acc_);
+            acc_ = 0;
+            fill_ = 0;
+        }
+    }
+
+    std::vector<uint8_t> &out_;
+    uint8_t acc_ = 0;
+    int fill_ = 0;
+};
+
+uint8_t crc8(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b) {
+            crc = static_cast<uint8_t>(crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= static_cast<uint16_t>(data[i] << 8);
+        for (int b = 0; b < 8; ++b) {
+            crc = static_cast<uint16_t>(crc & 0x8000 ? (crc << 1) ^ 0x8005 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+// FLAC's UTF-8-style variable-length frame number.
+void put_frame_number(BitWriter &bits, uint64_t n) {
+    if (n < 0x80) {
+        bits.put(static_cast<uint32_t>(n), 8);
+        return;
+    }
+    int extra = 1;
+    while (extra < 6 && n >= (1ull << (6 * extra + 6 - extra))) {
+        ++extra;
+    }
+    uint32_t lead = (0xFFu << (7 - extra)) & 0xFFu;
+    bits.put(lead | static_cast<uint32_t>(n >> (6 * extra)), 8);
+    for (int i = extra - 1; i >= 0; --i) {
+        bits.put(0x80u | static_cast<uint32_t>((n >> (6 * i)) & 0x3F), 8);
+    }
+}
+
+uint32_t fold(int32_t value) {
+    return static_cast<uint32_t>(value) << 1 ^ static_cast<uint32_t>(value >> 31);
+}
+
+}  // namespace
+
+FlacEncoder::FlacEncoder(int sample_rate, int block_size)
+    : sample_rate_(sample_rate), block_size_(block_size), residual_(block_size, 0) {}
+
+std::vector<uint8_t> FlacEncoder::stream_header(uint64_t total_samples) const {
+    std::vector<uint8_t> out;
+    BitWriter bits(out);
+    bits.put('f', 8);
+    bits.put('L', 8);
+    bits.put('a', 8);
+    bits.put('C', 8);
+    // Metadata block header: last-block flag, type 0 (STREAMINFO), 34 byte body.
+    bits.put(1, 1);
+    bits.put(0, 7);
+    bits.put(34, 24);
+    bits.put(static_cast<uint32_t>(block_size_), 16);
+    bits.put(static_cast<uint32_t>(block_size_), 16);
+    bits.put(min_frame_bytes_, 24);
+    bits.put(max_frame_bytes_, 24);
+    bits.put(static_cast<uint32_t>(sample_rate_), 20);
+    bits.put(0, 3);  // channels - 1
+    bits.put(kBitsPerSample - 1, 5);
+    bits.put(static_cast<uint32_t>(total_samples >> 32) & 0xF, 4);
+    bits.put(static_cast<uint32_t>(total_samples), 32);
+    for (int i = 0; i < 16; ++i) {
+        bits.put(0, 8);  // MD5 unknown
+    }
+    return out;
+}
+
+void FlacEncoder::compute_residual(const int16_t *x, int order) {
+    for (int i = order; i < block_size_; ++i) {
+        int32_t r;
+        switch (order) {
+        case 0:
+            r = x[i];
+            break;
+        case 1:
+            r = x[i] - x[i - 1];
+            break;
+        case 2:
+            r = x[i] - 2 * x[i - 1] + x[i - 2];
+            break;
+        case 3:
+            r = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+            break;
+        default:
+            r = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+            break;
+        }
+        residual_[i] = r;
+    }
+}
+
+// Cost in bits of the residual section for one partition order, with the best Rice
+// parameter per partition written to params.
+size_t FlacEncoder::residual_bits(int order, int partition_order, std::vector<int> &params) const {
+    const int partitions = 1 << partition_order;
+    const int per_partition = block_size_ >> partition_order;
+    params.assign(partitions, 0);
+    size_t total = 2 + 4;
+    int start = order;
+    for (int p = 0; p < partitions; ++p) {
+        int end = (p + 1) * per_partition;
+        int count = end - start;
+        uint64_t sum = 0;
+        for (int i = start; i < end; ++i) {
+            sum += fold(residual_[i]);
+        }
+        int guess = 0;
+        while (guess < kMaxRiceParam && (static_cast<uint64_t>(count) << (guess + 1)) < sum) {
+            ++guess;
+        }
+        size_t best = SIZE_MAX;
+        for (int k = std::max(0, guess - 1); k <= std::min(kMaxRiceParam, guess + 1); ++k) {
+            size_t bits = static_cast<size_t>(count) * (k + 1);
+            for (int i = start; i < end; ++i) {
+                bits += fold(residual_[i]) >> k;
+            }
+            if (bits < best) {
+                best = bits;
+                params[p] = k;
+            }
+        }
+        total += 4 + best;
+        start = end;
+    }
+    return total;
+}
+
+void FlacEncoder::encode(const int16_t *samples, std::vector<uint8_t> &out) {
+    const size_t frame_start = out.size();
+    BitWriter bits(out);
+
+    bits.put(0x3FFE, 14);  // sync
+    bits.put(0, 1);
+    bits.put(0, 1);  // fixed block size
+    bits.put(0x7, 4);  // block size - 1 follows as 16 bits
+    bits.put(0x0, 4);  // sample rate from STREAMINFO
+    bits.put(0x0, 4);  // mono
+    bits.put(0x4, 3);  // 16 bits per sample
+    bits.put(0, 1);
+    put_frame_number(bits, frame_number_);
+    bits.put(static_cast<uint32_t>(block_size_ - 1), 16);
+    bits.put(crc8(out.data() + frame_start, out.size() - frame_start), 8);
+
+    bool constant = std::all_of(samples, samples + block_size_, [&](int16_t s) { return s == samples[0]; });
+    if (constant) {
+        bits.put(0, 1);
+        bits.put(0x00, 6);
+        bits.put(0, 1);
+        bits.put_signed(samples[0], kBitsPerSample);
+    } else {
+        int best_order = -1;
+        int best_partition_order = 0;
+        size_t best_bits = static_cast<size_t>(block_size_) * kBitsPerSample;  // verbatim
+        for (int order = 0; order <= kMaxFixedOrder && order < block_size_; ++order) {
+            compute_residual(samples, order);
+            for (int po = 0; po <= kMaxPartitionOrder; ++po) {
+                if (block_size_ % (1 << po) != 0 || (block_size_ >> po) <= order) {
+                    break;
+                }
+                size_t cost = static_cast<size_t>(order) * kBitsPerSample + residual_bits(order, po, params_);
+                if (cost < best_bits) {
+                    best_bits = cost;
+                    best_order = order;
+                    best_partition_order = po;
+                    best_params_ = params_;
+                }
+            }
+        }
+
+        bits.put(0, 1);
+        if (best_order < 0) {
+            bits.put(0x01, 6);
+            bits.put(0, 1);
+            for (int i = 0; i < block_size_; ++i) {
+                bits.put_signed(samples[i], kBitsPerSample);
+            }
+        } else {
+            bits.put(0x08 | static_cast<uint32_t>(best_order), 6);
+            bits.put(0, 1);
+            for (int i = 0; i < best_order; ++i) {
+                bits.put_signed(samples[i], kBitsPerSample);
+            }
+            compute_residual(samples, best_order);
+            bits.put(0, 2);  // Rice coding with 4-bit parameters
+            bits.put(static_cast<uint32_t>(best_partition_order), 4);
+            const int per_partition = block_size_ >> best_partition_order;
+            int start = best_order;
+            for (int p = 0; p < (1 << best_partition_order); ++p) {
+                int end = (p + 1) * per_partition;
+                bits.put(static_cast<uint32_t>(best_params_[p]), 4);
+                for (int i = start; i < end; ++i) {
+                    bits.put_rice(residual_[i], best_params_[p]);
+                }
+                start = end;
+            }
+        }
+    }
+
+    bits.align();
+    uint16_t crc = crc16(out.data() + frame_start, out.size() - frame_start);
+    out.push_back(static_cast<uint8_t>(crc >> 8));
+    out.push_back(static_cast<uint8_t>(crc & 0xFF));
+
+    uint32_t frame_bytes = static_cast<uint32_t>(out.size() - frame_start);
+    min_frame_bytes_ = min_frame_bytes_ == 0 ? frame_bytes : std::min(min_frame_bytes_, frame_bytes);
+    max_frame_bytes_ = std::max(max_frame_bytes_, frame_bytes);
+    ++frame_number_;
+}
+
+}  // namespace engine
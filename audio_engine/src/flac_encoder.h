@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace engine {
+
+// Minimal FLAC encoder for mono 16-bit audio with a fixed block size.
+//
+// Each block becomes one frame with a constant, verbatim or fixed-predictor (order 0-4)
+// subframe; residuals use partitioned Rice coding with the cheapest partition order. Frames
+// are self-synchronising, so a stream cut off mid-write still decodes up to the last frame.
+class FlacEncoder {
+public:
+    FlacEncoder(int sample_rate, int block_size);
+
+    // "fLaC" marker plus STREAMINFO. total_samples == 0 means unknown, which decoders accept;
+    // the recorder patches the real count in when it closes the file.
+    std::vector<uint8_t> stream_header(uint64_t total_samples) const;
+
+    // Encodes block_size samples as the next frame and appends it to out.
+    void encode(const int16_t *samples, std::vector<uint8_t> &out);
+
+    uint64_t frames() const { return frame_number_; }
+
+private:
+    size_t residual_bits(int order, int partition_order, std::vector<int> &params) const;
+    void compute_residual(const int16_t *samples, int order);
+
+    int sample_rate_;
+    int block_size_;
+    uint64_t frame_number_ = 0;
+    uint32_t min_frame_bytes_ = 0;
+    uint32_t max_frame_bytes_ = 0;
+    std::vector<int32_t> residual_;
+    std::vector<int> params_;
+    std::vector<int> best_params_;
+};
+
+}  // namespace engine
@@ -0,0 +1,49 @@
+#include "frame_pool.h"
+
+namespace engine {
+
+void FrameRef::reset() {
+    SharedFrame *frame = std::exchange(frame_, nullptr);
+    if (frame && frame->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        frame->pool_->release(frame);
+    }
+}
+
+FramePool::FramePool(size_t frames, size_t frame_samples)
+    : capacity_(frames), frame_samples_(frame_samples), frames_(new SharedFrame[frames]) {
+    free_.reserve(frames);
+    for (size_t i = 0; i < frames; ++i) {
+        frames_[i].samples.resize(frame_samples);
+        frames_[i].pool_ = this;
+        free_.push_back(&frames_[i]);
+    }
+}
+
+FrameRef FramePool::acquire() {
+    SharedFrame *frame = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            return FrameRef();
+        }
+        frame = free_.back();
+        free_.pop_back();
+    }
+    frame->meta = FrameMeta{};
+    frame->samples.resize(frame_samples_);
+    frame->refs_.store(1, std::memory_order_relaxed);
+    return FrameRef(frame);
+}
+
+size_t FramePool::available() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_.size();
+}
+
+// free_ was reserved for every frame, so this never reallocates.
+void FramePool::release(SharedFrame *frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(frame);
+}
+
+}  // namespace engine
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "spsc_ring.h"
+
+namespace engine {
+
+class FramePool;
+
+// One captured frame, shared read-only by every subscriber and returned to its pool once
+// the last reference is released.
+struct SharedFrame {
+    FrameMeta meta;
+    // Allocated at the pool's frame size; shorter frames resize down within that capacity.
+    std::vector<int16_t> samples;
+
+private:
+    friend class FrameRef;
+    friend class FramePool;
+    std::atomic<uint32_t> refs_{0};
+    FramePool *pool_ = nullptr;
+};
+
+// Intrusively counted reference to a pooled frame. Copies share the frame; releasing the
+// last one hands it back to the pool, never to the heap.
+class FrameRef {
+public:
+    FrameRef() = default;
+    FrameRef(const FrameRef &other) : frame_(other.frame_) { retain(); }
+    FrameRef(FrameRef &&other) noexcept : frame_(std::exchange(other.frame_, nullptr)) {}
+    ~FrameRef() { reset(); }
+
+    FrameRef &operator=(const FrameRef &other) {
+        FrameRef copy(other);
+        std::swap(frame_, copy.frame_);
+        return *this;
+    }
+    FrameRef &operator=(FrameRef &&other) noexcept {
+        if (this != &other) {
+            reset();
+            frame_ = std::exchange(other.frame_, nullptr);
+        }
+        return *this;
+    }
+
+    void reset();
+
+    const SharedFrame *get() const { return frame_; }
+    const SharedFrame *operator->() const { return frame_; }
+    const SharedFrame &operator*() const { return *frame_; }
+    explicit operator bool() const { return frame_ != nullptr; }
+
+    // Write access for the frame's producer, before the reference is first copied.
+    SharedFrame *edit() const { return frame_; }
+
+private:
+    friend class FramePool;
+    explicit FrameRef(SharedFrame *frame) : frame_(frame) {}
+
+    void retain() {
+        if (frame_) {
+            frame_->refs_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SharedFrame *frame_ = nullptr;
+};
+
+// Fixed set of frames allocated up front, so steady-state streaming never touches the heap
+// on its way from the capture ring to the sockets. acquire() and the final release take a
+// short lock around a preallocated free list; they may run on any thread.
+class FramePool {
+public:
+    FramePool(size_t frames, size_t frame_samples);
+
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    // An unused frame holding frame_samples samples, or an empty reference when every frame
+    // is still queued somewhere.
+    FrameRef acquire();
+
+    size_t capacity() const { return capacity_; }
+    size_t available() const;
+
+private:
+    friend class FrameRef;
+    void release(SharedFrame *frame);
+
+    const size_t capacity_;
+    const size_t frame_samples_;
+    std::unique_ptr<SharedFrame[]> frames_;
+    mutable std::mutex mutex_;
+    std::vector<SharedFrame *> free_;
+};
+
+}  // namespace engine
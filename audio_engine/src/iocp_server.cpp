@@ -0,0 +1,483 @@
+#include "iocp_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "log.h"
+#include "net.h"
+
+#pragma comment(lib, "Mswsock.lib")
+
+namespace engine {
+namespace {
+
+constexpr DWORD kSweepIntervalMs = 50;
+constexpr int kAcceptsPerListener = 2;
+constexpr DWORD kAcceptAddressBytes = sizeof(sockaddr_in) + 16;
+
+enum class IoKind { Accept, Recv, Send, Wake };
+
+}  // namespace
+
+struct IocpListener {
+    SOCKET sock = INVALID_SOCKET;
+    std::string label;
+    size_t hello_bytes = 0;
+    DWORD hello_wait_ms = 0;
+    size_t max_connections = 0;
+    HandlerFactory factory;
+    // Accepted connections still open; guarded by the server mutex.
+    size_t active = 0;
+};
+
+// One outstanding overlapped operation. owner keeps the connection alive until the
+// completion has been handled.
+struct IoOp : OVERLAPPED {
+    explicit IoOp(IoKind op_kind) : OVERLAPPED{}, kind(op_kind) {}
+
+    IoKind kind;
+    std::shared_ptr<IocpConnection> owner;
+};
+
+enum class ConnState { Accepting, Hello, Replying, Streaming, Closed };
+
+struct IocpConnection {
+    std::shared_ptr<IocpListener> listener;
+    SOCKET sock = INVALID_SOCKET;
+    IoOp accept_op{IoKind::Accept};
+    IoOp recv_op{IoKind::Recv};
+    IoOp send_op{IoKind::Send};
+    IoOp wake_op{IoKind::Wake};
+    char addresses[2 * kAcceptAddressBytes] = {};
+
+    // Guards everything below and serialises calls into handler.
+    std::mutex mutex;
+    ConnState state = ConnState::Accepting;
+    std::unique_ptr<ConnectionHandler> handler;
+    std::vector<char> hello;
+    size_t hello_got = 0;
+    uint64_t hello_deadline_ms = UINT64_MAX;
+    std::vector<char> reply;
+    WSABUF buffers[kMaxSendBuffers] = {};
+    DWORD buffer_count = 0;
+    bool sending = false;
+    bool counted = false;
+
+    std::atomic<bool> wake_posted{false};
+};
+
+IocpServer::IocpServer() = default;
+
+IocpServer::~IocpServer() {
+    stop();
+}
+
+bool IocpServer::start(size_t workers) {
+    port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, static_cast<DWORD>(workers));
+    if (!port_) {
+        log_error("CreateIoCompletionPort failed: " + std::to_string(GetLastError()));
+        return false;
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.emplace_back(&IocpServer::worker, this, i == 0);
+    }
+    return true;
+}
+
+void IocpServer::stop() {
+    if (!port_) {
+        return;
+    }
+    std::vector<std::shared_ptr<IocpListener>> listeners;
+    std::vector<std::shared_ptr<IocpConnection>> connections;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        listeners.swap(listeners_);
+        connections = connections_;
+    }
+    for (const auto &listener : listeners) {
+        closesocket(listener->sock);
+    }
+    for (const auto &conn : connections) {
+        close(conn);
+    }
+    // A null completion tells one worker to exit; cancelled I/O queued ahead of it drains first.
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        PostQueuedCompletionStatus(port_, 0, 0, nullptr);
+    }
+    for (auto &worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+    CloseHandle(port_);
+    port_ = nullptr;
+}
+
+bool IocpServer::listen(const std::string &host, int port, const std::string &label, size_t hello_bytes,
+                        DWORD hello_wait_ms, size_t max_connections, HandlerFactory factory) {
+    auto listener = std::make_shared<IocpListener>();
+    listener->sock = create_listen_socket(host, port, label);
+    if (listener->sock == INVALID_SOCKET) {
+        return false;
+    }
+    listener->label = label;
+    listener->hello_bytes = hello_bytes;
+    listener->hello_wait_ms = hello_wait_ms;
+    listener->max_connections = max_connections;
+    listener->factory = std::move(factory);
+
+    if (!accept_ex_) {
+        GUID guid = WSAID_ACCEPTEX;
+        DWORD bytes = 0;
+        if (WSAIoctl(listener->sock, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &accept_ex_,
+                     sizeof(accept_ex_), &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+            log_error(label + " AcceptEx lookup failed: " + std::to_string(WSAGetLastError()));
+            closesocket(listener->sock);
+            return false;
+        }
+    }
+    if (!CreateIoCompletionPort(reinterpret_cast<HANDLE>(listener->sock), port_, 0, 0)) {
+        log_error(label + " completion port association failed: " + std::to_string(GetLastError()));
+        closesocket(listener->sock);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listeners_.push_back(listener);
+    }
+    for (int i = 0; i < kAcceptsPerListener; ++i) {
+        post_accept(listener);
+    }
+    return true;
+}
+
+void IocpServer::worker(bool sweeper) {
+    uint64_t last_sweep = GetTickCount64();
+    for (;;) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED *overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, sweeper ? kSweepIntervalMs : INFINITE);
+        DWORD error = ok ? 0 : GetLastError();
+        if (overlapped) {
+            IoOp *op = static_cast<IoOp *>(overlapped);
+            std::shared_ptr<IocpConnection> conn = std::move(op->owner);
+            switch (op->kind) {
+            case IoKind::Accept:
+                on_accepted(conn, error);
+                break;
+            case IoKind::Recv:
+                on_hello_recv(conn, error, bytes);
+                break;
+            case IoKind::Send:
+                on_send(conn, error, bytes);
+                break;
+            case IoKind::Wake:
+                conn->wake_posted.store(false);
+                try_send(conn);
+                break;
+            }
+        } else if (ok || error != WAIT_TIMEOUT) {
+            return;
+        }
+        // The sweeper also runs between completions so a busy port cannot starve it.
+        uint64_t now = GetTickCount64();
+        if (sweeper && now - last_sweep >= kSweepIntervalMs) {
+            last_sweep = now;
+            sweep_hello_deadlines();
+        }
+    }
+}
+
+void IocpServer::post_accept(const std::shared_ptr<IocpListener> &listener) {
+    SOCKET sock = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+    if (sock == INVALID_SOCKET) {
+        log_error(listener->label + " accept socket failed: " + std::to_string(WSAGetLastError()));
+        return;
+    }
+    if (!CreateIoCompletionPort(reinterpret_cast<HANDLE>(sock), port_, 0, 0)) {
+        log_error(listener->label + " completion port association failed: " + std::to_string(GetLastError()));
+        closesocket(sock);
+        return;
+    }
+
+    auto conn = std::make_shared<IocpConnection>();
+    conn->listener = listener;
+    conn->sock = sock;
+    conn->hello.resize(listener->hello_bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            closesocket(sock);
+            return;
+        }
+        connections_.push_back(conn);
+    }
+
+    conn->accept_op.owner = conn;
+    DWORD received = 0;
+    if (!accept_ex_(listener->sock, sock, conn->addresses, 0, kAcceptAddressBytes, kAcceptAddressBytes, &received,
+                    &conn->accept_op) &&
+        WSAGetLastError() != ERROR_IO_PENDING) {
+        log_error(listener->label + " AcceptEx failed: " + std::to_string(WSAGetLastError()));
+        conn->accept_op.owner.reset();
+        close(conn);
+    }
+}
+
+void IocpServer::on_accepted(const std::shared_ptr<IocpConnection> &conn, DWORD error) {
+    const std::shared_ptr<IocpListener> &listener = conn->listener;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+    }
+    post_accept(listener);
+    if (error != 0) {
+        log_error(listener->label + " accept failed: " + std::to_string(error));
+        close(conn);
+        return;
+    }
+
+    setsockopt(conn->sock, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, reinterpret_cast<const char *>(&listener->sock),
+               sizeof(listener->sock));
+    bool admitted = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (listener->active < listener->max_connections) {
+            ++listener->active;
+            admitted = true;
+        }
+    }
+    if (!admitted) {
+        log_error(listener->label + " connection limit reached; closing client");
+        close(conn);
+        return;
+    }
+
+    std::weak_ptr<IocpConnection> weak = conn;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->counted = true;
+        conn->handler = listener->factory([this, weak] {
+            if (auto target = weak.lock()) {
+                wake(target);
+            }
+        });
+    }
+    start_hello(conn);
+}
+
+void IocpServer::start_hello(const std::shared_ptr<IocpConnection> &conn) {
+    if (conn->listener->hello_bytes == 0) {
+        finish_hello(conn, false);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->state = ConnState::Hello;
+        conn->hello_deadline_ms = GetTickCount64() + conn->listener->hello_wait_ms;
+    }
+    post_recv(conn);
+}
+
+void IocpServer::post_recv(const std::shared_ptr<IocpConnection> &conn) {
+    bool failed = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (conn->state != ConnState::Hello) {
+            return;
+        }
+        WSABUF buffer{static_cast<ULONG>(conn->hello.size() - conn->hello_got), conn->hello.data() + conn->hello_got};
+        DWORD flags = 0;
+        conn->recv_op.owner = conn;
+        if (WSARecv(conn->sock, &buffer, 1, nullptr, &flags, &conn->recv_op, nullptr) == SOCKET_ERROR &&
+            WSAGetLastError() != WSA_IO_PENDING) {
+            conn->recv_op.owner.reset();
+            failed = true;
+        }
+    }
+    if (failed) {
+        close(conn);
+    }
+}
+
+void IocpServer::on_hello_recv(const std::shared_ptr<IocpConnection> &conn, DWORD error, DWORD bytes) {
+    bool silent = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (conn->state != ConnState::Hello) {
+            return;
+        }
+        // The sweeper cancels the receive when the hello window passes; a client that sent
+        // nothing by then is a raw client.
+        silent = error == ERROR_OPERATION_ABORTED && conn->hello_got == 0;
+        if (error == 0) {
+            conn->hello_got += bytes;
+        }
+    }
+    if (silent) {
+        finish_hello(conn, false);
+    } else if (error != 0 || bytes == 0) {
+        close(conn);
+    } else if (conn->hello_got < conn->hello.size()) {
+        post_recv(conn);
+    } else {
+        finish_hello(conn, true);
+    }
+}
+
+void IocpServer::finish_hello(const std::shared_ptr<IocpConnection> &conn, bool have_hello) {
+    bool keep = false;
+    bool replying = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (conn->state == ConnState::Closed) {
+            return;
+        }
+        keep = conn->handler->on_hello(have_hello ? conn->hello.data() : nullptr, conn->reply);
+        if (keep && !conn->reply.empty()) {
+            conn->state = ConnState::Replying;
+            conn->buffers[0] = WSABUF{static_cast<ULONG>(conn->reply.size()), conn->reply.data()};
+            conn->buffer_count = 1;
+            keep = issue_send(conn);
+            replying = true;
+        } else if (keep) {
+            conn->state = ConnState::Streaming;
+        }
+    }
+    if (!keep) {
+        close(conn);
+    } else if (!replying) {
+        try_send(conn);
+    }
+}
+
+// Caller holds conn->mutex.
+bool IocpServer::issue_send(const std::shared_ptr<IocpConnection> &conn) {
+    conn->sending = true;
+    conn->send_op.owner = conn;
+    if (WSASend(conn->sock, conn->buffers, conn->buffer_count, nullptr, 0, &conn->send_op, nullptr) == SOCKET_ERROR &&
+        WSAGetLastError() != WSA_IO_PENDING) {
+        conn->send_op.owner.reset();
+        conn->sending = false;
+        return false;
+    }
+    return true;
+}
+
+void IocpServer::try_send(const std::shared_ptr<IocpConnection> &conn) {
+    bool failed = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (conn->state != ConnState::Streaming || conn->sending) {
+            return;
+        }
+        int count = conn->handler->next_send(conn->buffers);
+        if (count == 0) {
+            return;
+        }
+        conn->buffer_count = static_cast<DWORD>(count);
+        failed = !issue_send(conn);
+    }
+    if (failed) {
+        close(conn);
+    }
+}
+
+void IocpServer::on_send(const std::shared_ptr<IocpConnection> &conn, DWORD error, DWORD bytes) {
+    bool failed = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->sending = false;
+        if (conn->state == ConnState::Closed) {
+            return;
+        }
+        if (error != 0) {
+            failed = true;
+        } else {
+            // Overlapped sends normally complete in full; resubmit whatever is left otherwise.
+            WSABUF *next = conn->buffers;
+            DWORD left = conn->buffer_count;
+            while (left > 0 && bytes >= next->len) {
+                bytes -= next->len;
+                ++next;
+                --left;
+            }
+            if (left > 0) {
+                next->buf += bytes;
+                next->len -= bytes;
+                std::copy(next, next + left, conn->buffers);
+                conn->buffer_count = left;
+                failed = !issue_send(conn);
+            } else if (conn->state == ConnState::Replying) {
+                conn->state = ConnState::Streaming;
+                conn->reply.clear();
+            } else {
+                conn->handler->on_sent();
+            }
+        }
+        if (!failed && conn->sending) {
+            return;
+        }
+    }
+    if (failed) {
+        close(conn);
+    } else {
+        try_send(conn);
+    }
+}
+
+void IocpServer::wake(const std::shared_ptr<IocpConnection> &conn) {
+    if (conn->wake_posted.exchange(true)) {
+        return;
+    }
+    conn->wake_op.owner = conn;
+    if (!PostQueuedCompletionStatus(port_, 0, 0, &conn->wake_op)) {
+        conn->wake_op.owner.reset();
+        conn->wake_posted.store(false);
+    }
+}
+
+void IocpServer::close(const std::shared_ptr<IocpConnection> &conn) {
+    ConnectionHandler *handler = nullptr;
+    bool counted = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (conn->state == ConnState::Closed) {
+            return;
+        }
+        conn->state = ConnState::Closed;
+        // Outstanding operations complete with an error and drop their owner reference.
+        closesocket(conn->sock);
+        handler = conn->handler.get();
+        counted = conn->counted;
+    }
+    // No other handler call can be running or follow once the state is Closed.
+    if (handler) {
+        handler->on_close();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.erase(std::remove(connections_.begin(), connections_.end(), conn), connections_.end());
+    if (counted) {
+        --conn->listener->active;
+    }
+}
+
+void IocpServer::sweep_hello_deadlines() {
+    uint64_t now = GetTickCount64();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &conn : connections_) {
+        std::lock_guard<std::mutex> conn_lock(conn->mutex);
+        if (conn->state == ConnState::Hello && now >= conn->hello_deadline_ms) {
+            conn->hello_deadline_ms = UINT64_MAX;
+            CancelIoEx(reinterpret_cast<HANDLE>(conn->sock), &conn->recv_op);
+        }
+    }
+}
+
+}  // namespace engine
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <winsock2.h>
+#include <mswsock.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+constexpr int kMaxSendBuffers = 2;
+
+// Protocol side of one accepted connection. The server calls it from its worker threads but
+// never concurrently for the same connection, so implementations need no locking of their own.
+class ConnectionHandler {
+public:
+    virtual ~ConnectionHandler() = default;
+
+    // The client's first hello_bytes bytes, or nullptr when it sent nothing within the hello
+    // window (or the listener expects no hello). Fills reply with the bytes to answer (may stay
+    // empty); returning false closes the connection.
+    virtual bool on_hello(const char *hello, std::vector<char> &reply) = 0;
+
+    // Describes the next message as up to kMaxSendBuffers buffers that must stay valid until
+    // on_sent(). Returns the buffer count, or 0 when nothing is queued.
+    virtual int next_send(WSABUF *buffers) = 0;
+    virtual void on_sent() = 0;
+
+    // Called once after the socket has closed; no other call follows.
+    virtual void on_close() = 0;
+};
+
+// Wakes the connection's send path after new data was queued; callable from any thread
+// until on_close() returns.
+using WakeFn = std::function<void()>;
+using HandlerFactory = std::function<std::unique_ptr<ConnectionHandler>(WakeFn wake)>;
+
+struct IocpListener;
+struct IocpConnection;
+
+// Overlapped accept/recv/send for every engine socket, serviced by one completion port and a
+// small worker pool. Each connection has at most one send in flight and streams messages as
+// gathered WSABUF lists, so frame payloads are sent from where they already live.
+class IocpServer {
+public:
+    IocpServer();
+    ~IocpServer();
+
+    IocpServer(const IocpServer &) = delete;
+    IocpServer &operator=(const IocpServer &) = delete;
+
+    bool start(size_t workers);
+    // Closes every listener and connection and joins the workers.
+    void stop();
+
+    // Binds host:port and keeps AcceptEx calls posted on it. hello_bytes == 0 skips the hello
+    // window; beyond max_connections new clients are closed straight away.
+    bool listen(const std::string &host, int port, const std::string &label, size_t hello_bytes,
+                DWORD hello_wait_ms, size_t max_connections, HandlerFactory factory);
+
+private:
+    void worker(bool sweeper);
+    void post_recv(const std::shared_ptr<IocpConnection> &conn);
+    void post_accept(const std::shared_ptr<IocpListener> &listener);
+    void on_accepted(const std::shared_ptr<IocpConnection> &conn, DWORD error);
+    void start_hello(const std::shared_ptr<IocpConnection> &conn);
+    void on_hello_recv(const std::shared_ptr<IocpConnection> &conn, DWORD error, DWORD bytes);
+    void finish_hello(const std::shared_ptr<IocpConnection> &conn, bool have_hello);
+    void try_send(const std::shared_ptr<IocpConnection> &conn);
+    void on_send(const std::shared_ptr<IocpConnection> &conn, DWORD error, DWORD bytes);
+    bool issue_send(const std::shared_ptr<IocpConnection> &conn);
+    void wake(const std::shared_ptr<IocpConnection> &conn);
+    void close(const std::shared_ptr<IocpConnection> &conn);
+    void sweep_hello_deadlines();
+
+    HANDLE port_ = nullptr;
+    LPFN_ACCEPTEX accept_ex_ = nullptr;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<IocpListener>> listeners_;
+    std::vector<std::shared_ptr<IocpConnection>> connections_;
+    bool stopping_ = false;
+};
+
+}  // namespace engine
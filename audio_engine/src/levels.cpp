@@ -0,0 +1,31 @@
+#include "levels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "dsp_kernels.h"
+
+namespace engine {
+namespace {
+
+constexpr int kFullScale = 32767;
+
+}  // namespace
+
+FrameLevels measure_levels(const int16_t *samples, size_t count) {
+    FrameLevels levels;
+    if (count == 0) {
+        return levels;
+    }
+
+    LevelSums sums;
+    accumulate_levels(samples, count, sums);
+
+    double rms = std::sqrt(static_cast<double>(sums.sum_squares) / static_cast<double>(count));
+    levels.rms = static_cast<uint16_t>(std::min<long>(std::lround(rms), kFullScale));
+    levels.peak = static_cast<uint16_t>(sums.peak);
+    levels.clipped = static_cast<uint16_t>(std::min<uint32_t>(sums.clipped, 0xFFFF));
+    return levels;
+}
+
+}  // namespace engine
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace engine {
+
+// Per-frame level meter readings, in int16 sample units.
+struct FrameLevels {
+    uint16_t rms = 0;
+    // Largest |sample|, saturated at 32767.
+    uint16_t peak = 0;
+    // Samples at full scale (|sample| >= 32767).
+    uint16_t clipped = 0;
+};
+
+// Measures RMS, peak and clip count for one mono frame, with the AVX2, SSE2 or scalar kernel
+// the CPU supports (see dsp_kernels.h).
+FrameLevels measure_levels(const int16_t *samples, size_t count);
+
+}  // namespace engine
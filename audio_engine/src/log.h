@@ -0,0 +1,16 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+namespace engine {
+
+inline void log_info(const std::string &msg) {
+    std::cout << "[audio_engine] " << msg << std::endl;
+}
+
+inline void log_error(const std::string &msg) {
+    std::cerr << "[audio_engine] " << msg << std::endl;
+}
+
+}  // namespace engine
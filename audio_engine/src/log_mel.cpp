@@ -0,0 +1,159 @@
+#include "log_mel.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "dsp_kernels.h"
+
+namespace engine {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr float kLogFloor = 1e-10f;
+
+// Slaney's mel scale (librosa htk=False): linear below 1 kHz, logarithmic above.
+constexpr double kMelLinearHz = 200.0 / 3.0;
+constexpr double kMelLogStartHz = 1000.0;
+constexpr double kMelLogStart = kMelLogStartHz / kMelLinearHz;
+
+double mel_log_step() {
+    return std::log(6.4) / 27.0;
+}
+
+double hz_to_mel(double hz) {
+    if (hz < kMelLogStartHz) {
+        return hz / kMelLinearHz;
+    }
+    return kMelLogStart + std::log(hz / kMelLogStartHz) / mel_log_step();
+}
+
+double mel_to_hz(double mel) {
+    if (mel < kMelLogStart) {
+        return mel * kMelLinearHz;
+    }
+    return kMelLogStartHz * std::exp(mel_log_step() * (mel - kMelLogStart));
+}
+
+}  // namespace
+
+LogMelExtractor::LogMelExtractor() : fft_(kWindow / 2) {
+    window_.resize(kWindow);
+    for (size_t n = 0; n < kWindow; ++n) {
+        window_[n] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * kPi * static_cast<double>(n) / kWindow));
+    }
+
+    const size_t half = kWindow / 2;
+    split_re_.resize(half + 1);
+    split_im_.resize(half + 1);
+    for (size_t k = 0; k <= half; ++k) {
+        double angle = -2.0 * kPi * static_cast<double>(k) / static_cast<double>(kWindow);
+        split_re_[k] = static_cast<float>(std::cos(angle));
+        split_im_[k] = static_cast<float>(std::sin(angle));
+    }
+
+    // Triangular filters between kMels + 2 points evenly spaced in mel from 0 Hz to Nyquist,
+    // area-normalized (Slaney), as librosa.filters.mel builds Whisper's bank.
+    std::vector<double> edges(kMels + 2);
+    const double top = hz_to_mel(kSampleRate / 2.0);
+    for (size_t i = 0; i < edges.size(); ++i) {
+        edges[i] = mel_to_hz(top * static_cast<double>(i) / static_cast<double>(kMels + 1));
+    }
+    for (size_t b = 0; b < kMels; ++b) {
+        const double lower = edges[b];
+        const double centre = edges[b + 1];
+        const double upper = edges[b + 2];
+        const double norm = 2.0 / (upper - lower);
+        band_first_.push_back(0);
+        band_size_.push_back(0);
+        band_offset_.push_back(static_cast<uint32_t>(weights_.size()));
+        for (size_t k = 0; k < kBins; ++k) {
+            const double hz = static_cast<double>(k) * kSampleRate / kWindow;
+            const double w = std::max(0.0, std::min((hz - lower) / (centre - lower), (upper - hz) / (upper - centre)));
+            if (w <= 0.0) {
+                continue;
+            }
+            if (band_size_[b] == 0) {
+                band_first_[b] = static_cast<uint16_t>(k);
+            }
+            // Bins of one band are contiguous, so only the first and the count are kept.
+            weights_.push_back(static_cast<float>(w * norm));
+            band_size_[b] = static_cast<uint16_t>(k - band_first_[b] + 1);
+        }
+    }
+
+    re_.assign(half + 1, 0.0f);
+    im_.assign(half + 1, 0.0f);
+    power_.assign(kBins, 0.0f);
+    reset();
+}
+
+void LogMelExtractor::reset() {
+    // The first window reaches kWindow / 2 samples before the stream start.
+    history_.assign(kWindow / 2, 0.0f);
+    history_start_ = -static_cast<int64_t>(kWindow / 2);
+    next_center_ = 0;
+    first_center_ = 0;
+}
+
+size_t LogMelExtractor::process(const int16_t *samples, size_t count, float *out) {
+    const int64_t input_start = history_start_ + static_cast<int64_t>(history_.size());
+    const size_t held = history_.size();
+    history_.resize(held + count);
+    int16_to_float(samples, history_.data() + held, count);
+    first_center_ = next_center_ - input_start;
+
+    size_t frames = 0;
+    const int64_t half = static_cast<int64_t>(kWindow / 2);
+    while (next_center_ + half <= history_start_ + static_cast<int64_t>(history_.size())) {
+        compute(history_.data() + (next_center_ - half - history_start_), out + frames * kMels);
+        ++frames;
+        next_center_ += static_cast<int64_t>(kHop);
+    }
+
+    const int64_t keep_from = next_center_ - half;
+    const size_t drop = static_cast<size_t>(keep_from - history_start_);
+    history_.erase(history_.begin(), history_.begin() + static_cast<std::ptrdiff_t>(drop));
+    history_start_ = keep_from;
+    return frames;
+}
+
+void LogMelExtractor::compute(const float *window, float *out) {
+    // Even samples become the real part and odd samples the imaginary part of a half-size
+    // signal, as in RealFft::forward().
+    const size_t half = kWindow / 2;
+    float *z_re = re_.data();
+    float *z_im = im_.data();
+    for (size_t n = 0; n < half; ++n) {
+        z_re[n] = window[2 * n] * window_[2 * n];
+        z_im[n] = window[2 * n + 1] * window_[2 * n + 1];
+    }
+    fft_.forward(z_re, z_im);
+
+    for (size_t k = 0; k <= half; ++k) {
+        const size_t a = k % half;
+        const size_t b = (half - k) % half;
+        const float zr = z_re[a];
+        const float zi = z_im[a];
+        const float cr = z_re[b];
+        const float ci = -z_im[b];
+        const float even_re = 0.5f * (zr + cr);
+        const float even_im = 0.5f * (zi + ci);
+        const float odd_re = 0.5f * (zi - ci);
+        const float odd_im = -0.5f * (zr - cr);
+        const float re = even_re + split_re_[k] * odd_re - split_im_[k] * odd_im;
+        const float im = even_im + split_re_[k] * odd_im + split_im_[k] * odd_re;
+        power_[k] = re * re + im * im;
+    }
+
+    for (size_t b = 0; b < kMels; ++b) {
+        const float *w = weights_.data() + band_offset_[b];
+        const float *p = power_.data() + band_first_[b];
+        float sum = 0.0f;
+        for (size_t i = 0; i < band_size_[b]; ++i) {
+            sum += w[i] * p[i];
+        }
+        out[b] = std::log10(std::max(sum, kLogFloor));
+    }
+}
+
+}  // namespace engine
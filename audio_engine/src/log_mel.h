@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "fft.h"
+
+namespace engine {
+
+// Streaming log-mel spectrogram in Whisper's front-end layout: 16 kHz input, 25 ms periodic
+// Hann windows every 10 ms, 80 Slaney mel bands over the 201-bin power spectrum, and
+// log10(max(mel, 1e-10)). Frame t is centred on input sample t * kHop, as with Whisper's
+// centred STFT; the first frame sees zeros before the stream start where Whisper reflects.
+//
+// Whisper's final scaling (clamp to the clip's maximum - 8, then (x + 4) / 4) depends on the
+// whole 30 s clip and is left to the reader.
+class LogMelExtractor {
+public:
+    static constexpr int kSampleRate = 16000;
+    static constexpr size_t kMels = 80;
+    static constexpr size_t kWindow = 400;
+    static constexpr size_t kHop = 160;
+    static constexpr size_t kBins = kWindow / 2 + 1;
+
+    LogMelExtractor();
+
+    // Upper bound on the frames process() writes for count input samples.
+    static size_t max_frames(size_t count) { return count / kHop + 1; }
+
+    // Appends count 16 kHz samples and writes kMels values for every frame whose window they
+    // complete; returns the frame count.
+    size_t process(const int16_t *samples, size_t count, float *out);
+    // Centre of the first frame of the last process() call, in samples from its first input
+    // sample (negative when the frame started in an earlier call).
+    int64_t first_center() const { return first_center_; }
+
+    void reset();
+
+private:
+    void compute(const float *window, float *out);
+
+    MixedRadixFft fft_;
+    std::vector<float> window_;
+    // exp(-2 pi i k / kWindow) for splitting the half-size transform into the real spectrum.
+    std::vector<float> split_re_;
+    std::vector<float> split_im_;
+    // Band b weighs power bins band_first_[b] onwards with weights_ from band_offset_[b].
+    std::vector<uint16_t> band_first_;
+    std::vector<uint16_t> band_size_;
+    std::vector<uint32_t> band_offset_;
+    std::vector<float> weights_;
+
+    // Input samples from absolute position history_start_ on, starting kWindow / 2 before the
+    // next frame's centre.
+    std::vector<float> history_;
+    int64_t history_start_ = 0;
+    int64_t next_center_ = 0;
+    int64_t first_center_ = 0;
+    std::vector<float> re_;
+    std::vector<float> im_;
+    std::vector<float> power_;
+};
+
+}  // namespace engine
@@ -1,161 +1,2163 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
+#include <objbase.h>
+
+#include <algorithm>
 #include <atomic>
+#include <cctype>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
-#pragma comment(lib, "Ws2_32.lib")
+#include "aec.h"
+#include "asr.h"
+#include "audio_format.h"
+#include "crosstalk.h"
+#include "drift.h"
+#include "dsp_kernels.h"
+#include "echo_reference.h"
+#include "events.h"
+#include "fanout.h"
+#include "frame_pool.h"
+#include "iocp_server.h"
+#include "levels.h"
+#include "log.h"
+#include "log_mel.h"
+#include "metrics.h"
+#include "net.h"
+#include "opus_codec.h"
+#include "pacer.h"
+#include "protocol.h"
+#include "recorder.h"
+#include "resampler.h"
+#include "segmenter.h"
+#include "shm_transport.h"
+#include "spsc_ring.h"
+#include "vad.h"
+#include "wasapi_capture.h"
+#include "wav_replay.h"
+
+namespace {
+using engine::capture_frame_samples;
+using engine::frames_for_ms;
+using engine::json_string;
+using engine::kSampleRate;
+using engine::log_error;
+using engine::log_info;
+
+constexpr double kTwoPi = 6.283185307179586476925286766559;
+constexpr float kProofAmplitude = 10000.0f / 32768.0f;
+constexpr DWORD kCaptureWaitMs = 40;
+constexpr DWORD kSenderWaitMs = 100;
+constexpr int kDeviceRetryMs = 1000;
+constexpr long kHelloWaitMs = 250;
+// Queue lengths are durations; --frame-ms decides how many frames they hold.
+constexpr int kRingMs = 1280;
+constexpr size_t kMaxSubscribers = 8;
+constexpr size_t kIoWorkers = 2;
+constexpr int kSubscriberQueueMs = 1000;
+constexpr int kMuxHoldMs = 60;
+constexpr int kShmMs = 2560;
+constexpr size_t kHeaderWords = sizeof(engine::FrameHeader) / sizeof(int16_t);
+constexpr int kEchoTailMs = 200;
+constexpr size_t kEchoChunkSamples = kSampleRate / 200;  // 5 ms
+constexpr size_t kEchoChunks = 64;
+constexpr uint64_t kDriftLogInterval100ns = 600000000;  // 60 s
+constexpr int kRecordRingMs = 5120;  // of disk stalls before frames are lost
+constexpr DWORD kRecordPollMs = 100;
+constexpr DWORD kReplayBackoffMs = 2;
+constexpr DWORD kReplayDrainMs = 2000;
+constexpr DWORD kMetricsPollMs = 100;
+constexpr long kControlPollMs = 100;
+constexpr size_t kControlMaxLine = 1024;
+constexpr size_t kMaxControlClients = 4;
+// How often subscribed control clients are handed new events.
+constexpr long kControlEventPollMs = 10;
+constexpr size_t kEventLogCapacity = 256;
+constexpr int kAsrRingMs = 5120;
+constexpr DWORD kAsrPollMs = 20;
+constexpr int kDefaultAsrWorkers = 2;
+constexpr int kCrosstalkRingMs = 1280;
+constexpr DWORD kCrosstalkPollMs = 20;
+// Process creation to each stream's first frame.
+constexpr uint64_t kColdStartBudgetMs = 200;
+
+// Every subscriber's queue full of distinct frames (drop-newest queues can lag far behind
+// the others) and an utterance subscriber's lookback, plus the frame each is sending, the
+// frames --pacing holds back and the one being filled.
+size_t frame_pool_frames() {
+    const size_t per_subscriber = frames_for_ms(kSubscriberQueueMs) + engine::utterance_lookback_frames() + 1;
+    return kMaxSubscribers * per_subscriber + frames_for_ms(engine::kMaxPlayoutDelayMs) + 2;
+}
+
+// A ring of capture frames holding ms of audio.
+std::unique_ptr<engine::FrameRing> make_frame_ring(int ms) {
+    return std::make_unique<engine::FrameRing>(frames_for_ms(ms), capture_frame_samples());
+}
+
+std::atomic<bool> g_running{true};
+// --replay: streams still playing; the last one to finish shuts the engine down.
+std::atomic<int> g_replays_active{0};
+
+BOOL WINAPI console_handler(DWORD ctrl_type) {
+    if (ctrl_type == CTRL_C_EVENT || ctrl_type == CTRL_BREAK_EVENT || ctrl_type == CTRL_CLOSE_EVENT) {
+        g_running.store(false);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// When the process was created, on the QPC timeline, so startup timings include loading the
+// executable and its DLLs; now when the creation time is unavailable.
+uint64_t process_started_100ns() {
+    const uint64_t now_qpc = engine::qpc_now_100ns();
+    FILETIME created, exited, kernel, user, now;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+        return now_qpc;
+    }
+    GetSystemTimePreciseAsFileTime(&now);
+    auto ticks = [](const FILETIME &t) { return (static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+    const uint64_t age = ticks(now) > ticks(created) ? ticks(now) - ticks(created) : 0;
+    return now_qpc > age ? now_qpc - age : 0;
+}
+
+// The stages the engine prepares before it is ready: every listen socket or shm mapping, each
+// stream's first endpoint open with its DSP state built, and the ASR model. The last one to
+// report logs a single "ready {json}" line, which the backend waits for instead of polling
+// the ports. A stage that failed is listed in it rather than holding it back; endpoints that
+// could not open are retried meanwhile.
+class Startup {
+public:
+    Startup(uint64_t started_100ns, size_t stages) : started_100ns_(started_100ns), pending_(stages) {}
+
+    uint64_t started_100ns() const { return started_100ns_; }
+
+    void done(const std::string &stage, bool ok = true) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!ok) {
+            failed_.push_back(stage);
+        }
+        if (pending_ == 0 || --pending_ > 0) {
+            return;
+        }
+        const uint64_t now = engine::qpc_now_100ns();
+        std::string failed = "[";
+        for (const std::string &name : failed_) {
+            failed += (failed.size() > 1 ? "," : "") + json_string(name);
+        }
+        log_info("ready {\"ready_ms\":" + std::to_string((now - started_100ns_) / 10000) +
+                 ",\"pid\":" + std::to_string(GetCurrentProcessId()) + ",\"failed\":" + failed + "]}");
+    }
+
+private:
+    const uint64_t started_100ns_;
+    std::mutex mutex_;
+    size_t pending_;
+    std::vector<std::string> failed_;
+};
+
+// What a stream is for the life of the process.
+struct StreamConfig {
+    std::string label;
+    std::string host;
+    int port = 0;
+    engine::CaptureKind kind = engine::CaptureKind::Microphone;
+    uint8_t channel_id = engine::kChannelMic;
+    bool framed = false;
+    // --replay: a WAV file played in place of the endpoint, on an epoch shared by both streams.
+    std::string replay_path;
+    double replay_speed = 1.0;
+    uint64_t replay_epoch_100ns = 0;
+    // --pacing timer: per-stream ports send on the capture grid instead of as frames arrive.
+    bool paced = false;
+    // --prewarm: the endpoint opens while the DSP chain runs a frame of silence.
+    bool prewarm = false;
+
+    bool replay() const { return !replay_path.empty(); }
+    // --speed 0 replays as fast as the consumers drain, so nothing may be dropped on the way.
+    bool lossless() const { return replay() && replay_speed <= 0.0; }
+};
+
+// What the control channel (--control-port) may change while the stream runs.
+struct LiveSettings {
+    std::string device_id;
+    int out_rate = kSampleRate;
+    bool vad = false;
+    bool vad_gate = false;
+    // Set on both streams together: the loop stream taps its capture and the mic stream
+    // cancels it.
+    bool aec = false;
+    // Framed consumers receive Opus packets instead of PCM.
+    bool opus = false;
+    int bitrate = engine::kDefaultOpusBitrate;
+
+    int frame_samples() const { return engine::frame_samples_for_rate(out_rate); }
+    int frame_bytes() const { return frame_samples() * static_cast<int>(sizeof(int16_t)); }
+};
+
+// A stream's LiveSettings shared between the control thread and the threads that act on it.
+// Each of those keeps its own copy and re-reads it at a frame boundary once generation() has
+// moved, so a change never lands mid-frame and the hot path pays one atomic load per frame.
+class LiveConfig {
+public:
+    explicit LiveConfig(LiveSettings initial) : settings_(std::move(initial)) {}
+
+    LiveSettings get() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return settings_;
+    }
+
+    template <typename Change>
+    void update(Change &&change) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        change(settings_);
+        generation_.fetch_add(1, std::memory_order_release);
+    }
+
+    uint64_t generation() const { return generation_.load(std::memory_order_acquire); }
+
+    // Copies the settings into out when they changed since seen; returns whether they did.
+    bool refresh(uint64_t &seen, LiveSettings &out) const {
+        if (generation() == seen) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        out = settings_;
+        seen = generation_.load(std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    LiveSettings settings_;
+    std::atomic<uint64_t> generation_{0};
+};
+
+// Capture output for one endpoint: the ring its capture thread fills and the event that
+// wakes whichever sender drains it. Ring slots hold a full 48 kHz frame, so the output rate
+// can change without reallocating; FrameMeta::samples gives each frame's length.
+struct Stream {
+    Stream(StreamConfig config, LiveSettings settings)
+        : cfg(std::move(config)),
+          live(std::move(settings)),
+          ring(frames_for_ms(kRingMs), capture_frame_samples()),
+          frame_ready(CreateEventW(nullptr, FALSE, FALSE, nullptr)),
+          pool(frame_pool_frames(), capture_frame_samples()) {}
+    ~Stream() { CloseHandle(frame_ready); }
+
+    Stream(const Stream &) = delete;
+    Stream &operator=(const Stream &) = delete;
+
+    StreamConfig cfg;
+    LiveConfig live;
+    engine::FrameRing ring;
+    HANDLE frame_ready;
+    // Loop capture chunks for the mic stream's echo canceller (see echo_reference.h), shared
+    // by both streams' capture threads.
+    engine::FrameRing *echo_ring = nullptr;
+    // Per-stream TCP port: the frames fanout queues; declared first so it outlives them.
+    engine::FramePool pool;
+    // Per-stream TCP port: every connected subscriber's queue (see stream_worker).
+    engine::FanOut fanout;
+    // --record: every frame, ungated, for record_worker.
+    std::unique_ptr<engine::FrameRing> record_ring;
+    // --asr: every frame with its VAD decision and utterance, ungated, for asr_worker.
+    std::unique_ptr<engine::FrameRing> asr_ring;
+    // --crosstalk: every 48 kHz capture frame with its VAD decision, for crosstalk_worker.
+    std::unique_ptr<engine::FrameRing> crosstalk_ring;
+    // Where the capture thread publishes utterance_start / utterance_end.
+    engine::EventLog *events = nullptr;
+    // Where the capture and transport threads report that they are prepared.
+    Startup *startup = nullptr;
+    // Hot-path timings, reported by metrics_worker (--metrics).
+    engine::StreamMetrics metrics;
+    // The endpoint capture runs on, as asked for ("" for the default), written by the capture
+    // thread for the config command; live.device_id may name one still opening or one that
+    // failed to. Unset while no endpoint is open.
+    mutable std::mutex device_mutex;
+    bool device_open = false;
+    std::string open_device_id;
+};
+
+uint64_t elapsed_us(uint64_t since_100ns, uint64_t now_100ns) {
+    return now_100ns > since_100ns ? (now_100ns - since_100ns) / 10 : 0;
+}
+
+// Control-port events for the segmenter's boundaries. Sample offsets count 48 kHz capture
+// samples from the stream start (sequence * capture_frame_samples()), whatever the stream's
+// output rate.
+void publish_utterance(Stream &stream, const engine::UtteranceSegmenter::Utterance &utterance, uint16_t flags) {
+    if (!stream.events) {
+        return;
+    }
+    std::string fields = "\"stream\":" + json_string(stream.cfg.label) +
+                         ",\"utterance\":" + std::to_string(utterance.id) +
+                         ",\"start_sequence\":" + std::to_string(utterance.start_sequence) +
+                         ",\"start_sample\":" + std::to_string(utterance.start_sample()) +
+                         ",\"start_qpc_100ns\":" + std::to_string(utterance.start_qpc_100ns);
+    if (flags & engine::kFrameFlagUtteranceStart) {
+        stream.events->publish("utterance_start",
+                               fields + ",\"onset_sequence\":" + std::to_string(utterance.onset_sequence));
+    }
+    if (flags & engine::kFrameFlagUtteranceEnd) {
+        fields += ",\"end_sequence\":" + std::to_string(utterance.end_sequence) +
+                  ",\"end_sample\":" + std::to_string(utterance.end_sample()) +
+                  ",\"end_qpc_100ns\":" + std::to_string(utterance.end_qpc_100ns) +
+                  ",\"duration_ms\":" + std::to_string(utterance.duration_ms());
+        stream.events->publish("utterance_end", fields);
+    }
+}
+
+// --vad-gate holds back frames outside utterances. The most recent ones are kept here so the
+// start of an utterance, which precedes the detector opening, still reaches the client.
+class PreRoll {
+public:
+    PreRoll()
+        : frames_(engine::utterance_lookback_frames()),
+          frame_samples_(static_cast<size_t>(capture_frame_samples())),
+          samples_(frames_ * frame_samples_, 0),
+          meta_(frames_) {}
+
+    void hold(const int16_t *samples, const engine::FrameMeta &meta) {
+        size_t slot = (first_ + count_) % frames_;
+        if (count_ == frames_) {
+            first_ = (first_ + 1) % frames_;
+        } else {
+            ++count_;
+        }
+        std::copy(samples, samples + meta.samples, samples_.begin() + slot * frame_samples_);
+        meta_[slot] = meta;
+    }
+
+    // Hands the held frames to emit oldest first and empties the buffer.
+    template <typename Emit>
+    void flush(Emit &&emit) {
+        for (size_t i = 0; i < count_; ++i) {
+            size_t slot = (first_ + i) % frames_;
+            emit(samples_.data() + slot * frame_samples_, meta_[slot]);
+        }
+        first_ = 0;
+        count_ = 0;
+    }
+
+private:
+    size_t frames_;
+    size_t frame_samples_;
+    std::vector<int16_t> samples_;
+    std::vector<engine::FrameMeta> meta_;
+    size_t first_ = 0;
+    size_t count_ = 0;
+};
+
+// --replay: feeds the stream's file through the capture sink in place of WASAPI. Media
+// timestamps on the shared epoch are already locked together, so drift correction is skipped.
+// Once the stream has drained, the last replay to finish stops the engine.
+void replay_capture(Stream &stream, const engine::CaptureSink &sink) {
+    const StreamConfig &cfg = stream.cfg;
+    engine::WavReplay replay(cfg.replay_path, cfg.label, cfg.replay_speed, cfg.replay_epoch_100ns);
+    const size_t backlog = frames_for_ms(kRingMs) / 2;
+    const bool opened = replay.open();
+    stream.startup->done(cfg.label + " replay", opened);
+    if (opened) {
+        char seconds[32];
+        std::snprintf(seconds, sizeof(seconds), "%.1f", replay.duration_seconds());
+        log_info(cfg.label + " replaying " + cfg.replay_path + " (" + seconds + " s at " +
+                 std::to_string(replay.file_rate()) + " Hz)");
+        while (g_running.load() && replay.pump(kCaptureWaitMs, sink)) {
+            while (cfg.lossless() && g_running.load() && stream.ring.size() >= backlog) {
+                Sleep(kReplayBackoffMs);
+            }
+        }
+        log_info(cfg.label + " replay finished");
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kReplayDrainMs);
+    while (g_running.load() && stream.ring.size() > 0 && std::chrono::steady_clock::now() < deadline) {
+        Sleep(kReplayBackoffMs);
+    }
+    if (--g_replays_active == 0 && g_running.load()) {
+        // Leave subscribers time to take what is still queued for them.
+        Sleep(kReplayDrainMs);
+        g_running.store(false);
+    }
+}
+
+// Opens an endpoint on a thread of its own, so the capture thread keeps pumping the current
+// one meanwhile. Empty when the endpoint cannot be opened.
+std::future<std::unique_ptr<engine::WasapiCapture>> open_capture_async(const StreamConfig &cfg,
+                                                                       std::string device_id) {
+    return std::async(std::launch::async, [kind = cfg.kind, label = cfg.label, device_id = std::move(device_id)] {
+        CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+        auto capture = std::make_unique<engine::WasapiCapture>(kind, device_id, label);
+        if (!capture->open()) {
+            capture.reset();
+        }
+        CoUninitialize();
+        return capture;
+    });
+}
+
+void set_open_device(Stream &stream, const engine::WasapiCapture *capture, const std::string &device_id) {
+    std::lock_guard<std::mutex> lock(stream.device_mutex);
+    stream.device_open = capture != nullptr;
+    stream.open_device_id = capture ? device_id : std::string();
+}
+
+void publish_device(Stream &stream, const engine::WasapiCapture &capture) {
+    if (stream.events) {
+        stream.events->publish("device_changed", "\"stream\":" + json_string(stream.cfg.label) +
+                                                     ",\"device\":" + json_string(capture.device_name()));
+    }
+}
+
+// A switch to device_id failed; capture stays on current, if any, and the switch is retried.
+void publish_device_failed(Stream &stream, const std::string &device_id, const engine::WasapiCapture *current) {
+    if (stream.events) {
+        stream.events->publish("device_failed",
+                               "\"stream\":" + json_string(stream.cfg.label) +
+                                   ",\"device\":" + json_string(device_id.empty() ? "default" : device_id) +
+                                   ",\"current\":" + (current ? json_string(current->device_name()) : "null"));
+    }
+}
+
+// Runs for the life of the stream on its own MMCSS thread, independent of any client, so
+// capture timing never sees the socket. A device switch, a new default endpoint or device
+// loss reopens capture in the background and splices the new endpoint's audio onto the
+// stream, with flagged silence over any outage, so the sequence and the clients carry on.
+void capture_worker(Stream &stream) {
+    const StreamConfig &cfg = stream.cfg;
+    const size_t frame_samples = static_cast<size_t>(capture_frame_samples());
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    engine::MmcssScope mmcss;
+
+    uint64_t seen = stream.live.generation();
+    LiveSettings live = stream.live.get();
+
+    // Echo cancellation: the loop stream taps its capture into echo_ring and the mic stream
+    // cancels it, both only while aec is set.
+    std::unique_ptr<engine::EchoTap> echo_tap;
+    std::unique_ptr<engine::EchoReference> echo_reference;
+    std::unique_ptr<engine::EchoCanceller> canceller;
+    if (stream.echo_ring && cfg.kind == engine::CaptureKind::Loopback) {
+        echo_tap = std::make_unique<engine::EchoTap>(*stream.echo_ring);
+    } else if (stream.echo_ring) {
+        echo_reference = std::make_unique<engine::EchoReference>(*stream.echo_ring);
+        canceller = std::make_unique<engine::EchoCanceller>(kSampleRate, frame_samples, kEchoTailMs);
+    }
+    auto log_canceller = [&] {
+        if (canceller && live.aec) {
+            log_info(cfg.label + " echo canceller block=" + std::to_string(canceller->block_size()) +
+                     " partitions=" + std::to_string(canceller->partitions()));
+        }
+    };
+    log_canceller();
+    std::vector<int16_t> held(frame_samples, 0);
+    std::vector<int16_t> reference(frame_samples, 0);
+    engine::FrameMeta held_meta;
+    bool have_held = false;
+
+    std::vector<int16_t> frame(frame_samples, 0);
+    engine::Resampler resampler(kSampleRate, live.out_rate);
+    std::vector<int16_t> resampled(resampler.max_output(frame_samples), 0);
+    engine::FrameMeta meta;
+    uint64_t next_sequence = 0;
+    size_t fill = 0;
+    bool all_silent = true;
+
+    engine::VoiceActivityDetector vad(live.out_rate);
+    engine::UtteranceSegmenter segmenter;
+    PreRoll pre_roll;
+    uint64_t next_pushed = 0;
+
+    auto push = [&](const int16_t *samples, engine::FrameMeta out_meta) {
+        out_meta.suppressed = static_cast<uint32_t>(out_meta.sequence - next_pushed);
+        next_pushed = out_meta.sequence + 1;
+        out_meta.pushed_100ns = engine::qpc_now_100ns();
+        stream.metrics.capture_to_ring_us.record(elapsed_us(out_meta.qpc_100ns, out_meta.pushed_100ns));
+        stream.metrics.ring_fill.record(stream.ring.size());
+        stream.ring.push(samples, out_meta);
+        SetEvent(stream.frame_ready);
+    };
+
+    // Cold start: process creation to the first frame out of the DSP chain.
+    bool first_frame = true;
+    auto report_first_frame = [&] {
+        first_frame = false;
+        const uint64_t us = elapsed_us(stream.startup->started_100ns(), engine::qpc_now_100ns());
+        stream.metrics.first_frame_us.store(us, std::memory_order_relaxed);
+        const std::string report = cfg.label + " first frame " + std::to_string(us / 1000) + " ms after start";
+        if (us / 1000 > kColdStartBudgetMs) {
+            log_error(report + ", over the " + std::to_string(kColdStartBudgetMs) + " ms budget");
+        } else {
+            log_info(report);
+        }
+    };
+
+    // Takes a finished 48 kHz frame through metering, resampling and the VAD gate.
+    auto deliver = [&](const int16_t *captured, engine::FrameMeta &frame_meta) {
+        if (first_frame) {
+            report_first_frame();
+        }
+        // Metered at the capture rate so clipping reflects what the device delivered.
+        frame_meta.levels = engine::measure_levels(captured, frame_samples);
+        frame_meta.samples = static_cast<uint32_t>(live.frame_samples());
+        const int16_t *out = captured;
+        if (!resampler.passthrough()) {
+            resampler.process(captured, frame_samples, resampled.data());
+            out = resampled.data();
+        }
+        // --asr and --crosstalk run the detector even when the stream itself does not carry it.
+        // With the detector off, an open utterance ends on the next frame.
+        const bool detect = live.vad || stream.asr_ring || stream.crosstalk_ring;
+        const bool speech = detect && vad.process(out, frame_meta.samples);
+        if (speech) {
+            frame_meta.flags |= engine::kFrameFlagSpeech;
+        }
+        if (segmenter.mark(frame_meta, speech)) {
+            publish_utterance(stream, segmenter.current(), frame_meta.flags);
+        }
+        if (stream.asr_ring) {
+            stream.asr_ring->push(out, frame_meta);
+        }
+        if (stream.crosstalk_ring) {
+            engine::FrameMeta capture_meta = frame_meta;
+            capture_meta.samples = static_cast<uint32_t>(frame_samples);
+            stream.crosstalk_ring->push(captured, capture_meta);
+        }
+        if (!live.vad) {
+            frame_meta.flags &= static_cast<uint16_t>(~(engine::kFrameFlagSpeech | engine::kFrameFlagUtteranceStart |
+                                                        engine::kFrameFlagUtteranceEnd));
+            frame_meta.utterance = 0;
+        }
+        if (stream.record_ring) {
+            stream.record_ring->push(out, frame_meta);
+        }
+        if (live.vad_gate && frame_meta.utterance == 0) {
+            pre_roll.hold(out, frame_meta);
+        } else {
+            pre_roll.flush(push);
+            push(out, frame_meta);
+        }
+    };
+
+    // Runs the held frame through the canceller once the loop thread has delivered its reference.
+    auto release_held = [&] {
+        echo_reference->fill(held_meta.qpc_100ns, reference.data(), frame_samples);
+        canceller->process(held.data(), reference.data(), held.data(), frame_samples);
+        deliver(held.data(), held_meta);
+        have_held = false;
+    };
+
+    // Picks up control-channel changes between frames. Frames held under the old settings (VAD
+    // pre-roll, the canceller's frame in hand) are released under them first. Device changes
+    // are acted on by the capture loop below.
+    auto apply_settings = [&] {
+        LiveSettings next = live;
+        if (!stream.live.refresh(seen, next)) {
+            return;
+        }
+        if (live.vad_gate && (!next.vad_gate || next.out_rate != live.out_rate)) {
+            pre_roll.flush(push);
+        }
+        if (have_held && !next.aec) {
+            release_held();
+        }
+        if (next.out_rate != live.out_rate) {
+            resampler = engine::Resampler(kSampleRate, next.out_rate);
+            resampled.assign(resampler.max_output(frame_samples), 0);
+            vad = engine::VoiceActivityDetector(next.out_rate);
+        } else if (next.vad && !live.vad) {
+            vad.reset();
+        }
+        const bool aec_started = next.aec && !live.aec;
+        if (aec_started && echo_tap) {
+            echo_tap->reset();
+        }
+        if (aec_started && canceller) {
+            canceller->reset();
+        }
+        live = std::move(next);
+        if (aec_started) {
+            log_canceller();
+        }
+    };
+
+    // End of the audio framed so far on the QPC timeline; 0 until the first sample.
+    uint64_t timeline_qpc = 0;
+    auto sink = [&](const int16_t *samples, size_t count, uint64_t qpc_100ns, uint32_t flags) {
+        if (echo_tap && live.aec) {
+            echo_tap->write(samples, count, qpc_100ns);
+        }
+        while (count > 0) {
+            if (fill == 0) {
+                meta.qpc_100ns = qpc_100ns;
+                meta.flags = 0;
+                all_silent = true;
+            }
+            if (flags & engine::kCaptureDiscontinuity) {
+                meta.flags |= engine::kFrameFlagDiscontinuity;
+            }
+            if (!(flags & engine::kCaptureSilent)) {
+                all_silent = false;
+            }
+            size_t n = std::min(count, frame_samples - fill);
+            std::copy(samples, samples + n, frame.begin() + fill);
+            fill += n;
+            samples += n;
+            count -= n;
+            qpc_100ns += n * 10000000ULL / kSampleRate;
+            timeline_qpc = qpc_100ns;
+            if (fill == frame_samples) {
+                fill = 0;
+                apply_settings();
+                meta.sequence = next_sequence++;
+                if (all_silent) {
+                    meta.flags |= engine::kFrameFlagSilence;
+                }
+                if (!canceller || !live.aec) {
+                    deliver(frame.data(), meta);
+                    continue;
+                }
+                // The canceller runs one frame behind capture, by which time the loop thread
+                // has delivered the reference covering the held frame.
+                if (have_held) {
+                    release_held();
+                }
+                held.swap(frame);
+                held_meta = meta;
+                have_held = true;
+            }
+        }
+    };
+
+    // Every stream is resampled onto the shared QPC timeline before framing, so mic and loop
+    // cannot drift apart however far their device clocks disagree.
+    engine::DriftCorrector drift;
+    uint64_t next_drift_log = 0;
+    // Silence from the end of the stream up to until_100ns, framed like endpoint silence.
+    const std::vector<int16_t> silence(frame_samples, 0);
+    auto fill_gap = [&](uint64_t until_100ns) {
+        while (timeline_qpc != 0 && timeline_qpc < until_100ns) {
+            const uint64_t missing = (until_100ns - timeline_qpc) * kSampleRate / 10000000ULL;
+            if (missing == 0) {
+                break;
+            }
+            sink(silence.data(), static_cast<size_t>(std::min<uint64_t>(missing, frame_samples)), timeline_qpc,
+                 engine::kCaptureSilent);
+        }
+    };
+    // Set when a new endpoint starts: its first audio is joined to the end of the stream, past
+    // silence over the outage or trimmed where the two endpoints overlap.
+    bool splice = false;
+    uint64_t splice_from = 0;
+    auto corrected_sink = [&](const int16_t *samples, size_t count, uint64_t qpc_100ns, uint32_t flags) {
+        if (flags & engine::kCaptureDiscontinuity) {
+            stream.metrics.xruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        size_t n = drift.process(samples, count, qpc_100ns);
+        if (drift.resynced()) {
+            flags |= engine::kCaptureDiscontinuity;
+        }
+        const int16_t *out = drift.output();
+        uint64_t out_qpc = drift.output_qpc();
+        if (splice && n > 0) {
+            splice = false;
+            if (out_qpc > timeline_qpc) {
+                fill_gap(out_qpc);
+            } else {
+                const size_t overlap =
+                    static_cast<size_t>(std::min<uint64_t>(n, (timeline_qpc - out_qpc) * kSampleRate / 10000000ULL));
+                out += overlap;
+                n -= overlap;
+                out_qpc = timeline_qpc;
+            }
+            stream.metrics.device_gap_us.record(elapsed_us(splice_from, timeline_qpc));
+        }
+        if (n > 0) {
+            sink(out, n, out_qpc, flags);
+        }
+        if (qpc_100ns >= next_drift_log) {
+            if (next_drift_log != 0) {
+                char ppm[32];
+                std::snprintf(ppm, sizeof(ppm), "%+.1f", drift.drift_ppm());
+                log_info(cfg.label + " clock drift " + ppm + " ppm vs QPC");
+            }
+            next_drift_log = qpc_100ns + kDriftLogInterval100ns;
+        }
+    };
+
+    // --prewarm: while the endpoint opens, a frame of silence goes through each DSP stage and
+    // their state is reset, so the first captured frame pays for no page faults or cold caches.
+    std::future<std::unique_ptr<engine::WasapiCapture>> opening;
+    if (cfg.prewarm && !cfg.replay()) {
+        opening = open_capture_async(cfg, live.device_id);
+    }
+    if (cfg.prewarm) {
+        engine::measure_levels(silence.data(), frame_samples);
+        drift.process(silence.data(), frame_samples, engine::qpc_now_100ns());
+        drift.reset();
+        if (!resampler.passthrough()) {
+            resampler.process(silence.data(), frame_samples, resampled.data());
+            resampler.reset();
+        }
+        vad.process(resampler.passthrough() ? silence.data() : resampled.data(), live.frame_samples());
+        vad.reset();
+        if (canceller) {
+            canceller->process(silence.data(), silence.data(), reference.data(), frame_samples);
+            canceller->reset();
+        }
+    }
+
+    if (cfg.replay()) {
+        replay_capture(stream, sink);
+        CoUninitialize();
+        return;
+    }
+
+    engine::DeviceWatcher watcher(cfg.kind);
+    watcher.start();
+    std::unique_ptr<engine::WasapiCapture> capture;
+    // The endpoint asked for and the default it followed; each new target bumps wanted_gen.
+    // A switch stays outstanding until an open of the latest target starts, so a failed one
+    // is retried while capture carries on with the endpoint it has.
+    std::string wanted_id = live.device_id;
+    uint64_t default_changes = watcher.changes();
+    uint64_t wanted_gen = 0;
+    bool switching = false;
+    // The target and generation of the open in flight, the endpoint capture runs on, and the
+    // last target whose failure was published.
+    std::string pending_id = wanted_id;
+    uint64_t pending_gen = 0;
+    std::string device_id;
+    uint64_t failed_gen = 0;
+    bool first_open = true;
+    bool reported = false;
+    auto retry_at = std::chrono::steady_clock::now();
+    while (g_running.load()) {
+        const auto now = std::chrono::steady_clock::now();
+        const bool default_moved = live.device_id.empty() && watcher.changes() != default_changes;
+        if (live.device_id != wanted_id || default_moved) {
+            log_info(cfg.label + " switching to device " + (live.device_id.empty() ? "default" : live.device_id));
+            wanted_id = live.device_id;
+            default_changes = watcher.changes();
+            ++wanted_gen;
+            switching = true;
+            retry_at = now;
+        }
+        if (!opening.valid() && (switching || !capture) && now >= retry_at) {
+            pending_id = wanted_id;
+            pending_gen = wanted_gen;
+            opening = open_capture_async(cfg, pending_id);
+        }
+        if (opening.valid() && opening.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            std::unique_ptr<engine::WasapiCapture> next = opening.get();
+            if (next && next->start()) {
+                // The old endpoint captured up to here; the new one's audio follows on.
+                if (capture) {
+                    capture->close();
+                    splice_from = timeline_qpc;
+                }
+                capture = std::move(next);
+                drift.reset();
+                next_drift_log = 0;
+                if (echo_tap) {
+                    echo_tap->reset();
+                }
+                if (canceller) {
+                    canceller->reset();
+                }
+                splice = timeline_qpc != 0;
+                device_id = pending_id;
+                switching = pending_gen != wanted_gen;
+                set_open_device(stream, capture.get(), device_id);
+                if (!first_open) {
+                    stream.metrics.device_switches.fetch_add(1, std::memory_order_relaxed);
+                    publish_device(stream, *capture);
+                }
+                first_open = false;
+            } else {
+                // A target that has moved on meanwhile is tried straight away.
+                if (pending_gen == wanted_gen) {
+                    retry_at = now + std::chrono::milliseconds(kDeviceRetryMs);
+                }
+                if (capture && pending_gen != failed_gen) {
+                    failed_gen = pending_gen;
+                    log_error(cfg.label + " could not switch to device " +
+                              (pending_id.empty() ? "default" : pending_id) + "; staying on " +
+                              capture->device_name());
+                    publish_device_failed(stream, pending_id, capture.get());
+                }
+            }
+            if (!reported) {
+                reported = true;
+                stream.startup->done(cfg.label + " device", capture != nullptr);
+            }
+        }
+        if (capture && !capture->pump(kCaptureWaitMs, corrected_sink)) {
+            // Lost: the default (or the same device, replugged) is tried again straight away.
+            capture.reset();
+            set_open_device(stream, nullptr, device_id);
+            splice_from = timeline_qpc;
+            retry_at = now;
+        } else if (!capture) {
+            // No endpoint: frames keep their cadence as silence until one opens.
+            if (opening.valid()) {
+                opening.wait_for(std::chrono::milliseconds(kCaptureWaitMs));
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(kCaptureWaitMs));
+            }
+            fill_gap(engine::qpc_now_100ns());
+        }
+        // A device that delivers nothing completes no frames, so check between packets too.
+        if (fill == 0) {
+            apply_settings();
+        }
+    }
+    capture.reset();
+    if (opening.valid()) {
+        opening.get();
+    }
+    watcher.stop();
+
+    CoUninitialize();
+}
+
+// Checks a received ClientHello and completes reply for it. Returns the negotiated protocol
+// version, or 0 (raw PCM) when the hello is malformed.
+int answer_hello(const engine::ClientHello &hello, const std::string &label, engine::ServerHello &reply) {
+    if (hello.magic != engine::kClientHelloMagic || hello.version == 0) {
+        log_error(label + " ignoring malformed client hello");
+        return 0;
+    }
+    uint16_t version = std::min(hello.version, engine::kProtocolVersion);
+    reply.magic = engine::kServerHelloMagic;
+    reply.version = version;
+    reply.header_bytes = sizeof(engine::FrameHeader);
+    reply.qpc_100ns = engine::qpc_now_100ns();
+    return version;
+}
+
+// Reads a ClientHello when framing is enabled and answers with reply. Returns the negotiated
+// protocol version (0 = raw PCM) or -1 when the client went away, e.g. a readiness probe.
+int negotiate_protocol(SOCKET client, const std::string &label, bool framed, engine::ServerHello reply) {
+    if (!framed || !engine::wait_readable(client, kHelloWaitMs)) {
+        return 0;
+    }
+
+    engine::ClientHello hello{};
+    if (!engine::recv_all(client, reinterpret_cast<char *>(&hello), sizeof(hello))) {
+        return -1;
+    }
+    int version = answer_hello(hello, label, reply);
+    if (version > 0 && !engine::send_all(client, reinterpret_cast<const char *>(&reply), sizeof(reply))) {
+        return -1;
+    }
+    return version;
+}
+
+// The stream as it is when a client attaches. Rate and codec may change later; each frame
+// header's sample_count and format_id describe the frame it precedes.
+engine::ServerHello describe_stream(const LiveSettings &live, uint8_t channel_id, uint8_t format_id) {
+    engine::ServerHello info{};
+    info.sample_rate = static_cast<uint32_t>(live.out_rate);
+    info.frame_samples = static_cast<uint16_t>(live.frame_samples());
+    info.channel_id = channel_id;
+    info.format_id = format_id;
+    return info;
+}
+
+void set_levels(engine::FrameHeader &header, int channel, const engine::FrameLevels &levels) {
+    header.level_rms[channel] = levels.rms;
+    header.level_peak[channel] = levels.peak;
+    header.clip_count[channel] = levels.clipped;
+}
+
+engine::FrameHeader make_header(const engine::FrameMeta &meta, int version, uint8_t channel_id, uint8_t format_id,
+                                int sample_count, int payload_bytes) {
+    engine::FrameHeader header{};
+    header.magic = engine::kFrameMagic;
+    header.version = static_cast<uint16_t>(version);
+    header.header_bytes = sizeof(engine::FrameHeader);
+    header.sequence = meta.sequence;
+    header.capture_qpc_100ns = meta.qpc_100ns;
+    header.sample_count = static_cast<uint32_t>(sample_count);
+    header.channel_id = channel_id;
+    header.format_id = format_id;
+    header.flags = meta.flags;
+    header.payload_bytes = static_cast<uint32_t>(payload_bytes);
+    header.suppressed = meta.suppressed;
+    set_levels(header, 0, meta.levels);
+    return header;
+}
+
+// --codec opus: encodes one frame behind its header into coded and returns the bytes to send,
+// or 0 when the encoder failed and the frame is skipped.
+int encode_frame(engine::OpusFrameEncoder &encoder, const int16_t *pcm, engine::FrameHeader header,
+                 std::vector<uint8_t> &coded) {
+    int bytes = encoder.encode(pcm, static_cast<int>(header.sample_count), coded.data() + sizeof(header),
+                               engine::kMaxOpusPacketBytes);
+    if (bytes == 0) {
+        return 0;
+    }
+    header.payload_bytes = static_cast<uint32_t>(bytes);
+    std::memcpy(coded.data(), &header, sizeof(header));
+    return static_cast<int>(sizeof(header)) + bytes;
+}
+
+// --codec opus: an encoder that follows the control channel. It is keyed on the rate of the
+// frame being encoded rather than the current setting, so frames queued before a rate change
+// still encode at the rate they were captured at. get() returns nullptr while PCM is selected
+// or when no encoder can be built, and the frame then goes out as PCM.
+class LiveEncoder {
+public:
+    explicit LiveEncoder(int channels) : channels_(channels) {}
+
+    engine::OpusFrameEncoder *get(bool opus, int bitrate, int frame_samples) {
+        if (!opus) {
+            encoder_.reset();
+            configured_ = false;
+            return nullptr;
+        }
+        const int rate = engine::rate_for_frame_samples(frame_samples);
+        if (!configured_ || rate != rate_ || bitrate != bitrate_) {
+            encoder_.reset();
+            configured_ = true;
+            rate_ = rate;
+            bitrate_ = bitrate;
+            if (engine::is_opus_rate(rate)) {
+                encoder_ = std::make_unique<engine::OpusFrameEncoder>(rate, channels_, bitrate);
+                if (!encoder_->ok()) {
+                    encoder_.reset();
+                }
+            }
+        }
+        return encoder_.get();
+    }
+
+    void reset() {
+        if (encoder_) {
+            encoder_->reset();
+        }
+    }
+
+private:
+    const int channels_;
+    std::unique_ptr<engine::OpusFrameEncoder> encoder_;
+    bool configured_ = false;
+    int rate_ = 0;
+    int bitrate_ = 0;
+};
+
+// kHelloFlagLogMel subscribers: resamples frames to 16 kHz and turns them into log-mel vectors
+// behind a kFormatLogMel header. A gap in the audio restarts the analysis, so vector times
+// stay tied to the capture clock.
+class LogMelFeed {
+public:
+    // Writes the frame's header and vectors into out and returns the bytes, or 0 when the
+    // frame completed no vector.
+    int encode(const int16_t *pcm, int frame_samples, engine::FrameMeta meta, int version, uint8_t channel_id,
+               std::vector<uint8_t> &out) {
+        const int rate = engine::rate_for_frame_samples(frame_samples);
+        if (!resampler_ || resampler_->in_rate() != rate) {
+            resampler_ = std::make_unique<engine::Resampler>(rate, engine::LogMelExtractor::kSampleRate);
+            audio_.resize(resampler_->max_output(capture_frame_samples()));
+            mel_.reset();
+        } else if ((meta.flags & engine::kFrameFlagDiscontinuity) || meta.suppressed > 0) {
+            resampler_->reset();
+            mel_.reset();
+        }
+        const size_t count = resampler_->process(pcm, static_cast<size_t>(frame_samples), audio_.data());
+
+        const size_t vector_bytes = engine::LogMelExtractor::kMels * sizeof(float);
+        out.resize(sizeof(engine::FrameHeader) + engine::LogMelExtractor::max_frames(count) * vector_bytes);
+        const size_t vectors =
+            mel_.process(audio_.data(), count, reinterpret_cast<float *>(out.data() + sizeof(engine::FrameHeader)));
+        if (vectors == 0) {
+            return 0;
+        }
+        // 625 x 100 ns per 16 kHz sample.
+        meta.qpc_100ns = static_cast<uint64_t>(static_cast<int64_t>(meta.qpc_100ns) + mel_.first_center() * 625);
+        const int payload_bytes = static_cast<int>(vectors * vector_bytes);
+        engine::FrameHeader header = make_header(meta, version, channel_id, engine::kFormatLogMel,
+                                                 static_cast<int>(vectors), payload_bytes);
+        std::memcpy(out.data(), &header, sizeof(header));
+        return static_cast<int>(sizeof(header)) + payload_bytes;
+    }
+
+private:
+    std::unique_ptr<engine::Resampler> resampler_;
+    std::vector<int16_t> audio_;
+    engine::LogMelExtractor mel_;
+};
+
+// Flags a frame whose sequence does not follow the previous one seen by this consumer,
+// allowing for frames the VAD gate suppressed on purpose.
+struct SequenceTracker {
+    bool have_last = false;
+    uint64_t last = 0;
+
+    uint16_t check(const engine::FrameMeta &meta) {
+        bool gap = have_last && meta.sequence != last + 1 + meta.suppressed;
+        have_last = true;
+        last = meta.sequence;
+        return gap ? engine::kFrameFlagDiscontinuity : 0;
+    }
+};
+
+SOCKET accept_client(SOCKET listen_sock, const std::string &label) {
+    sockaddr_in client_addr{};
+    int addr_len = sizeof(client_addr);
+    SOCKET client = accept(listen_sock, reinterpret_cast<sockaddr *>(&client_addr), &addr_len);
+    if (client == INVALID_SOCKET && g_running.load()) {
+        log_error(label + " accept failed: " + std::to_string(WSAGetLastError()));
+    }
+    return client;
+}
+
+// One client of a per-stream port, driven by the IOCP workers. It owns a fan-out queue,
+// a sequence tracker and (for --codec opus or log-mel features) an encoder, so a slow reader
+// only ever drops its own frames. A batching client (kHelloBatchShift) gets its frames copied
+// into one buffer per batch; everyone else is sent each frame as soon as it is queued.
+class StreamSubscriber : public engine::ConnectionHandler {
+public:
+    StreamSubscriber(Stream &stream, engine::WakeFn wake) : stream_(stream), wake_(std::move(wake)) {}
+
+    bool on_hello(const char *hello, std::vector<char> &reply) override {
+        const StreamConfig &cfg = stream_.cfg;
+        seen_ = stream_.live.generation();
+        live_ = stream_.live.get();
+        const uint8_t format_id = live_.opus ? engine::kFormatOpus : engine::kFormatPcm16;
+        uint16_t hello_flags = 0;
+        if (hello) {
+            engine::ClientHello client_hello;
+            std::memcpy(&client_hello, hello, sizeof(client_hello));
+            log_mel_ = (client_hello.flags & engine::kHelloFlagLogMel) != 0;
+            utterances_ = (client_hello.flags & engine::kHelloFlagUtterances) != 0;
+            batch_limit_ = (client_hello.flags & engine::kHelloBatchMask) >> engine::kHelloBatchShift;
+            engine::ServerHello server_hello = describe_stream(live_, cfg.channel_id, format_id);
+            if (log_mel_) {
+                server_hello.sample_rate = engine::LogMelExtractor::kSampleRate;
+                server_hello.frame_samples = static_cast<uint16_t>(engine::LogMelExtractor::kMels);
+                server_hello.format_id = engine::kFormatLogMel;
+            }
+            version_ = answer_hello(client_hello, cfg.label, server_hello);
+            if (version_ > 0) {
+                hello_flags = client_hello.flags;
+                const char *bytes = reinterpret_cast<const char *>(&server_hello);
+                reply.assign(bytes, bytes + sizeof(server_hello));
+            }
+        }
+
+        // Raw clients cannot delimit packets, so they keep receiving PCM.
+        log_mel_ = log_mel_ && version_ > 0;
+        utterances_ = utterances_ && version_ > 0;
+        batch_limit_ = version_ > 0 && batch_limit_ > 1 ? batch_limit_ : 0;
+        if (live_.opus && version_ > 0 && !log_mel_ && !encoder_.get(true, live_.bitrate, live_.frame_samples())) {
+            return false;
+        }
+
+        engine::DropPolicy policy =
+            (hello_flags & engine::kHelloFlagDropNewest) ? engine::DropPolicy::Newest : engine::DropPolicy::Oldest;
+        subscriber_ = stream_.fanout.subscribe(frames_for_ms(kSubscriberQueueMs), policy, wake_);
+        log_info(cfg.label + " client connected protocol=" + (version_ > 0 ? "framed" : "raw") +
+                 (log_mel_ ? " features=logmel" : "") + (utterances_ ? " utterances" : "") +
+                 (batch_limit_ ? " batch=" + std::to_string(batch_limit_) : std::string()) +
+                 " subscribers=" + std::to_string(stream_.fanout.subscribers()));
+        return true;
+    }
+
+    int next_send(WSABUF *buffers) override {
+        stream_.live.refresh(seen_, live_);
+        int count = batch_limit_ ? fill_batch(buffers) : fill_send(buffers);
+        if (count > 0) {
+            send_started_ = engine::qpc_now_100ns();
+            stream_.metrics.ring_to_send_us.record(elapsed_us(send_pushed_100ns_, send_started_));
+        }
+        return count;
+    }
+
+    void on_sent() override {
+        stream_.metrics.send_us.record(elapsed_us(send_started_, engine::qpc_now_100ns()));
+        if (batch_limit_) {
+            batch_.resize(sizeof(engine::BatchHeader));
+            batch_frames_ = 0;
+        } else {
+            frame_.reset();
+        }
+    }
+
+    void on_close() override {
+        if (subscriber_) {
+            stream_.fanout.unsubscribe(subscriber_);
+            log_info(stream_.cfg.label + " client disconnected drops=" + std::to_string(subscriber_->drops()));
+        }
+    }
+
+private:
+    // Describes the next queued frame in buffers; returns the buffer count, 0 when idle.
+    int fill_send(WSABUF *buffers) {
+        while (next_frame()) {
+            const int count = describe_frame(buffers);
+            if (count > 0) {
+                send_pushed_100ns_ = frame_->meta.pushed_100ns;
+                return count;
+            }
+        }
+        frame_.reset();
+        return 0;
+    }
+
+    // Appends queued frames to batch_ and describes it once it holds batch_limit_ frames, ends
+    // an utterance or has been open for batch_limit_ frame durations; returns 0 while it fills.
+    // A frame captured past the batch's window stays in frame_ to open the next one.
+    int fill_batch(WSABUF *buffers) {
+        const uint64_t window_100ns = static_cast<uint64_t>(batch_limit_) * engine::frame_100ns();
+        bool ready = false;
+        while (!ready && (frame_ || next_frame())) {
+            if (batch_frames_ > 0 && frame_->meta.qpc_100ns >= batch_qpc_100ns_ + window_100ns) {
+                ready = true;
+                break;
+            }
+            WSABUF parts[engine::kMaxSendBuffers];
+            const int count = describe_frame(parts);
+            if (count > 0) {
+                if (batch_frames_ == 0) {
+                    batch_qpc_100ns_ = frame_->meta.qpc_100ns;
+                    send_pushed_100ns_ = frame_->meta.pushed_100ns;
+                }
+                for (int i = 0; i < count; ++i) {
+                    batch_.insert(batch_.end(), parts[i].buf, parts[i].buf + parts[i].len);
+                }
+                ++batch_frames_;
+            }
+            const bool ends_utterance = (frame_->meta.flags & engine::kFrameFlagUtteranceEnd) != 0;
+            frame_.reset();
+            ready = batch_frames_ > 0 && (batch_frames_ >= batch_limit_ || ends_utterance);
+        }
+        // Nothing more queued: a stalled or gated stream still sends what it holds in time.
+        if (!ready && (batch_frames_ == 0 || engine::qpc_now_100ns() < send_pushed_100ns_ + window_100ns)) {
+            return 0;
+        }
+        engine::BatchHeader header{};
+        header.magic = engine::kBatchMagic;
+        header.version = static_cast<uint16_t>(version_);
+        header.header_bytes = sizeof(header);
+        header.frame_count = batch_frames_;
+        header.batch_bytes = static_cast<uint32_t>(batch_.size() - sizeof(header));
+        std::memcpy(batch_.data(), &header, sizeof(header));
+        buffers[0] = WSABUF{static_cast<ULONG>(batch_.size()), batch_.data()};
+        return 1;
+    }
+
+    // Describes frame_ as one framed (or raw) message in buffers that stay valid until the
+    // next call; returns the buffer count, 0 when the encoder produced nothing for it.
+    int describe_frame(WSABUF *buffers) {
+        const StreamConfig &cfg = stream_.cfg;
+        const int frame_samples = static_cast<int>(frame_->samples.size());
+        const int payload_bytes = frame_samples * static_cast<int>(sizeof(int16_t));
+        const ULONG frame_bytes = static_cast<ULONG>(payload_bytes);
+        engine::FrameMeta meta = frame_->meta;
+        if (utterances_) {
+            mark_utterance(meta);
+        }
+        meta.flags |= tracker_.check(meta);
+        char *pcm = const_cast<char *>(reinterpret_cast<const char *>(frame_->samples.data()));
+        if (log_mel_) {
+            int len =
+                log_mel_feed_.encode(frame_->samples.data(), frame_samples, meta, version_, cfg.channel_id, coded_);
+            if (len == 0) {
+                return 0;
+            }
+            buffers[0] = WSABUF{static_cast<ULONG>(len), reinterpret_cast<char *>(coded_.data())};
+            return 1;
+        }
+        engine::OpusFrameEncoder *encoder = encoder_.get(live_.opus && version_ > 0, live_.bitrate, frame_samples);
+        if (encoder) {
+            engine::FrameHeader header =
+                make_header(meta, version_, cfg.channel_id, engine::kFormatOpus, frame_samples, payload_bytes);
+            int len = encode_frame(*encoder, frame_->samples.data(), header, coded_);
+            if (len == 0) {
+                return 0;
+            }
+            buffers[0] = WSABUF{static_cast<ULONG>(len), reinterpret_cast<char *>(coded_.data())};
+            return 1;
+        }
+        if (version_ > 0) {
+            // The header goes out from here and the payload straight from the shared frame.
+            header_ = make_header(meta, version_, cfg.channel_id, engine::kFormatPcm16, frame_samples, payload_bytes);
+            buffers[0] = WSABUF{static_cast<ULONG>(sizeof(header_)), reinterpret_cast<char *>(&header_)};
+            buffers[1] = WSABUF{frame_bytes, pcm};
+            return 2;
+        }
+        buffers[0] = WSABUF{frame_bytes, pcm};
+        return 1;
+    }
+
+    // Takes the next frame to send into frame_. An utterance subscriber holds back frames
+    // outside utterances, keeping the segmenter's lookback to send ahead of the next one.
+    bool next_frame() {
+        if (!utterances_) {
+            return subscriber_->pop(frame_);
+        }
+        while (pending_.empty()) {
+            engine::FrameRef frame;
+            if (!subscriber_->pop(frame)) {
+                return false;
+            }
+            const uint64_t utterance = frame->meta.utterance;
+            if (utterance == 0) {
+                lookback_.push_back(std::move(frame));
+                if (lookback_.size() > engine::utterance_lookback_frames()) {
+                    lookback_.pop_front();
+                }
+                continue;
+            }
+            if (utterance != utterance_) {
+                utterance_ = utterance;
+                utterance_started_ = false;
+                pending_.swap(lookback_);
+            }
+            pending_.push_back(std::move(frame));
+        }
+        frame_ = std::move(pending_.front());
+        pending_.pop_front();
+        return true;
+    }
+
+    // The utterance's first frame sent carries the start flag, and the frames skipped before
+    // it are suppressed rather than lost: only a gap inside an utterance is a discontinuity.
+    void mark_utterance(engine::FrameMeta &meta) {
+        meta.flags &= static_cast<uint16_t>(~engine::kFrameFlagUtteranceStart);
+        if (utterance_started_) {
+            return;
+        }
+        utterance_started_ = true;
+        meta.flags |= engine::kFrameFlagUtteranceStart;
+        if (tracker_.have_last && meta.sequence > tracker_.last) {
+            meta.suppressed = static_cast<uint32_t>(meta.sequence - tracker_.last - 1);
+        }
+    }
+
+    Stream &stream_;
+    engine::WakeFn wake_;
+    int version_ = 0;
+    uint64_t seen_ = 0;
+    LiveSettings live_;
+    std::shared_ptr<engine::Subscriber> subscriber_;
+    LiveEncoder encoder_{1};
+    bool log_mel_ = false;
+    LogMelFeed log_mel_feed_;
+    bool utterances_ = false;
+    uint64_t utterance_ = 0;
+    bool utterance_started_ = false;
+    std::deque<engine::FrameRef> lookback_;
+    // The utterance's lookback and frames, in order, still to send.
+    std::deque<engine::FrameRef> pending_;
+    std::vector<uint8_t> coded_ = std::vector<uint8_t>(sizeof(engine::FrameHeader) + engine::kMaxOpusPacketBytes);
+    SequenceTracker tracker_;
+    engine::FrameRef frame_;
+    engine::FrameHeader header_{};
+    // kHelloBatchShift: frames per batch (0 = unbatched) and the batch being filled, its
+    // BatchHeader written in front once it is sent.
+    uint32_t batch_limit_ = 0;
+    uint32_t batch_frames_ = 0;
+    uint64_t batch_qpc_100ns_ = 0;
+    std::vector<char> batch_ = std::vector<char>(sizeof(engine::BatchHeader));
+    // Ring push time of the oldest frame in the message being sent.
+    uint64_t send_pushed_100ns_ = 0;
+    uint64_t send_started_ = 0;
+};
+
+// Registers the stream's port with the IOCP server, which accepts up to kMaxSubscribers
+// concurrent clients, then drains the capture ring into reference-counted frames shared by
+// every subscriber's queue until shutdown.
+void stream_worker(Stream &stream, engine::IocpServer &io) {
+    const StreamConfig &cfg = stream.cfg;
+    auto factory = [&stream](engine::WakeFn wake) -> std::unique_ptr<engine::ConnectionHandler> {
+        return std::make_unique<StreamSubscriber>(stream, std::move(wake));
+    };
+    if (!io.listen(cfg.host, cfg.port, cfg.label, cfg.framed ? sizeof(engine::ClientHello) : 0, kHelloWaitMs,
+                   kMaxSubscribers, factory)) {
+        stream.startup->done(cfg.label + " port", false);
+        return;
+    }
+
+    std::unique_ptr<engine::PacingTimer> timer;
+    if (cfg.paced) {
+        timer = std::make_unique<engine::PacingTimer>();
+        if (!timer->valid()) {
+            log_error(cfg.label + " pacing timer unavailable: " + std::to_string(GetLastError()));
+            stream.startup->done(cfg.label + " port", false);
+            return;
+        }
+        if (!timer->high_resolution()) {
+            log_info(cfg.label + " high-resolution timer unavailable; pacing follows the system timer");
+        }
+    }
+    const LiveSettings live = stream.live.get();
+    log_info(cfg.label + " listening on " + cfg.host + ":" + std::to_string(cfg.port) +
+             " rate=" + std::to_string(live.out_rate) +
+             (live.opus ? " codec=opus bitrate=" + std::to_string(live.bitrate) : std::string()) +
+             (cfg.paced ? " pacing=timer" : ""));
+    stream.startup->done(cfg.label + " port");
+
+    engine::JitterBuffer jitter;
+    // --pacing: frames waiting for their release time, oldest first.
+    std::deque<engine::FrameRef> paced;
+    uint64_t last_release = 0;
+    uint64_t last_scheduled = 0;
+    const HANDLE waits[2] = {stream.frame_ready, timer ? timer->handle() : nullptr};
+
+    // Hands due frames to the subscribers and records how far the sends strayed from the grid.
+    auto release_due = [&] {
+        while (!paced.empty()) {
+            const uint64_t scheduled = jitter.release_100ns(paced.front()->meta.qpc_100ns);
+            const uint64_t now = engine::qpc_now_100ns();
+            if (now < scheduled) {
+                return;
+            }
+            if (last_release != 0) {
+                const int64_t deviation = static_cast<int64_t>(now - last_release) -
+                                          static_cast<int64_t>(scheduled - last_scheduled);
+                stream.metrics.output_jitter_us.record(static_cast<uint64_t>(std::llabs(deviation)) / 10);
+            }
+            last_release = now;
+            last_scheduled = scheduled;
+            stream.metrics.playout_delay_us.record(jitter.delay_100ns() / 10);
+            if (stream.fanout.subscribers() > 0) {
+                stream.fanout.publish(paced.front());
+            }
+            paced.pop_front();
+        }
+    };
+
+    engine::FrameRef next;
+    while (g_running.load()) {
+        DWORD waited;
+        if (!paced.empty()) {
+            timer->arm(jitter.release_100ns(paced.front()->meta.qpc_100ns));
+            waited = WaitForMultipleObjects(2, waits, FALSE, kSenderWaitMs);
+        } else {
+            waited = WaitForSingleObject(stream.frame_ready, kSenderWaitMs);
+        }
+        if (waited == WAIT_TIMEOUT) {
+            // No audio for a while: batching subscribers send what they hold once it is due.
+            stream.fanout.poke_all();
+        }
+        for (;;) {
+            // Lossless replay holds frames in the ring until every subscriber has room.
+            if (cfg.lossless() && (stream.fanout.subscribers() == 0 || stream.fanout.any_full())) {
+                if (!g_running.load()) {
+                    break;
+                }
+                Sleep(kReplayBackoffMs);
+                continue;
+            }
+            if (!next) {
+                next = stream.pool.acquire();
+            }
+            // Every pooled frame still queued: leave the audio in the ring, which drops (and
+            // counts) the oldest if the subscribers never catch up.
+            if (!next) {
+                break;
+            }
+            engine::SharedFrame &frame = *next.edit();
+            // Sized for the largest frame, then trimmed to this one within the same capacity.
+            frame.samples.resize(capture_frame_samples());
+            if (!stream.ring.pop(frame.samples.data(), frame.meta)) {
+                break;
+            }
+            frame.samples.resize(frame.meta.samples);
+            const uint64_t deviation = jitter.arrived(frame.meta.qpc_100ns, frame.meta.pushed_100ns);
+            stream.metrics.arrival_jitter_us.record(deviation / 10);
+            if (cfg.paced) {
+                paced.push_back(std::move(next));
+                continue;
+            }
+            // Without subscribers the frame is dropped here and its buffer reused.
+            if (stream.fanout.subscribers() > 0) {
+                stream.fanout.publish(next);
+                next.reset();
+            }
+        }
+        release_due();
+        stream.metrics.late_frames.store(jitter.late(), std::memory_order_relaxed);
+    }
+}
+
+// --transport shm: publishes the stream into a named file mapping instead of a socket.
+// Frames are popped from the capture ring straight into the mapped slot.
+void shm_worker(Stream &stream, const std::string &name) {
+    const StreamConfig &cfg = stream.cfg;
+    uint64_t seen = stream.live.generation();
+    LiveSettings live = stream.live.get();
+
+    // Readers attach at any time, so the shm encoder is never reset; Opus decoders pick up
+    // mid-stream within a packet or two.
+    LiveEncoder encoder(1);
+    if (live.opus && !encoder.get(true, live.bitrate, live.frame_samples())) {
+        stream.startup->done(name, false);
+        return;
+    }
+    std::vector<int16_t> pcm(capture_frame_samples(), 0);
+    const uint8_t format_id = live.opus ? engine::kFormatOpus : engine::kFormatPcm16;
+
+    // Slots fit a full-rate PCM frame, so the control channel can switch rate or codec.
+    engine::ShmPublisher publisher;
+    const uint32_t slots = static_cast<uint32_t>(frames_for_ms(kShmMs));
+    if (!publisher.open(name, slots, describe_stream(live, cfg.channel_id, format_id),
+                        static_cast<uint32_t>(std::max(engine::capture_frame_bytes(), engine::kMaxOpusPacketBytes)))) {
+        stream.startup->done(name, false);
+        return;
+    }
+    log_info(cfg.label + " publishing to shm " + name + " rate=" + std::to_string(live.out_rate) +
+             (live.opus ? " codec=opus bitrate=" + std::to_string(live.bitrate) : std::string()));
+    stream.startup->done(name);
+
+    engine::FrameMeta meta;
+    SequenceTracker tracker;
+    while (g_running.load()) {
+        WaitForSingleObject(stream.frame_ready, kSenderWaitMs);
+        stream.live.refresh(seen, live);
+        for (;;) {
+            uint8_t *slot = publisher.next_payload();
+            // PCM is popped straight into the slot; Opus frames go through pcm to be encoded
+            // into it, or copied when no encoder fits their rate.
+            const bool opus = live.opus;
+            if (!stream.ring.pop(opus ? pcm.data() : reinterpret_cast<int16_t *>(slot), meta)) {
+                break;
+            }
+            meta.flags |= tracker.check(meta);
+            const int frame_samples = static_cast<int>(meta.samples);
+            int payload_bytes = frame_samples * static_cast<int>(sizeof(int16_t));
+            uint8_t frame_format = engine::kFormatPcm16;
+            if (opus) {
+                engine::OpusFrameEncoder *opus_encoder = encoder.get(true, live.bitrate, frame_samples);
+                if (opus_encoder) {
+                    payload_bytes = opus_encoder->encode(pcm.data(), frame_samples, slot, engine::kMaxOpusPacketBytes);
+                    frame_format = engine::kFormatOpus;
+                } else {
+                    std::memcpy(slot, pcm.data(), static_cast<size_t>(payload_bytes));
+                }
+                if (payload_bytes == 0) {
+                    continue;
+                }
+            }
+            publisher.commit(make_header(meta, engine::kProtocolVersion, cfg.channel_id, frame_format, frame_samples,
+                                         payload_bytes));
+            stream.metrics.ring_to_send_us.record(elapsed_us(meta.pushed_100ns, engine::qpc_now_100ns()));
+        }
+    }
+}
+
+enum class MuxLayout {
+    // Mono frames from both streams on one connection, merged in capture-time order.
+    Interleaved,
+    // One stereo frame per tick: mic on the left channel, loop on the right.
+    Stereo,
+};
+
+struct MuxConfig {
+    std::string host;
+    int port = 0;
+    MuxLayout layout = MuxLayout::Interleaved;
+    bool framed = false;
+};
+
+// Pending frame taken from one stream's ring while the mux waits for its partner.
+struct MuxSlot {
+    MuxSlot(size_t samples, engine::StreamMetrics &stream_metrics)
+        : packet(kHeaderWords + samples, 0), metrics(stream_metrics) {}
+
+    int16_t *payload() { return packet.data() + kHeaderWords; }
+
+    std::vector<int16_t> packet;
+    engine::FrameMeta meta;
+    SequenceTracker tracker;
+    bool pending = false;
+    // --codec opus, interleaved layout: each channel keeps its own encoder state.
+    LiveEncoder encoder{1};
+    engine::StreamMetrics &metrics;
+};
+
+// Serves both streams over a single connection. Frames are paired or ordered by capture
+// timestamp; a stream that falls more than kMuxHoldMs behind is sent without its partner
+// (stereo fills its side with flagged silence) so one stalled device cannot stall the other.
+// Rate and codec follow the mic stream's settings, which the control channel changes for
+// both streams together.
+void mux_worker(const MuxConfig &mux, Stream &mic, Stream &loop) {
+    const std::string label = "mux";
+    SOCKET listen_sock = engine::create_listen_socket(mux.host, mux.port, label);
+    if (listen_sock == INVALID_SOCKET) {
+        mic.startup->done(label + " port", false);
+        return;
+    }
+
+    const bool stereo = mux.layout == MuxLayout::Stereo;
+    uint64_t seen = mic.live.generation();
+    LiveSettings live = mic.live.get();
+    log_info(label + " listening on " + mux.host + ":" + std::to_string(mux.port) +
+             " layout=" + (stereo ? "stereo" : "interleaved") +
+             (live.opus ? " codec=opus bitrate=" + std::to_string(live.bitrate) : std::string()));
+
+    const uint64_t half_frame_100ns = engine::frame_100ns() / 2;
+    const uint64_t hold_100ns = engine::frame_100ns() + static_cast<uint64_t>(kMuxHoldMs) * 10000;
+
+    MuxSlot mic_slot(capture_frame_samples(), mic.metrics);
+    MuxSlot loop_slot(capture_frame_samples(), loop.metrics);
+    std::vector<int16_t> stereo_packet(kHeaderWords + 2 * capture_frame_samples(), 0);
+    HANDLE events[2] = {mic.frame_ready, loop.frame_ready};
+
+    LiveEncoder stereo_encoder(2);
+    if (live.opus && !(stereo ? stereo_encoder : mic_slot.encoder).get(true, live.bitrate, live.frame_samples())) {
+        closesocket(listen_sock);
+        mic.startup->done(label + " port", false);
+        return;
+    }
+    mic.startup->done(label + " port");
+    std::vector<uint8_t> coded(sizeof(engine::FrameHeader) + engine::kMaxOpusPacketBytes);
+
+    while (g_running.load()) {
+        SOCKET client = accept_client(listen_sock, label);
+        if (client == INVALID_SOCKET) {
+            continue;
+        }
+
+        mic.live.refresh(seen, live);
+        const uint8_t mono_format = live.opus ? engine::kFormatOpus : engine::kFormatPcm16;
+        const uint8_t stereo_format = live.opus ? engine::kFormatOpusStereo : engine::kFormatPcm16Stereo;
+        engine::ServerHello info = describe_stream(live, stereo ? engine::kChannelStereo : engine::kChannelMux,
+                                                   stereo ? stereo_format : mono_format);
+        int version = negotiate_protocol(client, label, mux.framed, info);
+        if (version < 0 || (version == 0 && !stereo)) {
+            if (version == 0) {
+                log_error(label + " interleaved layout needs the framed protocol; closing client");
+            }
+            closesocket(client);
+            continue;
+        }
 
-namespace {
-constexpr int kSampleRate = 48000;
-constexpr int kFrameSamples = 960;
-constexpr int kFrameBytes = kFrameSamples * sizeof(int16_t);
-constexpr double kTwoPi = 6.283185307179586476925286766559;
+        log_info(label + " client connected protocol=" + (version > 0 ? "framed" : "raw"));
+        mic.ring.discard_all();
+        loop.ring.discard_all();
+        mic_slot.pending = false;
+        loop_slot.pending = false;
+        mic_slot.tracker = SequenceTracker{};
+        loop_slot.tracker = SequenceTracker{};
+        uint64_t stereo_sequence = 0;
+        // Raw stereo clients cannot delimit packets, so they keep receiving PCM.
+        auto encode = [&] { return live.opus && version > 0; };
+        for (LiveEncoder *enc : {&stereo_encoder, &mic_slot.encoder, &loop_slot.encoder}) {
+            enc->reset();
+        }
 
-std::atomic<bool> g_running{true};
+        // Runs one send, timed for the stream(s) whose frame it carries.
+        auto timed = [](MuxSlot *left, MuxSlot *right, auto &&send) {
+            const uint64_t start = engine::qpc_now_100ns();
+            for (MuxSlot *slot : {left, right}) {
+                if (slot) {
+                    slot->metrics.ring_to_send_us.record(elapsed_us(slot->meta.pushed_100ns, start));
+                }
+            }
+            bool ok = send();
+            const uint64_t done = engine::qpc_now_100ns();
+            for (MuxSlot *slot : {left, right}) {
+                if (slot) {
+                    slot->metrics.send_us.record(elapsed_us(start, done));
+                }
+            }
+            return ok;
+        };
 
-void log_info(const std::string &msg) {
-    std::cout << "[audio_engine] " << msg << std::endl;
-}
+        auto write_mono = [&](MuxSlot &slot, uint8_t channel_id) {
+            slot.pending = false;
+            slot.meta.flags |= slot.tracker.check(slot.meta);
+            const int frame_samples = static_cast<int>(slot.meta.samples);
+            const int frame_bytes = frame_samples * static_cast<int>(sizeof(int16_t));
+            engine::OpusFrameEncoder *encoder = slot.encoder.get(encode(), live.bitrate, frame_samples);
+            engine::FrameHeader header = make_header(slot.meta, version, channel_id,
+                                                     encoder ? engine::kFormatOpus : engine::kFormatPcm16,
+                                                     frame_samples, frame_bytes);
+            if (encoder) {
+                int len = encode_frame(*encoder, slot.payload(), header, coded);
+                return len == 0 || engine::send_all(client, reinterpret_cast<const char *>(coded.data()), len);
+            }
+            std::memcpy(slot.packet.data(), &header, sizeof(header));
+            return engine::send_all(client, reinterpret_cast<const char *>(slot.packet.data()),
+                                    static_cast<int>(sizeof(header)) + frame_bytes);
+        };
+
+        // Either slot may be absent; its side of the stereo frame is then silence.
+        auto write_stereo = [&](MuxSlot *left, MuxSlot *right) {
+            const int frame_samples = static_cast<int>((left ? left : right)->meta.samples);
+            const int frame_bytes = frame_samples * static_cast<int>(sizeof(int16_t));
+            engine::FrameMeta meta;
+            meta.sequence = stereo_sequence++;
+            engine::FrameLevels levels[2];
+            int16_t *out = stereo_packet.data() + kHeaderWords;
+            MuxSlot *sides[2] = {left, right};
+            for (int ch = 0; ch < 2; ++ch) {
+                MuxSlot *slot = sides[ch];
+                if (!slot) {
+                    meta.flags |= engine::kFrameFlagSilence;
+                    for (int i = 0; i < frame_samples; ++i) {
+                        out[2 * i + ch] = 0;
+                    }
+                    continue;
+                }
+                slot->pending = false;
+                meta.flags |= slot->meta.flags | slot->tracker.check(slot->meta);
+                meta.qpc_100ns = meta.qpc_100ns ? std::min(meta.qpc_100ns, slot->meta.qpc_100ns) : slot->meta.qpc_100ns;
+                levels[ch] = slot->meta.levels;
+                const int16_t *src = slot->payload();
+                for (int i = 0; i < frame_samples; ++i) {
+                    out[2 * i + ch] = src[i];
+                }
+            }
+            const char *data = reinterpret_cast<const char *>(out);
+            int len = 2 * frame_bytes;
+            if (version > 0) {
+                engine::OpusFrameEncoder *encoder = stereo_encoder.get(encode(), live.bitrate, frame_samples);
+                engine::FrameHeader header =
+                    make_header(meta, version, engine::kChannelStereo,
+                                encoder ? engine::kFormatOpusStereo : engine::kFormatPcm16Stereo, frame_samples, len);
+                set_levels(header, 0, levels[0]);
+                set_levels(header, 1, levels[1]);
+                if (encoder) {
+                    len = encode_frame(*encoder, out, header, coded);
+                    return len == 0 || engine::send_all(client, reinterpret_cast<const char *>(coded.data()), len);
+                }
+                std::memcpy(stereo_packet.data(), &header, sizeof(header));
+                data = reinterpret_cast<const char *>(stereo_packet.data());
+                len += static_cast<int>(sizeof(header));
+            }
+            return engine::send_all(client, data, len);
+        };
+
+        auto send_mono = [&](MuxSlot &slot, uint8_t channel_id) {
+            return timed(&slot, nullptr, [&] { return write_mono(slot, channel_id); });
+        };
+        auto send_stereo = [&](MuxSlot *left, MuxSlot *right) {
+            return timed(left, right, [&] { return write_stereo(left, right); });
+        };
+
+        bool send_ok = true;
+        while (g_running.load() && send_ok) {
+            WaitForMultipleObjects(2, events, FALSE, kSenderWaitMs);
+            mic.live.refresh(seen, live);
+            while (send_ok) {
+                if (!mic_slot.pending) {
+                    mic_slot.pending = mic.ring.pop(mic_slot.payload(), mic_slot.meta);
+                }
+                if (!loop_slot.pending) {
+                    loop_slot.pending = loop.ring.pop(loop_slot.payload(), loop_slot.meta);
+                }
+
+                if (mic_slot.pending && loop_slot.pending) {
+                    uint64_t mic_ts = mic_slot.meta.qpc_100ns;
+                    uint64_t loop_ts = loop_slot.meta.qpc_100ns;
+                    uint64_t skew = mic_ts > loop_ts ? mic_ts - loop_ts : loop_ts - mic_ts;
+                    // Around a rate change the two sides can briefly differ in length.
+                    if (stereo && skew <= half_frame_100ns && mic_slot.meta.samples == loop_slot.meta.samples) {
+                        send_ok = send_stereo(&mic_slot, &loop_slot);
+                    } else if (mic_ts <= loop_ts) {
+                        send_ok = stereo ? send_stereo(&mic_slot, nullptr) : send_mono(mic_slot, engine::kChannelMic);
+                    } else {
+                        send_ok =
+                            stereo ? send_stereo(nullptr, &loop_slot) : send_mono(loop_slot, engine::kChannelLoop);
+                    }
+                    continue;
+                }
+
+                MuxSlot *lone = mic_slot.pending ? &mic_slot : (loop_slot.pending ? &loop_slot : nullptr);
+                if (!lone || engine::qpc_now_100ns() - lone->meta.qpc_100ns < hold_100ns) {
+                    break;
+                }
+                if (lone == &mic_slot) {
+                    send_ok = stereo ? send_stereo(&mic_slot, nullptr) : send_mono(mic_slot, engine::kChannelMic);
+                } else {
+                    send_ok = stereo ? send_stereo(nullptr, &loop_slot) : send_mono(loop_slot, engine::kChannelLoop);
+                }
+            }
+            if (!send_ok) {
+                log_error(label + " send failed: " + std::to_string(WSAGetLastError()));
+            }
+        }
+
+        closesocket(client);
+        log_info(label + " client disconnected");
+    }
 
-void log_error(const std::string &msg) {
-    std::cerr << "[audio_engine] " << msg << std::endl;
+    closesocket(listen_sock);
 }
 
-BOOL WINAPI console_handler(DWORD ctrl_type) {
-    if (ctrl_type == CTRL_C_EVENT || ctrl_type == CTRL_BREAK_EVENT || ctrl_type == CTRL_CLOSE_EVENT) {
-        g_running.store(false);
-        return TRUE;
+// --record: drains the stream's record ring to disk. Disk stalls only back up the ring; the
+// recorder fills anything the ring overwrote with silence.
+void record_worker(Stream &stream, const std::string &path_base, engine::RecordFormat format) {
+    const StreamConfig &cfg = stream.cfg;
+    const LiveSettings live = stream.live.get();
+    engine::SessionRecorder recorder(path_base, live.out_rate, static_cast<size_t>(live.frame_samples()), format);
+    if (!recorder.open()) {
+        return;
     }
-    return FALSE;
+    log_info(cfg.label + " recording to " + recorder.path());
+
+    std::vector<int16_t> samples(capture_frame_samples(), 0);
+    engine::FrameMeta meta;
+    bool ok = true;
+    auto drain = [&] {
+        while (ok && stream.record_ring->pop(samples.data(), meta)) {
+            // A file has one rate, so a rate change from the control channel starts a new part.
+            if (meta.samples != recorder.frame_samples()) {
+                ok = recorder.restart(engine::rate_for_frame_samples(static_cast<int>(meta.samples)), meta.samples);
+                if (ok) {
+                    log_info(cfg.label + " recording to " + recorder.path());
+                }
+            }
+            ok = ok && recorder.write(samples.data(), meta);
+        }
+    };
+    while (ok && g_running.load()) {
+        Sleep(kRecordPollMs);
+        drain();
+    }
+    drain();
+    recorder.close();
+    log_info(cfg.label + " recording closed: " + recorder.path() + " samples=" +
+             std::to_string(recorder.samples_written()) + " ring_drops=" +
+             std::to_string(stream.record_ring->drops()));
 }
 
-struct StreamConfig {
-    std::string label;
-    std::string host;
-    int port = 0;
-    double tone_hz = 220.0;
-};
+// --asr: hands the stream's utterances to the shared Whisper pool.
+void asr_worker(Stream &stream, engine::AsrPool &pool) {
+    engine::AsrFeed feed(pool, stream.cfg.label, &stream.metrics);
+    std::vector<int16_t> samples(capture_frame_samples(), 0);
+    engine::FrameMeta meta;
+    SequenceTracker tracker;
+    while (g_running.load()) {
+        Sleep(kAsrPollMs);
+        while (stream.asr_ring->pop(samples.data(), meta)) {
+            meta.flags |= tracker.check(meta);
+            feed.push(samples.data(), meta);
+        }
+    }
+    feed.flush();
+}
 
-SOCKET create_listen_socket(const std::string &host, int port, const std::string &label) {
-    addrinfo hints{};
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    hints.ai_flags = AI_PASSIVE;
+// --crosstalk: lines each mic frame up with the loop audio captured over the same interval
+// and publishes overlap_start / overlap_end while both speakers talk at once. A mic frame waits
+// up to kMuxHoldMs for the loop to cover it, then is compared with whatever loop audio there is.
+// Events of a --session carry its name.
+void crosstalk_worker(const std::string &session, Stream &mic, Stream &loop, engine::EventLog &events) {
+    using Change = engine::OverlapTracker::Change;
+    engine::CrosstalkAnalyzer analyzer;
+    engine::OverlapTracker tracker;
+    std::vector<int16_t> loop_frame(capture_frame_samples(), 0);
+    std::vector<int16_t> mic_frame(capture_frame_samples(), 0);
+    engine::FrameMeta loop_meta;
+    engine::FrameMeta mic_meta;
+    bool have_mic = false;
+    const uint64_t hold_100ns = engine::frame_100ns() + static_cast<uint64_t>(kMuxHoldMs) * 10000;
 
-    addrinfo *result = nullptr;
-    std::string port_str = std::to_string(port);
-    const char *host_ptr = host.empty() || host == "0.0.0.0" ? nullptr : host.c_str();
+    auto publish = [&](Change change) {
+        const engine::OverlapTracker::Overlap &overlap = tracker.current();
+        std::string fields = (session.empty() ? std::string() : "\"session\":" + json_string(session) + ",") +
+                             "\"overlap\":" + std::to_string(overlap.id) +
+                             ",\"start_qpc_100ns\":" + std::to_string(overlap.start_qpc_100ns);
+        if (change == Change::Started) {
+            events.publish("overlap_start", fields);
+        } else if (change == Change::Ended) {
+            char stats[96];
+            std::snprintf(stats, sizeof(stats), ",\"coherence\":%.3f,\"max_correlation\":%.3f",
+                          overlap.mean_coherence(), overlap.max_correlation);
+            events.publish("overlap_end", fields + ",\"end_qpc_100ns\":" + std::to_string(overlap.end_qpc_100ns) +
+                                              ",\"duration_ms\":" + std::to_string(overlap.duration_ms()) +
+                                              ",\"frames\":" + std::to_string(overlap.frames) +
+                                              ",\"echo_frames\":" + std::to_string(overlap.echo_frames) + stats);
+        }
+    };
 
-    int res = getaddrinfo(host_ptr, port_str.c_str(), &hints, &result);
-    if (res != 0) {
-        log_error(label + " getaddrinfo failed: " + std::to_string(res));
-        return INVALID_SOCKET;
+    while (g_running.load()) {
+        Sleep(kCrosstalkPollMs);
+        while (loop.crosstalk_ring->pop(loop_frame.data(), loop_meta)) {
+            analyzer.push_loop(loop_frame.data(), loop_meta);
+        }
+        for (;;) {
+            if (!have_mic) {
+                have_mic = mic.crosstalk_ring->pop(mic_frame.data(), mic_meta);
+            }
+            if (!have_mic || (!analyzer.covers(mic_meta.qpc_100ns) &&
+                              engine::qpc_now_100ns() < mic_meta.qpc_100ns + hold_100ns)) {
+                break;
+            }
+            have_mic = false;
+            publish(tracker.update(analyzer.analyze(mic_frame.data(), mic_meta)));
+        }
     }
+    if (tracker.finish()) {
+        publish(Change::Ended);
+    }
+}
 
-    SOCKET listen_sock = INVALID_SOCKET;
-    for (addrinfo *ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
-        listen_sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        if (listen_sock == INVALID_SOCKET) {
-            continue;
+// {"mic":{..},"loop":{..},"seat2.mic":{..},..}: each stream's latency histograms since the
+// last reset and its cumulative drop and xrun counters.
+std::string metrics_json(const std::vector<Stream *> &streams, bool reset) {
+    auto summary = [reset](engine::Histogram &h) { return reset ? h.take() : h.peek(); };
+    std::string json = "{";
+    for (Stream *stream : streams) {
+        engine::StreamMetrics &m = stream->metrics;
+        if (stream != streams.front()) {
+            json += ',';
         }
-        int opt = 1;
-        setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char *>(&opt), sizeof(opt));
-        if (bind(listen_sock, ptr->ai_addr, static_cast<int>(ptr->ai_addrlen)) == SOCKET_ERROR) {
-            closesocket(listen_sock);
-            listen_sock = INVALID_SOCKET;
-            continue;
+        json += "\"" + stream->cfg.label + "\":{";
+        engine::append_json(json, "capture_to_ring_us", summary(m.capture_to_ring_us));
+        engine::append_json(json, "ring_to_send_us", summary(m.ring_to_send_us));
+        engine::append_json(json, "send_us", summary(m.send_us));
+        engine::append_json(json, "ring_fill", summary(m.ring_fill));
+        engine::append_json(json, "arrival_jitter_us", summary(m.arrival_jitter_us));
+        engine::append_json(json, "device_gap_us", summary(m.device_gap_us));
+        json += ",\"first_frame_us\":" + std::to_string(m.first_frame_us.load(std::memory_order_relaxed));
+        if (stream->cfg.paced) {
+            engine::append_json(json, "output_jitter_us", summary(m.output_jitter_us));
+            engine::append_json(json, "playout_delay_us", summary(m.playout_delay_us));
+            json += ",\"late_frames\":" + std::to_string(m.late_frames.load(std::memory_order_relaxed));
+        }
+        json += ",\"ring_drops\":" + std::to_string(stream->ring.drops()) +
+                ",\"subscriber_drops\":" + std::to_string(stream->fanout.drops()) +
+                ",\"xruns\":" + std::to_string(m.xruns.load(std::memory_order_relaxed)) +
+                ",\"device_switches\":" + std::to_string(m.device_switches.load(std::memory_order_relaxed)) +
+                ",\"subscribers\":" + std::to_string(stream->fanout.subscribers());
+        if (stream->record_ring) {
+            json += ",\"record_drops\":" + std::to_string(stream->record_ring->drops());
+        }
+        if (stream->asr_ring) {
+            engine::append_json(json, "asr_first_word_us", summary(m.asr_first_word_us));
+            engine::append_json(json, "asr_final_us", summary(m.asr_final_us));
+            engine::append_json(json, "asr_decode_us", summary(m.asr_decode_us));
+            json += ",\"asr_drops\":" + std::to_string(stream->asr_ring->drops());
         }
-        if (listen(listen_sock, 1) == SOCKET_ERROR) {
-            closesocket(listen_sock);
-            listen_sock = INVALID_SOCKET;
+        json += '}';
+    }
+    json += '}';
+    return json;
+}
+
+// --metrics: every interval_s, logs one JSON line per engine with each stream's latency
+// histograms for that interval and its cumulative drop and xrun counters.
+void metrics_worker(const std::vector<Stream *> &streams, int interval_s) {
+    auto next = std::chrono::steady_clock::now() + std::chrono::seconds(interval_s);
+    while (g_running.load()) {
+        Sleep(kMetricsPollMs);
+        if (std::chrono::steady_clock::now() < next) {
             continue;
         }
-        break;
+        next += std::chrono::seconds(interval_s);
+        log_info("metrics {\"interval_s\":" + std::to_string(interval_s) +
+                 ",\"streams\":" + metrics_json(streams, true) + "}");
     }
+}
+
+struct ControlConfig {
+    std::string host;
+    int port = 0;
+    // Opus needs packet framing: --framed, or --transport shm which always frames.
+    bool framed = false;
+    // --mux-port serves both streams at one rate.
+    bool mux = false;
+};
 
-    freeaddrinfo(result);
+const char *vad_mode(const LiveSettings &live) {
+    return live.vad_gate ? "gate" : (live.vad ? "mark" : "off");
+}
 
-    if (listen_sock == INVALID_SOCKET) {
-        log_error(label + " failed to bind/listen on " + host + ":" + std::to_string(port));
+// The endpoint capture runs on (null while none is open), and the one asked for when capture
+// is not on it yet: still opening, or failed and being retried.
+std::string device_json(const Stream &stream, const LiveSettings &live) {
+    std::lock_guard<std::mutex> lock(stream.device_mutex);
+    auto name = [](const std::string &id) { return json_string(id.empty() ? "default" : id); };
+    std::string json = stream.device_open ? name(stream.open_device_id) : std::string("null");
+    if (!stream.device_open || stream.open_device_id != live.device_id) {
+        json += ",\"requested_device\":" + name(live.device_id);
     }
+    return json;
+}
 
-    return listen_sock;
+std::string config_json(const std::vector<Stream *> &streams) {
+    std::string json = "{";
+    for (Stream *stream : streams) {
+        const LiveSettings live = stream->live.get();
+        if (stream != streams.front()) {
+            json += ',';
+        }
+        json += "\"" + stream->cfg.label + "\":{\"device\":" +
+                (stream->cfg.replay() ? json_string(stream->cfg.replay_path) + ",\"replay\":true"
+                                      : device_json(*stream, live)) +
+                ",\"rate\":" + std::to_string(live.out_rate) + ",\"vad\":\"" + vad_mode(live) +
+                "\",\"aec\":" + (live.aec ? "true" : "false") + ",\"codec\":\"" + (live.opus ? "opus" : "pcm") +
+                "\",\"bitrate\":" + std::to_string(live.bitrate) +
+                ",\"frame_ms\":" + std::to_string(engine::frame_ms()) + "}";
+    }
+    return json + "}";
 }
 
-bool send_all(SOCKET sock, const char *data, int len) {
-    int total_sent = 0;
-    while (total_sent < len) {
-        int sent = send(sock, data + total_sent, len - total_sent, 0);
-        if (sent == SOCKET_ERROR || sent == 0) {
-            return false;
+// Runs one control command and returns its reply line: "ok" with an optional JSON body, or
+// "error" and the reason. Changes are validated here against every stream they touch, so the
+// threads that pick them up never see a combination the transport cannot carry.
+std::string run_control(const std::string &line, const ControlConfig &control, const std::vector<Stream *> &streams) {
+    std::istringstream in(line);
+    std::string command;
+    std::string target;
+    std::string value;
+    in >> command >> target >> value;
+
+    // One stream by label (mic, loop, NAME.mic, NAME.loop) or (where allowed) all of them.
+    auto streams_for = [&](const std::string &name, bool allow_all) {
+        std::vector<Stream *> out;
+        for (Stream *stream : streams) {
+            if (stream->cfg.label == name || (allow_all && name == "all")) {
+                out.push_back(stream);
+            }
         }
-        total_sent += sent;
+        return out;
+    };
+
+    if (command == "stats") {
+        return "ok " + metrics_json(streams, false);
     }
-    return true;
+    if (command == "config") {
+        return "ok " + config_json(streams);
+    }
+    if (command == "device") {
+        std::vector<Stream *> targets = streams_for(target, false);
+        if (targets.empty() || value.empty()) {
+            return "error usage: device STREAM ID|default";
+        }
+        if (targets[0]->cfg.replay()) {
+            return "error " + target + " is replaying a file";
+        }
+        targets[0]->live.update([&](LiveSettings &live) { live.device_id = value == "default" ? "" : value; });
+        return "ok";
+    }
+    if (command == "rate") {
+        std::vector<Stream *> targets = streams_for(target, true);
+        if (targets.empty() || value.empty()) {
+            return "error usage: rate STREAM|all HZ";
+        }
+        const int rate = std::atoi(value.c_str());
+        if (!engine::is_supported_out_rate(rate)) {
+            return "error unsupported output rate: " + value;
+        }
+        if (control.mux && targets.size() != streams.size()) {
+            return "error mux-port needs mic and loop at the same rate: use rate all";
+        }
+        for (Stream *stream : targets) {
+            if (stream->live.get().opus && !engine::is_opus_rate(rate)) {
+                return "error opus needs a rate of 8000, 12000, 16000, 24000 or 48000";
+            }
+        }
+        for (Stream *stream : targets) {
+            stream->live.update([&](LiveSettings &live) { live.out_rate = rate; });
+        }
+        return "ok";
+    }
+    if (command == "vad") {
+        std::vector<Stream *> targets = streams_for(target, true);
+        if (targets.empty() || (value != "off" && value != "mark" && value != "gate")) {
+            return "error usage: vad STREAM|all off|mark|gate";
+        }
+        for (Stream *stream : targets) {
+            stream->live.update([&](LiveSettings &live) {
+                live.vad = value != "off";
+                live.vad_gate = value == "gate";
+            });
+        }
+        return "ok";
+    }
+    if (command == "aec") {
+        if (target != "on" && target != "off") {
+            return "error usage: aec on|off";
+        }
+        for (Stream *stream : streams) {
+            stream->live.update([&](LiveSettings &live) { live.aec = target == "on"; });
+        }
+        return "ok";
+    }
+    if (command == "codec") {
+        if (target != "pcm" && target != "opus") {
+            return "error usage: codec pcm|opus [BITRATE]";
+        }
+        const bool opus = target == "opus";
+        const int bitrate = value.empty() ? streams.front()->live.get().bitrate : std::atoi(value.c_str());
+        if (opus) {
+            if (!engine::opus_available()) {
+                return "error engine built without libopus";
+            }
+            if (!control.framed) {
+                return "error opus needs --framed";
+            }
+            if (!engine::is_opus_bitrate(bitrate)) {
+                return "error bitrate out of range (6000-510000): " + value;
+            }
+            for (Stream *stream : streams) {
+                if (!engine::is_opus_rate(stream->live.get().out_rate)) {
+                    return "error opus needs a rate of 8000, 12000, 16000, 24000 or 48000";
+                }
+            }
+        }
+        for (Stream *stream : streams) {
+            stream->live.update([&](LiveSettings &live) {
+                live.opus = opus;
+                if (opus) {
+                    live.bitrate = bitrate;
+                }
+            });
+        }
+        return "ok";
+    }
+    return "error unknown command: " + command;
 }
 
-void stream_worker(StreamConfig cfg) {
-    SOCKET listen_sock = create_listen_socket(cfg.host, cfg.port, cfg.label);
+// One --control-port connection. A subscribed client is an event feed (see EventLog).
+struct ControlClient {
+    SOCKET sock = INVALID_SOCKET;
+    std::string pending;
+    bool subscribed = false;
+    uint64_t last_event = 0;
+};
+
+// --control-port: a line-based command channel for up to kMaxControlClients local clients.
+// Every command gets exactly one reply line (see run_control), so clients simply alternate
+// send and receive. "subscribe [ID]" instead turns the connection into an event feed: after
+// its "ok" the client receives an "event {json}" line for every event after ID (default: the
+// newest), such as --asr transcripts.
+void control_worker(const ControlConfig &control, const std::vector<Stream *> &streams, engine::EventLog &events,
+                    Startup &startup) {
+    const std::string label = "control";
+    SOCKET listen_sock = engine::create_listen_socket(control.host, control.port, label);
     if (listen_sock == INVALID_SOCKET) {
+        startup.done(label + " port", false);
         return;
     }
+    log_info(label + " listening on " + control.host + ":" + std::to_string(control.port));
+    startup.done(label + " port");
 
-    log_info(cfg.label + " listening on " + cfg.host + ":" + std::to_string(cfg.port));
-
-    std::vector<int16_t> frame(kFrameSamples, 0);
-    double phase = 0.0;
-    double phase_inc = kTwoPi * cfg.tone_hz / static_cast<double>(kSampleRate);
-
-    while (g_running.load()) {
-        sockaddr_in client_addr{};
-        int addr_len = sizeof(client_addr);
-        SOCKET client = accept(listen_sock, reinterpret_cast<sockaddr *>(&client_addr), &addr_len);
-        if (client == INVALID_SOCKET) {
-            if (g_running.load()) {
-                log_error(cfg.label + " accept failed: " + std::to_string(WSAGetLastError()));
+    // Runs the complete lines a client has sent; false once the connection should close.
+    auto serve = [&](ControlClient &client) {
+        char buffer[256];
+        int n = recv(client.sock, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return false;
+        }
+        client.pending.append(buffer, static_cast<size_t>(n));
+        size_t end;
+        while ((end = client.pending.find('\n')) != std::string::npos) {
+            std::string line = client.pending.substr(0, end);
+            client.pending.erase(0, end + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
             }
-            continue;
+            if (line.empty()) {
+                continue;
+            }
+            std::string reply;
+            if (line == "subscribe" || line.compare(0, 10, "subscribe ") == 0) {
+                client.subscribed = true;
+                client.last_event = line.size() > 10 ? std::strtoull(line.c_str() + 10, nullptr, 10) : events.last_id();
+                reply = "ok {\"last_id\":" + std::to_string(client.last_event) + "}";
+            } else {
+                reply = run_control(line, control, streams);
+                // Changes are logged so they show up next to their effect; queries are not.
+                if (reply.compare(0, 2, "ok") == 0 && line != "stats" && line != "config") {
+                    log_info(label + ": " + line);
+                }
+            }
+            reply += '\n';
+            if (!engine::send_all(client.sock, reply.data(), static_cast<int>(reply.size()))) {
+                return false;
+            }
+        }
+        if (client.pending.size() > kControlMaxLine) {
+            log_error(label + " command line too long; closing client");
+            return false;
         }
+        return true;
+    };
 
-        log_info(cfg.label + " client connected");
-        auto next_time = std::chrono::steady_clock::now();
+    std::vector<ControlClient> clients;
+    std::vector<std::string> batch;
+    while (g_running.load()) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listen_sock, &readable);
+        bool feeding = false;
+        for (const ControlClient &client : clients) {
+            FD_SET(client.sock, &readable);
+            feeding = feeding || client.subscribed;
+        }
+        const long wait_ms = feeding ? kControlEventPollMs : kControlPollMs;
+        timeval timeout{0, wait_ms * 1000};
+        const bool ready = select(0, &readable, nullptr, nullptr, &timeout) > 0;
 
-        while (g_running.load()) {
-            for (int i = 0; i < kFrameSamples; ++i) {
-                double sample = std::sin(phase);
-                int16_t value = static_cast<int16_t>(sample * 10000.0);
-                frame[i] = value;
-                phase += phase_inc;
-                if (phase >= kTwoPi) {
-                    phase -= kTwoPi;
+        if (ready && FD_ISSET(listen_sock, &readable)) {
+            SOCKET sock = accept_client(listen_sock, label);
+            if (sock != INVALID_SOCKET && clients.size() >= kMaxControlClients) {
+                log_error(label + " refusing client: " + std::to_string(kMaxControlClients) + " already connected");
+                closesocket(sock);
+            } else if (sock != INVALID_SOCKET) {
+                ControlClient client;
+                client.sock = sock;
+                clients.push_back(std::move(client));
+            }
+        }
+        for (ControlClient &client : clients) {
+            bool open = !(ready && FD_ISSET(client.sock, &readable)) || serve(client);
+            if (open && client.subscribed) {
+                batch.clear();
+                client.last_event = events.since(client.last_event, batch);
+                for (std::string &event : batch) {
+                    event = "event " + event + "\n";
+                    open = open && engine::send_all(client.sock, event.data(), static_cast<int>(event.size()));
                 }
             }
-
-            if (!send_all(client, reinterpret_cast<const char *>(frame.data()), kFrameBytes)) {
-                log_error(cfg.label + " send failed: " + std::to_string(WSAGetLastError()));
-                break;
+            if (!open) {
+                closesocket(client.sock);
+                client.sock = INVALID_SOCKET;
             }
-
-            next_time += std::chrono::milliseconds(20);
-            std::this_thread::sleep_until(next_time);
         }
-
-        closesocket(client);
-        log_info(cfg.label + " client disconnected");
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                     [](const ControlClient &client) { return client.sock == INVALID_SOCKET; }),
+                      clients.end());
     }
 
+    for (ControlClient &client : clients) {
+        closesocket(client.sock);
+    }
     closesocket(listen_sock);
 }
 
+// DIR\YYYYMMDD-HHMMSS, shared by both streams of a session.
+std::string record_path_base(const std::string &dir) {
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    char stamp[32];
+    std::snprintf(stamp, sizeof(stamp), "%04u%02u%02u-%02u%02u%02u", now.wYear, now.wMonth, now.wDay, now.wHour,
+                  now.wMinute, now.wSecond);
+    return dir + "\\" + stamp;
+}
+
 void write_wav(const std::string &path, const std::vector<int16_t> &samples) {
     uint32_t data_bytes = static_cast<uint32_t>(samples.size() * sizeof(int16_t));
     uint32_t fmt_chunk_size = 16;
@@ -192,8 +2194,8 @@ void write_wav(const std::string &path, const std::vector<int16_t> &samples) {
 
 void run_proof(int seconds) {
     int total_samples = seconds * kSampleRate;
-    std::vector<int16_t> mic_samples(total_samples, 0);
-    std::vector<int16_t> loop_samples(total_samples, 0);
+    std::vector<float> mic_tone(total_samples, 0.0f);
+    std::vector<float> loop_tone(total_samples, 0.0f);
 
     double mic_phase = 0.0;
     double loop_phase = 0.0;
@@ -201,8 +2203,8 @@ void run_proof(int seconds) {
     double loop_inc = kTwoPi * 220.0 / static_cast<double>(kSampleRate);
 
     for (int i = 0; i < total_samples; ++i) {
-        mic_samples[i] = static_cast<int16_t>(std::sin(mic_phase) * 10000.0);
-        loop_samples[i] = static_cast<int16_t>(std::sin(loop_phase) * 10000.0);
+        mic_tone[i] = static_cast<float>(std::sin(mic_phase));
+        loop_tone[i] = static_cast<float>(std::sin(loop_phase));
         mic_phase += mic_inc;
         loop_phase += loop_inc;
         if (mic_phase >= kTwoPi) {
@@ -213,19 +2215,158 @@ void run_proof(int seconds) {
         }
     }
 
+    std::vector<int16_t> mic_samples(total_samples, 0);
+    std::vector<int16_t> loop_samples(total_samples, 0);
+    engine::float_to_int16(mic_tone.data(), mic_samples.data(), mic_samples.size(), kProofAmplitude);
+    engine::float_to_int16(loop_tone.data(), loop_samples.data(), loop_samples.size(), kProofAmplitude);
     write_wav("mic.wav", mic_samples);
     write_wav("loop.wav", loop_samples);
     log_info("proof mode wrote mic.wav and loop.wav");
 }
 
+// --session: a seat beyond the first, with endpoints and ports of its own and the engine's
+// settings for everything else.
+struct SessionArgs {
+    std::string name;
+    int mic_port = 0;
+    int loop_port = 0;
+    std::string mic_device;
+    std::string loop_device;
+};
+
 struct Args {
     std::string host = "127.0.0.1";
     int mic_port = 0;
     int loop_port = 0;
     bool proof = false;
     int seconds = 10;
+    std::string mic_device;
+    std::string loop_device;
+    bool list_devices = false;
+    bool framed = false;
+    int mic_out_rate = kSampleRate;
+    int loop_out_rate = kSampleRate;
+    int mux_port = 0;
+    MuxLayout mux_layout = MuxLayout::Interleaved;
+    bool shm = false;
+    std::string shm_name = "aisc_engine";
+    bool vad = false;
+    bool vad_gate = false;
+    bool aec = false;
+    bool opus = false;
+    int bitrate = engine::kDefaultOpusBitrate;
+    std::string record_dir;
+    engine::RecordFormat record_format = engine::RecordFormat::Wav;
+    std::string replay_mic;
+    std::string replay_loop;
+    double speed = 1.0;
+    int metrics_interval = 0;
+    int control_port = 0;
+    std::string asr_model;
+    std::string asr_language = "en";
+    int asr_workers = kDefaultAsrWorkers;
+    bool crosstalk = false;
+    bool pacing = false;
+    int frame_ms = engine::kDefaultFrameMs;
+    std::vector<SessionArgs> sessions;
+    bool prewarm = false;
 };
 
+void print_usage() {
+    std::cout << "Usage: audio_engine --host HOST --mic-port PORT --loop-port PORT [options]\n"
+                 "  --mic-device ID       capture endpoint for mic (default: system default)\n"
+                 "  --loop-device ID      render endpoint to loop back (default: system default)\n"
+                 "  --list-devices        print endpoint ids and exit\n"
+                 "  --framed              allow the framed protocol (see protocol.h); clients may ask for\n"
+                 "                        80-bin log-mel features instead of audio (kHelloFlagLogMel)\n"
+                 "  --out-rate HZ         output sample rate for both streams (default 48000)\n"
+                 "  --mic-out-rate HZ     output sample rate for mic only\n"
+                 "  --loop-out-rate HZ    output sample rate for loop only\n"
+                 "  --frame-ms MS         frame duration: 5, 10, 20 (default) or 40; framed clients read it\n"
+                 "                        from the ServerHello (frame_samples / sample_rate)\n"
+                 "  --mux-port PORT       serve mic and loop on one connection instead of two ports\n"
+                 "  --mux-layout L        interleaved (framed mono frames) or stereo (default interleaved)\n"
+                 "  --transport T         tcp (default) or shm: publish to Local\\NAME_mic / NAME_loop mappings\n"
+                 "  --shm-name NAME       shared-memory name prefix (default aisc_engine)\n"
+                 "  --vad                 mark speech frames and utterance boundaries in framed headers;\n"
+                 "                        utterance_start / utterance_end are control-port events\n"
+                 "  --vad-gate            like --vad, and suppress frames outside utterances\n"
+                 "  --aec                 cancel loopback echo (speaker playback) from the mic stream\n"
+                 "  --codec C             pcm (default) or opus: framed clients receive one Opus packet per frame\n"
+                 "  --bitrate BPS         Opus bitrate per stream (default 32000)\n"
+                 "  --record DIR          record both streams to DIR\\<timestamp>_mic / _loop\n"
+                 "  --record-format F     wav (default) or flac\n"
+                 "  --replay MIC LOOP     stream two WAV files instead of capturing; exits when both end\n"
+                 "  --speed X             replay pace: 1 real time (default), N times faster, 0 as fast as the\n"
+                 "                        clients of each --mic-port / --loop-port read (lossless)\n"
+                 "  --metrics SECONDS     log per-stream latency histograms as a JSON line every SECONDS\n"
+                 "  --control-port PORT   accept runtime commands on HOST:PORT, one per line: stats, config,\n"
+                 "                        device STREAM ID|default, rate STREAM|all HZ,\n"
+                 "                        vad STREAM|all off|mark|gate, aec on|off, codec pcm|opus [BPS],\n"
+                 "                        subscribe [ID] (event feed: one \"event {json}\" line per event);\n"
+                 "                        STREAM is mic, loop, or NAME.mic / NAME.loop of a --session\n"
+                 "  --asr MODEL           transcribe both streams in-engine with a whisper.cpp ggml model;\n"
+                 "                        transcripts are control-port events (needs --control-port)\n"
+                 "  --asr-workers N       parallel Whisper decodes (default 2)\n"
+                 "  --asr-language L      spoken language code (default en)\n"
+                 "  --crosstalk           detect both speakers talking at once; overlap_start / overlap_end\n"
+                 "                        are control-port events (needs --control-port)\n"
+                 "  --pacing P            off (default: send frames as they arrive) or timer: hold them in an\n"
+                 "                        adaptive jitter buffer and send on the capture grid (per-stream ports)\n"
+                 "  --session SPEC        run another seat in this process, repeatable: name=NAME,mic-port=PORT,\n"
+                 "                        loop-port=PORT[,mic-device=ID][,loop-device=ID]; it shares every other\n"
+                 "                        option, the control port and the worker threads (per-stream ports only)\n"
+                 "  --prewarm             prepare every pipeline stage in parallel at startup: endpoints open\n"
+                 "                        while the DSP chain runs a silent frame and the ASR model loads\n"
+                 "  --proof --seconds N   write mic.wav/loop.wav test tones and exit\n"
+                 "Once its ports, endpoints and DSP state are prepared the engine logs one\n"
+                 "\"ready {json}\" line with the time since process start and any stage that failed.\n";
+}
+
+// Parses a --session SPEC of comma-separated key=value fields.
+bool parse_session(const std::string &spec, const std::vector<SessionArgs> &others, SessionArgs &out) {
+    std::istringstream fields(spec);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        const size_t eq = field.find('=');
+        const std::string key = field.substr(0, eq);
+        const std::string value = eq == std::string::npos ? std::string() : field.substr(eq + 1);
+        if (key == "name") {
+            out.name = value;
+        } else if (key == "mic-port") {
+            out.mic_port = std::stoi(value);
+        } else if (key == "loop-port") {
+            out.loop_port = std::stoi(value);
+        } else if (key == "mic-device") {
+            out.mic_device = value;
+        } else if (key == "loop-device") {
+            out.loop_device = value;
+        } else {
+            log_error("unknown session field: " + field);
+            return false;
+        }
+    }
+    // The name prefixes the session's stream labels, which control commands address.
+    const bool plain = !out.name.empty() && std::all_of(out.name.begin(), out.name.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_';
+    });
+    if (!plain || out.name == "all") {
+        log_error("session needs a name of letters, digits, - or _: " + spec);
+        return false;
+    }
+    for (const SessionArgs &other : others) {
+        if (other.name == out.name) {
+            log_error("duplicate session name: " + out.name);
+            return false;
+        }
+    }
+    if (out.mic_port <= 0 || out.loop_port <= 0) {
+        log_error("session " + out.name + " needs mic-port and loop-port");
+        return false;
+    }
+    return true;
+}
+
 bool parse_args(int argc, char **argv, Args &out) {
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -239,24 +2380,257 @@ bool parse_args(int argc, char **argv, Args &out) {
             out.proof = true;
         } else if (arg == "--seconds" && i + 1 < argc) {
             out.seconds = std::stoi(argv[++i]);
+        } else if (arg == "--mic-device" && i + 1 < argc) {
+            out.mic_device = argv[++i];
+        } else if (arg == "--loop-device" && i + 1 < argc) {
+            out.loop_device = argv[++i];
+        } else if (arg == "--framed") {
+            out.framed = true;
+        } else if (arg == "--out-rate" && i + 1 < argc) {
+            out.mic_out_rate = std::stoi(argv[++i]);
+            out.loop_out_rate = out.mic_out_rate;
+        } else if (arg == "--mic-out-rate" && i + 1 < argc) {
+            out.mic_out_rate = std::stoi(argv[++i]);
+        } else if (arg == "--loop-out-rate" && i + 1 < argc) {
+            out.loop_out_rate = std::stoi(argv[++i]);
+        } else if (arg == "--frame-ms" && i + 1 < argc) {
+            out.frame_ms = std::stoi(argv[++i]);
+            if (!engine::is_supported_frame_ms(out.frame_ms)) {
+                log_error("frame-ms must be 5, 10, 20 or 40: " + std::string(argv[i]));
+                return false;
+            }
+        } else if (arg == "--mux-port" && i + 1 < argc) {
+            out.mux_port = std::stoi(argv[++i]);
+        } else if (arg == "--mux-layout" && i + 1 < argc) {
+            std::string layout = argv[++i];
+            if (layout == "interleaved") {
+                out.mux_layout = MuxLayout::Interleaved;
+            } else if (layout == "stereo") {
+                out.mux_layout = MuxLayout::Stereo;
+            } else {
+                log_error("unknown mux layout: " + layout);
+                return false;
+            }
+        } else if (arg == "--transport" && i + 1 < argc) {
+            std::string transport = argv[++i];
+            if (transport == "shm") {
+                out.shm = true;
+            } else if (transport != "tcp") {
+                log_error("unknown transport: " + transport);
+                return false;
+            }
+        } else if (arg == "--shm-name" && i + 1 < argc) {
+            out.shm_name = argv[++i];
+        } else if (arg == "--vad") {
+            out.vad = true;
+        } else if (arg == "--vad-gate") {
+            out.vad = true;
+            out.vad_gate = true;
+        } else if (arg == "--aec") {
+            out.aec = true;
+        } else if (arg == "--codec" && i + 1 < argc) {
+            std::string codec = argv[++i];
+            if (codec == "opus") {
+                out.opus = true;
+            } else if (codec != "pcm") {
+                log_error("unknown codec: " + codec);
+                return false;
+            }
+        } else if (arg == "--bitrate" && i + 1 < argc) {
+            out.bitrate = std::stoi(argv[++i]);
+            if (!engine::is_opus_bitrate(out.bitrate)) {
+                log_error("bitrate out of range (6000-510000): " + std::string(argv[i]));
+                return false;
+            }
+        } else if (arg == "--record" && i + 1 < argc) {
+            out.record_dir = argv[++i];
+        } else if (arg == "--record-format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "wav") {
+                out.record_format = engine::RecordFormat::Wav;
+            } else if (format == "flac") {
+                out.record_format = engine::RecordFormat::Flac;
+            } else {
+                log_error("unknown record format: " + format);
+                return false;
+            }
+        } else if (arg == "--replay" && i + 2 < argc) {
+            out.replay_mic = argv[++i];
+            out.replay_loop = argv[++i];
+        } else if (arg == "--speed" && i + 1 < argc) {
+            out.speed = std::stod(argv[++i]);
+            if (!(out.speed >= 0.0)) {
+                log_error("speed must be 0 or positive: " + std::string(argv[i]));
+                return false;
+            }
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            out.metrics_interval = std::stoi(argv[++i]);
+            if (out.metrics_interval < 0) {
+                log_error("metrics interval must be 0 (off) or positive: " + std::string(argv[i]));
+                return false;
+            }
+        } else if (arg == "--control-port" && i + 1 < argc) {
+            out.control_port = std::stoi(argv[++i]);
+        } else if (arg == "--asr" && i + 1 < argc) {
+            out.asr_model = argv[++i];
+        } else if (arg == "--asr-workers" && i + 1 < argc) {
+            out.asr_workers = std::stoi(argv[++i]);
+            if (out.asr_workers < 1) {
+                log_error("asr workers must be at least 1: " + std::string(argv[i]));
+                return false;
+            }
+        } else if (arg == "--asr-language" && i + 1 < argc) {
+            out.asr_language = argv[++i];
+        } else if (arg == "--crosstalk") {
+            out.crosstalk = true;
+        } else if (arg == "--prewarm") {
+            out.prewarm = true;
+        } else if (arg == "--pacing" && i + 1 < argc) {
+            std::string pacing = argv[++i];
+            if (pacing != "off" && pacing != "timer") {
+                log_error("unknown pacing: " + pacing);
+                return false;
+            }
+            out.pacing = pacing == "timer";
+        } else if (arg == "--session" && i + 1 < argc) {
+            SessionArgs session;
+            if (!parse_session(argv[++i], out.sessions, session)) {
+                return false;
+            }
+            out.sessions.push_back(std::move(session));
+        } else if (arg == "--list-devices") {
+            out.list_devices = true;
+            return true;
         } else if (arg == "--help" || arg == "-h") {
-            std::cout << "Usage: audio_engine --host HOST --mic-port PORT --loop-port PORT [--proof --seconds N]\n";
+            print_usage();
             return false;
         } else {
             log_error("unknown arg: " + arg);
             return false;
         }
     }
+    // Rates are checked against the frame duration, which everything from here on uses.
+    engine::set_frame_ms(out.frame_ms);
+    for (int rate : {out.mic_out_rate, out.loop_out_rate}) {
+        if (!engine::is_supported_out_rate(rate)) {
+            log_error("unsupported output rate for " + std::to_string(out.frame_ms) + " ms frames: " +
+                      std::to_string(rate));
+            return false;
+        }
+    }
+    if (out.opus) {
+        if (!engine::opus_available()) {
+            log_error("--codec opus needs an engine built with libopus");
+            return false;
+        }
+        if (!engine::is_opus_rate(out.mic_out_rate) || !engine::is_opus_rate(out.loop_out_rate)) {
+            log_error("--codec opus needs an output rate of 8000, 12000, 16000, 24000 or 48000");
+            return false;
+        }
+        // Packet lengths travel in the frame header; --transport shm is always framed.
+        if (!out.framed && !out.shm) {
+            log_error("--codec opus needs --framed");
+            return false;
+        }
+    }
+    if (!out.asr_model.empty()) {
+        if (!engine::asr_available()) {
+            log_error("--asr needs an engine built with whisper.cpp");
+            return false;
+        }
+        // Transcripts have no other way out.
+        if (out.control_port <= 0) {
+            log_error("--asr needs --control-port");
+            return false;
+        }
+    }
+    if (out.crosstalk && out.control_port <= 0) {
+        log_error("--crosstalk needs --control-port");
+        return false;
+    }
+    if (out.pacing) {
+        // The jitter buffer releases on the capture clock; replay only keeps it at speed 1.
+        if (out.shm || out.mux_port > 0) {
+            log_error("--pacing timer needs --mic-port / --loop-port");
+            return false;
+        }
+        if (!out.replay_mic.empty() && out.speed != 1.0) {
+            log_error("--pacing timer needs --speed 1");
+            return false;
+        }
+    }
+    // Extra sessions listen on ports of their own and capture live endpoints.
+    if (!out.sessions.empty() && (out.shm || out.mux_port > 0 || !out.replay_mic.empty())) {
+        log_error("--session needs --mic-port / --loop-port and live capture (no --transport shm, --mux-port "
+                  "or --replay)");
+        return false;
+    }
+    if (out.shm) {
+        if (out.mux_port > 0) {
+            log_error("--transport shm does not combine with --mux-port");
+            return false;
+        }
+        return true;
+    }
+    if (out.mux_port > 0) {
+        if (out.mic_out_rate != out.loop_out_rate) {
+            log_error("mux-port needs mic and loop at the same output rate");
+            return false;
+        }
+        if (out.mux_layout == MuxLayout::Interleaved && !out.framed) {
+            log_error("interleaved mux layout needs --framed");
+            return false;
+        }
+        return true;
+    }
     if (out.mic_port <= 0 || out.loop_port <= 0) {
-        log_error("mic-port and loop-port are required");
+        log_error("mic-port and loop-port (or mux-port) are required");
         return false;
     }
     return true;
 }
 
+std::string stream_label(const std::string &session, const char *stream) {
+    return session.empty() ? std::string(stream) : session + "." + stream;
+}
+
+// One seat: a mic and a loop stream on endpoints and ports of its own, paired by their echo
+// ring. The first session comes from --mic-port / --loop-port and alone may replay; each
+// --session adds one. All of them share the IOCP server, the ASR pool, the event log and the
+// control port, so a seat costs its own threads and buffers, not a process.
+struct Session {
+    Session(const Args &args, const SessionArgs &seat, uint64_t replay_epoch)
+        : name(seat.name),
+          mic(StreamConfig{stream_label(seat.name, "mic"), args.host, seat.mic_port, engine::CaptureKind::Microphone,
+                           engine::kChannelMic, args.framed, seat.name.empty() ? args.replay_mic : std::string(),
+                           args.speed, replay_epoch, args.pacing, args.prewarm},
+              LiveSettings{seat.mic_device, args.mic_out_rate, args.vad, args.vad_gate, args.aec, args.opus,
+                           args.bitrate}),
+          loop(StreamConfig{stream_label(seat.name, "loop"), args.host, seat.loop_port, engine::CaptureKind::Loopback,
+                            engine::kChannelLoop, args.framed, seat.name.empty() ? args.replay_loop : std::string(),
+                            args.speed, replay_epoch, args.pacing, args.prewarm},
+               LiveSettings{seat.loop_device, args.loop_out_rate, args.vad, args.vad_gate, args.aec, args.opus,
+                            args.bitrate}),
+          echo_ring(kEchoChunks, kEchoChunkSamples) {
+        mic.echo_ring = &echo_ring;
+        loop.echo_ring = &echo_ring;
+    }
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    // Empty for the first session.
+    std::string name;
+    Stream mic;
+    Stream loop;
+    // Allocated even without --aec, which the control channel can turn on later.
+    engine::FrameRing echo_ring;
+};
+
 }  // namespace
 
 int main(int argc, char **argv) {
+    const uint64_t started_100ns = process_started_100ns();
     SetConsoleCtrlHandler(console_handler, TRUE);
 
     Args args;
@@ -264,6 +2638,18 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (args.list_devices) {
+        CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+        for (const auto &line : engine::list_endpoints(engine::CaptureKind::Microphone)) {
+            std::cout << "mic\t" << line << "\n";
+        }
+        for (const auto &line : engine::list_endpoints(engine::CaptureKind::Loopback)) {
+            std::cout << "loop\t" << line << "\n";
+        }
+        CoUninitialize();
+        return 0;
+    }
+
     if (args.proof) {
         run_proof(args.seconds);
         return 0;
@@ -274,16 +2660,156 @@ int main(int argc, char **argv) {
         log_error("WSAStartup failed");
         return 1;
     }
+    log_info(std::string("dsp kernels: ") + engine::simd_level_name(engine::simd_level()));
+    log_info("frame duration: " + std::to_string(engine::frame_ms()) + " ms");
+
+    const uint64_t replay_epoch = engine::qpc_now_100ns();
+    std::vector<std::unique_ptr<Session>> sessions;
+    sessions.push_back(std::make_unique<Session>(
+        args, SessionArgs{"", args.mic_port, args.loop_port, args.mic_device, args.loop_device}, replay_epoch));
+    for (const SessionArgs &seat : args.sessions) {
+        sessions.push_back(std::make_unique<Session>(args, seat, replay_epoch));
+    }
+    std::vector<Stream *> streams;
+    for (const auto &session : sessions) {
+        streams.push_back(&session->mic);
+        streams.push_back(&session->loop);
+    }
+    Session &primary = *sessions.front();
+    if (primary.mic.cfg.replay()) {
+        g_replays_active.store(2);
+    }
+    if (sessions.size() > 1) {
+        log_info(std::to_string(sessions.size()) + " sessions");
+    }
+
+    // One stage per stream's endpoint and per port or mapping, plus the control port and the model.
+    const size_t transports = args.shm ? 2 : args.mux_port > 0 ? 1 : streams.size();
+    Startup startup(started_100ns, streams.size() + transports + (args.control_port > 0 ? 1 : 0) +
+                                       (args.asr_model.empty() ? 0 : 1));
+    for (Stream *stream : streams) {
+        stream->startup = &startup;
+    }
+
+    engine::EventLog events(kEventLogCapacity);
+    engine::AsrPool asr(args.asr_model, args.asr_language, args.asr_workers, events);
+    std::atomic<bool> asr_failed{false};
+    auto load_asr = [&] {
+        if (!asr.start()) {
+            asr_failed.store(true);
+            startup.done("asr model", false);
+            return false;
+        }
+        log_info("asr model " + args.asr_model + " workers=" + std::to_string(asr.workers()) +
+                 " language=" + args.asr_language);
+        startup.done("asr model");
+        return true;
+    };
+    // --prewarm loads the model alongside the endpoints and ports; until it is up, utterances
+    // are not transcribed. A model that fails to load stops the engine either way.
+    std::thread asr_loader;
+    if (!args.asr_model.empty() && args.prewarm) {
+        asr_loader = std::thread([&] {
+            if (!load_asr()) {
+                g_running.store(false);
+            }
+        });
+    } else if (!args.asr_model.empty() && !load_asr()) {
+        WSACleanup();
+        return 1;
+    }
+
+    std::string record_base;
+    if (!args.record_dir.empty()) {
+        // An existing directory is fine; anything else surfaces when the files are opened.
+        CreateDirectoryA(args.record_dir.c_str(), nullptr);
+        record_base = record_path_base(args.record_dir);
+    }
+    // Every session's capture, recording, ASR and crosstalk threads, joined after the transports.
+    std::vector<std::thread> pipeline;
+    for (const auto &session : sessions) {
+        const std::string base = record_base + (session->name.empty() ? "" : "_" + session->name);
+        for (Stream *stream : {&session->mic, &session->loop}) {
+            const bool mic = stream == &session->mic;
+            if (args.control_port > 0) {
+                stream->events = &events;
+            }
+            if (!args.record_dir.empty()) {
+                stream->record_ring = make_frame_ring(kRecordRingMs);
+                pipeline.emplace_back(record_worker, std::ref(*stream), base + (mic ? "_mic" : "_loop"),
+                                      args.record_format);
+            }
+            if (!args.asr_model.empty()) {
+                stream->asr_ring = make_frame_ring(kAsrRingMs);
+                pipeline.emplace_back(asr_worker, std::ref(*stream), std::ref(asr));
+            }
+            if (args.crosstalk) {
+                stream->crosstalk_ring = make_frame_ring(kCrosstalkRingMs);
+            }
+        }
+        if (args.crosstalk) {
+            pipeline.emplace_back(crosstalk_worker, std::cref(session->name), std::ref(session->mic),
+                                  std::ref(session->loop), std::ref(events));
+        }
+    }
+    for (Stream *stream : streams) {
+        pipeline.emplace_back(capture_worker, std::ref(*stream));
+    }
 
-    StreamConfig mic_cfg{"mic", args.host, args.mic_port, 440.0};
-    StreamConfig loop_cfg{"loop", args.host, args.loop_port, 220.0};
+    std::thread metrics;
+    if (args.metrics_interval > 0) {
+        metrics = std::thread(metrics_worker, std::cref(streams), args.metrics_interval);
+    }
+    std::thread control;
+    ControlConfig control_cfg{args.host, args.control_port, args.framed || args.shm, args.mux_port > 0 && !args.shm};
+    if (args.control_port > 0) {
+        control = std::thread(control_worker, std::cref(control_cfg), std::cref(streams), std::ref(events),
+                              std::ref(startup));
+    }
 
-    std::thread mic_thread(stream_worker, mic_cfg);
-    std::thread loop_thread(stream_worker, loop_cfg);
+    if (args.shm) {
+        std::thread mic_thread(shm_worker, std::ref(primary.mic), args.shm_name + "_mic");
+        std::thread loop_thread(shm_worker, std::ref(primary.loop), args.shm_name + "_loop");
+        mic_thread.join();
+        loop_thread.join();
+    } else if (args.mux_port > 0) {
+        MuxConfig mux{args.host, args.mux_port, args.mux_layout, args.framed};
+        mux_worker(mux, primary.mic, primary.loop);
+    } else {
+        // One completion port serves every session's ports, with workers added per session up
+        // to the core count.
+        engine::IocpServer io;
+        const size_t cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+        if (io.start(std::min(kIoWorkers * sessions.size(), std::max(kIoWorkers, cores)))) {
+            std::vector<std::thread> senders;
+            for (Stream *stream : streams) {
+                senders.emplace_back(stream_worker, std::ref(*stream), std::ref(io));
+            }
+            for (std::thread &sender : senders) {
+                sender.join();
+            }
+        } else {
+            for (Stream *stream : streams) {
+                startup.done(stream->cfg.label + " port", false);
+            }
+        }
+        io.stop();
+    }
 
-    mic_thread.join();
-    loop_thread.join();
+    for (std::thread &thread : pipeline) {
+        thread.join();
+    }
+    if (metrics.joinable()) {
+        metrics.join();
+    }
+    if (control.joinable()) {
+        control.join();
+    }
+    if (asr_loader.joinable()) {
+        asr_loader.join();
+    }
+    asr.stop();
 
     WSACleanup();
-    return 0;
+    return asr_failed.load() ? 1 : 0;
 }
@@ -0,0 +1,87 @@
+#include "metrics.h"
+
+#include <algorithm>
+
+namespace engine {
+
+size_t Histogram::bucket_of(uint64_t value) {
+    if (value < (1u << kSubBits)) {
+        return static_cast<size_t>(value);
+    }
+    int msb = kSubBits;
+    while (msb < kMaxOctave && (value >> (msb + 1)) != 0) {
+        ++msb;
+    }
+    if ((value >> (msb + 1)) != 0) {
+        value = (uint64_t{2} << kMaxOctave) - 1;
+    }
+    uint64_t sub = (value >> (msb - kSubBits)) & ((1u << kSubBits) - 1);
+    return (static_cast<size_t>(msb - kSubBits + 1) << kSubBits) + static_cast<size_t>(sub);
+}
+
+// Midpoint of the bucket's range.
+uint64_t Histogram::value_of(size_t bucket) {
+    if (bucket < (1u << kSubBits)) {
+        return bucket;
+    }
+    int msb = static_cast<int>(bucket >> kSubBits) + kSubBits - 1;
+    uint64_t sub = bucket & ((1u << kSubBits) - 1);
+    uint64_t width = uint64_t{1} << (msb - kSubBits);
+    return ((uint64_t{1} << kSubBits) + sub) * width + width / 2;
+}
+
+void Histogram::record(uint64_t value) {
+    counts_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = max_.load(std::memory_order_relaxed);
+    while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+Histogram::Summary Histogram::summarize(bool clear) {
+    uint64_t counts[kBuckets];
+    Summary out;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        counts[i] = clear ? counts_[i].exchange(0, std::memory_order_relaxed)
+                          : counts_[i].load(std::memory_order_relaxed);
+        out.count += counts[i];
+    }
+    out.max = clear ? max_.exchange(0, std::memory_order_relaxed) : max_.load(std::memory_order_relaxed);
+    if (out.count == 0) {
+        return out;
+    }
+
+    const uint64_t rank50 = (out.count + 1) / 2;
+    const uint64_t rank99 = (out.count * 99 + 99) / 100;
+    uint64_t seen = 0;
+    bool have50 = false;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        seen += counts[i];
+        if (!have50 && seen >= rank50) {
+            out.p50 = value_of(i);
+            have50 = true;
+        }
+        if (seen >= rank99) {
+            out.p99 = value_of(i);
+            break;
+        }
+    }
+    // Bucket midpoints can overshoot the largest value actually recorded.
+    out.p50 = std::min(out.p50, out.max);
+    out.p99 = std::min(out.p99, out.max);
+    return out;
+}
+
+void append_json(std::string &out, const char *key, const Histogram::Summary &summary) {
+    if (!out.empty() && out.back() != '{') {
+        out += ',';
+    }
+    out += '"';
+    out += key;
+    out += "\":{\"n\":" + std::to_string(summary.count) + ",\"p50\":" + std::to_string(summary.p50) +
+           ",\"p99\":" + std::to_string(summary.p99) + ",\"max\":" + std::to_string(summary.max) + "}";
+}
+
+}  // namespace engine
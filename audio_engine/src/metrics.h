@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace engine {
+
+// Lock-free histogram of non-negative integers (latencies in microseconds, queue depths).
+//
+// Buckets are log-linear: values below 8 are exact, above that every octave is split into 8
+// buckets, so any reported value is within 6.25% of what was recorded. record() is a couple of
+// relaxed atomic increments and may run on any thread, including the capture thread.
+class Histogram {
+public:
+    struct Summary {
+        uint64_t count = 0;
+        uint64_t p50 = 0;
+        uint64_t p99 = 0;
+        uint64_t max = 0;
+    };
+
+    void record(uint64_t value);
+
+    // Reads and clears the histogram, so each summary covers the time since the previous one.
+    // Values recorded while it runs land in either interval.
+    Summary take() { return summarize(true); }
+    // Reads the interval so far without clearing it.
+    Summary peek() { return summarize(false); }
+
+private:
+    Summary summarize(bool clear);
+
+    static constexpr int kSubBits = 3;
+    static constexpr int kMaxOctave = 40;  // values saturate at 2^41 - 1
+    static constexpr size_t kBuckets = (kMaxOctave - kSubBits + 2) << kSubBits;
+
+    static size_t bucket_of(uint64_t value);
+    static uint64_t value_of(size_t bucket);
+
+    std::atomic<uint64_t> counts_[kBuckets] = {};
+    std::atomic<uint64_t> max_{0};
+};
+
+// Hot-path timings for one stream, filled in by its capture and sender threads and read by
+// the --metrics reporter.
+struct StreamMetrics {
+    // First sample captured to frame pushed into the ring (framing, AEC hold-back, DSP).
+    Histogram capture_to_ring_us;
+    // Frame pushed to frame handed to the transport (queueing behind slow consumers).
+    Histogram ring_to_send_us;
+    // Send posted to send completed (TCP only).
+    Histogram send_us;
+    // Frames already queued in the ring at each push.
+    Histogram ring_fill;
+    // WASAPI glitches (kCaptureDiscontinuity) seen by the capture thread.
+    std::atomic<uint64_t> xruns{0};
+    // Capture moved to another endpoint (hot-plug, default change, device loss), and the
+    // silence spliced in over each outage.
+    std::atomic<uint64_t> device_switches{0};
+    Histogram device_gap_us;
+    // Process creation to the stream's first frame out of the DSP chain; 0 until then.
+    std::atomic<uint64_t> first_frame_us{0};
+    // --asr: speech onset to the utterance's first transcribed word, end of speech to its
+    // final transcript, and the Whisper decode of each job.
+    Histogram asr_first_word_us;
+    Histogram asr_final_us;
+    Histogram asr_decode_us;
+    // Deviation of each frame's capture-to-ring transit from the running mean (RFC 3550 style),
+    // measured whether or not --pacing is on.
+    Histogram arrival_jitter_us;
+    // --pacing timer: deviation of each send interval from the capture interval, the playout
+    // delay the jitter buffer held frames for, and frames that arrived after their release time.
+    Histogram output_jitter_us;
+    Histogram playout_delay_us;
+    std::atomic<uint64_t> late_frames{0};
+};
+
+// Appends "key":{"n":..,"p50":..,"p99":..,"max":..} to a JSON object body.
+void append_json(std::string &out, const char *key, const Histogram::Summary &summary);
+
+}  // namespace engine
@@ -0,0 +1,88 @@
+#include "net.h"
+
+#include "log.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace engine {
+
+SOCKET create_listen_socket(const std::string &host, int port, const std::string &label) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo *result = nullptr;
+    std::string port_str = std::to_string(port);
+    const char *host_ptr = host.empty() || host == "0.0.0.0" ? nullptr : host.c_str();
+
+    int res = getaddrinfo(host_ptr, port_str.c_str(), &hints, &result);
+    if (res != 0) {
+        log_error(label + " getaddrinfo failed: " + std::to_string(res));
+        return INVALID_SOCKET;
+    }
+
+    SOCKET listen_sock = INVALID_SOCKET;
+    for (addrinfo *ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
+        listen_sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+        if (listen_sock == INVALID_SOCKET) {
+            continue;
+        }
+        int opt = 1;
+        setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char *>(&opt), sizeof(opt));
+        if (bind(listen_sock, ptr->ai_addr, static_cast<int>(ptr->ai_addrlen)) == SOCKET_ERROR) {
+            closesocket(listen_sock);
+            listen_sock = INVALID_SOCKET;
+            continue;
+        }
+        if (listen(listen_sock, SOMAXCONN) == SOCKET_ERROR) {
+            closesocket(listen_sock);
+            listen_sock = INVALID_SOCKET;
+            continue;
+        }
+        break;
+    }
+
+    freeaddrinfo(result);
+
+    if (listen_sock == INVALID_SOCKET) {
+        log_error(label + " failed to bind/listen on " + host + ":" + std::to_string(port));
+    }
+
+    return listen_sock;
+}
+
+bool recv_all(SOCKET sock, char *data, int len) {
+    int total = 0;
+    while (total < len) {
+        int got = recv(sock, data + total, len - total, 0);
+        if (got == SOCKET_ERROR || got == 0) {
+            return false;
+        }
+        total += got;
+    }
+    return true;
+}
+
+bool send_all(SOCKET sock, const char *data, int len) {
+    int total_sent = 0;
+    while (total_sent < len) {
+        int sent = send(sock, data + total_sent, len - total_sent, 0);
+        if (sent == SOCKET_ERROR || sent == 0) {
+            return false;
+        }
+        total_sent += sent;
+    }
+    return true;
+}
+
+bool wait_readable(SOCKET sock, long timeout_ms) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    timeval timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    return select(0, &readable, nullptr, nullptr, &timeout) > 0;
+}
+
+}  // namespace engine
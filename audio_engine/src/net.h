@@ -0,0 +1,19 @@
+#pragma once
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <string>
+
+namespace engine {
+
+// Binds and listens on host:port; logs and returns INVALID_SOCKET on failure.
+SOCKET create_listen_socket(const std::string &host, int port, const std::string &label);
+
+bool send_all(SOCKET sock, const char *data, int len);
+bool recv_all(SOCKET sock, char *data, int len);
+
+// True when sock has data (or EOF) to read within timeout_ms.
+bool wait_readable(SOCKET sock, long timeout_ms);
+
+}  // namespace engine
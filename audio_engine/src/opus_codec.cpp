@@ -0,0 +1,87 @@
+#include "opus_codec.h"
+
+#include <string>
+
+#include "log.h"
+
+#ifdef ENGINE_HAVE_OPUS
+#include <opus.h>
+#endif
+
+namespace engine {
+
+bool is_opus_rate(int rate) {
+    return rate == 8000 || rate == 12000 || rate == 16000 || rate == 24000 || rate == 48000;
+}
+
+bool is_opus_bitrate(int bitrate) {
+    return bitrate >= 6000 && bitrate <= 510000;
+}
+
+#ifdef ENGINE_HAVE_OPUS
+
+bool opus_available() {
+    return true;
+}
+
+OpusFrameEncoder::OpusFrameEncoder(int sample_rate, int channels, int bitrate) {
+    int err = OPUS_OK;
+    OpusEncoder *enc = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &err);
+    if (err != OPUS_OK || !enc) {
+        log_error(std::string("opus encoder create failed: ") + opus_strerror(err));
+        return;
+    }
+    // Packets cross TCP or shared memory, so in-band FEC would only cost bits. DTX stays off
+    // so every frame keeps its own packet; --vad-gate already handles silence.
+    opus_encoder_ctl(enc, OPUS_SET_BITRATE(bitrate));
+    opus_encoder_ctl(enc, OPUS_SET_VBR(1));
+    opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(0));
+    opus_encoder_ctl(enc, OPUS_SET_DTX(0));
+    encoder_ = enc;
+}
+
+OpusFrameEncoder::~OpusFrameEncoder() {
+    if (encoder_) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+int OpusFrameEncoder::encode(const int16_t *pcm, int frame_samples, uint8_t *out, int max_bytes) {
+    if (!encoder_) {
+        return 0;
+    }
+    opus_int32 bytes = opus_encode(encoder_, pcm, frame_samples, out, max_bytes);
+    if (bytes < 0) {
+        log_error(std::string("opus encode failed: ") + opus_strerror(bytes));
+        return 0;
+    }
+    return bytes;
+}
+
+void OpusFrameEncoder::reset() {
+    if (encoder_) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+}
+
+#else
+
+bool opus_available() {
+    return false;
+}
+
+OpusFrameEncoder::OpusFrameEncoder(int, int, int) {
+    log_error("opus encoder unavailable: built without libopus");
+}
+
+OpusFrameEncoder::~OpusFrameEncoder() = default;
+
+int OpusFrameEncoder::encode(const int16_t *, int, uint8_t *, int) {
+    return 0;
+}
+
+void OpusFrameEncoder::reset() {}
+
+#endif
+
+}  // namespace engine
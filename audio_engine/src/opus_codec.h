@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct OpusEncoder;
+
+namespace engine {
+
+// Upper bound on one encoded Opus packet of up to 40 ms: two frames of at most 1275 bytes
+// behind a code 2 header (RFC 6716, sections 3.2 and 3.4).
+constexpr int kMaxOpusPacketBytes = 3 + 2 * 1275;
+constexpr int kDefaultOpusBitrate = 32000;
+
+// False when the engine was built without libopus (see CMakeLists.txt).
+bool opus_available();
+// Opus only runs at these rates; --out-rate must be one of them for --codec opus.
+bool is_opus_rate(int rate);
+bool is_opus_bitrate(int bitrate);
+
+// Encodes frames of frame_ms() (5 to 40 ms, all Opus frame sizes) into one Opus packet each.
+// Every consumer owns its encoder and resets it when a new client attaches, so the client's
+// decoder starts from matching state.
+class OpusFrameEncoder {
+public:
+    OpusFrameEncoder(int sample_rate, int channels, int bitrate);
+    ~OpusFrameEncoder();
+
+    OpusFrameEncoder(const OpusFrameEncoder &) = delete;
+    OpusFrameEncoder &operator=(const OpusFrameEncoder &) = delete;
+
+    bool ok() const { return encoder_ != nullptr; }
+
+    // Encodes frame_samples samples per channel (interleaved when stereo) into out. Returns
+    // the packet length, or 0 when encoding failed.
+    int encode(const int16_t *pcm, int frame_samples, uint8_t *out, int max_bytes);
+    void reset();
+
+private:
+    OpusEncoder *encoder_ = nullptr;
+};
+
+}  // namespace engine
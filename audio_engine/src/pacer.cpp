@@ -0,0 +1,80 @@
+#include "pacer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "wasapi_capture.h"
+
+// Windows SDK 10.0.17134 and later.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+namespace engine {
+namespace {
+
+constexpr double kJitterGain = 1.0 / 16.0;
+constexpr double kTransitGain = 1.0 / 16.0;
+constexpr double kJitterMultiple = 4.0;
+// Headroom above the target, and the most the delay shrinks per frame.
+constexpr uint64_t kPlayoutMargin100ns = 10000;  // 1 ms
+constexpr uint64_t kPlayoutDecay100ns = 500;     // 50 us
+constexpr uint64_t kMaxPlayoutDelay100ns = static_cast<uint64_t>(kMaxPlayoutDelayMs) * 10000;
+
+}  // namespace
+
+uint64_t JitterBuffer::arrived(uint64_t capture_100ns, uint64_t arrival_100ns) {
+    const int64_t transit = static_cast<int64_t>(arrival_100ns) - static_cast<int64_t>(capture_100ns);
+    uint64_t deviation = 0;
+    const bool first = !started_;
+    if (first) {
+        started_ = true;
+        mean_transit_ = static_cast<double>(transit);
+    } else {
+        deviation = static_cast<uint64_t>(std::llabs(transit - last_transit_));
+        jitter_100ns_ += (static_cast<double>(deviation) - jitter_100ns_) * kJitterGain;
+        mean_transit_ += (static_cast<double>(transit) - mean_transit_) * kTransitGain;
+    }
+    last_transit_ = transit;
+
+    const double target = mean_transit_ + kJitterMultiple * jitter_100ns_ + static_cast<double>(kPlayoutMargin100ns);
+    const uint64_t wanted = static_cast<uint64_t>(std::clamp(target, 0.0, static_cast<double>(kMaxPlayoutDelay100ns)));
+    const uint64_t needed = transit > 0 ? static_cast<uint64_t>(transit) : 0;
+    if (needed > delay_100ns_) {
+        late_ += first ? 0 : 1;
+        delay_100ns_ = std::min(std::max(wanted, needed + kPlayoutMargin100ns), kMaxPlayoutDelay100ns);
+    } else if (wanted > delay_100ns_) {
+        delay_100ns_ = wanted;
+    } else {
+        delay_100ns_ = std::max(wanted, delay_100ns_ - std::min(delay_100ns_, kPlayoutDecay100ns));
+    }
+    return deviation;
+}
+
+void JitterBuffer::reset() {
+    *this = JitterBuffer{};
+}
+
+PacingTimer::PacingTimer() {
+    handle_ = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    high_resolution_ = handle_ != nullptr;
+    if (!handle_) {
+        handle_ = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+    }
+}
+
+PacingTimer::~PacingTimer() {
+    if (handle_) {
+        CloseHandle(handle_);
+    }
+}
+
+void PacingTimer::arm(uint64_t due_qpc_100ns) {
+    const uint64_t now = qpc_now_100ns();
+    // Negative due times are relative, in 100 ns; zero fires at once.
+    LARGE_INTEGER due;
+    due.QuadPart = due_qpc_100ns > now ? -static_cast<LONGLONG>(due_qpc_100ns - now) : 0;
+    SetWaitableTimer(handle_, &due, 0, nullptr, nullptr, FALSE);
+}
+
+}  // namespace engine
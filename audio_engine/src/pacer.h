@@ -0,0 +1,65 @@
+#pragma once
+
+#include <windows.h>
+
+#include <cstdint>
+
+namespace engine {
+
+// Longest playout delay the jitter buffer adapts to; frames arriving later still go out, late.
+constexpr int kMaxPlayoutDelayMs = 120;
+
+// Adaptive playout delay for --pacing: a frame captured at t is released at t + delay(), so
+// frames leave on the exact capture grid however unevenly they reached the sender.
+//
+// Each frame's transit (ring arrival minus capture time) feeds an RFC 3550 style jitter
+// estimate, J += (|transit - previous transit| - J) / 16, and a smoothed mean transit. The
+// delay targets the mean plus four times J: a late frame raises it at once to cover that
+// frame, and it sinks back towards the target by kPlayoutDecay100ns per frame, so a quieter
+// link shortens the buffer without squeezing frames together.
+class JitterBuffer {
+public:
+    // Records a frame; returns its transit deviation from the previous frame (100 ns), the
+    // interarrival jitter sample.
+    uint64_t arrived(uint64_t capture_100ns, uint64_t arrival_100ns);
+
+    uint64_t delay_100ns() const { return delay_100ns_; }
+    uint64_t release_100ns(uint64_t capture_100ns) const { return capture_100ns + delay_100ns_; }
+    // Smoothed interarrival jitter (J above), in 100 ns.
+    double jitter_100ns() const { return jitter_100ns_; }
+    // Frames that arrived after their release time.
+    uint64_t late() const { return late_; }
+    void reset();
+
+private:
+    bool started_ = false;
+    int64_t last_transit_ = 0;
+    double mean_transit_ = 0.0;
+    double jitter_100ns_ = 0.0;
+    uint64_t delay_100ns_ = 0;
+    uint64_t late_ = 0;
+};
+
+// A waitable timer armed for a QPC time. Where Windows supports it (10 1803 and later) the
+// timer is high resolution, firing within about half a millisecond instead of at the next
+// tick of the 15.6 ms system timer.
+class PacingTimer {
+public:
+    PacingTimer();
+    ~PacingTimer();
+
+    PacingTimer(const PacingTimer &) = delete;
+    PacingTimer &operator=(const PacingTimer &) = delete;
+
+    bool valid() const { return handle_ != nullptr; }
+    bool high_resolution() const { return high_resolution_; }
+    // Signalled once the time passed to arm() is reached.
+    HANDLE handle() const { return handle_; }
+    void arm(uint64_t due_qpc_100ns);
+
+private:
+    HANDLE handle_ = nullptr;
+    bool high_resolution_ = false;
+};
+
+}  // namespace engine
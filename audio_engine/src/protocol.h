@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+
+namespace engine {
+
+// Framed wire protocol, enabled with --framed. All fields are little-endian.
+//
+// On connect a framed client sends ClientHello. The engine answers with ServerHello and then
+// prefixes every frame with FrameHeader. A client that sends nothing within the hello window
+// keeps receiving raw PCM frames, so older backends are unaffected. Frames last 20 ms unless
+// the engine runs with --frame-ms; a raw client must be told the duration, a framed one reads
+// it from the ServerHello.
+//
+// Readers must honour header_bytes and skip any header fields they do not know; fields are
+// only ever appended.
+
+constexpr uint32_t make_tag(char a, char b, char c, char d) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(a)) | (static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24);
+}
+
+constexpr uint32_t kClientHelloMagic = make_tag('A', 'E', 'C', 'H');
+constexpr uint32_t kServerHelloMagic = make_tag('A', 'E', 'S', 'H');
+constexpr uint32_t kFrameMagic = make_tag('A', 'E', 'F', 'R');
+constexpr uint32_t kBatchMagic = make_tag('A', 'E', 'F', 'B');
+constexpr uint16_t kProtocolVersion = 1;
+
+enum ClientHelloFlags : uint16_t {
+    // Per-stream TCP ports only: when this subscriber's queue is full, drop incoming frames
+    // instead of the oldest queued one (see fanout.h).
+    kHelloFlagDropNewest = 1 << 0,
+    // Per-stream TCP ports only: send this subscriber kFormatLogMel feature frames in place of
+    // the stream's audio.
+    kHelloFlagLogMel = 1 << 1,
+    // Per-stream TCP ports only: send this subscriber utterances alone, each from its
+    // lookback (the first frame carries kFrameFlagUtteranceStart) to its end frame.
+    kHelloFlagUtterances = 1 << 2,
+};
+
+// Per-stream TCP ports only: bits 8-15 of ClientHello::flags ask for batches of up to that many
+// frames (0 or 1 keeps one frame per message). Each batch is one BatchHeader followed by its
+// frames, header and payload as usual, and spans at most that many frame durations of capture
+// time; an utterance end frame closes its batch early. For bulk readers (recorders, deep
+// analysis) that trade latency for far fewer sends.
+constexpr int kHelloBatchShift = 8;
+constexpr uint16_t kHelloBatchMask = 0xFF00;
+
+enum ChannelId : uint8_t {
+    kChannelMic = 0,
+    kChannelLoop = 1,
+    // --mux-layout stereo: mic on the left channel, loop on the right.
+    kChannelStereo = 2,
+    // ServerHello only, --mux-layout interleaved: each frame header names its own channel.
+    kChannelMux = 0xFF,
+};
+
+enum FormatId : uint8_t {
+    kFormatPcm16 = 1,
+    // Interleaved L/R int16; sample_count counts samples per channel.
+    kFormatPcm16Stereo = 2,
+    // --codec opus: one Opus packet per frame. payload_bytes is the packet length and
+    // sample_count the decoded samples per channel.
+    kFormatOpus = 3,
+    kFormatOpusStereo = 4,
+    // Whisper-style log-mel features (see log_mel.h): sample_count vectors of 80 float32
+    // log10 band energies, one per 10 ms, with capture_qpc_100ns at the first one's window
+    // centre. The ServerHello of such a subscriber carries sample_rate 16000 (the analysis
+    // rate) and frame_samples 80 (values per vector).
+    kFormatLogMel = 5,
+};
+
+enum FrameFlags : uint16_t {
+    // Frames were lost before this one (ring overflow or a device glitch).
+    kFrameFlagDiscontinuity = 1 << 0,
+    // The endpoint delivered no audio and the frame was filled with silence.
+    kFrameFlagSilence = 1 << 1,
+    // --vad / --vad-gate: the voice activity detector considers this frame speech.
+    kFrameFlagSpeech = 1 << 2,
+    // --vad / --vad-gate: the first frame of an utterance (see segmenter.h) and its last.
+    kFrameFlagUtteranceStart = 1 << 3,
+    kFrameFlagUtteranceEnd = 1 << 4,
+};
+
+#pragma pack(push, 1)
+
+struct ClientHello {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+};
+
+struct ServerHello {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;
+    uint32_t sample_rate;
+    // Samples per channel in each frame, so audio frames last frame_samples / sample_rate.
+    uint16_t frame_samples;
+    uint8_t channel_id;
+    uint8_t format_id;
+    // Engine QPC clock at handshake, in 100 ns units, for mapping capture timestamps.
+    uint64_t qpc_100ns;
+};
+
+struct FrameHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;
+    uint64_t sequence;
+    // QPC time of the first sample in 100 ns units (the WASAPI packet timestamp clock).
+    uint64_t capture_qpc_100ns;
+    uint32_t sample_count;
+    uint8_t channel_id;
+    uint8_t format_id;
+    uint16_t flags;
+    uint32_t payload_bytes;
+    // Frames the VAD gate withheld directly before this one. The sequence advances over them,
+    // so a reader counts sequence - last - 1 - suppressed as actually lost.
+    uint32_t suppressed;
+    // Level meter readings for the payload (see levels.h). Stereo frames fill [0] for the left
+    // channel and [1] for the right; mono frames use [0] only.
+    uint16_t level_rms[2];
+    uint16_t level_peak[2];
+    uint16_t clip_count[2];
+    uint16_t reserved[2];
+};
+
+// Precedes the frames of one batch (kHelloBatchShift); batch_bytes counts everything after
+// header_bytes up to the next BatchHeader.
+struct BatchHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;
+    uint32_t frame_count;
+    uint32_t batch_bytes;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(ClientHello) == 8, "ClientHello layout is part of the wire protocol");
+static_assert(sizeof(ServerHello) == 24, "ServerHello layout is part of the wire protocol");
+static_assert(sizeof(FrameHeader) == 56, "FrameHeader layout is part of the wire protocol");
+static_assert(sizeof(BatchHeader) == 16, "BatchHeader layout is part of the wire protocol");
+
+}  // namespace engine
@@ -0,0 +1,210 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "audio_format.h"
+#include "log.h"
+
+namespace engine {
+namespace {
+
+constexpr uint64_t kReserveChunkBytes = 16ull << 20;
+constexpr int kPatchIntervalMs = 1000;
+constexpr int kFlushIntervalMs = 5000;
+constexpr int kMaxGapFillMs = 10000;  // larger jumps are not a ring overflow
+constexpr uint32_t kWavHeaderBytes = 44;
+// RIFF sizes are 32-bit; roll over well before they wrap.
+constexpr uint64_t kMaxWavBytes = 0xF0000000ull;
+
+void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, static_cast<uint16_t>(v));
+    put_u16(p + 2, static_cast<uint16_t>(v >> 16));
+}
+
+void wav_header(uint8_t *out, int sample_rate, uint32_t data_bytes) {
+    std::memcpy(out, "RIFF", 4);
+    put_u32(out + 4, kWavHeaderBytes - 8 + data_bytes);
+    std::memcpy(out + 8, "WAVEfmt ", 8);
+    put_u32(out + 16, 16);
+    put_u16(out + 20, 1);  // PCM
+    put_u16(out + 22, 1);  // mono
+    put_u32(out + 24, static_cast<uint32_t>(sample_rate));
+    put_u32(out + 28, static_cast<uint32_t>(sample_rate) * 2);
+    put_u16(out + 32, 2);
+    put_u16(out + 34, 16);
+    std::memcpy(out + 36, "data", 4);
+    put_u32(out + 40, data_bytes);
+}
+
+}  // namespace
+
+SessionRecorder::SessionRecorder(std::string path_base, int sample_rate, size_t frame_samples, RecordFormat format)
+    : path_base_(std::move(path_base)),
+      sample_rate_(sample_rate),
+      frame_samples_(frame_samples),
+      format_(format),
+      silence_(frame_samples, 0) {}
+
+SessionRecorder::~SessionRecorder() {
+    close();
+}
+
+bool SessionRecorder::open() {
+    part_ = 0;
+    total_samples_ = 0;
+    have_sequence_ = false;
+    return open_part();
+}
+
+bool SessionRecorder::open_part() {
+    path_ = path_base_ + (part_ > 0 ? "_part" + std::to_string(part_ + 1) : std::string()) +
+            (format_ == RecordFormat::Wav ? ".wav" : ".flac");
+    file_ = CreateFileA(path_.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                        nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        log_error("record open failed for " + path_ + ": " + std::to_string(GetLastError()));
+        return false;
+    }
+    offset_ = 0;
+    reserved_ = 0;
+    part_samples_ = 0;
+    frames_since_patch_ = 0;
+    frames_since_flush_ = 0;
+
+    if (format_ == RecordFormat::Wav) {
+        uint8_t header[kWavHeaderBytes];
+        wav_header(header, sample_rate_, 0);
+        return append(header, sizeof(header));
+    }
+    flac_ = std::make_unique<FlacEncoder>(sample_rate_, static_cast<int>(frame_samples_));
+    std::vector<uint8_t> header = flac_->stream_header(0);
+    return append(header.data(), header.size());
+}
+
+void SessionRecorder::close_part() {
+    if (file_ == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    if (format_ == RecordFormat::Wav) {
+        patch_header();
+    } else {
+        // Final sample count and frame size range; the STREAMINFO block keeps its size.
+        std::vector<uint8_t> header = flac_->stream_header(part_samples_);
+        write_at(0, header.data(), header.size());
+    }
+    // Reserved space beyond end-of-file is released when the handle closes.
+    FlushFileBuffers(file_);
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+}
+
+bool SessionRecorder::restart(int sample_rate, size_t frame_samples) {
+    close_part();
+    sample_rate_ = sample_rate;
+    frame_samples_ = frame_samples;
+    silence_.assign(frame_samples, 0);
+    have_sequence_ = false;
+    ++part_;
+    return open_part();
+}
+
+void SessionRecorder::close() {
+    close_part();
+}
+
+bool SessionRecorder::write_at(uint64_t offset, const void *data, size_t len) {
+    OVERLAPPED at{};
+    at.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFu);
+    at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD written = 0;
+    if (!WriteFile(file_, data, static_cast<DWORD>(len), &written, &at) || written != len) {
+        log_error("record write failed for " + path_ + ": " + std::to_string(GetLastError()));
+        return false;
+    }
+    return true;
+}
+
+bool SessionRecorder::append(const void *data, size_t len) {
+    if (offset_ + len > reserved_) {
+        // Allocation only: end-of-file stays at the last byte written. Failure just means the
+        // file grows cluster by cluster.
+        reserved_ = offset_ + len + kReserveChunkBytes;
+        FILE_ALLOCATION_INFO info{};
+        info.AllocationSize.QuadPart = static_cast<LONGLONG>(reserved_);
+        SetFileInformationByHandle(file_, FileAllocationInfo, &info, sizeof(info));
+    }
+    if (!write_at(offset_, data, len)) {
+        return false;
+    }
+    offset_ += len;
+    return true;
+}
+
+void SessionRecorder::patch_header() {
+    if (format_ != RecordFormat::Wav) {
+        return;
+    }
+    uint8_t header[kWavHeaderBytes];
+    wav_header(header, sample_rate_, static_cast<uint32_t>(offset_ - kWavHeaderBytes));
+    write_at(0, header, sizeof(header));
+}
+
+bool SessionRecorder::write(const int16_t *samples, const FrameMeta &meta) {
+    if (file_ == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    if (have_sequence_ && meta.sequence > next_sequence_) {
+        uint64_t missing = std::min<uint64_t>(meta.sequence - next_sequence_, frames_for_ms(kMaxGapFillMs));
+        for (uint64_t i = 0; i < missing; ++i) {
+            if (!write_frame(silence_.data())) {
+                return false;
+            }
+        }
+    }
+    have_sequence_ = true;
+    next_sequence_ = meta.sequence + 1;
+    return write_frame(samples);
+}
+
+bool SessionRecorder::write_frame(const int16_t *samples) {
+    const size_t frame_bytes = frame_samples_ * sizeof(int16_t);
+    if (format_ == RecordFormat::Wav && offset_ + frame_bytes > kMaxWavBytes) {
+        close_part();
+        ++part_;
+        if (!open_part()) {
+            return false;
+        }
+    }
+
+    bool ok;
+    if (format_ == RecordFormat::Wav) {
+        ok = append(samples, frame_bytes);
+    } else {
+        encoded_.clear();
+        flac_->encode(samples, encoded_);
+        ok = append(encoded_.data(), encoded_.size());
+    }
+    if (!ok) {
+        return false;
+    }
+    part_samples_ += frame_samples_;
+    total_samples_ += frame_samples_;
+
+    if (++frames_since_patch_ >= frames_for_ms(kPatchIntervalMs)) {
+        frames_since_patch_ = 0;
+        patch_header();
+    }
+    if (++frames_since_flush_ >= frames_for_ms(kFlushIntervalMs)) {
+        frames_since_flush_ = 0;
+        FlushFileBuffers(file_);
+    }
+    return true;
+}
+
+}  // namespace engine
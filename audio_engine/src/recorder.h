@@ -0,0 +1,79 @@
+#pragma once
+
+#include <windows.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flac_encoder.h"
+#include "spsc_ring.h"
+
+namespace engine {
+
+enum class RecordFormat {
+    Wav,
+    Flac,
+};
+
+// Appends one stream's frames to a WAV or FLAC file. Runs on a background thread fed from
+// its own FrameRing, so the capture thread only ever does a non-blocking ring push.
+//
+// Disk space is reserved in large chunks ahead of the data without moving end-of-file, so
+// the file never contains a tail of unwritten zeros. WAV headers are patched about once a
+// second and the file is flushed every few seconds, so after a crash the file is valid up to
+// shortly before it; FLAC frames are self-synchronising and valid up to the last frame.
+// WAV files roll over to a numbered part before reaching the 4 GiB format limit.
+class SessionRecorder {
+public:
+    // path_base gets ".wav" / ".flac" (and "_partN" after a rollover) appended.
+    SessionRecorder(std::string path_base, int sample_rate, size_t frame_samples, RecordFormat format);
+    ~SessionRecorder();
+
+    SessionRecorder(const SessionRecorder &) = delete;
+    SessionRecorder &operator=(const SessionRecorder &) = delete;
+
+    bool open();
+    // Appends one frame. Frames missing from the sequence (ring overflow) are written as
+    // silence so that mic and loop recordings stay aligned in time.
+    bool write(const int16_t *samples, const FrameMeta &meta);
+    // The stream's output rate changed: continues in a new part at the new format.
+    bool restart(int sample_rate, size_t frame_samples);
+    void close();
+
+    size_t frame_samples() const { return frame_samples_; }
+
+    const std::string &path() const { return path_; }
+    uint64_t samples_written() const { return total_samples_; }
+
+private:
+    bool open_part();
+    void close_part();
+    bool append(const void *data, size_t len);
+    bool write_at(uint64_t offset, const void *data, size_t len);
+    bool write_frame(const int16_t *samples);
+    void patch_header();
+
+    std::string path_base_;
+    std::string path_;
+    int sample_rate_;
+    size_t frame_samples_;
+    RecordFormat format_;
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    int part_ = 0;
+    uint64_t offset_ = 0;
+    uint64_t reserved_ = 0;
+    uint64_t part_samples_ = 0;
+    uint64_t total_samples_ = 0;
+    uint64_t frames_since_patch_ = 0;
+    uint64_t frames_since_flush_ = 0;
+    bool have_sequence_ = false;
+    uint64_t next_sequence_ = 0;
+    std::unique_ptr<FlacEncoder> flac_;
+    std::vector<uint8_t> encoded_;
+    std::vector<int16_t> silence_;
+};
+
+}  // namespace engine
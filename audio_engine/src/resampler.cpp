@@ -0,0 +1,160 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "audio_format.h"
+#include "dsp_kernels.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define ENGINE_RESAMPLER_SSE 1
+#endif
+
+namespace engine {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr double kStopbandDb = 80.0;
+constexpr double kKaiserBeta = 0.1102 * (kStopbandDb - 8.7);
+// Cutoff and transition width as fractions of the lower Nyquist frequency.
+constexpr double kCutoff = 0.94;
+constexpr double kTransition = 0.10;
+constexpr size_t kMinTaps = 16;
+constexpr size_t kMaxTaps = 512;
+
+double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    double half = x * 0.5;
+    for (int k = 1; k < 64; ++k) {
+        term *= (half / k) * (half / k);
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// Taps must be a multiple of 4 for the SIMD dot product.
+inline float dot_product(const float *a, const float *b, size_t n) {
+#if defined(ENGINE_RESAMPLER_SSE)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    if (i < n) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    __m128 shuf = _mm_shuffle_ps(acc0, acc0, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(acc0, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+#else
+    float acc = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        acc += a[i] * b[i];
+    }
+    return acc;
+#endif
+}
+
+inline int16_t to_int16(float value) {
+    float scaled = value * 32768.0f;
+    if (scaled >= 32767.0f) {
+        return 32767;
+    }
+    if (scaled <= -32768.0f) {
+        return -32768;
+    }
+    return static_cast<int16_t>(std::lrintf(scaled));
+}
+
+}  // namespace
+
+Resampler::Resampler(int in_rate, int out_rate) : in_rate_(in_rate), out_rate_(out_rate) {
+    int divisor = std::gcd(in_rate, out_rate);
+    up_ = static_cast<uint64_t>(out_rate / divisor);
+    down_ = static_cast<uint64_t>(in_rate / divisor);
+    if (passthrough()) {
+        return;
+    }
+
+    // Kaiser length estimate, measured in input samples, rounded up to the SIMD width.
+    double nyquist = 0.5 * std::min(in_rate, out_rate);
+    double transition = kTransition * nyquist / in_rate;
+    size_t taps = static_cast<size_t>(std::ceil((kStopbandDb - 8.0) / (2.285 * 2.0 * kPi * transition)));
+    taps_ = std::min(kMaxTaps, std::max(kMinTaps, (taps + 3) & ~static_cast<size_t>(3)));
+
+    // Prototype lowpass runs at in_rate * up; gain of up restores the zero-stuffed level.
+    const size_t length = taps_ * up_;
+    const double cutoff = kCutoff * nyquist / (static_cast<double>(in_rate) * up_);
+    const double center = 0.5 * static_cast<double>(length - 1);
+    const double window_norm = bessel_i0(kKaiserBeta);
+    std::vector<double> prototype(length);
+    for (size_t n = 0; n < length; ++n) {
+        double x = static_cast<double>(n) - center;
+        double sinc = x == 0.0 ? 1.0 : std::sin(2.0 * kPi * cutoff * x) / (2.0 * kPi * cutoff * x);
+        double r = x / center;
+        double window = bessel_i0(kKaiserBeta * std::sqrt(std::max(0.0, 1.0 - r * r))) / window_norm;
+        prototype[n] = 2.0 * cutoff * sinc * window * static_cast<double>(up_);
+    }
+
+    bank_.assign(length, 0.0f);
+    for (size_t phase = 0; phase < up_; ++phase) {
+        float *dst = bank_.data() + phase * taps_;
+        for (size_t j = 0; j < taps_; ++j) {
+            dst[taps_ - 1 - j] = static_cast<float>(prototype[phase + j * up_]);
+        }
+    }
+
+    buffer_.reserve(taps_ - 1 + 2 * kMaxFrameSamples);
+    reset();
+}
+
+size_t Resampler::max_output(size_t count) const {
+    return static_cast<size_t>((count * up_ + down_ - 1) / down_) + 1;
+}
+
+void Resampler::reset() {
+    buffer_.assign(taps_ > 0 ? taps_ - 1 : 0, 0.0f);
+    position_ = 0;
+}
+
+size_t Resampler::process(const int16_t *in, size_t count, int16_t *out) {
+    if (passthrough()) {
+        std::copy(in, in + count, out);
+        return count;
+    }
+
+    const size_t history = taps_ - 1;
+    buffer_.resize(history + count);
+    int16_to_float(in, buffer_.data() + history, count);
+
+    size_t written = 0;
+    const uint64_t end = static_cast<uint64_t>(count) * up_;
+    while (position_ < end) {
+        size_t index = static_cast<size_t>(position_ / up_);
+        size_t phase = static_cast<size_t>(position_ % up_);
+        out[written++] = to_int16(dot_product(buffer_.data() + index, bank_.data() + phase * taps_, taps_));
+        position_ += down_;
+    }
+    position_ -= end;
+
+    std::copy(buffer_.end() - history, buffer_.end(), buffer_.begin());
+    buffer_.resize(history);
+    return written;
+}
+
+bool is_supported_out_rate(int rate) {
+    return rate >= 8000 && rate <= kSampleRate && rate * frame_ms() % 1000 == 0;
+}
+
+}  // namespace engine
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace engine {
+
+// Streaming polyphase windowed-sinc (Kaiser) sample-rate converter for mono int16.
+//
+// The ratio is reduced to up/down by gcd and every output sample is one dot product of a
+// filter phase against the input history, so only the outputs that are kept get computed.
+// For rates with a whole number of samples per frame every input frame yields exactly one
+// output frame of the same duration, which keeps the engine's fixed framing intact.
+class Resampler {
+public:
+    Resampler(int in_rate, int out_rate);
+
+    int in_rate() const { return in_rate_; }
+    int out_rate() const { return out_rate_; }
+    bool passthrough() const { return up_ == down_; }
+    size_t taps() const { return taps_; }
+
+    // Upper bound on the samples process() writes for count inputs.
+    size_t max_output(size_t count) const;
+
+    // Consumes count input samples and writes the resampled output; returns samples written.
+    size_t process(const int16_t *in, size_t count, int16_t *out);
+
+    void reset();
+
+private:
+    int in_rate_;
+    int out_rate_;
+    uint64_t up_ = 1;
+    uint64_t down_ = 1;
+    size_t taps_ = 0;
+
+    // Phase-major filter bank; each phase is stored reversed so it lines up with history.
+    std::vector<float> bank_;
+    // taps_ - 1 samples of history followed by the current input block.
+    std::vector<float> buffer_;
+    // Position of the next output in the upsampled domain, relative to the current block.
+    uint64_t position_ = 0;
+};
+
+// Validates an output rate the framing can carry (whole samples per frame_ms(), <= capture
+// rate).
+bool is_supported_out_rate(int rate);
+
+}  // namespace engine
@@ -0,0 +1,41 @@
+#include "segmenter.h"
+
+#include <algorithm>
+
+#include "protocol.h"
+
+namespace engine {
+
+bool UtteranceSegmenter::mark(FrameMeta &meta, bool speech) {
+    if (!started_) {
+        started_ = true;
+        earliest_start_ = meta.sequence;
+    }
+    meta.utterance = 0;
+    meta.flags = static_cast<uint16_t>(meta.flags & ~(kFrameFlagUtteranceStart | kFrameFlagUtteranceEnd));
+    if (!open_ && !speech) {
+        return false;
+    }
+
+    if (!open_) {
+        open_ = true;
+        current_ = Utterance{};
+        current_.id = next_id_++;
+        current_.onset_sequence = meta.sequence;
+        const uint64_t lookback = std::min<uint64_t>(meta.sequence, utterance_lookback_frames());
+        current_.start_sequence = std::max(earliest_start_, meta.sequence - lookback);
+        current_.start_qpc_100ns = meta.qpc_100ns - (meta.sequence - current_.start_sequence) * frame_100ns();
+        meta.flags |= kFrameFlagUtteranceStart;
+    }
+    meta.utterance = current_.id;
+    current_.end_sequence = meta.sequence;
+    if (!speech || meta.sequence + 1 - current_.start_sequence >= frames_for_ms(kMaxUtteranceMs)) {
+        open_ = false;
+        earliest_start_ = meta.sequence + 1;
+        current_.end_qpc_100ns = meta.qpc_100ns + frame_100ns();
+        meta.flags |= kFrameFlagUtteranceEnd;
+    }
+    return (meta.flags & (kFrameFlagUtteranceStart | kFrameFlagUtteranceEnd)) != 0;
+}
+
+}  // namespace engine
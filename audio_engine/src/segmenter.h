@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audio_format.h"
+#include "spsc_ring.h"
+
+namespace engine {
+
+// Audio kept ahead of each utterance: the VAD opens a little after speech begins, so the
+// frames before the onset are part of it. The --vad-gate pre-roll holds the same amount.
+constexpr int kUtteranceLookbackMs = 300;
+// Whisper's 30 s window, lookback included; longer speech is cut into several utterances.
+constexpr int kMaxUtteranceMs = 30000;
+
+inline size_t utterance_lookback_frames() {
+    return frames_for_ms(kUtteranceLookbackMs);
+}
+
+// Cuts a stream into utterances from per-frame VAD decisions, on metadata alone. An utterance
+// opens on the first speech frame and closes on the first frame after speech (the detector's
+// hangover already trails the last word) or after kMaxUtteranceMs. Every frame from the
+// onset to the closing one carries the utterance id; the onset frame gets
+// kFrameFlagUtteranceStart and the closing one kFrameFlagUtteranceEnd.
+//
+// Positions are frame sequence numbers, and sample offsets count capture-rate samples from
+// the stream start (sequence * capture_frame_samples()), which output-rate changes do not
+// disturb.
+class UtteranceSegmenter {
+public:
+    struct Utterance {
+        // 1, 2, ... per stream.
+        uint64_t id = 0;
+        // First lookback frame (never before the previous utterance's end), onset frame and
+        // closing frame.
+        uint64_t start_sequence = 0;
+        uint64_t onset_sequence = 0;
+        uint64_t end_sequence = 0;
+        // Capture time (100 ns QPC) of the first lookback sample.
+        uint64_t start_qpc_100ns = 0;
+        // Capture time just after the last sample; set once the utterance has ended.
+        uint64_t end_qpc_100ns = 0;
+
+        uint64_t start_sample() const { return start_sequence * capture_frame_samples(); }
+        uint64_t end_sample() const { return (end_sequence + 1) * capture_frame_samples(); }
+        uint64_t duration_ms() const { return (end_sequence + 1 - start_sequence) * frame_ms(); }
+    };
+
+    // Sets meta.utterance and the utterance flags for one frame; speech is its VAD decision.
+    // Returns true when the frame opened or closed an utterance (see meta.flags).
+    bool mark(FrameMeta &meta, bool speech);
+
+    bool open() const { return open_; }
+    // The open utterance, or the one that closed last.
+    const Utterance &current() const { return current_; }
+
+private:
+    bool open_ = false;
+    bool started_ = false;
+    // Lookback stops at the stream's first frame and at the end of the previous utterance.
+    uint64_t earliest_start_ = 0;
+    uint64_t next_id_ = 1;
+    Utterance current_;
+};
+
+}  // namespace engine
@@ -0,0 +1,107 @@
+#include "shm_transport.h"
+
+#include <cstring>
+#include <new>
+
+#include "log.h"
+
+namespace engine {
+namespace {
+
+constexpr uint32_t kSlotAlign = 64;
+
+}  // namespace
+
+ShmPublisher::~ShmPublisher() {
+    close();
+}
+
+bool ShmPublisher::open(const std::string &name, uint32_t slot_count, const ServerHello &info,
+                        uint32_t max_payload_bytes) {
+    close();
+
+    slot_count_ = slot_count;
+    slot_bytes_ = (static_cast<uint32_t>(sizeof(FrameHeader)) + max_payload_bytes + kSlotAlign - 1) & ~(kSlotAlign - 1);
+    const uint64_t total = sizeof(ShmHeader) + static_cast<uint64_t>(slot_count_) * slot_bytes_;
+
+    const std::string mapping_name = "Local\\" + name;
+    mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(total >> 32),
+                                  static_cast<DWORD>(total & 0xFFFFFFFFu), mapping_name.c_str());
+    if (!mapping_) {
+        log_error("shm CreateFileMapping failed for " + mapping_name + ": " + std::to_string(GetLastError()));
+        return false;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        // Another engine instance owns this name; sharing it would interleave two writers.
+        log_error("shm mapping " + mapping_name + " already exists");
+        close();
+        return false;
+    }
+
+    view_ = static_cast<uint8_t *>(MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(total)));
+    if (!view_) {
+        log_error("shm MapViewOfFile failed: " + std::to_string(GetLastError()));
+        close();
+        return false;
+    }
+
+    const std::string event_name = "Local\\" + name + "_ready";
+    event_ = CreateEventA(nullptr, FALSE, FALSE, event_name.c_str());
+    if (!event_) {
+        log_error("shm CreateEvent failed for " + event_name + ": " + std::to_string(GetLastError()));
+        close();
+        return false;
+    }
+
+    header_ = new (view_) ShmHeader{};
+    header_->header_bytes = sizeof(ShmHeader);
+    header_->slot_count = slot_count_;
+    header_->slot_bytes = slot_bytes_;
+    header_->sample_rate = info.sample_rate;
+    header_->frame_samples = info.frame_samples;
+    header_->channel_id = info.channel_id;
+    header_->format_id = info.format_id;
+    header_->write_index.store(0, std::memory_order_relaxed);
+    header_->version = kShmVersion;
+    // Readers treat a matching magic as "header complete", so it goes last.
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = kShmMagic;
+    return true;
+}
+
+void ShmPublisher::close() {
+    if (view_) {
+        UnmapViewOfFile(view_);
+        view_ = nullptr;
+        header_ = nullptr;
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+        mapping_ = nullptr;
+    }
+    if (event_) {
+        CloseHandle(event_);
+        event_ = nullptr;
+    }
+}
+
+uint8_t *ShmPublisher::slot(uint64_t index) const {
+    return view_ + sizeof(ShmHeader) + static_cast<size_t>(index % slot_count_) * slot_bytes_;
+}
+
+uint8_t *ShmPublisher::next_payload() {
+    return slot(header_->write_index.load(std::memory_order_relaxed)) + sizeof(FrameHeader);
+}
+
+void ShmPublisher::commit(const FrameHeader &header) {
+    uint64_t index = header_->write_index.load(std::memory_order_relaxed);
+    std::memcpy(slot(index), &header, sizeof(header));
+    header_->write_index.store(index + 1, std::memory_order_release);
+    SetEvent(event_);
+}
+
+uint64_t ShmPublisher::published() const {
+    return header_ ? header_->write_index.load(std::memory_order_relaxed) : 0;
+}
+
+}  // namespace engine
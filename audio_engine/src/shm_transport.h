@@ -0,0 +1,72 @@
+#pragma once
+
+#include <windows.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "protocol.h"
+
+namespace engine {
+
+constexpr uint32_t kShmMagic = make_tag('A', 'E', 'S', 'M');
+constexpr uint16_t kShmVersion = 1;
+
+// Layout at the start of the mapping; slots follow at header_bytes, each slot_bytes long
+// and holding a FrameHeader followed by its payload. Single writer (the engine), any
+// number of readers. A reader owning index r may read slot r % slot_count while
+// write_index - r < slot_count; re-checking that after the copy detects an overwrite.
+struct ShmHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_bytes;
+    uint32_t slot_count;
+    uint32_t slot_bytes;
+    uint32_t sample_rate;
+    uint16_t frame_samples;
+    uint8_t channel_id;
+    uint8_t format_id;
+    uint8_t reserved[40];
+    // Number of slots published so far; on its own cache line.
+    std::atomic<uint64_t> write_index;
+    uint8_t reserved_tail[56];
+};
+
+static_assert(sizeof(ShmHeader) == 128, "ShmHeader layout is shared with backend/engine_stream.py");
+static_assert(offsetof(ShmHeader, write_index) == 64, "write_index offset is shared with engine_stream.py");
+
+// Publishes frames into a named file mapping (Local\<name>) and signals the auto-reset
+// event Local\<name>_ready after each one. Frames are written in place, so the path from
+// the capture ring to the reader involves no kernel copies.
+class ShmPublisher {
+public:
+    ShmPublisher() = default;
+    ~ShmPublisher();
+
+    ShmPublisher(const ShmPublisher &) = delete;
+    ShmPublisher &operator=(const ShmPublisher &) = delete;
+
+    bool open(const std::string &name, uint32_t slot_count, const ServerHello &info, uint32_t max_payload_bytes);
+    void close();
+
+    // Payload area of the next slot; valid until commit().
+    uint8_t *next_payload();
+    // Writes the header into the pending slot and makes it visible to readers.
+    void commit(const FrameHeader &header);
+
+    uint64_t published() const;
+
+private:
+    uint8_t *slot(uint64_t index) const;
+
+    HANDLE mapping_ = nullptr;
+    HANDLE event_ = nullptr;
+    uint8_t *view_ = nullptr;
+    ShmHeader *header_ = nullptr;
+    uint32_t slot_count_ = 0;
+    uint32_t slot_bytes_ = 0;
+};
+
+}  // namespace engine
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "levels.h"
+
+namespace engine {
+
+struct FrameMeta {
+    uint64_t sequence = 0;
+    uint64_t qpc_100ns = 0;
+    uint16_t flags = 0;
+    uint32_t suppressed = 0;
+    FrameLevels levels;
+    // QPC time (100 ns) the frame entered its ring; only used for latency metrics.
+    uint64_t pushed_100ns = 0;
+    // Samples in this frame when it is shorter than the ring's slots (an output rate set at
+    // runtime); 0 means a full slot.
+    uint32_t samples = 0;
+    // The utterance (see segmenter.h) this frame belongs to, 0 outside one; not sent.
+    uint64_t utterance = 0;
+};
+
+// Fixed-capacity, lock-free ring of int16 frames between one producer (the capture thread)
+// and one consumer (the socket sender). push() never blocks: when the ring is full the
+// oldest frame is discarded and counted, so TCP backpressure can never stall capture.
+//
+// Dropping the oldest frame means the producer also advances the read index, so both sides
+// move it with compare-exchange. The consumer copies a slot first and only keeps the copy
+// if its read index is still current; a lost race means the slot was overwritten and the
+// frame was already counted as a drop.
+class FrameRing {
+public:
+    FrameRing(size_t capacity, size_t frame_samples)
+        : capacity_(round_up_pow2(capacity)),
+          mask_(capacity_ - 1),
+          frame_samples_(frame_samples),
+          samples_(capacity_ * frame_samples, 0),
+          meta_(capacity_) {}
+
+    FrameRing(const FrameRing &) = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+
+    // Producer only.
+    void push(const int16_t *samples, const FrameMeta &meta) {
+        uint64_t write = write_.load(std::memory_order_relaxed);
+        uint64_t read = read_.load(std::memory_order_acquire);
+        while (write - read >= capacity_) {
+            if (read_.compare_exchange_weak(read, read + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                drops_.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+        size_t slot = static_cast<size_t>(write & mask_);
+        std::copy(samples, samples + count_of(meta), samples_.begin() + slot * frame_samples_);
+        meta_[slot] = meta;
+        write_.store(write + 1, std::memory_order_release);
+    }
+
+    // Consumer only. Copies the oldest frame into out; returns false when the ring is empty.
+    bool pop(int16_t *out, FrameMeta &meta) {
+        uint64_t read = read_.load(std::memory_order_acquire);
+        for (;;) {
+            uint64_t write = write_.load(std::memory_order_acquire);
+            if (read == write) {
+                return false;
+            }
+            size_t slot = static_cast<size_t>(read & mask_);
+            const int16_t *src = samples_.data() + slot * frame_samples_;
+            meta = meta_[slot];
+            std::copy(src, src + count_of(meta), out);
+            if (read_.compare_exchange_strong(read, read + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+    }
+
+    // Consumer only. Drops whatever is queued without counting it, e.g. stale audio that
+    // accumulated while no client was connected.
+    void discard_all() {
+        uint64_t read = read_.load(std::memory_order_acquire);
+        uint64_t write = write_.load(std::memory_order_acquire);
+        while (read != write &&
+               !read_.compare_exchange_weak(read, write, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            write = write_.load(std::memory_order_acquire);
+        }
+    }
+
+    size_t size() const {
+        uint64_t write = write_.load(std::memory_order_acquire);
+        uint64_t read = read_.load(std::memory_order_acquire);
+        return static_cast<size_t>(write - read);
+    }
+
+    size_t capacity() const { return capacity_; }
+    size_t frame_samples() const { return frame_samples_; }
+    uint64_t drops() const { return drops_.load(std::memory_order_relaxed); }
+
+private:
+    size_t count_of(const FrameMeta &meta) const {
+        return meta.samples == 0 ? frame_samples_ : std::min<size_t>(meta.samples, frame_samples_);
+    }
+
+    static size_t round_up_pow2(size_t value) {
+        size_t out = 1;
+        while (out < value) {
+            out <<= 1;
+        }
+        return out;
+    }
+
+    const size_t capacity_;
+    const uint64_t mask_;
+    const size_t frame_samples_;
+    std::vector<int16_t> samples_;
+    std::vector<FrameMeta> meta_;
+
+    alignas(64) std::atomic<uint64_t> write_{0};
+    alignas(64) std::atomic<uint64_t> read_{0};
+    alignas(64) std::atomic<uint64_t> drops_{0};
+};
+
+}  // namespace engine
@@ -0,0 +1,135 @@
+#include "vad.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "audio_format.h"
+
+namespace engine {
+namespace {
+
+constexpr float kPi = 3.14159265358979f;
+constexpr float kInitialFloorDb = -60.0f;
+constexpr float kMinFloorDb = -90.0f;
+// Per 20 ms frame: the floor follows quieter frames quickly and louder ones slowly (about 4 s
+// per step). Other frame durations scale the rates to the same time constants.
+constexpr float kFloorFall = 0.5f;
+constexpr float kFloorRise = 0.005f;
+// Still creeps up during candidates (about 40 s per step) so steady noise cannot hold it open.
+constexpr float kFloorRiseActive = 0.0005f;
+constexpr float kSpeechMarginDb = 10.0f;
+constexpr float kAbsoluteMinDb = -55.0f;
+constexpr float kMinBandRatio = 0.5f;
+constexpr float kMaxVoiceZcrHz = 1500.0f;
+constexpr int kOnsetMs = 40;
+constexpr int kHangoverMs = 300;
+
+Biquad make_biquad(float cutoff_hz, int sample_rate, bool high) {
+    float w0 = 2.0f * kPi * cutoff_hz / static_cast<float>(sample_rate);
+    float cos_w0 = std::cos(w0);
+    float alpha = std::sin(w0) / (2.0f * 0.70710678f);
+    float a0 = 1.0f + alpha;
+    Biquad q;
+    if (high) {
+        q.b0 = (1.0f + cos_w0) * 0.5f / a0;
+        q.b1 = -(1.0f + cos_w0) / a0;
+    } else {
+        q.b0 = (1.0f - cos_w0) * 0.5f / a0;
+        q.b1 = (1.0f - cos_w0) / a0;
+    }
+    q.b2 = q.b0;
+    q.a1 = -2.0f * cos_w0 / a0;
+    q.a2 = (1.0f - alpha) / a0;
+    return q;
+}
+
+float to_db(double power) {
+    return static_cast<float>(10.0 * std::log10(power + 1e-10));
+}
+
+// A smoothing rate given per 20 ms frame, for frames of frame_ms() instead.
+float rate_for_frame(float rate_per_20ms) {
+    return 1.0f - std::pow(1.0f - rate_per_20ms, static_cast<float>(frame_ms()) / kDefaultFrameMs);
+}
+
+}  // namespace
+
+Biquad Biquad::highpass(float cutoff_hz, int sample_rate) {
+    return make_biquad(cutoff_hz, sample_rate, true);
+}
+
+Biquad Biquad::lowpass(float cutoff_hz, int sample_rate) {
+    return make_biquad(cutoff_hz, sample_rate, false);
+}
+
+VoiceActivityDetector::VoiceActivityDetector(int sample_rate)
+    : sample_rate_(sample_rate),
+      highpass_(Biquad::highpass(200.0f, sample_rate)),
+      lowpass_(Biquad::lowpass(std::min(4000.0f, 0.45f * static_cast<float>(sample_rate)), sample_rate)),
+      floor_fall_(rate_for_frame(kFloorFall)),
+      floor_rise_(rate_for_frame(kFloorRise)),
+      floor_rise_active_(rate_for_frame(kFloorRiseActive)),
+      onset_frames_(static_cast<int>(frames_for_ms(kOnsetMs))),
+      hangover_frames_(static_cast<int>(frames_for_ms(kHangoverMs))),
+      noise_floor_db_(kInitialFloorDb) {}
+
+void VoiceActivityDetector::reset() {
+    highpass_.reset();
+    lowpass_.reset();
+    noise_floor_db_ = kInitialFloorDb;
+    band_db_ = -100.0f;
+    onset_count_ = 0;
+    hangover_left_ = 0;
+}
+
+bool VoiceActivityDetector::process(const int16_t *samples, size_t count) {
+    if (count == 0) {
+        return active();
+    }
+
+    double total = 0.0;
+    double band = 0.0;
+    size_t crossings = 0;
+    float prev = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        float x = static_cast<float>(samples[i]) * (1.0f / 32768.0f);
+        float y = lowpass_.process(highpass_.process(x));
+        total += static_cast<double>(x) * x;
+        band += static_cast<double>(y) * y;
+        if ((y >= 0.0f) != (prev >= 0.0f)) {
+            ++crossings;
+        }
+        prev = y;
+    }
+    total /= static_cast<double>(count);
+    band /= static_cast<double>(count);
+
+    band_db_ = to_db(band);
+    float ratio = total > 0.0 ? static_cast<float>(band / total) : 0.0f;
+    float zcr_hz = 0.5f * static_cast<float>(crossings) * static_cast<float>(sample_rate_) / static_cast<float>(count);
+
+    bool candidate = band_db_ > noise_floor_db_ + kSpeechMarginDb && band_db_ > kAbsoluteMinDb &&
+                     ratio > kMinBandRatio && zcr_hz < kMaxVoiceZcrHz;
+
+    if (band_db_ < noise_floor_db_) {
+        noise_floor_db_ += floor_fall_ * (band_db_ - noise_floor_db_);
+    } else {
+        noise_floor_db_ += (candidate ? floor_rise_active_ : floor_rise_) * (band_db_ - noise_floor_db_);
+    }
+    noise_floor_db_ = std::max(noise_floor_db_, kMinFloorDb);
+
+    if (candidate) {
+        ++onset_count_;
+        if (onset_count_ >= onset_frames_ || active()) {
+            hangover_left_ = hangover_frames_;
+        }
+    } else {
+        onset_count_ = 0;
+        if (hangover_left_ > 0) {
+            --hangover_left_;
+        }
+    }
+    return active();
+}
+
+}  // namespace engine
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace engine {
+
+// Second-order IIR section (RBJ cookbook), direct form I.
+struct Biquad {
+    float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+    float x1 = 0.0f, x2 = 0.0f, y1 = 0.0f, y2 = 0.0f;
+
+    static Biquad highpass(float cutoff_hz, int sample_rate);
+    static Biquad lowpass(float cutoff_hz, int sample_rate);
+
+    float process(float x) {
+        float y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        return y;
+    }
+
+    void reset() { x1 = x2 = y1 = y2 = 0.0f; }
+};
+
+// Per-frame voice activity detector for mono frames of frame_ms() (see audio_format.h).
+//
+// A frame is a speech candidate when its energy in the 200 Hz - 4 kHz speech band clears an
+// adaptive noise floor, most of its energy sits in that band, and its zero-crossing rate is
+// voice-like rather than hiss-like. 40 ms of consecutive candidates open the detector; it
+// stays open for a 300 ms hangover after the last candidate so word gaps and soft consonants
+// survive.
+class VoiceActivityDetector {
+public:
+    explicit VoiceActivityDetector(int sample_rate);
+
+    // Returns true while speech is active (including hangover).
+    bool process(const int16_t *samples, size_t count);
+    void reset();
+
+    bool active() const { return hangover_left_ > 0; }
+    float band_db() const { return band_db_; }
+    float noise_floor_db() const { return noise_floor_db_; }
+
+private:
+    int sample_rate_;
+    Biquad highpass_;
+    Biquad lowpass_;
+    // The noise floor's rates and the onset and hangover lengths, for the frame duration.
+    float floor_fall_;
+    float floor_rise_;
+    float floor_rise_active_;
+    int onset_frames_;
+    int hangover_frames_;
+    float noise_floor_db_;
+    float band_db_ = -100.0f;
+    int onset_count_ = 0;
+    int hangover_left_ = 0;
+};
+
+}  // namespace engine
@@ -0,0 +1,466 @@
+#include "wasapi_capture.h"
+
+#include <avrt.h>
+#include <mmreg.h>
+#include <objbase.h>
+
+#include <initguid.h>
+#include <functiondiscoverykeys_devpkey.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "audio_format.h"
+#include "dsp_kernels.h"
+#include "log.h"
+
+#pragma comment(lib, "avrt.lib")
+#pragma comment(lib, "ole32.lib")
+
+namespace engine {
+namespace {
+
+constexpr REFERENCE_TIME kBufferDuration = 200000;  // 20 ms in 100 ns units
+constexpr uint64_t kHundredNsPerSecond = 10000000ULL;
+
+template <typename T>
+void safe_release(T *&ptr) {
+    if (ptr) {
+        ptr->Release();
+        ptr = nullptr;
+    }
+}
+
+std::string narrow(const wchar_t *wide) {
+    if (!wide) {
+        return {};
+    }
+    int len = WideCharToMultiByte(CP_UTF8, 0, wide, -1, nullptr, 0, nullptr, nullptr);
+    if (len <= 1) {
+        return {};
+    }
+    std::string out(static_cast<size_t>(len - 1), '\0');
+    WideCharToMultiByte(CP_UTF8, 0, wide, -1, &out[0], len, nullptr, nullptr);
+    return out;
+}
+
+std::wstring widen(const std::string &utf8) {
+    if (utf8.empty()) {
+        return {};
+    }
+    int len = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, nullptr, 0);
+    if (len <= 1) {
+        return {};
+    }
+    std::wstring out(static_cast<size_t>(len - 1), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, &out[0], len);
+    return out;
+}
+
+std::string hr_string(HRESULT hr) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "0x%08lx", static_cast<unsigned long>(hr));
+    return buf;
+}
+
+std::string friendly_name(IMMDevice *device) {
+    IPropertyStore *props = nullptr;
+    if (FAILED(device->OpenPropertyStore(STGM_READ, &props))) {
+        return {};
+    }
+    PROPVARIANT value;
+    PropVariantInit(&value);
+    std::string name;
+    if (SUCCEEDED(props->GetValue(PKEY_Device_FriendlyName, &value)) && value.vt == VT_LPWSTR) {
+        name = narrow(value.pwszVal);
+    }
+    PropVariantClear(&value);
+    props->Release();
+    return name;
+}
+
+// Same scaling and rounding as the float kernels (dsp_kernels.h), so every format lands alike.
+inline int16_t clamp_to_int16(float value) {
+    float scaled = value * 32768.0f;
+    if (scaled >= 32767.0f) {
+        return 32767;
+    }
+    if (scaled <= -32768.0f) {
+        return -32768;
+    }
+    return static_cast<int16_t>(std::lrintf(scaled));
+}
+
+}  // namespace
+
+MmcssScope::MmcssScope() {
+    DWORD task_index = 0;
+    handle_ = AvSetMmThreadCharacteristicsW(L"Pro Audio", &task_index);
+    if (!handle_) {
+        log_error("AvSetMmThreadCharacteristics failed: " + std::to_string(GetLastError()));
+    }
+}
+
+MmcssScope::~MmcssScope() {
+    if (handle_) {
+        AvRevertMmThreadCharacteristics(handle_);
+    }
+}
+
+WasapiCapture::WasapiCapture(CaptureKind kind, std::string device_id, std::string label)
+    : kind_(kind), device_id_(std::move(device_id)), label_(std::move(label)) {}
+
+WasapiCapture::~WasapiCapture() {
+    close();
+}
+
+bool WasapiCapture::open() {
+    HRESULT hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator),
+                                  reinterpret_cast<void **>(&enumerator_));
+    if (FAILED(hr)) {
+        log_error(label_ + " MMDeviceEnumerator failed: " + hr_string(hr));
+        return false;
+    }
+
+    EDataFlow flow = kind_ == CaptureKind::Loopback ? eRender : eCapture;
+    if (device_id_.empty()) {
+        hr = enumerator_->GetDefaultAudioEndpoint(flow, eConsole, &device_);
+    } else {
+        hr = enumerator_->GetDevice(widen(device_id_).c_str(), &device_);
+    }
+    if (FAILED(hr)) {
+        log_error(label_ + " endpoint lookup failed: " + hr_string(hr));
+        close();
+        return false;
+    }
+    device_name_ = friendly_name(device_);
+
+    hr = device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, reinterpret_cast<void **>(&client_));
+    if (FAILED(hr)) {
+        log_error(label_ + " IAudioClient activation failed: " + hr_string(hr));
+        close();
+        return false;
+    }
+
+    WAVEFORMATEX *mix_format = nullptr;
+    hr = client_->GetMixFormat(&mix_format);
+    if (FAILED(hr)) {
+        log_error(label_ + " GetMixFormat failed: " + hr_string(hr));
+        close();
+        return false;
+    }
+
+    // Keep the engine's channel layout and sample type but ask for kSampleRate; shared mode
+    // converts the rate for us when the endpoint runs at 44.1 kHz or 96 kHz.
+    std::vector<BYTE> format_bytes(sizeof(WAVEFORMATEX) + mix_format->cbSize);
+    std::memcpy(format_bytes.data(), mix_format, format_bytes.size());
+    CoTaskMemFree(mix_format);
+    WAVEFORMATEX *format = reinterpret_cast<WAVEFORMATEX *>(format_bytes.data());
+
+    DWORD flags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_NOPERSIST;
+    if (kind_ == CaptureKind::Loopback) {
+        flags |= AUDCLNT_STREAMFLAGS_LOOPBACK;
+    }
+    if (format->nSamplesPerSec != static_cast<DWORD>(kSampleRate)) {
+        format->nSamplesPerSec = kSampleRate;
+        format->nAvgBytesPerSec = kSampleRate * format->nBlockAlign;
+        flags |= AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+    }
+
+    WORD tag = format->wFormatTag;
+    if (tag == WAVE_FORMAT_EXTENSIBLE && format->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) {
+        // KSDATAFORMAT_SUBTYPE_* GUIDs carry the classic format tag in Data1.
+        tag = static_cast<WORD>(reinterpret_cast<WAVEFORMATEXTENSIBLE *>(format)->SubFormat.Data1);
+    }
+    if (tag == WAVE_FORMAT_IEEE_FLOAT && format->wBitsPerSample == 32) {
+        format_ = SampleFormat::Float32;
+    } else if (tag == WAVE_FORMAT_PCM && format->wBitsPerSample == 16) {
+        format_ = SampleFormat::Pcm16;
+    } else if (tag == WAVE_FORMAT_PCM && format->wBitsPerSample == 24) {
+        format_ = SampleFormat::Pcm24;
+    } else if (tag == WAVE_FORMAT_PCM && format->wBitsPerSample == 32) {
+        format_ = SampleFormat::Pcm32;
+    } else {
+        log_error(label_ + " unsupported mix format tag=" + std::to_string(tag) +
+                  " bits=" + std::to_string(format->wBitsPerSample));
+        close();
+        return false;
+    }
+    channels_ = format->nChannels;
+    block_align_ = format->nBlockAlign;
+
+    hr = client_->Initialize(AUDCLNT_SHAREMODE_SHARED, flags, kBufferDuration, 0, format, nullptr);
+    if (FAILED(hr)) {
+        log_error(label_ + " IAudioClient::Initialize failed: " + hr_string(hr));
+        close();
+        return false;
+    }
+
+    event_ = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!event_ || FAILED(client_->SetEventHandle(event_))) {
+        log_error(label_ + " SetEventHandle failed");
+        close();
+        return false;
+    }
+
+    hr = client_->GetService(__uuidof(IAudioCaptureClient), reinterpret_cast<void **>(&capture_));
+    if (FAILED(hr)) {
+        log_error(label_ + " IAudioCaptureClient unavailable: " + hr_string(hr));
+        close();
+        return false;
+    }
+
+    UINT32 buffer_frames = 0;
+    client_->GetBufferSize(&buffer_frames);
+    scratch_.assign(std::max<size_t>(buffer_frames, kMaxFrameSamples), 0);
+
+    log_info(label_ + " capturing \"" + device_name_ + "\" channels=" + std::to_string(channels_) +
+             " bits=" + std::to_string(format->wBitsPerSample) + " buffer=" + std::to_string(buffer_frames));
+    return true;
+}
+
+bool WasapiCapture::start() {
+    if (!client_) {
+        return false;
+    }
+    HRESULT hr = client_->Start();
+    if (FAILED(hr)) {
+        log_error(label_ + " IAudioClient::Start failed: " + hr_string(hr));
+        return false;
+    }
+    next_qpc_ = qpc_now_100ns();
+    started_ = true;
+    return true;
+}
+
+void WasapiCapture::stop() {
+    if (client_ && started_) {
+        client_->Stop();
+    }
+    started_ = false;
+}
+
+void WasapiCapture::close() {
+    stop();
+    safe_release(capture_);
+    safe_release(client_);
+    safe_release(device_);
+    safe_release(enumerator_);
+    if (event_) {
+        CloseHandle(event_);
+        event_ = nullptr;
+    }
+}
+
+bool WasapiCapture::pump(DWORD timeout_ms, const CaptureSink &sink) {
+    DWORD wait = WaitForSingleObject(event_, timeout_ms);
+    if (wait != WAIT_OBJECT_0 && wait != WAIT_TIMEOUT) {
+        log_error(label_ + " wait failed: " + std::to_string(GetLastError()));
+        return false;
+    }
+
+    // Drain on timeout too: loopback on older Windows builds never signals the event.
+    bool got_packet = false;
+    UINT32 packet_frames = 0;
+    HRESULT hr = S_OK;
+    while (SUCCEEDED(hr = capture_->GetNextPacketSize(&packet_frames)) && packet_frames > 0) {
+        BYTE *data = nullptr;
+        UINT32 frames = 0;
+        DWORD flags = 0;
+        UINT64 device_pos = 0;
+        UINT64 qpc_pos = 0;
+        hr = capture_->GetBuffer(&data, &frames, &flags, &device_pos, &qpc_pos);
+        if (FAILED(hr)) {
+            break;
+        }
+        uint32_t sink_flags = 0;
+        if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+            ++discontinuities_;
+            sink_flags |= kCaptureDiscontinuity;
+        }
+        if (frames > scratch_.size()) {
+            frames = static_cast<UINT32>(scratch_.size());
+        }
+        if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+            std::fill(scratch_.begin(), scratch_.begin() + frames, static_cast<int16_t>(0));
+        } else {
+            convert_to_mono(data, frames);
+        }
+        capture_->ReleaseBuffer(frames);
+
+        sink(scratch_.data(), frames, qpc_pos, sink_flags);
+        next_qpc_ = qpc_pos + frames * kHundredNsPerSecond / kSampleRate;
+        got_packet = true;
+    }
+
+    if (FAILED(hr)) {
+        if (hr == AUDCLNT_E_DEVICE_INVALIDATED) {
+            log_error(label_ + " device invalidated");
+        } else {
+            log_error(label_ + " capture failed: " + hr_string(hr));
+        }
+        return false;
+    }
+
+    if (!got_packet && wait == WAIT_TIMEOUT && kind_ == CaptureKind::Loopback) {
+        emit_silence(qpc_now_100ns(), sink);
+    }
+    return true;
+}
+
+void WasapiCapture::convert_to_mono(const BYTE *data, UINT32 frames) {
+    // The shared-mode mix format is packed float32 on practically every device.
+    if (format_ == SampleFormat::Float32 && block_align_ == channels_ * static_cast<int>(sizeof(float))) {
+        downmix_to_int16(reinterpret_cast<const float *>(data), frames, channels_, scratch_.data());
+        return;
+    }
+    const float inv_channels = 1.0f / static_cast<float>(channels_);
+    for (UINT32 i = 0; i < frames; ++i) {
+        const BYTE *frame = data + static_cast<size_t>(i) * block_align_;
+        float sum = 0.0f;
+        for (int ch = 0; ch < channels_; ++ch) {
+            switch (format_) {
+            case SampleFormat::Float32: {
+                float v;
+                std::memcpy(&v, frame + ch * 4, 4);
+                sum += v;
+                break;
+            }
+            case SampleFormat::Pcm16: {
+                int16_t v;
+                std::memcpy(&v, frame + ch * 2, 2);
+                sum += static_cast<float>(v) / 32768.0f;
+                break;
+            }
+            case SampleFormat::Pcm24: {
+                const BYTE *p = frame + ch * 3;
+                uint32_t bits = (static_cast<uint32_t>(p[2]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                                (static_cast<uint32_t>(p[0]) << 8);
+                int32_t v = static_cast<int32_t>(bits);
+                sum += static_cast<float>(v) / 2147483648.0f;
+                break;
+            }
+            case SampleFormat::Pcm32: {
+                int32_t v;
+                std::memcpy(&v, frame + ch * 4, 4);
+                sum += static_cast<float>(v) / 2147483648.0f;
+                break;
+            }
+            }
+        }
+        scratch_[i] = clamp_to_int16(sum * inv_channels);
+    }
+}
+
+void WasapiCapture::emit_silence(uint64_t now_100ns, const CaptureSink &sink) {
+    if (now_100ns <= next_qpc_) {
+        return;
+    }
+    uint64_t missing = (now_100ns - next_qpc_) * kSampleRate / kHundredNsPerSecond;
+    std::fill(scratch_.begin(), scratch_.end(), static_cast<int16_t>(0));
+    while (missing > 0) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(missing, scratch_.size()));
+        sink(scratch_.data(), chunk, next_qpc_, kCaptureSilent);
+        next_qpc_ += chunk * kHundredNsPerSecond / kSampleRate;
+        missing -= chunk;
+    }
+}
+
+DeviceWatcher::DeviceWatcher(CaptureKind kind) : flow_(kind == CaptureKind::Loopback ? eRender : eCapture) {}
+
+DeviceWatcher::~DeviceWatcher() {
+    stop();
+}
+
+bool DeviceWatcher::start() {
+    HRESULT hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator),
+                                  reinterpret_cast<void **>(&enumerator_));
+    if (SUCCEEDED(hr)) {
+        hr = enumerator_->RegisterEndpointNotificationCallback(this);
+    }
+    if (FAILED(hr)) {
+        log_error("endpoint notifications unavailable: " + hr_string(hr));
+        safe_release(enumerator_);
+        return false;
+    }
+    return true;
+}
+
+void DeviceWatcher::stop() {
+    if (enumerator_) {
+        enumerator_->UnregisterEndpointNotificationCallback(this);
+        safe_release(enumerator_);
+    }
+}
+
+HRESULT STDMETHODCALLTYPE DeviceWatcher::OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR) {
+    // Capture opens the eConsole default; the other roles change along with it or not at all.
+    if (flow == flow_ && role == eConsole) {
+        changes_.fetch_add(1, std::memory_order_acq_rel);
+    }
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceWatcher::QueryInterface(REFIID iid, void **out) {
+    if (iid == __uuidof(IUnknown) || iid == __uuidof(IMMNotificationClient)) {
+        *out = static_cast<IMMNotificationClient *>(this);
+        AddRef();
+        return S_OK;
+    }
+    *out = nullptr;
+    return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE DeviceWatcher::AddRef() {
+    return refs_.fetch_add(1) + 1;
+}
+
+ULONG STDMETHODCALLTYPE DeviceWatcher::Release() {
+    return refs_.fetch_sub(1) - 1;
+}
+
+std::vector<std::string> list_endpoints(CaptureKind kind) {
+    std::vector<std::string> out;
+    IMMDeviceEnumerator *enumerator = nullptr;
+    if (FAILED(CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator),
+                                reinterpret_cast<void **>(&enumerator)))) {
+        return out;
+    }
+    IMMDeviceCollection *devices = nullptr;
+    EDataFlow flow = kind == CaptureKind::Loopback ? eRender : eCapture;
+    if (SUCCEEDED(enumerator->EnumAudioEndpoints(flow, DEVICE_STATE_ACTIVE, &devices))) {
+        UINT count = 0;
+        devices->GetCount(&count);
+        for (UINT i = 0; i < count; ++i) {
+            IMMDevice *device = nullptr;
+            if (FAILED(devices->Item(i, &device))) {
+                continue;
+            }
+            LPWSTR id = nullptr;
+            if (SUCCEEDED(device->GetId(&id))) {
+                out.push_back(narrow(id) + "\t" + friendly_name(device));
+                CoTaskMemFree(id);
+            }
+            device->Release();
+        }
+        devices->Release();
+    }
+    enumerator->Release();
+    return out;
+}
+
+uint64_t qpc_now_100ns() {
+    static const uint64_t frequency = [] {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return static_cast<uint64_t>(f.QuadPart);
+    }();
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    uint64_t ticks = static_cast<uint64_t>(counter.QuadPart);
+    return (ticks / frequency) * kHundredNsPerSecond + (ticks % frequency) * kHundredNsPerSecond / frequency;
+}
+
+}  // namespace engine
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <windows.h>
+
+#include <audioclient.h>
+#include <mmdeviceapi.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace engine {
+
+enum class CaptureKind {
+    Microphone,
+    Loopback,
+};
+
+enum CaptureFlags : uint32_t {
+    // Samples were synthesized because the endpoint delivered nothing (idle loopback).
+    kCaptureSilent = 1 << 0,
+    // WASAPI reported a glitch (buffer overrun) before this packet.
+    kCaptureDiscontinuity = 1 << 1,
+};
+
+// Receives mono int16 samples at kSampleRate on the capture thread. qpc_100ns is the
+// QueryPerformanceCounter time of the first sample, in 100 ns units as reported by WASAPI.
+using CaptureSink =
+    std::function<void(const int16_t *samples, size_t count, uint64_t qpc_100ns, uint32_t flags)>;
+
+// Joins the calling thread to the MMCSS "Pro Audio" task for the lifetime of the scope.
+class MmcssScope {
+public:
+    MmcssScope();
+    ~MmcssScope();
+
+    MmcssScope(const MmcssScope &) = delete;
+    MmcssScope &operator=(const MmcssScope &) = delete;
+
+    bool active() const { return handle_ != nullptr; }
+
+private:
+    HANDLE handle_ = nullptr;
+};
+
+// Shared-mode, event-driven WASAPI capture of one endpoint. Microphone streams capture the
+// eCapture endpoint; loopback streams capture what is being rendered on the eRender endpoint.
+// open() may run on any COM-initialized (MTA) thread, so a replacement endpoint can be
+// prepared in the background; every later call must come from one such thread.
+class WasapiCapture {
+public:
+    WasapiCapture(CaptureKind kind, std::string device_id, std::string label);
+    ~WasapiCapture();
+
+    WasapiCapture(const WasapiCapture &) = delete;
+    WasapiCapture &operator=(const WasapiCapture &) = delete;
+
+    bool open();
+    bool start();
+    void stop();
+    void close();
+
+    // Waits up to timeout_ms for the device event and hands every pending packet to sink.
+    // Loopback endpoints deliver nothing while the render side is idle, so a timeout there
+    // is filled with silence to keep the stream continuous. Returns false on device loss.
+    bool pump(DWORD timeout_ms, const CaptureSink &sink);
+
+    uint64_t discontinuities() const { return discontinuities_; }
+    const std::string &device_name() const { return device_name_; }
+
+private:
+    enum class SampleFormat {
+        Float32,
+        Pcm16,
+        Pcm24,
+        Pcm32,
+    };
+
+    void convert_to_mono(const BYTE *data, UINT32 frames);
+    void emit_silence(uint64_t now_100ns, const CaptureSink &sink);
+
+    CaptureKind kind_;
+    std::string device_id_;
+    std::string label_;
+    std::string device_name_;
+
+    IMMDeviceEnumerator *enumerator_ = nullptr;
+    IMMDevice *device_ = nullptr;
+    IAudioClient *client_ = nullptr;
+    IAudioCaptureClient *capture_ = nullptr;
+    HANDLE event_ = nullptr;
+
+    SampleFormat format_ = SampleFormat::Float32;
+    int channels_ = 0;
+    int block_align_ = 0;
+    std::vector<int16_t> scratch_;
+
+    uint64_t next_qpc_ = 0;
+    uint64_t discontinuities_ = 0;
+    bool started_ = false;
+};
+
+// Counts changes of the default console endpoint for one kind of capture, so a stream that
+// follows the default can move when a headset is plugged in or an app switches the output.
+// The notifications arrive on a system thread; changes() may be read from any thread.
+class DeviceWatcher : public IMMNotificationClient {
+public:
+    explicit DeviceWatcher(CaptureKind kind);
+    ~DeviceWatcher();
+
+    DeviceWatcher(const DeviceWatcher &) = delete;
+    DeviceWatcher &operator=(const DeviceWatcher &) = delete;
+
+    // Registers for endpoint notifications; needs COM (MTA) on the calling thread.
+    bool start();
+    void stop();
+
+    uint64_t changes() const { return changes_.load(std::memory_order_acquire); }
+
+    HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR device_id) override;
+    HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR, DWORD) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR, const PROPERTYKEY) override { return S_OK; }
+
+    // The watcher lives as long as its owner, which unregisters it first; the reference count
+    // only satisfies COM.
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, void **out) override;
+    ULONG STDMETHODCALLTYPE AddRef() override;
+    ULONG STDMETHODCALLTYPE Release() override;
+
+private:
+    EDataFlow flow_;
+    IMMDeviceEnumerator *enumerator_ = nullptr;
+    std::atomic<uint64_t> changes_{0};
+    std::atomic<ULONG> refs_{1};
+};
+
+// Returns "id<TAB>name" lines for every active endpoint of the given kind.
+std::vector<std::string> list_endpoints(CaptureKind kind);
+
+// QueryPerformanceCounter converted to the 100 ns units WASAPI uses for packet timestamps.
+uint64_t qpc_now_100ns();
+
+}  // namespace engine
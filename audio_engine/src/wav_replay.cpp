@@ -0,0 +1,168 @@
+#include "wav_replay.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "audio_format.h"
+#include "log.h"
+
+namespace engine {
+namespace {
+
+constexpr uint64_t kHundredNsPerSecond = 10000000ULL;
+constexpr uint16_t kWaveFormatPcm = 1;
+constexpr uint16_t kWaveFormatExtensible = 0xFFFE;
+
+uint16_t get_u16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+uint32_t get_u32(const uint8_t *p) {
+    return static_cast<uint32_t>(get_u16(p)) | static_cast<uint32_t>(get_u16(p + 2)) << 16;
+}
+
+}  // namespace
+
+WavReplay::WavReplay(std::string path, std::string label, double speed, uint64_t epoch_100ns)
+    : path_(std::move(path)), label_(std::move(label)), speed_(speed), epoch_100ns_(epoch_100ns) {}
+
+WavReplay::~WavReplay() {
+    close();
+}
+
+bool WavReplay::open() {
+    file_ = CreateFileA(path_.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        log_error(label_ + " replay: cannot open " + path_ + ": " + std::to_string(GetLastError()));
+        return false;
+    }
+    LARGE_INTEGER size{};
+    GetFileSizeEx(file_, &size);
+    const uint64_t file_bytes = static_cast<uint64_t>(size.QuadPart);
+    if (file_bytes >= 12) {
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    if (mapping_) {
+        view_ = static_cast<const uint8_t *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!view_ || std::memcmp(view_, "RIFF", 4) != 0 || std::memcmp(view_ + 8, "WAVE", 4) != 0) {
+        log_error(label_ + " replay: " + path_ + " is not a WAV file");
+        close();
+        return false;
+    }
+
+    int bits = 0;
+    uint16_t tag = 0;
+    uint64_t offset = 12;
+    while (offset + 8 <= file_bytes) {
+        const uint8_t *chunk = view_ + offset;
+        const uint64_t remaining = file_bytes - offset - 8;
+        const uint64_t chunk_bytes = get_u32(chunk + 4);
+        if (std::memcmp(chunk, "fmt ", 4) == 0 && chunk_bytes >= 16 && chunk_bytes <= remaining) {
+            tag = get_u16(chunk + 8);
+            channels_ = get_u16(chunk + 10);
+            rate_ = static_cast<int>(get_u32(chunk + 12));
+            bits = get_u16(chunk + 22);
+            if (tag == kWaveFormatExtensible && chunk_bytes >= 40) {
+                tag = get_u16(chunk + 32);  // first two bytes of the SubFormat GUID
+            }
+        } else if (std::memcmp(chunk, "data", 4) == 0) {
+            // 0 or past end of file: the header was never finalised, so take what was written.
+            uint64_t data_bytes = chunk_bytes == 0 || chunk_bytes > remaining ? remaining : chunk_bytes;
+            data_ = chunk + 8;
+            if (channels_ > 0) {
+                frames_ = data_bytes / (static_cast<uint64_t>(channels_) * sizeof(int16_t));
+            }
+            break;
+        }
+        offset += 8 + chunk_bytes + (chunk_bytes & 1);
+    }
+    if (!data_ || tag != kWaveFormatPcm || bits != 16 || channels_ <= 0 || rate_ <= 0) {
+        log_error(label_ + " replay: " + path_ + " is not 16-bit PCM WAV");
+        close();
+        return false;
+    }
+
+    chunk_frames_ = static_cast<size_t>(std::max(1, rate_ * frame_ms() / 1000));
+    mono_.assign(chunk_frames_, 0);
+    if (rate_ != kSampleRate) {
+        resampler_ = std::make_unique<Resampler>(rate_, kSampleRate);
+        resampled_.assign(resampler_->max_output(chunk_frames_), 0);
+    }
+    position_ = 0;
+    emitted_ = 0;
+    return true;
+}
+
+void WavReplay::close() {
+    if (view_) {
+        UnmapViewOfFile(view_);
+        view_ = nullptr;
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+        mapping_ = nullptr;
+    }
+    if (file_ != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+    }
+    data_ = nullptr;
+}
+
+bool WavReplay::pump(DWORD timeout_ms, const CaptureSink &sink) {
+    if (!data_ || position_ >= frames_) {
+        return false;
+    }
+    if (speed_ <= 0.0) {
+        emit_chunk(sink);
+        return true;
+    }
+
+    // Wall-clock time at which the next chunk's first sample is due.
+    auto due = [this] {
+        return epoch_100ns_ +
+               static_cast<uint64_t>(static_cast<double>(position_) * kHundredNsPerSecond / (rate_ * speed_));
+    };
+    uint64_t now = qpc_now_100ns();
+    uint64_t next = due();
+    if (now < next) {
+        uint64_t wait_ms = (next - now + 9999) / 10000;
+        Sleep(static_cast<DWORD>(std::min<uint64_t>(wait_ms, timeout_ms)));
+        now = qpc_now_100ns();
+    }
+    while (position_ < frames_ && due() <= now) {
+        emit_chunk(sink);
+    }
+    return true;
+}
+
+void WavReplay::emit_chunk(const CaptureSink &sink) {
+    const size_t n = static_cast<size_t>(std::min<uint64_t>(chunk_frames_, frames_ - position_));
+    const uint8_t *src = data_ + position_ * static_cast<uint64_t>(channels_) * sizeof(int16_t);
+    for (size_t i = 0; i < n; ++i) {
+        int32_t sum = 0;
+        for (int ch = 0; ch < channels_; ++ch) {
+            int16_t v;
+            std::memcpy(&v, src, sizeof(v));
+            sum += v;
+            src += sizeof(v);
+        }
+        mono_[i] = static_cast<int16_t>(sum / channels_);
+    }
+    position_ += n;
+
+    const int16_t *out = mono_.data();
+    size_t count = n;
+    if (resampler_) {
+        count = resampler_->process(mono_.data(), n, resampled_.data());
+        out = resampled_.data();
+    }
+    if (count > 0) {
+        sink(out, count, epoch_100ns_ + emitted_ * kHundredNsPerSecond / kSampleRate, 0);
+        emitted_ += count;
+    }
+}
+
+}  // namespace engine
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <windows.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "resampler.h"
+#include "wasapi_capture.h"
+
+namespace engine {
+
+// Plays a 16-bit PCM WAV file into a CaptureSink in place of a WASAPI endpoint (--replay).
+//
+// The file is memory-mapped read-only and walked in frame-long chunks, downmixed to mono and
+// resampled to kSampleRate when needed. Timestamps are media time on a caller-supplied QPC
+// epoch, so two replays sharing an epoch stay sample-aligned regardless of pacing. A data
+// chunk whose size was never finalised (a recording cut off by a crash) plays to end of file.
+class WavReplay {
+public:
+    // speed 1 is real time, N plays N times faster and 0 emits a chunk on every pump() call.
+    WavReplay(std::string path, std::string label, double speed, uint64_t epoch_100ns);
+    ~WavReplay();
+
+    WavReplay(const WavReplay &) = delete;
+    WavReplay &operator=(const WavReplay &) = delete;
+
+    bool open();
+    void close();
+
+    // Hands every chunk that is due to sink, waiting up to timeout_ms for the next one.
+    // Returns false once the whole file has been delivered.
+    bool pump(DWORD timeout_ms, const CaptureSink &sink);
+
+    int file_rate() const { return rate_; }
+    double duration_seconds() const { return rate_ > 0 ? static_cast<double>(frames_) / rate_ : 0.0; }
+
+private:
+    void emit_chunk(const CaptureSink &sink);
+
+    std::string path_;
+    std::string label_;
+    double speed_;
+    uint64_t epoch_100ns_;
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    const uint8_t *view_ = nullptr;
+
+    const uint8_t *data_ = nullptr;
+    uint64_t frames_ = 0;
+    int rate_ = 0;
+    int channels_ = 0;
+    size_t chunk_frames_ = 0;
+
+    uint64_t position_ = 0;  // file frames consumed
+    uint64_t emitted_ = 0;   // kSampleRate samples handed to the sink
+    std::unique_ptr<Resampler> resampler_;
+    std::vector<int16_t> mono_;
+    std::vector<int16_t> resampled_;
+};
+
+}  // namespace engine
@@ -14,7 +14,8 @@ from typing import Callable, Optional, Dict, Any
 import aiohttp
 
 from engine_client import EngineClient
-from engine_stream import EngineStream
+from engine_stream import EngineStream, ShmEngineStream, frame_bytes_for_rate
+from ogg_opus import OggOpusMuxer
 
 
 def list_audio_devices():
@@ -51,9 +52,14 @@ DEEPGRAM_URL_BASE = (
     "&endpointing=200"
     "&vad_events=true"
 )
+# Deepgram drops a socket after ~10 s without audio; the engine VAD gate can be quieter than that.
+DG_KEEPALIVE_S = 5.0
 
 
-def build_deepgram_url(sample_rate: int) -> str:
+def build_deepgram_url(sample_rate: int, codec: str = "pcm") -> str:
+    if codec == "opus":
+        # Ogg Opus is self-describing; Deepgram reads rate and channels from the container.
+        return DEEPGRAM_URL_BASE.replace("&encoding=linear16&channels=1", "")
     sr = int(sample_rate) if sample_rate else 48000
     return f"{DEEPGRAM_URL_BASE}&sample_rate={sr}"
 
@@ -66,6 +72,10 @@ class StreamConfig:
     port: int
     sample_rate: int = 48000
     blocksize: int = 960
+    frame_ms: int = 20
+    framed: bool = False
+    shm_name: str = ""  # set when the engine runs with --transport shm
+    codec: str = "pcm"  # opus: frames are Opus packets (engine --codec opus)
 
 
 def _pcm_rms_int16(pcm: bytes) -> float:
@@ -93,6 +103,8 @@ def _stream_worker_process(
     pcm_q: "queue.Queue[bytes]" = queue.Queue(maxsize=2000)
 
     level = 0.0
+    peak = 0.0
+    clip_count = 0
     queue_drops = 0
     bytes_sent = 0
     msgs_recv = 0
@@ -114,7 +126,18 @@ def _stream_worker_process(
 
     q_soft_cap = 200
 
-    stream = EngineStream(cfg.host, cfg.port, cfg.label, retry_s=10.0)
+    if cfg.shm_name:
+        stream = ShmEngineStream(cfg.shm_name, cfg.label, retry_s=10.0)
+    else:
+        stream = EngineStream(
+            cfg.host,
+            cfg.port,
+            cfg.label,
+            retry_s=10.0,
+            framed=cfg.framed,
+            frame_bytes=frame_bytes_for_rate(cfg.sample_rate, cfg.frame_ms),
+            frame_ms=cfg.frame_ms,
+        )
     tcp_thread: Optional[threading.Thread] = None
 
     def push_status(extra: Optional[Dict[str, Any]] = None):
@@ -123,7 +146,10 @@ def _stream_worker_process(
         payload = {
             "ts": now,
             "status": "streaming",
-            "rms": float(level),
+            # A gated stream sends nothing between utterances, so a stale level reads as silence.
+            "rms": float(level) if last_audio_ts and now - last_audio_ts < 0.5 else 0.0,
+            "peak": float(peak),
+            "clip_count": int(clip_count),
             "partial": last_partial,
             "final": last_final,
             "emit_count": int(emit_count),
@@ -145,6 +171,9 @@ def _stream_worker_process(
             "tcp_bytes": tcp_status.bytes,
             "tcp_drops": tcp_status.drops,
             "tcp_last_error": tcp_status.last_error,
+            "tcp_framed": tcp_status.framed,
+            "tcp_last_seq": tcp_status.last_seq,
+            "tcp_latency_ms": tcp_status.capture_latency_ms,
         }
         if extra:
             payload.update(extra)
@@ -167,7 +196,7 @@ def _stream_worker_process(
             pass
 
     def tcp_reader():
-        nonlocal level, last_audio_ts, queue_drops
+        nonlocal level, peak, clip_count, last_audio_ts, queue_drops
         while not stop_evt.is_set():
             frame = stream.read_frame()
             if frame is None:
@@ -175,7 +204,14 @@ def _stream_worker_process(
                 continue
 
             last_audio_ts = time.time()
-            level = _pcm_rms_int16(frame)
+            # Framed engines meter natively; only raw PCM still needs the Python RMS pass.
+            info = stream.last_info
+            if info is not None and info.levels:
+                level = info.levels[0].level
+                peak = info.levels[0].peak / 32768.0
+                clip_count += info.levels[0].clipped
+            elif cfg.codec != "opus":
+                level = _pcm_rms_int16(frame)
 
             if pcm_q.qsize() >= q_soft_cap:
                 try:
@@ -194,7 +230,7 @@ def _stream_worker_process(
         nonlocal last_partial, last_final, last_dg_type, last_dg_error, last_ws_close
         nonlocal last_dg_raw, last_dg_no_transcript
 
-        url = build_deepgram_url(cfg.sample_rate)
+        url = build_deepgram_url(cfg.sample_rate, cfg.codec)
         headers = {"Authorization": f"Token {deepgram_key}"}
         timeout = aiohttp.ClientTimeout(total=None)
 
@@ -208,14 +244,30 @@ def _stream_worker_process(
                     chunk_seconds = frames_per_chunk / float(sr)
 
                     next_send_time = time.time()
+                    last_keepalive_ts = time.time()
+
+                    # Each websocket is a fresh Ogg stream; Opus decoders resync mid-stream.
+                    muxer: Optional[OggOpusMuxer] = None
+                    if cfg.codec == "opus":
+                        muxer = OggOpusMuxer(sr)
+                        await ws.send_bytes(muxer.header())
 
                     while not stop_evt.is_set():
                         try:
                             chunk = pcm_q.get_nowait()
                         except queue.Empty:
+                            # With the engine VAD gate there is no audio between utterances;
+                            # Deepgram closes idle sockets unless it gets a KeepAlive.
+                            now = time.time()
+                            idle_since = max(last_send_ts, last_keepalive_ts)
+                            if now - idle_since >= DG_KEEPALIVE_S:
+                                await ws.send_str(json.dumps({"type": "KeepAlive"}))
+                                last_keepalive_ts = now
                             await asyncio.sleep(0.001)
                             continue
 
+                        if muxer is not None:
+                            chunk = muxer.packet(chunk, frames_per_chunk)
                         await ws.send_bytes(chunk)
                         bytes_sent += len(chunk)
                         last_send_ts = time.time()
@@ -386,6 +438,9 @@ class ProcessStreamController:
             "tcp_bytes": 0,
             "tcp_drops": 0,
             "tcp_last_error": "",
+            "tcp_framed": False,
+            "tcp_last_seq": None,
+            "tcp_latency_ms": None,
             # NEW parent-side fields
             "worker_pid": None,
             "worker_alive": False,
@@ -474,49 +529,203 @@ class ProcessStreamController:
 
 
 class DualAudioController:
-    def __init__(self, on_text: Callable[[str, str], None]):
+    def __init__(
+        self,
+        on_text: Callable[[str, str], None],
+        on_turn: Optional[Callable[[str, Dict[str, Any]], None]] = None,
+    ):
+        # whisper.cpp model for in-engine transcription; replaces the Deepgram workers.
+        self._engine_asr_model = os.getenv("AUDIO_ENGINE_ASR_MODEL", "").strip()
+        self._engine_asr_workers = int(os.getenv("AUDIO_ENGINE_ASR_WORKERS", "2"))
+        self._engine_asr_language = os.getenv("AUDIO_ENGINE_ASR_LANGUAGE", "en").strip() or "en"
         dg_key = os.getenv("DEEPGRAM_API_KEY", "").strip()
-        if not dg_key:
+        if not dg_key and not self._engine_asr_model:
             raise RuntimeError("Missing DEEPGRAM_API_KEY in environment/.env")
         self._dg_key = dg_key
         self._on_text = on_text
+        self._on_turn = on_turn
         self._engine_host = os.getenv("AUDIO_ENGINE_HOST", "127.0.0.1")
         self._engine_mic_port = int(os.getenv("AUDIO_ENGINE_MIC_PORT", "17711"))
         self._engine_loop_port = int(os.getenv("AUDIO_ENGINE_LOOP_PORT", "17712"))
+        self._engine_framed = os.getenv("AUDIO_ENGINE_FRAMED", "0").strip() == "1"
+        # The engine resamples natively; 16 kHz is all the speech models need.
+        self._engine_out_rate = int(os.getenv("AUDIO_ENGINE_OUT_RATE", "16000"))
+        self._engine_transport = os.getenv("AUDIO_ENGINE_TRANSPORT", "tcp").strip() or "tcp"
+        self._engine_shm_name = os.getenv("AUDIO_ENGINE_SHM_NAME", "aisc_engine").strip() or "aisc_engine"
+        # off | mark (flag speech frames) | gate (the engine stops sending silence)
+        self._engine_vad = os.getenv("AUDIO_ENGINE_VAD", "off").strip().lower() or "off"
+        # Speakers instead of headphones: cancel Speaker B's playback out of the mic stream.
+        self._engine_aec = os.getenv("AUDIO_ENGINE_AEC", "0").strip() == "1"
+        # opus: ~32 kbps per stream instead of 256 kbps PCM at 16 kHz; needs framed frames.
+        self._engine_codec = os.getenv("AUDIO_ENGINE_CODEC", "pcm").strip().lower() or "pcm"
+        self._engine_bitrate = int(os.getenv("AUDIO_ENGINE_BITRATE", "32000"))
+        # Seconds between engine latency/drop reports surfaced in status(); 0 disables them.
+        self._engine_metrics = int(os.getenv("AUDIO_ENGINE_METRICS", "10"))
+        # Port for runtime device/rate/VAD/AEC/codec changes (engine_control); 0 disables it.
+        self._engine_control_port = int(os.getenv("AUDIO_ENGINE_CONTROL_PORT", "0"))
+        # Call on_turn once per utterance the engine's VAD segmenter closes, instead of leaving
+        # turn boundaries to the ASR's transcript fragments. Always on with engine ASR.
+        self._engine_turns = bool(self._engine_asr_model) or os.getenv("AUDIO_ENGINE_TURNS", "0").strip() == "1"
+        if self._engine_turns and not self._engine_asr_model and self._engine_vad == "off":
+            self._engine_vad = "mark"
+        # Overlap (both speakers at once) periods from the engine, surfaced in status().
+        self._engine_crosstalk = os.getenv("AUDIO_ENGINE_CROSSTALK", "0").strip() == "1"
+        # timer: even frame spacing for consumers that play or forward audio as it arrives.
+        self._engine_pacing = os.getenv("AUDIO_ENGINE_PACING", "off").strip().lower() or "off"
+        # Engine frame duration: 5 or 10 for low-latency cues, 40 to batch for cloud ASR.
+        self._engine_frame_ms = int(os.getenv("AUDIO_ENGINE_FRAME_MS", "20"))
+        # Open devices, warm the DSP chain and load the ASR model in parallel at engine startup.
+        self._engine_prewarm = os.getenv("AUDIO_ENGINE_PREWARM", "0").strip() == "1"
+        if (self._engine_turns or self._engine_crosstalk) and self._engine_control_port <= 0:
+            # Engine transcripts, utterance boundaries and overlaps arrive as control-port events.
+            self._engine_control_port = 17713
+        if self._engine_codec == "opus":
+            self._engine_framed = True
         self._engine = EngineClient(
             mic_port=self._engine_mic_port,
             loop_port=self._engine_loop_port,
             host=self._engine_host,
             command=os.getenv("AUDIO_ENGINE_CMD"),
+            framed=self._engine_framed,
+            out_rate=self._engine_out_rate,
+            transport=self._engine_transport,
+            shm_name=self._engine_shm_name,
+            vad=self._engine_vad,
+            aec=self._engine_aec,
+            codec=self._engine_codec,
+            bitrate=self._engine_bitrate,
+            metrics_interval=self._engine_metrics,
+            control_port=self._engine_control_port,
+            asr_model=self._engine_asr_model,
+            asr_workers=self._engine_asr_workers,
+            asr_language=self._engine_asr_language,
+            crosstalk=self._engine_crosstalk,
+            pacing=self._engine_pacing,
+            frame_ms=self._engine_frame_ms,
+            prewarm=self._engine_prewarm,
         )
 
         self.mic_ctrl: Optional[ProcessStreamController] = None
         self.vm_ctrl: Optional[ProcessStreamController] = None
+        self._events_stop = threading.Event()
+        self._events_thread: Optional[threading.Thread] = None
+        # Speaker -> utterance_end event still waiting for its streaming transcript.
+        self._turns_pending: Dict[str, Dict[str, Any]] = {}
+        self._turns_lock = threading.Lock()
+        self._crosstalk: Dict[str, Any] = {"active": False, "count": 0, "total_ms": 0, "last": None}
+        # Per engine stream: latest partial/final transcript, surfaced in status().
+        self._asr_latest: Dict[str, Dict[str, Any]] = {}
+
+    def _shm_stream_name(self, label: str) -> str:
+        if self._engine_transport != "shm":
+            return ""
+        return f"{self._engine_shm_name}_{label}"
 
     def start(self, mic_device_index: int, vm_device_index: int):
         self._engine.start()
         self._engine.wait_ready(timeout_s=10.0)
 
+        if self._engine_turns or self._engine_crosstalk:
+            self._events_stop.clear()
+            self._events_thread = threading.Thread(target=self._event_loop, daemon=True)
+            self._events_thread.start()
+        if self._engine_asr_model:
+            self._asr_latest = {
+                label: {"status": "engine_asr", "partial": "", "final": "", "emit_count": 0} for label in ("mic", "loop")
+            }
+            return
+
         mic_cfg = StreamConfig(
             label="mic",
             speaker="A",
             host=self._engine_host,
             port=self._engine_mic_port,
+            sample_rate=self._engine_out_rate,
+            blocksize=self._engine_out_rate * self._engine_frame_ms // 1000,
+            frame_ms=self._engine_frame_ms,
+            framed=self._engine_framed,
+            shm_name=self._shm_stream_name("mic"),
+            codec=self._engine_codec,
         )
         vm_cfg = StreamConfig(
             label="vm",
             speaker="B",
             host=self._engine_host,
             port=self._engine_loop_port,
+            sample_rate=self._engine_out_rate,
+            blocksize=self._engine_out_rate * self._engine_frame_ms // 1000,
+            frame_ms=self._engine_frame_ms,
+            framed=self._engine_framed,
+            shm_name=self._shm_stream_name("loop"),
+            codec=self._engine_codec,
         )
 
-        self.mic_ctrl = ProcessStreamController(mic_cfg, self._dg_key, self._on_text)
-        self.vm_ctrl = ProcessStreamController(vm_cfg, self._dg_key, self._on_text)
+        self.mic_ctrl = ProcessStreamController(mic_cfg, self._dg_key, self._emit_text)
+        self.vm_ctrl = ProcessStreamController(vm_cfg, self._dg_key, self._emit_text)
 
         self.mic_ctrl.start()
         self.vm_ctrl.start()
 
+    def engine_control(self, command: str):
+        return self._engine.control(command)
+
+    def _emit_text(self, speaker: str, text: str):
+        # Streaming ASR finals trail the audio, so a turn ends with the first text after its
+        # utterance_end rather than at the event itself.
+        self._on_text(speaker, text)
+        with self._turns_lock:
+            event = self._turns_pending.pop(speaker, None)
+        if event is not None and self._on_turn:
+            self._on_turn(speaker, event)
+
+    @property
+    def turn_events(self) -> bool:
+        """True when on_turn, not each on_text, marks the end of a speaker's turn."""
+        return self._engine_turns and self._on_turn is not None
+
+    def _event_loop(self):
+        speakers = {"mic": "A", "loop": "B"}
+        for event in self._engine.events(self._events_stop):
+            kind = event.get("type")
+            if kind == "overlap_start":
+                self._crosstalk["active"] = True
+                continue
+            if kind == "overlap_end":
+                self._crosstalk["active"] = False
+                self._crosstalk["count"] += 1
+                self._crosstalk["total_ms"] += int(event.get("duration_ms", 0))
+                self._crosstalk["last"] = event
+                continue
+            label = event.get("stream", "")
+            if label not in speakers:
+                continue
+            if kind == "utterance_end" and self._engine_turns and not self._engine_asr_model:
+                with self._turns_lock:
+                    self._turns_pending[speakers[label]] = event
+                continue
+            if kind != "transcript":
+                continue
+            latest = self._asr_latest.get(label)
+            text = (event.get("text") or "").strip()
+            if latest is None:
+                continue
+            if not event.get("final"):
+                latest["partial"] = text
+                continue
+            latest["partial"] = ""
+            if text:
+                latest["final"] = text
+                latest["emit_count"] += 1
+                self._on_text(speakers[label], text)
+                # An engine final covers exactly one utterance, so it is the turn.
+                if self._on_turn:
+                    self._on_turn(speakers[label], event)
+
     def stop(self):
+        self._events_stop.set()
+        if self._events_thread:
+            self._events_thread.join(timeout=2.0)
+            self._events_thread = None
         if self.mic_ctrl:
             self.mic_ctrl.stop()
         if self.vm_ctrl:
@@ -550,6 +759,9 @@ class DualAudioController:
                 "tcp_bytes": 0,
                 "tcp_drops": 0,
                 "tcp_last_error": "",
+                "tcp_framed": False,
+                "tcp_last_seq": None,
+                "tcp_latency_ms": None,
                 "worker_pid": None,
                 "worker_alive": False,
                 "worker_exitcode": None,
@@ -579,6 +791,10 @@ class DualAudioController:
                     vm["status"] = "audio_error"
                     vm["capture_error"] = f"worker_exitcode={vm['worker_exitcode']}"
 
+        if self._asr_latest:
+            mic.update(self._asr_latest.get("mic", {}))
+            vm.update(self._asr_latest.get("loop", {}))
+
         engine_status = self._engine.status()
         return {
             "engine": {
@@ -590,7 +806,9 @@ class DualAudioController:
                 "host": self._engine_host,
                 "mic_port": self._engine_mic_port,
                 "loop_port": self._engine_loop_port,
+                "metrics": engine_status.metrics,
             },
             "mic": mic,
             "vm": vm,
+            "crosstalk": dict(self._crosstalk) if self._engine_crosstalk else None,
         }
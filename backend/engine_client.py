@@ -1,5 +1,6 @@
 ﻿from __future__ import annotations
 
+import json
 import os
 import shlex
 import socket
@@ -8,7 +9,7 @@ import threading
 import time
 from dataclasses import dataclass
 from pathlib import Path
-from typing import List, Optional
+from typing import Any, Dict, Iterator, List, Optional
 
 
 @dataclass
@@ -23,6 +24,10 @@ class EngineStatus:
     loop_port: int
     command: str
     resolved_exe: str
+    # Latest --metrics line: per-stream latency histograms and drop/xrun counters.
+    metrics: Optional[Dict[str, Any]] = None
+    # The engine's ready line: ready_ms since process start, pid, and stages that failed.
+    ready: Optional[Dict[str, Any]] = None
 
 
 class EngineClient:
@@ -32,16 +37,66 @@ class EngineClient:
         loop_port: int,
         host: str = "127.0.0.1",
         command: Optional[str] = None,
+        framed: bool = False,
+        out_rate: int = 48000,
+        mux_port: int = 0,
+        mux_layout: str = "interleaved",
+        transport: str = "tcp",
+        shm_name: str = "aisc_engine",
+        vad: str = "off",
+        aec: bool = False,
+        codec: str = "pcm",
+        bitrate: int = 32000,
+        metrics_interval: int = 0,
+        control_port: int = 0,
+        asr_model: str = "",
+        asr_workers: int = 2,
+        asr_language: str = "en",
+        crosstalk: bool = False,
+        pacing: str = "off",
+        frame_ms: int = 20,
+        sessions: Optional[List[Dict[str, Any]]] = None,
+        prewarm: bool = False,
     ) -> None:
         self._host = host
         self._mic_port = int(mic_port)
         self._loop_port = int(loop_port)
         self._command = command or "audio_engine"
+        self._framed = bool(framed)
+        self._out_rate = int(out_rate)
+        self._mux_port = int(mux_port)
+        self._mux_layout = mux_layout
+        self._transport = transport
+        self._shm_name = shm_name
+        self._vad = vad  # off | mark | gate
+        self._aec = bool(aec)
+        self._codec = codec  # pcm | opus (needs framed)
+        self._bitrate = int(bitrate)
+        self._metrics_interval = int(metrics_interval)  # seconds; 0 = off
+        self._control_port = int(control_port)  # 0 = no runtime control channel
+        # whisper.cpp model path for in-engine transcription (needs control_port); "" = off.
+        self._asr_model = asr_model
+        self._asr_workers = int(asr_workers)
+        self._asr_language = asr_language
+        # overlap_start / overlap_end control-port events when both speakers talk at once.
+        self._crosstalk = bool(crosstalk)
+        # off | timer: send on the capture grid through the engine's jitter buffer (per-stream ports).
+        self._pacing = pacing
+        # 5 | 10 | 20 | 40 ms frames: smaller cuts latency per hop, larger cuts per-frame overhead.
+        self._frame_ms = int(frame_ms)
+        # Further seats in the same process (per-stream ports only), each a dict with name,
+        # mic_port, loop_port and optionally mic_device / loop_device; streams are NAME.mic / NAME.loop.
+        self._sessions = list(sessions or [])
+        # Open endpoints, warm the DSP chain and load the ASR model in parallel at startup.
+        self._prewarm = bool(prewarm)
 
         self._proc: Optional[subprocess.Popen[str]] = None
         self._lock = threading.Lock()
         self._last_log = ""
         self._last_err = ""
+        self._metrics: Optional[Dict[str, Any]] = None
+        self._ready: Optional[Dict[str, Any]] = None
+        self._ready_event = threading.Event()
         self._resolved_exe = ""
 
         self._backend_dir = Path(__file__).resolve().parent
@@ -86,67 +141,97 @@ class EngineClient:
         self._resolved_exe = exe
         cmd[0] = exe
 
-        cmd += [
-            "--host", self._host,
-            "--mic-port", str(self._mic_port),
-            "--loop-port", str(self._loop_port),
-        ]
+        cmd += ["--host", self._host]
+        if self._transport == "shm":
+            cmd += ["--transport", "shm", "--shm-name", self._shm_name]
+        elif self._mux_port:
+            cmd += ["--mux-port", str(self._mux_port), "--mux-layout", self._mux_layout]
+        else:
+            cmd += ["--mic-port", str(self._mic_port), "--loop-port", str(self._loop_port)]
+        if self._framed:
+            cmd += ["--framed"]
+        if self._out_rate != 48000:
+            cmd += ["--out-rate", str(self._out_rate)]
+        if self._frame_ms != 20:
+            cmd += ["--frame-ms", str(self._frame_ms)]
+        if self._vad == "mark":
+            cmd += ["--vad"]
+        elif self._vad == "gate":
+            cmd += ["--vad-gate"]
+        if self._aec:
+            cmd += ["--aec"]
+        if self._codec == "opus":
+            cmd += ["--codec", "opus", "--bitrate", str(self._bitrate)]
+        if self._metrics_interval > 0:
+            cmd += ["--metrics", str(self._metrics_interval)]
+        if self._control_port > 0:
+            cmd += ["--control-port", str(self._control_port)]
+        if self._asr_model:
+            cmd += ["--asr", self._asr_model, "--asr-workers", str(self._asr_workers)]
+            cmd += ["--asr-language", self._asr_language]
+        if self._crosstalk:
+            cmd += ["--crosstalk"]
+        if self._pacing == "timer" and self._transport != "shm" and not self._mux_port:
+            cmd += ["--pacing", "timer"]
+        if self._transport != "shm" and not self._mux_port:
+            for seat in self._sessions:
+                spec = f"name={seat['name']},mic-port={int(seat['mic_port'])},loop-port={int(seat['loop_port'])}"
+                for key in ("mic_device", "loop_device"):
+                    if seat.get(key):
+                        spec += f",{key.replace('_', '-')}={seat[key]}"
+                cmd += ["--session", spec]
+        if self._prewarm:
+            cmd += ["--prewarm"]
         if proof:
             cmd += ["--proof", "--seconds", str(int(seconds))]
         return cmd
 
     def wait_ready(self, timeout_s: float = 2.0) -> bool:
         """
-        Block until the engine process is running and both TCP ports accept a connection.
-        Returns True on success, False on timeout/failure (and sets last_err).
+        Block until the engine logs its ready line: every port or shm mapping is up and each
+        endpoint has been opened once. Returns True on success, False on timeout/failure (and
+        sets last_err). An endpoint that failed to open leaves the engine running and retrying,
+        so it is reported in last_err without failing the wait.
         """
         deadline = time.time() + float(timeout_s)
-
-        # Wait for process to exist + not exited
         while time.time() < deadline:
             with self._lock:
                 p = self._proc
-            if p is not None:
-                rc = p.poll()
-                if rc is None:
-                    break
-                else:
-                    with self._lock:
-                        self._last_err = f"ENGINE_EXITED_EARLY: exit_code={rc} exe={self._resolved_exe}"
-                    return False
-            time.sleep(0.02)
-
-        with self._lock:
-            p = self._proc
-        if p is None:
+            if p is None:
+                with self._lock:
+                    self._last_err = f"ENGINE_NOT_STARTED exe={self._resolved_exe}"
+                return False
+            if self._ready_event.wait(timeout=min(0.05, max(0.0, deadline - time.time()))):
+                break
+            rc = p.poll()
+            if rc is not None:
+                with self._lock:
+                    self._last_err = f"ENGINE_EXITED_EARLY: exit_code={rc} exe={self._resolved_exe}"
+                return False
+        else:
             with self._lock:
-                self._last_err = f"ENGINE_NOT_STARTED exe={self._resolved_exe}"
+                self._last_err = (
+                    f"ENGINE_NOT_READY timeout={timeout_s}s host={self._host} mic={self._mic_port} loop={self._loop_port}"
+                )
             return False
 
-        # Try connecting to both ports until deadline
-        def _can_connect(port: int) -> bool:
-            try:
-                with socket.create_connection((self._host, port), timeout=0.2):
-                    return True
-            except OSError:
-                return False
-
-        while time.time() < deadline:
-            if _can_connect(self._mic_port) and _can_connect(self._loop_port):
-                return True
-            time.sleep(0.05)
-
         with self._lock:
-            self._last_err = f"ENGINE_NOT_READY timeout={timeout_s}s host={self._host} mic={self._mic_port} loop={self._loop_port}"
-        return False
+            ready = self._ready or {}
+            failed = [str(stage) for stage in ready.get("failed", [])]
+            if failed:
+                self._last_err = f"ENGINE_DEGRADED failed={','.join(failed)} ready_ms={ready.get('ready_ms')}"
+        return all(stage.endswith(" device") for stage in failed)
 
     def start(self, proof: bool = False, seconds: int = 10) -> None:
         with self._lock:
             self._last_log = ""
             self._last_err = ""
+            self._metrics = None
 
             if self._proc and self._proc.poll() is None:
                 return
+            self._ready = None
+            self._ready_event.clear()
 
             cmd = self._build_command(proof=proof, seconds=seconds)
             try:
@@ -173,6 +258,19 @@ class EngineClient:
                 t = (line or "").strip()
                 if not t:
                     continue
+                if is_stdout:
+                    metrics = self._parse_line(t, "metrics")
+                    if metrics is not None:
+                        with self._lock:
+                            self._metrics = metrics
+                        continue
+                    ready = self._parse_line(t, "ready")
+                    if ready is not None:
+                        with self._lock:
+                            self._ready = ready
+                            self._last_log = t[:400]
+                        self._ready_event.set()
+                        continue
                 with self._lock:
                     if is_stdout:
                         self._last_log = t[:400]
@@ -182,6 +280,109 @@ class EngineClient:
             with self._lock:
                 self._last_err = f"ENGINE_STREAM_READ_FAILED: {type(e).__name__}: {e}"[:400]
 
+    @staticmethod
+    def _parse_line(line: str, kind: str) -> Optional[Dict[str, Any]]:
+        # "[audio_engine] metrics {...}" / "[audio_engine] ready {...}"
+        marker = f"] {kind} {{"
+        at = line.find(marker)
+        if at < 0:
+            return None
+        try:
+            return json.loads(line[at + len(marker) - 1 :])
+        except ValueError:
+            return None
+
+    def control(self, command: str, timeout_s: float = 2.0) -> Dict[str, Any]:
+        """
+        Send one command line to the engine's --control-port and return its reply:
+        {"ok": True, "result": <json or None>} or {"ok": False, "error": "..."}.
+        Changes take effect at the engine's next frame boundary.
+        """
+        if self._control_port <= 0:
+            return {"ok": False, "error": "ENGINE_CONTROL_DISABLED"}
+        try:
+            with socket.create_connection((self._host, self._control_port), timeout=timeout_s) as s:
+                s.sendall(command.strip().encode("utf-8") + b"\n")
+                reply = b""
+                while not reply.endswith(b"\n"):
+                    chunk = s.recv(4096)
+                    if not chunk:
+                        break
+                    reply += chunk
+        except OSError as e:
+            return {"ok": False, "error": f"ENGINE_CONTROL_FAILED: {type(e).__name__}: {e}"}
+
+        line = reply.decode("utf-8", errors="replace").strip()
+        if line == "ok" or line.startswith("ok "):
+            body = line[3:].strip()
+            try:
+                return {"ok": True, "result": json.loads(body) if body else None}
+            except ValueError:
+                return {"ok": False, "error": f"ENGINE_CONTROL_BAD_REPLY: {line[:200]}"}
+        return {"ok": False, "error": line[len("error ") :] if line.startswith("error ") else line[:200]}
+
+    def set_device(self, stream: str, device_id: str) -> Dict[str, Any]:
+        return self.control(f"device {stream} {device_id or 'default'}")
+
+    def set_rate(self, stream: str, rate: int) -> Dict[str, Any]:
+        return self.control(f"rate {stream} {int(rate)}")
+
+    def set_vad(self, stream: str, mode: str) -> Dict[str, Any]:
+        return self.control(f"vad {stream} {mode}")
+
+    def set_aec(self, enabled: bool) -> Dict[str, Any]:
+        return self.control("aec on" if enabled else "aec off")
+
+    def set_codec(self, codec: str, bitrate: Optional[int] = None) -> Dict[str, Any]:
+        return self.control(f"codec {codec}" + (f" {int(bitrate)}" if bitrate else ""))
+
+    def live_stats(self) -> Dict[str, Any]:
+        return self.control("stats")
+
+    def events(self, stop: threading.Event, retry_s: float = 1.0) -> Iterator[Dict[str, Any]]:
+        """
+        Yield engine events (e.g. {"type": "transcript", ...}) from a "subscribe" connection
+        on the control port until stop is set. A reconnect resumes after the last event seen;
+        a jump in "id" means the engine's backlog overflowed in between.
+        """
+        last_id: Optional[int] = None
+        while not stop.is_set():
+            if self._control_port <= 0:
+                return
+            try:
+                with socket.create_connection((self._host, self._control_port), timeout=2.0) as s:
+                    s.sendall(b"subscribe\n" if last_id is None else f"subscribe {last_id}\n".encode("ascii"))
+                    # Short reads so stop is noticed between events.
+                    s.settimeout(0.5)
+                    pending = b""
+                    while not stop.is_set():
+                        try:
+                            chunk = s.recv(65536)
+                        except socket.timeout:
+                            continue
+                        if not chunk:
+                            break
+                        pending += chunk
+                        while b"\n" in pending:
+                            raw, pending = pending.split(b"\n", 1)
+                            line = raw.decode("utf-8", errors="replace").strip()
+                            if line.startswith("ok "):
+                                if last_id is None:
+                                    last_id = int(json.loads(line[3:]).get("last_id", 0))
+                                continue
+                            if not line.startswith("event "):
+                                continue
+                            try:
+                                event = json.loads(line[len("event ") :])
+                            except ValueError:
+                                continue
+                            last_id = int(event.get("id", last_id or 0))
+                            yield event
+            except OSError as e:
+                with self._lock:
+                    self._last_err = f"ENGINE_EVENTS_FAILED: {type(e).__name__}: {e}"
+            stop.wait(retry_s)
+
     def stop(self) -> None:
         with self._lock:
             if not self._proc:
@@ -209,4 +410,6 @@ class EngineClient:
                 loop_port=self._loop_port,
                 command=self._command,
                 resolved_exe=self._resolved_exe,
+                metrics=self._metrics,
+                ready=self._ready,
             )
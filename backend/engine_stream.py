@@ -1,15 +1,120 @@
 from __future__ import annotations
 
+import array
+import ctypes
 import socket
 import struct
+import sys
 import time
 from dataclasses import dataclass
 from typing import Optional
 
 
+FRAME_MS = 20  # engine default; --frame-ms picks 5, 10, 20 or 40
 FRAME_BYTES = 960 * 2  # 20ms of 48kHz mono int16
 
 
+def frame_bytes_for_rate(sample_rate: int, frame_ms: int = FRAME_MS) -> int:
+    # --out-rate only changes the sample count; the duration is the engine's --frame-ms.
+    return int(sample_rate) * int(frame_ms) // 1000 * 2
+
+# Framed protocol (engine --framed), see audio_engine/src/protocol.h.
+PROTOCOL_VERSION = 1
+CLIENT_HELLO = struct.Struct("<4sHH")
+SERVER_HELLO = struct.Struct("<4sHHIHBBQ")
+FRAME_HEADER = struct.Struct("<4sHHQQIBBHII")
+BATCH_HEADER = struct.Struct("<4sHHII")
+# Level meter fields appended to FRAME_HEADER; present when header_bytes covers them.
+FRAME_LEVELS = struct.Struct("<8H")
+CLIENT_HELLO_MAGIC = b"AECH"
+SERVER_HELLO_MAGIC = b"AESH"
+FRAME_MAGIC = b"AEFR"
+BATCH_MAGIC = b"AEFB"
+# ClientHello flags.
+HELLO_DROP_NEWEST = 1 << 0  # a full subscriber queue drops incoming frames, not the oldest
+HELLO_LOG_MEL = 1 << 1  # receive FORMAT_LOG_MEL feature frames instead of audio
+HELLO_UTTERANCES = 1 << 2  # receive utterances only, each from its lookback to its end frame
+HELLO_BATCH_SHIFT = 8  # bits 8-15: frames per batch, each batch one BATCH_HEADER and its frames
+MAX_BATCH_FRAMES = 255
+
+FLAG_DISCONTINUITY = 1 << 0
+FLAG_SILENCE = 1 << 1
+FLAG_SPEECH = 1 << 2  # engine --vad / --vad-gate
+FLAG_UTTERANCE_START = 1 << 3  # first frame of an utterance
+FLAG_UTTERANCE_END = 1 << 4  # last frame of an utterance
+
+# Channel ids in frame headers; mux connections (engine --mux-port) carry several.
+CHANNEL_MIC = 0
+CHANNEL_LOOP = 1
+CHANNEL_STEREO = 2
+
+# Payload formats (FrameInfo.format_id); Opus frames carry one packet each (engine --codec opus).
+FORMAT_PCM16 = 1
+FORMAT_PCM16_STEREO = 2
+FORMAT_OPUS = 3
+FORMAT_OPUS_STEREO = 4
+# Whisper-style log10 mel energies: sample_count vectors of LOG_MEL_BINS float32, one per 10 ms.
+FORMAT_LOG_MEL = 5
+LOG_MEL_BINS = 80
+
+
+def qpc_now_100ns() -> int:
+    # On Windows perf_counter is QueryPerformanceCounter, the clock of engine capture timestamps.
+    return int(time.perf_counter() * 10_000_000)
+
+
+@dataclass
+class ChannelLevels:
+    rms: int
+    peak: int
+    clipped: int
+
+    @property
+    def level(self) -> float:
+        """RMS as a 0..1 fraction of full scale."""
+        return self.rms / 32768.0
+
+
+@dataclass
+class FrameInfo:
+    sequence: int
+    capture_qpc_100ns: int
+    sample_count: int
+    channel_id: int
+    format_id: int
+    flags: int
+    suppressed: int = 0
+    # [left/mono, right] when the engine meters frames, else None.
+    levels: Optional[list[ChannelLevels]] = None
+
+    @property
+    def speech(self) -> bool:
+        return bool(self.flags & FLAG_SPEECH)
+
+    @property
+    def utterance_start(self) -> bool:
+        return bool(self.flags & FLAG_UTTERANCE_START)
+
+    @property
+    def utterance_end(self) -> bool:
+        return bool(self.flags & FLAG_UTTERANCE_END)
+
+    @property
+    def opus(self) -> bool:
+        return self.format_id in (FORMAT_OPUS, FORMAT_OPUS_STEREO)
+
+    @property
+    def log_mel(self) -> bool:
+        return self.format_id == FORMAT_LOG_MEL
+
+
+def _unpack_levels(extra: bytes) -> Optional[list[ChannelLevels]]:
+    if len(extra) < FRAME_LEVELS.size:
+        return None
+    rms0, rms1, peak0, peak1, clip0, clip1, _, _ = FRAME_LEVELS.unpack_from(extra, 0)
+    return [ChannelLevels(rms0, peak0, clip0), ChannelLevels(rms1, peak1, clip1)]
+
+
 @dataclass
 class StreamStats:
     connected: bool
@@ -18,28 +123,82 @@ class StreamStats:
     last_frame_ts: Optional[float]
     last_frame_ms: Optional[int]
     last_error: str
+    framed: bool = False
+    frames: int = 0
+    last_seq: Optional[int] = None
+    capture_latency_ms: Optional[float] = None
 
 
 class EngineStream:
-    def __init__(self, host: str, port: int, label: str, retry_s: float = 10.0) -> None:
+    def __init__(
+        self,
+        host: str,
+        port: int,
+        label: str,
+        retry_s: float = 10.0,
+        framed: bool = False,
+        frame_bytes: int = FRAME_BYTES,
+        drop_newest: bool = False,
+        log_mel: bool = False,
+        utterances: bool = False,
+        frame_ms: int = FRAME_MS,
+        batch_frames: int = 0,
+    ) -> None:
         self._host = host
         self._port = int(port)
         self._label = label
         self._retry_s = float(retry_s)
+        self._want_framed = bool(framed)
+        self._frame_bytes = int(frame_bytes)
+        # Each connection is its own engine subscriber; recorders want a contiguous backlog.
+        self._hello_flags = HELLO_DROP_NEWEST if drop_newest else 0
+        # Feature frames need the framed protocol; see decode_log_mel().
+        if log_mel:
+            self._want_framed = True
+            self._hello_flags |= HELLO_LOG_MEL
+        # Only speech, cut by the engine's segmenter (needs engine --vad); see read_utterance().
+        if utterances:
+            self._want_framed = True
+            self._hello_flags |= HELLO_UTTERANCES
+        # Bulk readers (recorders, deep analysis) take up to this many frames per engine send;
+        # read_frame() still returns one frame at a time.
+        batch_frames = max(0, min(int(batch_frames), MAX_BATCH_FRAMES))
+        if batch_frames > 1:
+            self._want_framed = True
+            self._hello_flags |= batch_frames << HELLO_BATCH_SHIFT
+        self._batch = memoryview(b"")
         self._sock: Optional[socket.socket] = None
         self._connected = False
+        self._framed = False
         self._bytes = 0
         self._drops = 0
+        self._frames = 0
+        self._last_seq: Optional[int] = None
+        self._latency_ms: Optional[float] = None
         self._last_frame_ts: Optional[float] = None
         self._last_error = ""
+        # Raw streams carry no handshake, so the caller states the engine's --frame-ms; framed
+        # ones take it from the ServerHello.
+        self.frame_ms = int(frame_ms)
+        self.frame_samples = self._frame_bytes // 2
+        self.sample_rate = self.frame_samples * 1000 // self.frame_ms
+        self.last_info: Optional[FrameInfo] = None
 
     def _connect(self) -> bool:
         deadline = time.time() + self._retry_s
         while time.time() < deadline:
             try:
                 sock = socket.create_connection((self._host, self._port), timeout=1.0)
-                sock.settimeout(1.0)
+                # A batch may take its whole window to arrive.
+                sock.settimeout(1.0 + (self._hello_flags >> HELLO_BATCH_SHIFT) * self.frame_ms / 1000.0)
                 self._sock = sock
+                self._framed = False
+                self._last_seq = None
+                self._batch = memoryview(b"")
+                if self._want_framed and not self._handshake():
+                    self.close()
+                    time.sleep(0.1)
+                    continue
                 self._connected = True
                 self._last_error = ""
                 return True
@@ -50,6 +209,15 @@ class EngineStream:
         return False
 
     def _read_exact(self, size: int) -> Optional[bytes]:
+        # Frames of a batch that has already arrived are served from memory.
+        if self._batch:
+            if len(self._batch) < size:
+                self._last_error = "protocol_error: truncated batch"
+                self._batch = memoryview(b"")
+                return None
+            data = bytes(self._batch[:size])
+            self._batch = self._batch[size:]
+            return data
         if not self._sock:
             return None
         buf = bytearray()
@@ -67,6 +235,28 @@ class EngineStream:
             buf.extend(chunk)
         return bytes(buf)
 
+    def _handshake(self) -> bool:
+        assert self._sock is not None
+        try:
+            self._sock.sendall(CLIENT_HELLO.pack(CLIENT_HELLO_MAGIC, PROTOCOL_VERSION, self._hello_flags))
+        except OSError as e:
+            self._last_error = f"hello_error: {e!s}"
+            return False
+        data = self._read_exact(SERVER_HELLO.size)
+        if data is None:
+            return False
+        magic, version, _header_bytes, rate, samples, _chan, _fmt, _qpc = SERVER_HELLO.unpack(data)
+        if magic != SERVER_HELLO_MAGIC or version < 1:
+            self._last_error = "hello_error: bad server hello"
+            return False
+        self._framed = True
+        self.sample_rate = int(rate)
+        self.frame_samples = int(samples)
+        # Feature subscribers count values per vector, not samples; their frames keep the default.
+        if not self._hello_flags & HELLO_LOG_MEL and self.sample_rate:
+            self.frame_ms = self.frame_samples * 1000 // self.sample_rate
+        return True
+
     def ensure_connected(self) -> bool:
         if self._connected and self._sock:
             return True
@@ -85,16 +275,98 @@ class EngineStream:
         if not self.ensure_connected():
             return None
 
-        data = self._read_exact(FRAME_BYTES)
+        if self._framed:
+            return self._read_framed()
+
+        data = self._read_exact(self._frame_bytes)
         if data is None:
             self._drops += 1
             self.close()
             return None
 
         self._bytes += len(data)
+        self._frames += 1
         self._last_frame_ts = time.time()
         return data
 
+    def _read_batch(self) -> bool:
+        head = self._read_exact(BATCH_HEADER.size)
+        if head is None:
+            return False
+        magic, _version, header_bytes, _count, batch_bytes = BATCH_HEADER.unpack(head)
+        if magic != BATCH_MAGIC or header_bytes < BATCH_HEADER.size:
+            self._last_error = "protocol_error: bad batch magic"
+            return False
+        if header_bytes > BATCH_HEADER.size and self._read_exact(header_bytes - BATCH_HEADER.size) is None:
+            return False
+        data = self._read_exact(batch_bytes)
+        if data is None:
+            return False
+        self._batch = memoryview(data)
+        return True
+
+    def _read_framed(self) -> Optional[bytes]:
+        if self._hello_flags >> HELLO_BATCH_SHIFT and not self._batch and not self._read_batch():
+            self.close()
+            return None
+        head = self._read_exact(FRAME_HEADER.size)
+        if head is None:
+            self.close()
+            return None
+        (magic, _version, header_bytes, seq, qpc, count, chan, fmt, flags, payload_bytes, suppressed) = (
+            FRAME_HEADER.unpack(head)
+        )
+        if magic != FRAME_MAGIC:
+            self._last_error = "protocol_error: bad frame magic"
+            self.close()
+            return None
+        extra = b""
+        if header_bytes > FRAME_HEADER.size:
+            extra = self._read_exact(header_bytes - FRAME_HEADER.size)
+            if extra is None:
+                self.close()
+                return None
+        data = self._read_exact(payload_bytes)
+        if data is None:
+            self.close()
+            return None
+
+        # Sequence gaps are exact: every missing number the VAD gate did not account for is a
+        # frame the engine dropped.
+        if self._last_seq is not None and seq > self._last_seq + 1 + suppressed:
+            self._drops += seq - self._last_seq - 1 - suppressed
+        self._last_seq = seq
+        self._latency_ms = (qpc_now_100ns() - qpc) / 10_000.0
+        self.last_info = FrameInfo(seq, qpc, count, chan, fmt, flags, suppressed, _unpack_levels(extra))
+
+        self._bytes += len(data)
+        self._frames += 1
+        self._last_frame_ts = time.time()
+        return data
+
+    def read_utterance(self) -> Optional[tuple[FrameInfo, bytes]]:
+        """
+        Reads one whole utterance: the payload of every frame from an utterance start to its end,
+        and the first frame's info. None on a disconnect, or when frames were lost mid-utterance.
+        """
+        first: Optional[FrameInfo] = None
+        parts: list[bytes] = []
+        while True:
+            data = self.read_frame()
+            info = self.last_info
+            if data is None or info is None:
+                return None
+            if info.utterance_start:
+                first = info
+                parts = []
+            elif first is None:
+                continue
+            elif info.flags & FLAG_DISCONTINUITY:
+                return None
+            parts.append(data)
+            if info.utterance_end:
+                return first, b"".join(parts)
+
     def status(self) -> StreamStats:
         last_ms = None
         if self._last_frame_ts:
@@ -106,12 +378,232 @@ class EngineStream:
             last_frame_ts=self._last_frame_ts,
             last_frame_ms=last_ms,
             last_error=self._last_error,
+            framed=self._framed,
+            frames=int(self._frames),
+            last_seq=self._last_seq,
+            capture_latency_ms=self._latency_ms,
         )
 
 
-def decode_frame_header(frame: bytes) -> tuple[int, int, bytes]:
-    if len(frame) < 12:
+def decode_frame_header(frame: bytes) -> tuple[FrameInfo, bytes]:
+    if len(frame) < FRAME_HEADER.size:
         raise ValueError("frame too short")
-    ts_ms, pcm_len = struct.unpack_from("<QI", frame, 0)
-    pcm = frame[12 : 12 + pcm_len]
-    return int(ts_ms), int(pcm_len), pcm
+    (magic, _version, header_bytes, seq, qpc, count, chan, fmt, flags, payload_bytes, suppressed) = (
+        FRAME_HEADER.unpack_from(frame, 0)
+    )
+    if magic != FRAME_MAGIC:
+        raise ValueError("bad frame magic")
+    pcm = frame[header_bytes : header_bytes + payload_bytes]
+    levels = _unpack_levels(frame[FRAME_HEADER.size : header_bytes])
+    return FrameInfo(seq, qpc, count, chan, fmt, flags, suppressed, levels), pcm
+
+
+def decode_log_mel(payload: bytes, count: int) -> list[array.array]:
+    """Splits a FORMAT_LOG_MEL payload into count rows of LOG_MEL_BINS log10 energies."""
+    values = array.array("f")
+    values.frombytes(payload[: count * LOG_MEL_BINS * 4])
+    if sys.byteorder != "little":
+        values.byteswap()
+    return [values[i * LOG_MEL_BINS : (i + 1) * LOG_MEL_BINS] for i in range(count)]
+
+
+def whisper_scale(rows: list[array.array]) -> list[list[float]]:
+    """Whisper's final log-mel scaling over a window of rows: clamp to max - 8, then (x + 4) / 4."""
+    if not rows:
+        return []
+    floor = max(max(row) for row in rows) - 8.0
+    return [[(max(x, floor) + 4.0) / 4.0 for x in row] for row in rows]
+
+
+# Shared-memory transport (engine --transport shm), see audio_engine/src/shm_transport.h.
+SHM_MAGIC = b"AESM"
+SHM_HEADER = struct.Struct("<4sHHIIIHBB")
+SHM_WRITE_INDEX_OFFSET = 64
+_FILE_MAP_READ = 0x0004
+_SYNCHRONIZE = 0x00100000
+_WAIT_OBJECT_0 = 0
+
+_kernel32 = None
+
+
+def _k32():
+    global _kernel32
+    if _kernel32 is None:
+        if sys.platform != "win32":
+            raise OSError("shared-memory transport is Windows-only")
+        from ctypes import wintypes
+
+        k32 = ctypes.WinDLL("kernel32", use_last_error=True)
+        k32.OpenFileMappingW.argtypes = [wintypes.DWORD, wintypes.BOOL, wintypes.LPCWSTR]
+        k32.OpenFileMappingW.restype = wintypes.HANDLE
+        k32.MapViewOfFile.argtypes = [wintypes.HANDLE, wintypes.DWORD, wintypes.DWORD, wintypes.DWORD, ctypes.c_size_t]
+        k32.MapViewOfFile.restype = ctypes.c_void_p
+        k32.UnmapViewOfFile.argtypes = [ctypes.c_void_p]
+        k32.OpenEventW.argtypes = [wintypes.DWORD, wintypes.BOOL, wintypes.LPCWSTR]
+        k32.OpenEventW.restype = wintypes.HANDLE
+        k32.WaitForSingleObject.argtypes = [wintypes.HANDLE, wintypes.DWORD]
+        k32.WaitForSingleObject.restype = wintypes.DWORD
+        k32.CloseHandle.argtypes = [wintypes.HANDLE]
+        _kernel32 = k32
+    return _kernel32
+
+
+class ShmEngineStream:
+    """Same interface as EngineStream, reading frames the engine publishes into a named
+    file mapping. Each frame is one memcpy out of the mapping; no socket syscalls."""
+
+    def __init__(self, name: str, label: str, retry_s: float = 10.0) -> None:
+        self._name = name
+        self._label = label
+        self._retry_s = float(retry_s)
+        self._mapping = None
+        self._event = None
+        self._view = 0
+        self._base = 0
+        self._write_index: Optional[ctypes.c_uint64] = None
+        self._slot_count = 0
+        self._slot_bytes = 0
+        self._read = 0
+        self._connected = False
+        self._bytes = 0
+        self._drops = 0
+        self._frames = 0
+        self._last_seq: Optional[int] = None
+        self._latency_ms: Optional[float] = None
+        self._last_frame_ts: Optional[float] = None
+        self._last_error = ""
+        self.sample_rate = 48000
+        self.frame_samples = FRAME_BYTES // 2
+        self.frame_ms = FRAME_MS
+        self.last_info: Optional[FrameInfo] = None
+
+    def _open(self) -> bool:
+        k32 = _k32()
+        mapping = k32.OpenFileMappingW(_FILE_MAP_READ, False, "Local\\" + self._name)
+        if not mapping:
+            self._last_error = f"shm_open_error: {ctypes.get_last_error()}"
+            return False
+        base = k32.MapViewOfFile(mapping, _FILE_MAP_READ, 0, 0, 0)
+        if not base:
+            self._last_error = f"shm_map_error: {ctypes.get_last_error()}"
+            k32.CloseHandle(mapping)
+            return False
+        magic, _version, header_bytes, slots, slot_bytes, rate, samples, _chan, _fmt = SHM_HEADER.unpack(
+            ctypes.string_at(base, SHM_HEADER.size)
+        )
+        event = k32.OpenEventW(_SYNCHRONIZE, False, "Local\\" + self._name + "_ready")
+        if magic != SHM_MAGIC or not event:
+            self._last_error = "shm_open_error: mapping not ready"
+            k32.UnmapViewOfFile(base)
+            k32.CloseHandle(mapping)
+            if event:
+                k32.CloseHandle(event)
+            return False
+        self._mapping, self._event = mapping, event
+        self._base = base + header_bytes
+        self._write_index = ctypes.c_uint64.from_address(base + SHM_WRITE_INDEX_OFFSET)
+        self._view = base
+        self._slot_count = int(slots)
+        self._slot_bytes = int(slot_bytes)
+        self.sample_rate = int(rate)
+        self.frame_samples = int(samples)
+        if self.sample_rate:
+            self.frame_ms = self.frame_samples * 1000 // self.sample_rate
+        self._read = int(self._write_index.value)
+        self._last_seq = None
+        self._connected = True
+        self._last_error = ""
+        return True
+
+    def ensure_connected(self) -> bool:
+        if self._connected:
+            return True
+        deadline = time.time() + self._retry_s
+        while time.time() < deadline:
+            if self._open():
+                return True
+            time.sleep(0.1)
+        return False
+
+    def close(self) -> None:
+        if self._connected:
+            k32 = _k32()
+            k32.UnmapViewOfFile(self._view)
+            k32.CloseHandle(self._mapping)
+            k32.CloseHandle(self._event)
+        self._mapping = None
+        self._event = None
+        self._connected = False
+
+    def read_frame(self) -> Optional[bytes]:
+        if not self.ensure_connected():
+            return None
+
+        write = int(self._write_index.value)
+        if write == self._read:
+            if _k32().WaitForSingleObject(self._event, 1000) != _WAIT_OBJECT_0:
+                return None
+            write = int(self._write_index.value)
+            if write == self._read:
+                return None
+        if write - self._read >= self._slot_count:
+            # Fell a whole ring behind; resume at the oldest slot that is still intact.
+            self._read = write - self._slot_count + 1
+
+        slot = self._base + (self._read % self._slot_count) * self._slot_bytes
+        head = ctypes.string_at(slot, FRAME_HEADER.size)
+        (_, _version, header_bytes, seq, qpc, count, chan, fmt, flags, payload_bytes, suppressed) = (
+            FRAME_HEADER.unpack(head)
+        )
+        extra = ctypes.string_at(slot + FRAME_HEADER.size, max(0, header_bytes - FRAME_HEADER.size))
+        data = ctypes.string_at(slot + header_bytes, payload_bytes)
+        # The writer reuses this slot once it publishes index read + slot_count.
+        overwritten = int(self._write_index.value) - self._read >= self._slot_count
+        self._read += 1
+        if overwritten:
+            return None
+
+        if self._last_seq is not None and seq > self._last_seq + 1 + suppressed:
+            self._drops += seq - self._last_seq - 1 - suppressed
+        self._last_seq = seq
+        self._latency_ms = (qpc_now_100ns() - qpc) / 10_000.0
+        self.last_info = FrameInfo(seq, qpc, count, chan, fmt, flags, suppressed, _unpack_levels(extra))
+
+        self._bytes += len(data)
+        self._frames += 1
+        self._last_frame_ts = time.time()
+        return data
+
+    def status(self) -> StreamStats:
+        last_ms = None
+        if self._last_frame_ts:
+            last_ms = int((time.time() - self._last_frame_ts) * 1000)
+        return StreamStats(
+            connected=bool(self._connected),
+            bytes=int(self._bytes),
+            drops=int(self._drops),
+            last_frame_ts=self._last_frame_ts,
+            last_frame_ms=last_ms,
+            last_error=self._last_error,
+            framed=True,
+            frames=int(self._frames),
+            last_seq=self._last_seq,
+            capture_latency_ms=self._latency_ms,
+        )
+
+
+def shm_available(name: str) -> bool:
+    stream = ShmEngineStream(name, name, retry_s=0.0)
+    try:
+        ok = stream._open()
+    except OSError:
+        return False
+    stream.close()
+    return ok
+
+
+def split_stereo(pcm: bytes) -> tuple[bytes, bytes]:
+    """Splits a --mux-layout stereo frame into (mic, loop) mono int16 PCM."""
+    samples = array.array("h")
+    samples.frombytes(pcm[: len(pcm) - (len(pcm) % 4)])
+    return samples[0::2].tobytes(), samples[1::2].tobytes()
@@ -100,10 +100,16 @@ def _run_coach_if_available():
 
 def _on_text(speaker: str, text: str):
     _append_turn(speaker, text)
+    # With engine turn events the coach runs once per utterance instead (see _on_turn).
+    if not audio_controller.turn_events:
+        _run_coach_if_available()
+
+
+def _on_turn(speaker: str, utterance: dict):
     _run_coach_if_available()
 
 
-audio_controller = DualAudioController(on_text=_on_text)
+audio_controller = DualAudioController(on_text=_on_text, on_turn=_on_turn)
 
 
 @app.get("/", response_class=HTMLResponse)
@@ -0,0 +1,63 @@
+from __future__ import annotations
+
+import struct
+
+# Minimal Ogg Opus muxer (RFC 7845) for engine --codec opus packets. Deepgram and most ASR
+# APIs accept Ogg Opus as a container without any encoding/sample_rate query parameters.
+
+_PAGE_HEADER = struct.Struct("<4sBBqIIIB")
+_OPUS_HEAD = struct.Struct("<8sBBHIhB")
+# libopus encoder lookahead at 48 kHz; decoders discard this many samples at stream start.
+_PRE_SKIP = 312
+
+
+def _crc_table() -> list[int]:
+    table = []
+    for i in range(256):
+        r = i << 24
+        for _ in range(8):
+            r = ((r << 1) ^ 0x04C11DB7) if r & 0x80000000 else (r << 1)
+        table.append(r & 0xFFFFFFFF)
+    return table
+
+
+_CRC_TABLE = _crc_table()
+
+
+def _ogg_crc(data: bytes) -> int:
+    crc = 0
+    for b in data:
+        crc = ((crc << 8) & 0xFFFFFFFF) ^ _CRC_TABLE[((crc >> 24) & 0xFF) ^ b]
+    return crc
+
+
+class OggOpusMuxer:
+    """Wraps one Opus packet per engine frame into its own Ogg page.
+
+    One muxer per output stream (e.g. per Deepgram websocket); call header() first."""
+
+    def __init__(self, sample_rate: int, channels: int = 1, serial: int = 0x41455346) -> None:
+        self._sample_rate = int(sample_rate)
+        self._channels = int(channels)
+        self._serial = serial
+        self._sequence = 0
+        # Granule positions always count 48 kHz samples, whatever the input rate.
+        self._granule = 0
+
+    def _page(self, packet: bytes, header_type: int, granule: int) -> bytes:
+        lacing = [255] * (len(packet) // 255) + [len(packet) % 255]
+        head = _PAGE_HEADER.pack(b"OggS", 0, header_type, granule, self._serial, self._sequence, 0, len(lacing))
+        page = bytearray(head + bytes(lacing) + packet)
+        struct.pack_into("<I", page, 22, _ogg_crc(bytes(page)))
+        self._sequence += 1
+        return bytes(page)
+
+    def header(self) -> bytes:
+        head = _OPUS_HEAD.pack(b"OpusHead", 1, self._channels, _PRE_SKIP, self._sample_rate, 0, 0)
+        vendor = b"audio_engine"
+        tags = b"OpusTags" + struct.pack("<I", len(vendor)) + vendor + struct.pack("<I", 0)
+        return self._page(head, 0x02, 0) + self._page(tags, 0x00, 0)
+
+    def packet(self, data: bytes, sample_count: int) -> bytes:
+        self._granule += int(sample_count) * 48000 // self._sample_rate
+        return self._page(data, 0x00, self._granule)